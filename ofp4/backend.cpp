@@ -14,19 +14,29 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <limits>
 #include <vector>
 #include <map>
+#include <set>
+#include <sstream>
+#include <tuple>
 
 #include "backend.h"
 #include "ofvisitors.h"
 #include "ir/ir.h"
+#include "lib/json.h"
 #include "lib/sourceCodeBuilder.h"
 #include "lib/nullstream.h"
 #include "frontends/p4/evaluator/evaluator.h"
 #include "frontends/p4/methodInstance.h"
 #include "frontends/p4/evaluator/substituteParameters.h"
 #include "frontends/p4/parameterSubstitution.h"
+#include "lower.h"
 #include "resources.h"
+#include "registerAllocator.h"
 
 namespace OFP4 {
 
@@ -382,18 +392,115 @@ class ActionTranslator : public Inspector {
     }
 };
 
-static const IR::DDlogAtom* makeFlowAtom(const IR::OF_MatchAndAction* value) {
-    auto opt = value->apply(OpenFlowSimplify());
+/// Returns the table matched by 'match'.
+static size_t getTableId(const IR::OF_Match* match) {
+    if (auto tm = match->to<IR::OF_TableMatch>())
+        return tm->id;
+    if (auto sm = match->to<IR::OF_SeqMatch>()) {
+        for (auto m : sm->matches)
+            if (auto tm = m->to<IR::OF_TableMatch>())
+                return tm->id;
+    }
+    BUG("%1%: no table match", match);
+}
+
+/// Returns the name of the relation for the flows of OpenFlow table
+/// 'table'.
+static cstring flowRelation(const OFP4Program* model, size_t table) {
+    cstring name = model->structuredFlows ? "StructuredFlow" : "Flow";
+    if (model->perTableFlows)
+        name += "_" + Util::toString(table);
+    return name;
+}
+
+/// Simplifies 'flowRule' for output and records what it matches.
+static const IR::OF_MatchAndAction* optimizeFlow(const OFP4Program* model,
+                                                 const IR::OF_MatchAndAction* flowRule) {
+    size_t table = getTableId(flowRule->match);
+    auto opt = flowRule->apply(OpenFlowSimplify())->apply(OpenFlowPeephole())
+            ->apply(UseGotoTable(table));
+    if (model->registerWrites)
+        opt = opt->apply(NarrowRegisterMatches(*model->registerWrites));
+    auto result = opt->checkedTo<IR::OF_MatchAndAction>();
+    if (model->megaflow)
+        model->megaflow->addMatch(table, result->match);
+    return result;
+}
+
+static const IR::DDlogAtom* makeFlowAtom(const OFP4Program* model,
+                                         const IR::OF_MatchAndAction* value) {
+    auto opt = optimizeFlow(model, value);
+    cstring relation = flowRelation(model, getTableId(opt->match));
+    if (model->structuredFlows) {
+        OpenFlowStructuredPrint ofp;
+        opt->apply(ofp);
+        return new IR::DDlogAtom(relation, new IR::DDlogTupleExpression({
+                    new IR::DDlogLiteral(ofp.getTable()),
+                    new IR::DDlogLiteral(ofp.getPriority()),
+                    new IR::DDlogLiteral(ofp.getMatches()),
+                    new IR::DDlogLiteral(ofp.getActions()),
+                    new IR::DDlogLiteral(ofp.getCookie())}));
+    }
     auto str = new IR::DDlogStringLiteral(OpenFlowPrint::toString(opt));
-    auto atom = new IR::DDlogAtom("Flow", new IR::DDlogTupleExpression({str}));
+    auto atom = new IR::DDlogAtom(relation, new IR::DDlogTupleExpression({str}));
     return atom;
 }
 
-// Make a rule that contain a single atom.
-static IR::DDlogRule* makeFlowRule(const IR::OF_MatchAndAction* flowRule, cstring comment) {
-    auto atom = makeFlowAtom(flowRule);
-    auto rule = new IR::DDlogRule(atom, {}, comment);
-    return rule;
+/// Returns a DDlog expression for the OpenFlow actions in 'action':
+/// a string, or a Vec<of_action_t> for structured flows.
+static const IR::DDlogExpression* makeActions(const OFP4Program* model,
+                                              const IR::OF_Action* action) {
+    if (model->structuredFlows)
+        return new IR::DDlogLiteral(OpenFlowStructuredPrint::actionsToString(action));
+    return new IR::DDlogStringLiteral(OpenFlowPrint::toString(action));
+}
+
+/// Adds a flow that does not depend on any DDlog relation.  The flow
+/// becomes a rule with an empty body, unless the flow is constant and
+/// static flows are written separately.
+static void addFlowRule(OFP4Program* model, IR::Vector<IR::Node>* declarations,
+                        const IR::OF_MatchAndAction* flowRule, cstring comment) {
+    if (model->separateStaticFlows && IsStaticFlow::check(flowRule)) {
+        auto opt = optimizeFlow(model, flowRule);
+        if (!comment.isNullOrEmpty())
+            model->staticFlows.push_back("# " + comment);
+        model->staticFlows.push_back(OpenFlowPrint::toStaticString(opt));
+        return;
+    }
+    auto atom = makeFlowAtom(model, flowRule);
+    declarations->push_back(new IR::DDlogRule(atom, {}, comment));
+}
+
+/// Counts the flows that the declarations from 'firstDecl' onward and
+/// the static flows of 'model' from 'firstStatic' onward produce.  A
+/// flow rule with an empty body and a static flow are one flow each,
+/// in 'fixed'; a flow rule that joins relations produces a flow for
+/// each row of the first of them, so 'joins' counts these rules by
+/// that relation.
+static void countFlows(const OFP4Program* model, const IR::Vector<IR::Node>* declarations,
+                       size_t firstDecl, size_t firstStatic,
+                       size_t& fixed, std::map<cstring, size_t>& joins) {
+    cstring flows = model->structuredFlows ? "StructuredFlow" : "Flow";
+    fixed = 0;
+    for (size_t i = firstDecl; i < declarations->size(); i++) {
+        auto rule = declarations->at(i)->to<IR::DDlogRule>();
+        auto head = rule ? rule->lhs->to<IR::DDlogAtom>() : nullptr;
+        if (!head || (head->relation.name != flows &&
+                      !head->relation.name.startsWith(flows + "_")))
+            continue;
+        const IR::DDlogAtom* first = nullptr;
+        for (auto term : rule->rhs) {
+            if ((first = term->to<IR::DDlogAtom>()))
+                break;
+        }
+        if (first)
+            joins[first->relation.name]++;
+        else
+            fixed++;
+    }
+    for (size_t i = firstStatic; i < model->staticFlows.size(); i++)
+        if (!model->staticFlows.at(i).startsWith("#"))
+            fixed++;
 }
 
 static cstring makeId(cstring name) {
@@ -418,6 +525,109 @@ static bool tableHasPriority(const IR::P4Table* table) {
     return false;
 }
 
+/// Returns the direct_counter named by the 'counters' property of
+/// 'table', or nullptr if the table has no counters.
+static const IR::Declaration_Instance* directCounter(P4::ReferenceMap* refMap,
+                                                     const IR::P4Table* table) {
+    auto prop = table->properties->getProperty("counters");
+    if (!prop)
+        return nullptr;
+    const IR::Declaration_Instance* counter = nullptr;
+    if (auto ev = prop->value->to<IR::ExpressionValue>()) {
+        if (auto pe = ev->expression->to<IR::PathExpression>())
+            counter = refMap->getDeclaration(pe->path, true)->to<IR::Declaration_Instance>();
+    }
+    auto type = counter ? counter->type->to<IR::Type_Name>() : nullptr;
+    if (!type || type->path->name != "direct_counter") {
+        ::error(ErrorType::ERR_EXPECTED, "%1%: expected a direct_counter", prop);
+        return nullptr;
+    }
+    return counter;
+}
+
+/// Returns the action_selector named by the 'implementation' property
+/// of 'table', or nullptr if the table has none.
+static const IR::Declaration_Instance* actionSelector(P4::ReferenceMap* refMap,
+                                                      const IR::P4Table* table) {
+    auto prop = table->properties->getProperty("implementation");
+    if (!prop)
+        return nullptr;
+    const IR::Declaration_Instance* selector = nullptr;
+    if (auto ev = prop->value->to<IR::ExpressionValue>()) {
+        if (auto pe = ev->expression->to<IR::PathExpression>())
+            selector = refMap->getDeclaration(pe->path, true)->to<IR::Declaration_Instance>();
+    }
+    auto type = selector ? selector->type->to<IR::Type_Name>() : nullptr;
+    if (!type || type->path->name != "action_selector") {
+        ::error(ErrorType::ERR_EXPECTED, "%1%: expected an action_selector", prop);
+        return nullptr;
+    }
+    return selector;
+}
+
+static cstring keyName(const IR::KeyElement* ke) {
+    return ke->annotations->getSingle(IR::Annotation::nameAnnotation)->getSingleString();
+}
+
+static size_t keyWidth(P4::TypeMap* typeMap, const IR::KeyElement* ke) {
+    auto type = typeMap->getType(ke->expression, true);
+    return typeMap->widthBits(type, ke->expression, true);
+}
+
+/// Returns the lpm key of 'table' if all its other keys are exact.  In
+/// that case the control plane does not supply priorities; the flows
+/// are prioritized by prefix length instead.
+static const IR::KeyElement* lpmPriorityKey(const IR::P4Table* table) {
+    auto key = table->getKey();
+    if (!key)
+        return nullptr;
+    const IR::KeyElement* result = nullptr;
+    for (auto ke : key->keyElements) {
+        auto match = ke->matchType->path->name.name;
+        if (match == "lpm" && !result)
+            result = ke;
+        else if (match != "exact")
+            return nullptr;
+    }
+    return result;
+}
+
+static bool
+defaultActionIsConstant(const IR::P4Table* p4table)
+{
+    auto daprop = p4table->properties->getProperty(
+        IR::TableProperties::defaultActionPropertyName);
+    CHECK_NULL(daprop);
+    return daprop->isConstant;
+}
+
+/// True if all the flows of 'table' are known at compile time: it has
+/// no key or its entries are 'const entries', and its default action is
+/// constant.  Such a table gets no DDlog relations; its flows are
+/// generated directly, as static flows.
+static bool isConstantTable(const IR::P4Table* table) {
+    if (!defaultActionIsConstant(table))
+        return false;
+    if (table->getKey()) {
+        auto entries = table->properties->getProperty(
+            IR::TableProperties::entriesPropertyName);
+        if (!entries || !entries->isConstant)
+            return false;
+    }
+    // A range key may need several flows per entry, which DDlog
+    // computes.
+    if (auto key = table->getKey()) {
+        for (auto ke : key->keyElements)
+            if (ke->matchType->path->name.name == "range")
+                return false;
+    }
+    // Counters, selectors and conjunctions take their ids from the
+    // runtime.
+    return !table->properties->getProperty("counters") &&
+            !table->properties->getProperty("implementation") &&
+            !table->getAnnotation("of_conjunction");
+}
+
 /// Generates code for DDlog declarations.
 class DeclarationGenerator : public Inspector {
     OFP4Program* model;
@@ -426,6 +636,8 @@ class DeclarationGenerator : public Inspector {
     IR::Vector<IR::Type> *defaultActions;
     cstring tableName;
     ActionTranslator *actionTranslator;
+    /// The table that uses each action selector.
+    std::map<const IR::Declaration_Instance*, const IR::P4Table*> selectorTables;
 
  public:
     DeclarationGenerator(OFP4Program* model, IR::Vector<IR::Node> *declarations):
@@ -435,30 +647,71 @@ class DeclarationGenerator : public Inspector {
     }
 
     Visitor::profile_t init_apply(const IR::Node* node) override {
-        // Declare 'Flow' relation
-        declarations->push_back(new IR::DDlogRelationDirect(
-            IR::ID("Flow"), IR::Direction::Out, new IR::Type_Name("flow_t")));
-
-        // Declare 'Flow' index
-        auto params = new IR::IndexedVector<IR::Parameter>();
-        auto param = new IR::Parameter("s", IR::Direction::None, new IR::DDlogTypeString());
-        params->push_back(param);
-        auto formals = new std::vector<IR::ID>();
-        formals->push_back("s");
-        declarations->push_back(new IR::DDlogIndex(IR::ID("Flow"), *params, "Flow", *formals));
+        if (model->perTableFlows) {
+            // One relation per OpenFlow table, including table 0, which
+            // may only jump to the first ingress table.
+            std::set<size_t> tables = { 0 };
+            for (auto node : model->nodes)
+                tables.insert(node->id);
+            for (auto table : tables)
+                declareFlowRelation(flowRelation(model, table));
+        } else {
+            declareFlowRelation(flowRelation(model, 0));
+        }
 
         // Declare 'MulticastGroup' relation
         declarations->push_back(new IR::DDlogRelationDirect(
             IR::ID("MulticastGroup"), IR::Direction::In, new IR::Type_Name("multicast_group_t")));
 
-        // TODO: maybe this table should be removed
-        auto flowRule = new IR::OF_MatchAndAction(
-            new IR::OF_TableMatch(0),
-            new IR::OF_ResubmitAction(model->startIngressId));
-        declarations->push_back(makeFlowRule(flowRule, "initialize output port and output group"));
+        // Declare 'ActionProfileBucket' relation, from which the runtime
+        // builds the select groups of action selectors.
+        declarations->push_back(new IR::DDlogRelationDirect(
+            IR::ID("ActionProfileBucket"), IR::Direction::Out,
+            new IR::Type_Name("action_profile_bucket_t")));
+
+        // Declare 'MulticastBucket' relation, from which the runtime
+        // builds the groups for multicast.
+        if (model->multicastGroups)
+            declarations->push_back(new IR::DDlogRelationDirect(
+                IR::ID("MulticastBucket"), IR::Direction::Out,
+                new IR::Type_Name("multicast_bucket_t")));
         return Inspector::init_apply(node);
     }
 
+    /// Declares the output relation 'name' for flows, and its index.
+    void declareFlowRelation(cstring name) {
+        if (model->structuredFlows) {
+            // Declare 'StructuredFlow' relation and its index
+            declarations->push_back(new IR::DDlogRelationDirect(
+                IR::ID(name), IR::Direction::Out,
+                new IR::Type_Name("structured_flow_t")));
+            auto params = new IR::IndexedVector<IR::Parameter>();
+            auto formals = new std::vector<IR::ID>();
+            for (auto field : { std::make_pair("table", "bit<8>"),
+                                std::make_pair("priority", "bit<16>"),
+                                std::make_pair("matches", "Vec<of_field_t>"),
+                                std::make_pair("actions", "Vec<of_action_t>"),
+                                std::make_pair("cookie", "bit<64>") }) {
+                params->push_back(new IR::Parameter(
+                    field.first, IR::Direction::None, new IR::Type_Name(field.second)));
+                formals->push_back(field.first);
+            }
+            declarations->push_back(new IR::DDlogIndex(IR::ID(name), *params, name, *formals));
+        } else {
+            // Declare 'Flow' relation
+            declarations->push_back(new IR::DDlogRelationDirect(
+                IR::ID(name), IR::Direction::Out, new IR::Type_Name("flow_t")));
+
+            // Declare 'Flow' index
+            auto params = new IR::IndexedVector<IR::Parameter>();
+            auto param = new IR::Parameter("s", IR::Direction::None, new IR::DDlogTypeString());
+            params->push_back(param);
+            auto formals = new std::vector<IR::ID>();
+            formals->push_back("s");
+            declarations->push_back(new IR::DDlogIndex(IR::ID(name), *params, name, *formals));
+        }
+    }
+
     bool preorder(const IR::Type_Typedef* tdef) override {
         auto trans = new IR::DDlogTypedef(tdef->name, tdef->type);
         declarations->push_back(trans);
@@ -506,6 +759,10 @@ class DeclarationGenerator : public Inspector {
     }
 
     void postorder(const IR::P4Table* table) override {
+        if (isConstantTable(table)) {
+            tableName = "";
+            return;
+        }
         cstring typeName = tableName + "Action";
 
         auto key = table->getKey();
@@ -520,25 +777,59 @@ class DeclarationGenerator : public Inspector {
             // Parameters of the corresponding P4Runtime relation
             auto params = new IR::IndexedVector<IR::Parameter>();
             // Arguments of a tuple expression
+            size_t lpmKeys = 0;
             for (auto ke : key->keyElements) {
                 auto type = model->typeMap->getType(ke->expression, true);
-                auto match = ke->matchType;
-                if (match->path->name.name == "optional") {
+                auto match = ke->matchType->path->name.name;
+                if (match == "optional") {
                     type = new IR::DDlogTypeOption(type);
+                } else if (match == "ternary" || match == "range") {
+                    // value and mask, or low and high value
+                    type = new IR::DDlogTypeTuple(IR::Vector<IR::Type>({type, type}));
+                } else if (match == "lpm") {
+                    // value and prefix length
+                    type = new IR::DDlogTypeTuple(
+                        IR::Vector<IR::Type>({type, IR::Type_Bits::get(32)}));
+                    if (++lpmKeys > 1)
+                        ::error(ErrorType::ERR_UNSUPPORTED_ON_TARGET,
+                                "%1%: a table can have at most one lpm key", ke);
                 }
-                auto name = ke->annotations->getSingle(
-                    IR::Annotation::nameAnnotation)->getSingleString();
-                auto param = new IR::Parameter(ke->srcInfo, name, IR::Direction::None, type);
+                auto param = new IR::Parameter(ke->srcInfo, keyName(ke), IR::Direction::None, type);
                 params->push_back(param);
             }
             if (hasPriority)
                 params->push_back(new IR::Parameter(
                     "priority", IR::Direction::None, IR::Type_Bits::get(32)));
-            params->push_back(new IR::Parameter(
-                "action", IR::Direction::None, new IR::Type_Name(typeName)));
+            if (auto selector = actionSelector(model->refMap, table)) {
+                // Entries name a group, which the runtime turns into an
+                // OpenFlow group id; the actions are in the members.
+                declareSelector(selector, table, typeName);
+                params->push_back(new IR::Parameter(
+                    "of_group", IR::Direction::None, IR::Type_Bits::get(32)));
+            } else {
+                params->push_back(new IR::Parameter(
+                    "action", IR::Direction::None, new IR::Type_Name(typeName)));
+            }
+            // The runtime gives each entry of a table with direct
+            // counters an id, which becomes part of its flows' cookies.
+            if (directCounter(model->refMap, table))
+                params->push_back(new IR::Parameter(
+                    "counter_id", IR::Direction::None, IR::Type_Bits::get(32)));
+            // The runtime gives the entries of a table with
+            // @of_conjunction that have the same action and priority the
+            // id of their OVS conjunction.
+            if (table->getAnnotation("of_conjunction"))
+                params->push_back(new IR::Parameter(
+                    "conj_id", IR::Direction::None, IR::Type_Bits::get(32)));
             auto rel = new IR::DDlogRelationSugared(
                 table->srcInfo, IR::ID(tableName), IR::Direction::In, *params);
             declarations->push_back(rel);
+        } else if (directCounter(model->refMap, table)) {
+            ::error(ErrorType::ERR_UNSUPPORTED_ON_TARGET,
+                    "%1%: direct counters require a table with a key", table);
+        } else if (actionSelector(model->refMap, table)) {
+            ::error(ErrorType::ERR_UNSUPPORTED_ON_TARGET,
+                    "%1%: action selectors require a table with a key", table);
         }
 
         auto defaultAction = table->getDefaultAction();
@@ -561,6 +852,36 @@ class DeclarationGenerator : public Inspector {
 
         tableName = "";
     }
+
+    /// Declares the relation of the members of 'selector', used by
+    /// 'table' whose actions have type 'typeName'.
+    void declareSelector(const IR::Declaration_Instance* selector, const IR::P4Table* table,
+                         cstring typeName) {
+        auto it = selectorTables.emplace(selector, table).first;
+        if (it->second != table) {
+            ::error(ErrorType::ERR_UNSUPPORTED_ON_TARGET,
+                    "%1%: action selector used by %2% and %3%; it can only be used by one table",
+                    selector, it->second, table);
+            return;
+        }
+        if (model->structuredFlows)
+            ::error(ErrorType::ERR_UNSUPPORTED_ON_TARGET,
+                    "%1%: action selectors are not supported with structured flows", selector);
+        if (table->getEntries())
+            ::error(ErrorType::ERR_UNSUPPORTED_ON_TARGET,
+                    "%1%: a table with an action selector cannot have constant entries", table);
+        if (table->getAnnotation("of_conjunction"))
+            ::error(ErrorType::ERR_UNSUPPORTED_ON_TARGET,
+                    "%1%: action selectors are not supported with @of_conjunction", table);
+
+        auto params = new IR::IndexedVector<IR::Parameter>();
+        params->push_back(new IR::Parameter(
+            "member_id", IR::Direction::None, IR::Type_Bits::get(32)));
+        params->push_back(new IR::Parameter(
+            "action", IR::Direction::None, new IR::Type_Name(typeName)));
+        declarations->push_back(new IR::DDlogRelationSugared(
+            selector->srcInfo, IR::ID(tableName + "Member"), IR::Direction::In, *params));
+    }
 };
 
 static CFG::Node* findActionSuccessor(
@@ -587,30 +908,271 @@ static CFG::Node* findActionSuccessor(
     return nullptr;
 }
 
-static bool
-defaultActionIsConstant(const IR::P4Table* p4table)
-{
-    auto daprop = p4table->properties->getProperty(
-        IR::TableProperties::defaultActionPropertyName);
-    CHECK_NULL(daprop);
-    return daprop->isConstant;
+/// Memoizes the translation of action bodies to OpenFlow actions.
+/// The same P4 action is often used by several tables, and by a table
+/// both as an entry action and as a default action; each is lowered
+/// and simplified only once for a given exit block and successor.
+/// The DDlog expressions for the resulting texts are placeholders that
+/// ActionSharing later turns into literals or calls of shared functions,
+/// once the uses of all the nodes are known.
+class ActionCache {
+    OFP4Program* model;
+    const IR::Vector<IR::Node>* declarations;
+    ActionTranslator* actionTranslator;
+
+    /// Translated body of (action, exit block id).
+    std::map<std::pair<const IR::P4Action*, size_t>, const IR::OF_Action*> bodies;
+    /// DDlog text of the simplified actions for
+    /// (action, exit block id, table id, successor id).
+    std::map<std::tuple<const IR::P4Action*, size_t, size_t, size_t>, cstring> texts;
+
+ public:
+    size_t hits = 0;
+
+    /// A use of 'text', computed by 'action', that a CFG node needs
+    /// 'uses' times, through placeholder 'site', in the declaration at
+    /// 'position' in the declarations of the cache or a later one.
+    /// 'name' names the function that computes the text if it is shared.
+    struct Use {
+        cstring text;
+        const IR::P4Action* action;
+        size_t uses;
+        cstring name;
+        const IR::DDlogLiteral* site;
+        size_t position;
+    };
+    /// The uses since the last call of takeUses(), in order.
+    std::vector<Use> uses;
+
+    ActionCache(OFP4Program* model, const IR::Vector<IR::Node>* declarations,
+                ActionTranslator* actionTranslator):
+            model(model), declarations(declarations), actionTranslator(actionTranslator) {
+        CHECK_NULL(model); CHECK_NULL(declarations); CHECK_NULL(actionTranslator);
+    }
+
+    /// Returns the OpenFlow actions of 'action' in the table with id
+    /// 'tableId', followed by a jump to 'successor'.
+    cstring translate(const IR::P4Action* action, size_t exitBlockId,
+                      size_t tableId, size_t successor) {
+        auto key = std::make_tuple(action, exitBlockId, tableId, successor);
+        auto it = texts.find(key);
+        if (it != texts.end()) {
+            hits++;
+            return it->second;
+        }
+
+        auto bodyKey = std::make_pair(action, exitBlockId);
+        auto bit = bodies.find(bodyKey);
+        if (bit == bodies.end()) {
+            auto body = actionTranslator->translate(action->body, false, exitBlockId);
+            bit = bodies.emplace(bodyKey, body->checkedTo<IR::OF_Action>()).first;
+        } else {
+            hits++;
+        }
+        const IR::OF_Action* result = new IR::OF_SeqAction(
+            bit->second, new IR::OF_ResubmitAction(successor));
+        auto opt = result->apply(OpenFlowSimplify())->apply(OpenFlowPeephole())
+                ->apply(UseGotoTable(tableId));
+        result = opt->checkedTo<IR::OF_Action>();
+        cstring text = model->structuredFlows ?
+                OpenFlowStructuredPrint::actionsToString(result) :
+                cstring("\"") + OpenFlowPrint::toString(result).escapeJson() + "\"";
+        texts.emplace(key, text);
+        return text;
+    }
+
+    /// Returns a DDlog expression for 'text', computed by 'action' and
+    /// needed 'uses' times by the caller.  'name' names the function
+    /// that is created if the text is shared; it must be unique to the
+    /// CFG node that uses it.
+    const IR::DDlogExpression* expression(cstring text, const IR::P4Action* action,
+                                          size_t uses, cstring name) {
+        auto site = new IR::DDlogLiteral(text);
+        this->uses.push_back({ text, action, uses, name, site, declarations->size() });
+        return site;
+    }
+
+    /// Makes 'declarations' the vector in which the DDlog expressions go.
+    void setDeclarations(const IR::Vector<IR::Node>* declarations) {
+        this->declarations = declarations;
+    }
+
+    /// Returns the uses recorded so far and forgets them.
+    std::vector<Use> takeUses() {
+        std::vector<Use> result;
+        result.swap(uses);
+        return result;
+    }
+};
+
+/// Decides which texts of the action caches to share, and appends the
+/// declarations that use them to a DDlog program.  A text that is used
+/// more than once, counting the uses of all the declarations added, is
+/// emitted once, before its first use, as a DDlog function of the
+/// parameters of its action, and all its uses call the function.  The
+/// others stay literals.
+class ActionSharing : public Transform {
+    typedef std::pair<cstring, const IR::P4Action*> Key;
+
+    OFP4Program* model;
+    IR::Vector<IR::Node>* declarations;
+
+    /// Declarations added by add(), with the uses of their texts.
+    std::vector<std::pair<const IR::Vector<IR::Node>*, std::vector<ActionCache::Use>>> batches;
+    /// Number of uses of each text, by the action that computes it.  The
+    /// action is part of the key because a function takes the parameters
+    /// of the action that it was made for.
+    std::map<Key, size_t> counts;
+    /// Function that computes each text used more than once, once declared.
+    std::map<Key, cstring> functions;
+    /// The calls that replace the placeholders of shared texts.
+    std::map<const IR::Node*, const IR::DDlogExpression*> calls;
+
+    /// Makes 'use' call the function for its text if the text is shared,
+    /// declaring the function if this is its first use.
+    void share(const ActionCache::Use& use) {
+        auto key = std::make_pair(use.text, use.action);
+        if (counts.at(key) < 2)
+            return;
+        auto fit = functions.find(key);
+        if (fit == functions.end()) {
+            fit = functions.emplace(key, use.name).first;
+            auto params = new IR::IndexedVector<IR::Parameter>();
+            for (auto p : use.action->parameters->parameters)
+                params->push_back(new IR::Parameter(p->name, IR::Direction::None, p->type));
+            const IR::Type* type = model->structuredFlows ?
+                    static_cast<const IR::Type*>(new IR::Type_Name("Vec<of_action_t>")) :
+                    new IR::DDlogTypeString();
+            declarations->push_back(new IR::DDlogFunction(
+                IR::ID(fit->second), type, new IR::ParameterList(*params),
+                new IR::DDlogLiteral(use.text)));
+        }
+
+        cstring call = fit->second + "(";
+        bool first = true;
+        for (auto p : use.action->parameters->parameters) {
+            if (!first)
+                call += ", ";
+            first = false;
+            call += p->name;
+        }
+        calls.emplace(use.site, new IR::DDlogLiteral(call + ")"));
+    }
+
+ public:
+    ActionSharing(OFP4Program* model, IR::Vector<IR::Node>* declarations):
+            model(model), declarations(declarations) {
+        setName("ActionSharing");
+        CHECK_NULL(model); CHECK_NULL(declarations);
+    }
+
+    const IR::Node* postorder(IR::DDlogLiteral* literal) override {
+        auto it = calls.find(getOriginal());
+        return it == calls.end() ? literal : it->second;
+    }
+
+    /// Adds 'generated', whose action texts are the placeholders of
+    /// 'uses', to the declarations that finish() appends.
+    void add(const IR::Vector<IR::Node>* generated, std::vector<ActionCache::Use> uses) {
+        for (auto& use : uses)
+            counts[std::make_pair(use.text, use.action)] += use.uses;
+        batches.emplace_back(generated, std::move(uses));
+    }
+
+    /// Appends the declarations added so far, in order.
+    void finish() {
+        for (auto& batch : batches) {
+            auto& generated = *batch.first;
+            auto use = batch.second.begin();
+            for (size_t i = 0; i < generated.size(); i++) {
+                for (; use != batch.second.end() && use->position == i; ++use)
+                    share(*use);
+                declarations->push_back(generated.at(i)->apply(*this));
+            }
+        }
+        batches.clear();
+    }
+};
+
+/// Returns the source text of 'node', or its IR text if the midend
+/// made it up.
+static cstring sourceText(const IR::Node* node) {
+    if (node->srcInfo.isValid())
+        return node->srcInfo.toBriefSourceFragment();
+    return node->toString();
+}
+
+/// Keys each if statement of a control by the source of its condition,
+/// prefixed by the key of the enclosing if and the branch it is in.
+/// Unlike the conditions that the midend rewrites, these do not depend
+/// on the numbering of the midend's temporaries or on source lines.
+class IfKeys : public Inspector {
+ public:
+    std::map<const IR::IfStatement*, cstring> keys;
+
+    bool preorder(const IR::IfStatement* statement) override {
+        cstring key = sourceText(statement->condition);
+        const IR::Node* child = statement;
+        for (auto ctx = getContext(); ctx; ctx = ctx->parent) {
+            if (auto parent = ctx->node->to<IR::IfStatement>()) {
+                auto branch = parent->ifTrue == child ? " then " : " else ";
+                key = keys.at(parent) + branch + key;
+                break;
+            }
+            child = ctx->node;
+        }
+        keys.emplace(statement, key);
+        return true;
+    }
+};
+
+/// Returns a key that identifies 'node' of 'cfg' across compilations,
+/// as long as the node itself does not change.  'ifKeys' are the keys
+/// of the if statements of 'cfg'.
+static cstring stableNodeKey(const CFG& cfg, const IfKeys& ifKeys, const CFG::Node* node) {
+    cstring control = cfg.container->externalName();
+    if (auto tn = node->to<CFG::TableNode>())
+        return control + " table " + tn->table->controlPlaneName();
+    if (auto in = node->to<CFG::IfNode>()) {
+        auto it = ifKeys.keys.find(in->statement);
+        if (it != ifKeys.keys.end())
+            return control + " if " + it->second;
+        return control + " if " + sourceText(in->statement->condition);
+    }
+    if (node == cfg.exitPoint)
+        return control + " exit";
+    return control + " " + node->name;
 }
 
 /// Generates DDlog Flow rules
 class FlowGenerator : public Inspector {
     OFP4Program* model;
+    /// Declarations of the nodes generated since the last flush().
     IR::Vector<IR::Node>* declarations;
     ActionTranslator* actionTranslator;
-    size_t exitBlockId;
+    ActionCache* actionCache;
+    /// Appends the declarations to the DDlog program.
+    ActionSharing* sharing;
+    size_t exitBlockId = 0;
+    /// Number of CFG nodes that apply each table.
+    std::map<const IR::P4Table*, size_t> applications;
+    /// The graph being generated, and the keys of its if statements,
+    /// which name its nodes other than tables.
+    const CFG* cfg = nullptr;
+    IfKeys ifKeys;
 
  public:
-    FlowGenerator(OFP4Program* model, IR::Vector<IR::Node> *declarations):
-            model(model), declarations(declarations) {
+    FlowGenerator(OFP4Program* model, IR::Vector<IR::Node> *program):
+            model(model), declarations(new IR::Vector<IR::Node>()) {
         setName("FlowGenerator"); visitDagOnce = false;
-        CHECK_NULL(model); CHECK_NULL(declarations);
+        CHECK_NULL(model); CHECK_NULL(program);
         actionTranslator = new ActionTranslator(model);
+        actionCache = new ActionCache(model, declarations, actionTranslator);
+        sharing = new ActionSharing(model, program);
     }
 
+    size_t actionCacheHits() const { return actionCache->hits; }
+
     void generateActionCall(const IR::MethodCallExpression* actionCall,
                             const IR::OF_Match* match,
                             const CFG::TableNode* cfgtable,
@@ -620,6 +1182,8 @@ class FlowGenerator : public Inspector {
         CHECK_NULL(ac);
         auto at = new ActionTranslator(model, &ac->substitution);
         auto callTranslation = at->translate(ac->action->body, false, exitBlockId);
+        if (callTranslation == nullptr)
+            return;
         auto ofaction = callTranslation->checkedTo<IR::OF_Action>();
 
         CFG::Node* next = findActionSuccessor(cfgtable, ac->action, defaultAction);
@@ -627,20 +1191,191 @@ class FlowGenerator : public Inspector {
         auto successor = new IR::OF_ResubmitAction(next ? next->id : 0);
         ofaction = new IR::OF_SeqAction(ofaction, successor);
         auto flowRule = new IR::OF_MatchAndAction(match, ofaction);
-        declarations->push_back(makeFlowRule(flowRule, cfgtable->table->externalName()));
+        addFlowRule(model, declarations, flowRule, cfgtable->table->externalName());
     }
 
+    /// Sets 'value' and 'mask' to the value and mask that 'v' gives to
+    /// ternary or lpm key 'ke' in a constant entry.  Returns false on
+    /// error.
+    bool constantMask(const IR::Expression* v, const IR::KeyElement* ke,
+                      big_int& value, big_int& mask) {
+        value = 0;
+        mask = 0;
+        if (auto m = v->to<IR::Mask>()) {
+            auto left = m->left->to<IR::Constant>();
+            auto right = m->right->to<IR::Constant>();
+            if (!left || !right) {
+                ::error(ErrorType::ERR_UNSUPPORTED_ON_TARGET,
+                        "%1%: expected a constant value and mask", v);
+                return false;
+            }
+            value = left->value;
+            mask = right->value;
+        } else if (auto c = v->to<IR::Constant>()) {
+            value = c->value;
+            mask = IR::Constant::GetMask(keyWidth(model->typeMap, ke)).value;
+        } else if (!v->is<IR::DefaultExpression>()) {
+            ::error(ErrorType::ERR_UNSUPPORTED_ON_TARGET,
+                    "%1%: expected a constant value and mask", v);
+            return false;
+        }
+        return true;
+    }
+
+    /// Returns the prefix length of 'mask', which 'v' gives to lpm key
+    /// 'ke' in a constant entry.
+    size_t prefixLength(const IR::Expression* v, const IR::KeyElement* ke,
+                        const big_int& mask) {
+        size_t width = keyWidth(model->typeMap, ke);
+        size_t plen = 0;
+        while (plen < width && ((mask >> (width - plen - 1)) & 1) != 0)
+            plen++;
+        if (mask != (IR::Constant::GetMask(width).value ^ IR::Constant::GetMask(width - plen).value))
+            ::error(ErrorType::ERR_INVALID, "%1%: mask of an lpm key must be a prefix", v);
+        return plen;
+    }
+
+    /// Returns the DDlog value for key 'ke' in a constant entry, where
+    /// 'v' is the value given in the P4 program.
+    cstring constantKey(const IR::Expression* v, const IR::KeyElement* ke) {
+        auto match = ke->matchType->path->name.name;
+        if (match == "range") {
+            big_int low = 0;
+            big_int high = IR::Constant::GetMask(keyWidth(model->typeMap, ke)).value;
+            if (auto r = v->to<IR::Range>()) {
+                auto left = r->left->to<IR::Constant>();
+                auto right = r->right->to<IR::Constant>();
+                if (!left || !right) {
+                    ::error(ErrorType::ERR_UNSUPPORTED_ON_TARGET,
+                            "%1%: expected a constant range", v);
+                    return "(0, 0)";
+                }
+                low = left->value;
+                high = right->value;
+            } else if (auto c = v->to<IR::Constant>()) {
+                low = high = c->value;
+            } else if (!v->is<IR::DefaultExpression>()) {
+                ::error(ErrorType::ERR_UNSUPPORTED_ON_TARGET,
+                        "%1%: expected a constant range", v);
+                return "(0, 0)";
+            }
+            return "(" + Util::toString(low) + ", " + Util::toString(high) + ")";
+        }
+        if (match != "ternary" && match != "lpm") {
+            auto value = actionTranslator->translate(v, true, exitBlockId);
+            return OpenFlowPrint::toString(value->to<IR::Node>());
+        }
+
+        big_int value, mask;
+        if (!constantMask(v, ke, value, mask))
+            return "(0, 0)";
+        if (match == "ternary")
+            return "(" + Util::toString(value) + ", " + Util::toString(mask) + ")";
+        return "(" + Util::toString(value) + ", " + Util::toString(prefixLength(v, ke, mask)) + ")";
+    }
+
+    /// Adds to 'match' the OpenFlow match for value 'v' of key 'ke' in a
+    /// constant entry; a value that matches anything adds nothing.  Sets
+    /// 'plen' to the prefix length of an lpm key.  Returns false on error.
+    bool constantMatch(const IR::Expression* v, const IR::KeyElement* ke,
+                       IR::OF_SeqMatch* match, size_t& plen) {
+        auto key = actionTranslator->translate(ke->expression, false, exitBlockId);
+        if (key == nullptr)
+            return false;
+        auto keye = key->checkedTo<IR::OF_Expression>();
+
+        auto matchType = ke->matchType->path->name.name;
+        if (matchType == "exact" || matchType == "optional") {
+            if (v->is<IR::DefaultExpression>())
+                return true;
+            auto value = actionTranslator->translate(v, true, exitBlockId);
+            if (value == nullptr)
+                return false;
+            match->push_back(new IR::OF_EqualsMatch(
+                keye, value->checkedTo<IR::OF_Expression>(), nullptr));
+            return true;
+        }
+        if (matchType != "ternary" && matchType != "lpm") {
+            ::error(ErrorType::ERR_UNSUPPORTED_ON_TARGET,
+                    "%1%: match kind %2% not supported", ke, matchType);
+            return false;
+        }
+
+        big_int value, mask;
+        if (!constantMask(v, ke, value, mask))
+            return false;
+        if (matchType == "lpm")
+            plen = prefixLength(v, ke, mask);
+        if (mask == 0)
+            return true;
+        size_t width = keyWidth(model->typeMap, ke);
+        auto type = IR::Type_Bits::get(width);
+        const IR::OF_Expression* ofmask = nullptr;
+        if (mask != IR::Constant::GetMask(width).value)
+            ofmask = new IR::OF_Constant(new IR::Constant(type, mask));
+        match->push_back(new IR::OF_EqualsMatch(
+            keye, new IR::OF_Constant(new IR::Constant(type, value & mask)), ofmask));
+        return true;
+    }
+
+    /// Generates the flows of a table for which isConstantTable() holds:
+    /// one for each constant entry and one for the default action.  They
+    /// go through addFlowRule(), so they are static flows.
+    void convertConstantTable(CFG::TableNode* table) {
+        auto p4table = table->table;
+        if (auto entries = p4table->getEntries()) {
+            auto key = p4table->getKey();
+            CHECK_NULL(key);
+            bool lpm = lpmPriorityKey(p4table) != nullptr;
+            // Earlier entries take precedence, as they do for the
+            // constant entries of other tables.
+            size_t priority = entries->entries.size() + 1;
+            for (auto entry : entries->entries) {
+                auto match = new IR::OF_SeqMatch();
+                match->push_back(new IR::OF_TableMatch(table->id));
+                auto keys = entry->getKeys();
+                size_t plen = 0;
+                for (size_t i = 0; i < keys->components.size(); i++) {
+                    if (!constantMatch(keys->components.at(i), key->keyElements.at(i),
+                                       match, plen))
+                        return;
+                }
+                if (tableHasPriority(p4table))
+                    match->push_back(new IR::OF_PriorityMatch(
+                        new IR::OF_Constant(static_cast<int>(lpm ? plen + 2 : priority))));
+                priority--;
+                generateActionCall(entry->getAction()->checkedTo<IR::MethodCallExpression>(),
+                                   match, table, false);
+            }
+        }
+
+        auto defaultAction = p4table->getDefaultAction();
+        CHECK_NULL(defaultAction);  // always inserted by front-end
+        auto match = new IR::OF_SeqMatch();
+        match->push_back(new IR::OF_TableMatch(table->id));
+        match->push_back(new IR::OF_PriorityMatch(
+            new IR::OF_Constant(OFP4Program::defaultActionPriority)));
+        generateActionCall(defaultAction->checkedTo<IR::MethodCallExpression>(),
+                           match, table, true);
+    }
+
+    // 'priority' is only used if the table has priorities.
     IR::Node*
-    makeConstantEntry(const IR::ListExpression* keys, const IR::Expression* action,
+    makeConstantEntry(const IR::ListExpression* keys, const IR::P4Table* p4table,
+                      size_t priority, const IR::Expression* action,
                       const cstring& tableName, bool isDefault, cstring comment) {
         auto members = IR::Vector<IR::DDlogExpression>();
 
         if (keys) {
-            for (auto v : keys->components) {
-                auto value = actionTranslator->translate(v, true, exitBlockId);
-                auto str = new IR::DDlogLiteral(OpenFlowPrint::toString(value->to<IR::Node>()));
+            auto key = p4table->getKey();
+            CHECK_NULL(key);
+            for (size_t i = 0; i < keys->components.size(); i++) {
+                auto str = new IR::DDlogLiteral(
+                    constantKey(keys->components.at(i), key->keyElements.at(i)));
                 members.push_back(str->checkedTo<IR::DDlogExpression>());
             }
+            if (tableHasPriority(p4table))
+                members.push_back(new IR::DDlogLiteral(Util::toString(priority)));
         }
 
         auto mce = action->checkedTo<IR::MethodCallExpression>();
@@ -656,82 +1391,175 @@ class FlowGenerator : public Inspector {
         auto cExp = new IR::DDlogConstructorExpression(method, args);
         members.push_back(cExp->checkedTo<IR::DDlogExpression>());
 
+        // Constant entries cannot be read through P4Runtime, so they
+        // get no counter id.
+        if (keys && directCounter(model->refMap, p4table))
+            members.push_back(new IR::DDlogLiteral("0"));
+
         auto atom = new IR::DDlogAtom(makeId(tableName + (isDefault ? "DefaultAction" : "")), new IR::DDlogTupleExpression(members));
         auto rule = new IR::DDlogRule(atom, {}, comment);
         return rule;
     }
 
-    // This recursive function adds to 'this->declarations' a set of
-    // "DDlogRule"s for the P4 'table'.  When called, 'tableArgs' contains set
+    // Translates key 'k' of a table: adds to 'tableArgs' the pattern for
+    // the key in the table relation, to 'match' the OpenFlow match, and to
+    // 'terms' the DDlog terms that compute the values and masks that the
+    // match uses.  Returns false on error.
+    bool translateKey(const IR::KeyElement* k,
+                      safe_vector<const IR::DDlogExpression*>& tableArgs,
+                      safe_vector<const IR::OF_Match*>& match,
+                      safe_vector<const IR::DDlogTerm*>& terms) {
+        auto name = keyName(k);
+        auto key = actionTranslator->translate(k->expression, false, exitBlockId);
+        if (key == nullptr)
+            return false;
+        auto keye = key->checkedTo<IR::OF_Expression>();
+
+        auto matchType = k->matchType->path->name.name;
+        const IR::OF_Expression* mask = nullptr;
+        cstring valueName = name;
+        if (matchType == "optional") {
+            // None matches any value, so it is the same as a zero
+            // mask.  This keeps a single rule per table instead of
+            // one per combination of None and Some keys.
+            bool isBool = model->typeMap->getType(k->expression, true)->is<IR::Type_Boolean>();
+            size_t width = keyWidth(model->typeMap, k);
+            valueName = name + "_value";
+            cstring maskName = name + "_mask";
+            tableArgs.push_back(new IR::DDlogVarName(name));
+            terms.push_back(new IR::DDlogExpressionTerm(new IR::DDlogSetExpression(
+                valueName, new IR::DDlogLiteral(
+                    "unwrap_or(" + name + ", " + (isBool ? "false" : "0") + ")"))));
+            cstring present = "is_some(" + name + ")";
+            if (!isBool)
+                present = "if (" + present + ") " + Util::toString(width) + "'d" +
+                        Util::toString(IR::Constant::GetMask(width).value) + " else 0";
+            terms.push_back(new IR::DDlogExpressionTerm(new IR::DDlogSetExpression(
+                maskName, new IR::DDlogLiteral(present))));
+            mask = new IR::OF_InterpolatedVarExpression(maskName, keye->width());
+        } else if (matchType == "ternary") {
+            // The control plane supplies the mask.
+            cstring maskName = name + "_mask";
+            tableArgs.push_back(new IR::DDlogTupleExpression({
+                        new IR::DDlogVarName(name), new IR::DDlogVarName(maskName)}));
+            mask = new IR::OF_InterpolatedVarExpression(maskName, keye->width());
+        } else if (matchType == "lpm") {
+            // The control plane supplies the prefix length; compute the mask.
+            cstring plenName = name + "_plen";
+            cstring maskName = name + "_mask";
+            tableArgs.push_back(new IR::DDlogTupleExpression({
+                        new IR::DDlogVarName(name), new IR::DDlogVarName(plenName)}));
+            size_t width = keyWidth(model->typeMap, k);
+            auto computeMask = new IR::DDlogLiteral(
+                "lpm_mask(" + plenName + ", " + Util::toString(width) + ") as bit<" +
+                Util::toString(width) + ">");
+            terms.push_back(new IR::DDlogExpressionTerm(
+                new IR::DDlogSetExpression(maskName, computeMask)));
+            mask = new IR::OF_InterpolatedVarExpression(maskName, keye->width());
+        } else if (matchType == "range") {
+            // Each of the prefixes that cover the range is a flow of its
+            // own.
+            cstring highName = name + "_high";
+            cstring prefixName = name + "_prefix";
+            cstring maskName = name + "_mask";
+            valueName = name + "_value";
+            tableArgs.push_back(new IR::DDlogTupleExpression({
+                        new IR::DDlogVarName(name), new IR::DDlogVarName(highName)}));
+            cstring width = Util::toString(keyWidth(model->typeMap, k));
+            cstring type = "bit<" + width + ">";
+            terms.push_back(new IR::DDlogExpressionTerm(new IR::DDlogSetExpression(
+                prefixName, new IR::DDlogLiteral(
+                    "FlatMap(range_to_prefixes(" + name + " as bit<128>, " + highName +
+                    " as bit<128>, " + width + "))"))));
+            terms.push_back(new IR::DDlogExpressionTerm(new IR::DDlogSetExpression(
+                valueName, new IR::DDlogLiteral(prefixName + ".0 as " + type))));
+            terms.push_back(new IR::DDlogExpressionTerm(new IR::DDlogSetExpression(
+                maskName, new IR::DDlogLiteral(prefixName + ".1 as " + type))));
+            mask = new IR::OF_InterpolatedVarExpression(maskName, keye->width());
+        } else if (matchType == "exact") {
+            tableArgs.push_back(new IR::DDlogVarName(name));
+        } else {
+            ::error(ErrorType::ERR_UNSUPPORTED_ON_TARGET,
+                    "%1%: match kind %2% not supported", k, matchType);
+            return false;
+        }
+
+        auto varName = new IR::OF_InterpolatedVarExpression(valueName, keye->width());
+        match.push_back(new IR::OF_EqualsMatch(keye, varName, mask));
+        return true;
+    }
+
+    // This recursive function adds to 'this->declarations' the "DDlogRule"
+    // for the P4 'table'.  When called, 'tableArgs' contains set
     // of arguments that the caller has already figured out for the P4 'table'
-    // on the right-hand side of the DDlog :-, and 'match' contains the set of
+    // on the right-hand side of the DDlog :-, 'match' contains the set of
     // OpenFlow match expressions that the caller has already added
-    // corresponding to the arguments.  'curKey'...'end' contains the key
+    // corresponding to the arguments, and 'terms' the DDlog terms that
+    // compute the values and masks they use.  'curKey'...'end' contains the key
     // elements still to be processed and recursively passed into this function.
     void convertKey(CFG::TableNode* table,
                     const IR::Vector<IR::DDlogMatchCase>* tableCases,
                     safe_vector<const IR::DDlogExpression*> tableArgs,
                     safe_vector<const IR::OF_Match*> match,
+                    safe_vector<const IR::DDlogTerm*> terms,
                     IR::Vector<IR::KeyElement>::const_iterator curKey,
                     IR::Vector<IR::KeyElement>::const_iterator end,
                     size_t nKeys) {
         if (curKey != end) {
             // Recursive case.
-            auto k = *curKey;
-            auto name = k->annotations->getSingle(
-                IR::Annotation::nameAnnotation)->getSingleString();
-            auto key = actionTranslator->translate(k->expression, false, exitBlockId);
-            if (key == nullptr)
+            if (!translateKey(*curKey, tableArgs, match, terms))
                 return;
-
-            auto matchType = k->matchType;
-            if (matchType->path->name.name == "optional") {
-                // For an optional field, we need a flow for None and a flow
-                // for Some.  The flow for None doesn't have a match component;
-                // add it first, recurse, and discard it.
-                std::vector<cstring> args;
-                tableArgs.push_back(new IR::DDlogConstructorExpression(IR::ID("None"), args));
-                convertKey(table, tableCases, tableArgs, match, curKey + 1, end, nKeys);
-                tableArgs.pop_back();
-
-                // Then add the Some and fall through.  The match component
-                // gets added just below in code shared with exact-match.
-                args.push_back(name);
-                tableArgs.push_back(new IR::DDlogConstructorExpression(IR::ID("Some"), args));
-            } else {
-                tableArgs.push_back(new IR::DDlogVarName(name));
-            }
-
-            auto keye = key->checkedTo<IR::OF_Expression>();
-            auto varName = new IR::OF_InterpolatedVarExpression(name, keye->width());
-            match.push_back(new IR::OF_EqualsMatch(keye, varName));
-
-            convertKey(table, tableCases, tableArgs, match, curKey + 1, end, nKeys);
-
+            convertKey(table, tableCases, tableArgs, match, terms, curKey + 1, end, nKeys);
             return;
         }
 
         // Base case.
         auto p4table = table->table;
         if (tableHasPriority(p4table)) {
-            tableArgs.push_back(new IR::DDlogVarName("priority"));
+            if (auto lpm = lpmPriorityKey(p4table)) {
+                // Longer prefixes win; all of them beat the default
+                // action, which has priority 1.
+                tableArgs.push_back(new IR::DDlogVarName("_"));
+                terms.push_back(new IR::DDlogExpressionTerm(
+                    new IR::DDlogSetExpression("priority", new IR::DDlogLiteral(
+                        keyName(lpm) + "_plen + 2"))));
+            } else {
+                tableArgs.push_back(new IR::DDlogVarName("priority"));
+            }
             match.push_back(
                 new IR::OF_PriorityMatch(
                     new IR::OF_InterpolatedVarExpression("priority", 16)));
         }
-        tableArgs.push_back(new IR::DDlogVarName("action"));
+        // The buckets of the group of an entry in a table with an action
+        // selector run the actions.
+        bool selector = nKeys && actionSelector(model->refMap, p4table);
+        tableArgs.push_back(new IR::DDlogVarName(selector ? "of_group" : "action"));
+        if (nKeys && directCounter(model->refMap, p4table)) {
+            tableArgs.push_back(new IR::DDlogVarName("counter_id"));
+            match.push_back(new IR::OF_CookieMatch(
+                new IR::OF_InterpolatedVarExpression("counter_id", 32)));
+        }
 
         auto seqMatch = new IR::OF_SeqMatch(IR::Vector<IR::OF_Match>(match));
-        auto flowRule = new IR::OF_MatchAndAction(
-            seqMatch,
-            new IR::OF_InterpolatedVariableAction("actions"));
-        auto flowTerm = makeFlowAtom(flowRule);
+        const IR::OF_Action* tableAction = selector ?
+                static_cast<const IR::OF_Action*>(new IR::OF_GroupAction(
+                    new IR::OF_InterpolatedVarExpression("of_group", 32))) :
+                new IR::OF_InterpolatedVariableAction("actions");
+        auto flowRule = new IR::OF_MatchAndAction(seqMatch, tableAction);
+        auto flowTerm = makeFlowAtom(model, flowRule);
         auto ruleRhs = new IR::Vector<IR::DDlogTerm>();
         auto relationTerm = new IR::DDlogAtom(p4table->srcInfo,
                                               IR::ID(genTableName(p4table)),
                                               new IR::DDlogTupleExpression(*new IR::Vector<IR::DDlogExpression>(tableArgs)));
         if (nKeys)
             ruleRhs->push_back(relationTerm);
+        for (auto t : terms)
+            ruleRhs->push_back(t);
+        if (selector) {
+            declarations->push_back(
+                new IR::DDlogRule(flowTerm, *ruleRhs, p4table->externalName()));
+            return;
+        }
 
         const IR::DDlogExpression* computeAction;
         if (tableCases->size() == 0) {
@@ -750,8 +1578,173 @@ class FlowGenerator : public Inspector {
         declarations->push_back(rule);
     }
 
+    // Generates the flows for a table annotated with @of_conjunction.
+    // Entries with the same action and priority share OVS
+    // conjunctions, whose ids the runtime allocates: each distinct value
+    // of key i gets a single flow with action conjunction(id, i/n), and
+    // one more flow that matches conj_id=id runs the action.  The flow count is then the sum of
+    // the number of values of each key instead of their product.  The
+    // runtime keeps the entries of each conjunction a cross product of
+    // these values, and a value shared by several conjunctions gets a
+    // single flow with all their conjunction actions.
+    void convertConjunction(CFG::TableNode* table,
+                            const IR::Vector<IR::DDlogMatchCase>* tableCases,
+                            const IR::Key* key) {
+        auto p4table = table->table;
+        size_t nKeys = key->keyElements.size();
+        if (nKeys < 2) {
+            ::error(ErrorType::ERR_INVALID,
+                    "%1%: @of_conjunction requires a table with at least 2 keys", p4table);
+            return;
+        }
+        if (model->structuredFlows) {
+            ::error(ErrorType::ERR_UNSUPPORTED_ON_TARGET,
+                    "%1%: @of_conjunction is not supported with structured flows", p4table);
+            return;
+        }
+        if (directCounter(model->refMap, p4table)) {
+            // Conjunction flows are shared among entries.
+            ::error(ErrorType::ERR_UNSUPPORTED_ON_TARGET,
+                    "%1%: direct counters are not supported with @of_conjunction", p4table);
+            return;
+        }
+
+        safe_vector<const IR::DDlogExpression*> tableArgs;
+        safe_vector<const IR::OF_Match*> dimensions;
+        safe_vector<const IR::DDlogTerm*> terms;
+        for (auto k : key->keyElements) {
+            if (k->matchType->path->name.name == "lpm") {
+                ::error(ErrorType::ERR_UNSUPPORTED_ON_TARGET,
+                        "%1%: lpm keys are not supported with @of_conjunction", k);
+                return;
+            }
+            if (!translateKey(k, tableArgs, dimensions, terms))
+                return;
+        }
+        // The entries of a table without priorities have only exact
+        // keys, so they never overlap, but their flows still have to
+        // beat the default action.
+        if (tableHasPriority(p4table))
+            tableArgs.push_back(new IR::DDlogVarName("priority"));
+        else
+            terms.push_back(new IR::DDlogExpressionTerm(
+                new IR::DDlogSetExpression("priority", new IR::DDlogLiteral(
+                    "16'd" + Util::toString(OFP4Program::defaultActionPriority + 1)))));
+        tableArgs.push_back(new IR::DDlogVarName("action"));
+        tableArgs.push_back(new IR::DDlogVarName("conj_id"));
+
+        auto relationTerm = new IR::DDlogAtom(
+            p4table->srcInfo, IR::ID(genTableName(p4table)),
+            new IR::DDlogTupleExpression(*new IR::Vector<IR::DDlogExpression>(tableArgs)));
+        auto priority = new IR::OF_PriorityMatch(
+            new IR::OF_InterpolatedVarExpression("priority", 16));
+
+        // One flow per value of each dimension.  Flows for the same value
+        // would replace each other, so group their conjunction actions.
+        for (size_t i = 0; i < nKeys; i++) {
+            auto dimension = dimensions.at(i)->checkedTo<IR::OF_EqualsMatch>();
+            IR::Vector<IR::DDlogExpression> groupKey;
+            for (auto e : { dimension->right, dimension->mask }) {
+                if (auto var = e ? e->to<IR::OF_InterpolatedVarExpression>() : nullptr)
+                    groupKey.push_back(new IR::DDlogVarName(var->varname));
+            }
+            groupKey.push_back(new IR::DDlogVarName("priority"));
+            auto conjunction = new IR::DDlogStringLiteral(
+                "conjunction(${conj_id}, " + Util::toString(i + 1) + "/" +
+                Util::toString(nKeys) + ")");
+            auto grouped = new IR::DDlogApply(
+                "join",
+                new IR::DDlogApply(
+                    "to_vec",
+                    new IR::DDlogApply(
+                        "to_set",
+                        new IR::DDlogApply("group_by", conjunction,
+                                           { new IR::DDlogTupleExpression(groupKey) }),
+                        {}),
+                    {}),
+                { new IR::DDlogStringLiteral(", ") });
+
+            auto match = new IR::OF_SeqMatch();
+            match->push_back(new IR::OF_TableMatch(table->id));
+            match->push_back(dimension);
+            match->push_back(priority);
+            auto flowRule = new IR::OF_MatchAndAction(
+                match, new IR::OF_InterpolatedVariableAction("conjunctions"));
+            auto ruleRhs = new IR::Vector<IR::DDlogTerm>();
+            ruleRhs->push_back(relationTerm);
+            for (auto t : terms)
+                ruleRhs->push_back(t);
+            ruleRhs->push_back(new IR::DDlogExpressionTerm(
+                new IR::DDlogSetExpression("conjunctions", grouped)));
+            declarations->push_back(new IR::DDlogRule(
+                makeFlowAtom(model, flowRule), *ruleRhs,
+                p4table->externalName() + " dimension " + Util::toString(i + 1)));
+        }
+
+        // The flow that runs the action once all dimensions matched.
+        auto match = new IR::OF_SeqMatch();
+        match->push_back(new IR::OF_TableMatch(table->id));
+        match->push_back(new IR::OF_EqualsMatch(
+            new IR::OF_Register("conj_id", 32, 0, 31, false),
+            new IR::OF_InterpolatedVarExpression("conj_id", 32)));
+        match->push_back(priority);
+        auto flowRule = new IR::OF_MatchAndAction(
+            match, new IR::OF_InterpolatedVariableAction("actions"));
+        auto ruleRhs = new IR::Vector<IR::DDlogTerm>();
+        ruleRhs->push_back(relationTerm);
+        for (auto t : terms)
+            ruleRhs->push_back(t);
+        auto computeAction = new IR::DDlogMatchExpression(
+            new IR::DDlogVarName("action"), *tableCases);
+        ruleRhs->push_back(new IR::DDlogExpressionTerm(
+            new IR::DDlogSetExpression("actions", computeAction)));
+        declarations->push_back(new IR::DDlogRule(
+            makeFlowAtom(model, flowRule), *ruleRhs, p4table->externalName() + " conjunction"));
+    }
+
+    /// An action of a table, and what the table needs of the action
+    /// cache for it: 'text' runs the action and jumps to its successor
+    /// 'next', 'uses' counts whether it is an entry action and a default
+    /// action, and 'function' names the function that computes 'text'
+    /// if it is shared.
+    struct ActionUse {
+        const P4::ActionCall* call;
+        bool defaultOnly;
+        bool tableOnly;
+        CFG::Node* next;
+        cstring text;
+        size_t uses;
+        cstring function;
+    };
+
+    ActionUse actionUse(const CFG::TableNode* table, const IR::ActionListElement* ale) {
+        auto p4table = table->table;
+        auto mce = ale->expression->to<IR::MethodCallExpression>();
+        BUG_CHECK(mce, "%1%: expected a method call", ale->expression);
+        auto mi = P4::MethodInstance::resolve(mce, model->refMap, model->typeMap);
+        ActionUse use;
+        use.call = mi->to<P4::ActionCall>();
+        CHECK_NULL(use.call);
+        auto action = use.call->action;
+        auto annos = ale->getAnnotations();
+        use.defaultOnly = annos->getSingle(IR::Annotation::defaultOnlyAnnotation) != nullptr;
+        use.tableOnly = annos->getSingle(IR::Annotation::tableOnlyAnnotation) != nullptr;
+        use.next = findActionSuccessor(table, action, false);
+        BUG_CHECK(use.next, "%1%:%2%: no successor", p4table->name, action->name);
+        use.text = actionCache->translate(action, exitBlockId, table->id, use.next->id);
+        use.uses = (use.defaultOnly ? 0 : 1) + (use.tableOnly ? 0 : 1);
+        use.function = "actions_" + makeId(p4table->externalName()) + "_" + action->name.name;
+        if (applications[p4table] > 1)
+            use.function += "_" + Util::toString(table->id);
+        return use;
+    }
+
     void convertTable(CFG::TableNode* table) {
         LOG2("Converting " << table);
+        if (isConstantTable(table->table)) {
+            convertConstantTable(table);
+            return;
+        }
         size_t id = table->id;
         auto p4table = table->table;
         auto entries = p4table->getEntries();
@@ -761,36 +1754,32 @@ class FlowGenerator : public Inspector {
 
         auto tableCases = new IR::Vector<IR::DDlogMatchCase>();
         auto defaultCases = new IR::Vector<IR::DDlogMatchCase>();
+        auto bucketCases = new IR::Vector<IR::DDlogMatchCase>();
         auto defaultArgs = new IR::Vector<IR::DDlogExpression>();
+        auto selector = p4table->getKey() ? actionSelector(model->refMap, p4table) : nullptr;
+        if (selector && applications[p4table] > 1) {
+            // The buckets of a member would differ in their successor.
+            ::error(ErrorType::ERR_UNSUPPORTED_ON_TARGET,
+                    "%1%: a table with an action selector can only be applied once", p4table);
+            return;
+        }
 
         auto acvar = new IR::DDlogVarName("action");
         defaultArgs->push_back(acvar);
 
         for (auto ale : actions->actionList) {
-            auto mce = ale->expression->to<IR::MethodCallExpression>();
-            BUG_CHECK(mce, "%1%: expected a method call", ale->expression);
-            auto mi = P4::MethodInstance::resolve(mce, model->refMap, model->typeMap);
-            auto ac = mi->to<P4::ActionCall>();
-            auto annos = ale->getAnnotations();
-            bool defaultOnly = annos->getSingle(
-                IR::Annotation::defaultOnlyAnnotation) != nullptr;
-            bool tableOnly = annos->getSingle(
-                IR::Annotation::tableOnlyAnnotation) != nullptr;
-
-            CFG::Node* next = findActionSuccessor(table, ac->action, false);
-            BUG_CHECK(next, "%1%:%2%: no successor", p4table->name, ac->action->name);
-            auto successor = new IR::OF_ResubmitAction(next ? next->id : 0);
+            auto use = actionUse(table, ale);
+            auto ac = use.call;
+            bool defaultOnly = use.defaultOnly;
+            bool tableOnly = use.tableOnly;
+            CFG::Node* next = use.next;
 
             /// Generate matching code for the rule
             std::vector<cstring> keyargs;
             for (auto p : ac->action->parameters->parameters) {
                 keyargs.push_back(p->name);
             }
-            auto body = actionTranslator->translate(ac->action->body, false, exitBlockId);
-            auto action = body->checkedTo<IR::OF_Action>();
-            action = new IR::OF_SeqAction(action, successor);
-            auto opt = action->apply(OpenFlowSimplify());
-            auto matched = new IR::DDlogStringLiteral(OpenFlowPrint::toString(opt));
+            auto matched = actionCache->expression(use.text, ac->action, use.uses, use.function);
 
             if (!defaultOnly) {
                 cstring alternative = makeId(tableName + "Action" + ac->action->name);
@@ -798,6 +1787,16 @@ class FlowGenerator : public Inspector {
                 auto mc = new IR::DDlogMatchCase(cExp, matched);
                 tableCases->push_back(mc);
             }
+            if (selector && !defaultOnly) {
+                // OpenFlow does not allow goto_table in a group bucket,
+                // so the bucket resubmits to the successor.
+                auto bucket = actionCache->translate(ac->action, exitBlockId,
+                                                     std::numeric_limits<size_t>::max(), next->id);
+                cstring alternative = makeId(tableName + "Action" + ac->action->name);
+                bucketCases->push_back(new IR::DDlogMatchCase(
+                    new IR::DDlogConstructorExpression(alternative, keyargs),
+                    new IR::DDlogLiteral(bucket)));
+            }
             if (!tableOnly) {
                 cstring alternative = makeId(
                     tableName + "DefaultAction" + ac->action->name);
@@ -813,15 +1812,43 @@ class FlowGenerator : public Inspector {
         }
         safe_vector<const IR::DDlogExpression*> tableArgs;
         safe_vector<const IR::OF_Match*> match;
+        safe_vector<const IR::DDlogTerm*> terms;
         match.push_back(new IR::OF_TableMatch(table->id));
-        convertKey(table, tableCases, tableArgs, match,
-                   key->keyElements.begin(), key->keyElements.end(),
-                   key->keyElements.size());
+        if (p4table->getAnnotation("of_conjunction"))
+            convertConjunction(table, tableCases, key);
+        else
+            convertKey(table, tableCases, tableArgs, match, terms,
+                       key->keyElements.begin(), key->keyElements.end(),
+                       key->keyElements.size());
+
+        // The actions of the members of an action selector become group
+        // buckets, which the runtime groups as the control plane says.
+        if (selector) {
+            auto bucketTerm = new IR::DDlogAtom(
+                "ActionProfileBucket", new IR::DDlogTupleExpression({
+                    new IR::DDlogStringLiteral(selector->controlPlaneName()),
+                    new IR::DDlogVarName("member_id"),
+                    new IR::DDlogVarName("actions")}));
+            auto memberTerm = new IR::DDlogAtom(
+                p4table->srcInfo, IR::ID(tableName + "Member"),
+                new IR::DDlogTupleExpression({
+                    new IR::DDlogVarName("member_id"), new IR::DDlogVarName("action")}));
+            auto set = new IR::DDlogSetExpression(
+                "actions", new IR::DDlogMatchExpression(new IR::DDlogVarName("action"),
+                                                        *bucketCases));
+            declarations->push_back(new IR::DDlogRule(
+                bucketTerm, { memberTerm, new IR::DDlogExpressionTerm(set) },
+                p4table->externalName() + " members"));
+        }
 
         // For each constant entry, add a constant value to the relation.
+        // Earlier entries take precedence; all of them beat the default
+        // action, which has priority 1.
         if (entries) {
+            size_t priority = entries->entries.size() + 1;
             for (auto entry : entries->entries) {
-                declarations->push_back(makeConstantEntry(entry->getKeys(), entry->getAction(), tableName, false,
+                declarations->push_back(makeConstantEntry(entry->getKeys(), p4table, priority--,
+                                            entry->getAction(), tableName, false,
                                             "constant entry for table " + tableName));
             }
         }
@@ -831,12 +1858,13 @@ class FlowGenerator : public Inspector {
         CHECK_NULL(defaultAction);  // always inserted by front-end
         auto default_match = new IR::OF_SeqMatch();
         default_match->push_back(tablematch);
-        default_match->push_back(new IR::OF_PriorityMatch(new IR::OF_Constant(1)));
+        default_match->push_back(new IR::OF_PriorityMatch(
+            new IR::OF_Constant(OFP4Program::defaultActionPriority)));
 
         auto flowRule = new IR::OF_MatchAndAction(
             default_match,
             new IR::OF_InterpolatedVariableAction("actions"));
-        auto flowTerm = makeFlowAtom(flowRule);
+        auto flowTerm = makeFlowAtom(model, flowRule);
         auto ruleRhs = new IR::Vector<IR::DDlogTerm>();
         auto relationTerm = new IR::DDlogAtom(
             p4table->srcInfo, IR::ID(tableName + "DefaultAction"),
@@ -858,7 +1886,7 @@ class FlowGenerator : public Inspector {
         declarations->push_back(rule);
 
         if (defaultActionIsConstant(p4table)) {
-            declarations->push_back(makeConstantEntry(nullptr, defaultAction, tableName, true,
+            declarations->push_back(makeConstantEntry(nullptr, p4table, 0, defaultAction, tableName, true,
                                         "constant default action for table " + tableName));
         }
     }
@@ -869,64 +1897,237 @@ class FlowGenerator : public Inspector {
             auto ma = new IR::OF_MatchAndAction(
                 new IR::OF_TableMatch(node->id),
                 new IR::OF_ResubmitAction(e->endpoint->id));
-            auto rule = makeFlowRule(ma, nullptr);
-            declarations->push_back(rule);
+            addFlowRule(model, declarations, ma, nullptr);
         }
     }
 
+    // Returns the match for a literal of a NormalCondition, ignoring
+    // its negation.
+    const IR::OF_Match* translateLiteral(const IR::Expression* expression) {
+        if (auto neq = expression->to<IR::Neq>())
+            expression = new IR::Equ(neq->srcInfo, neq->left, neq->right);
+        auto translation = actionTranslator->translate(expression, true, exitBlockId);
+        if (!translation)
+            return nullptr;
+        auto match = translation->to<IR::OF_Match>();
+        if (!match)
+            ::error(ErrorType::ERR_UNSUPPORTED_ON_TARGET,
+                    "%1%: condition not supported on target", expression);
+        return match;
+    }
+
+    // Returns the negation of 'match' if it is also an equality test,
+    // that is, if 'match' compares a single bit with a constant.
+    static const IR::OF_Match* invertMatch(const IR::OF_Match* match) {
+        auto em = match->to<IR::OF_EqualsMatch>();
+        if (!em || em->mask || em->left->width() != 1)
+            return nullptr;
+        auto constant = em->right->to<IR::OF_Constant>();
+        if (!constant)
+            return nullptr;
+        return new IR::OF_EqualsMatch(
+            em->left, new IR::OF_Constant(constant->value->value == 0 ? 1 : 0));
+    }
+
+    // Each term of the condition, in normal form, becomes a flow with
+    // priority 100 that jumps to the true branch; any other packet
+    // takes the false branch at priority 1.  A negated literal that is
+    // not an equality test, in a condition with a single term, becomes
+    // a flow with priority 200 that matches the rest of the term and
+    // the literal and jumps to the false branch.
     void convertIf(CFG::IfNode* node) {
         LOG2("Converting " << node);
         size_t id = node->id;
-        auto expr = actionTranslator->translate(node->statement->condition, true, exitBlockId);
+        auto condition = node->statement->condition;
+        cstring comment = node->statement->toString();
 
-        for (auto e : node->successors.edges) {
+        CFG::Node* onTrue = nullptr;
+        CFG::Node* onFalse = nullptr;
+        for (auto e : node->successors.edges)
+            (e->getBool() ? onTrue : onFalse) = e->endpoint;
+
+        auto addFlow = [&](const safe_vector<const IR::OF_Match*>& matches,
+                           int priority, CFG::Node* next) {
             auto match = new IR::OF_SeqMatch();
             match->push_back(new IR::OF_TableMatch(id));
-            CFG::Node* next = e->endpoint;
+            for (auto m : matches)
+                match->push_back(m);
+            match->push_back(new IR::OF_PriorityMatch(new IR::OF_Constant(priority)));
             auto action = new IR::OF_ResubmitAction(next ? next->id : 0);
-            const IR::OF_MatchAndAction* ma;
-            if (e->getBool()) {
-                // if condition is true
-                if (expr != nullptr) {
-                    auto cond = expr->to<IR::OF_Match>();
-                    match->push_back(cond);
-                    match->push_back(
-                        new IR::OF_PriorityMatch(new IR::OF_Constant(100)));
+            addFlowRule(model, declarations, new IR::OF_MatchAndAction(match, action), comment);
+        };
+
+        NormalCondition normal;
+        if (!normal.normalize(condition, model->typeMap) || !normal.matchable()) {
+            ::error(ErrorType::ERR_UNSUPPORTED_ON_TARGET,
+                    "%1%: condition not supported on target", condition);
+            return;
+        }
+        for (auto& term : normal.terms) {
+            safe_vector<const IR::OF_Match*> matches;
+            safe_vector<const IR::OF_Match*> exceptions;
+            for (auto& literal : term) {
+                auto match = translateLiteral(literal.expression);
+                if (!match)
+                    return;
+                if (!literal.negated) {
+                    matches.push_back(match);
+                } else if (auto inverse = invertMatch(match)) {
+                    matches.push_back(inverse);
+                } else if (normal.terms.size() == 1) {
+                    exceptions.push_back(match);
+                } else {
+                    ::error(ErrorType::ERR_UNSUPPORTED_ON_TARGET,
+                            "%1%: cannot match the negation of %2% in a disjunction",
+                            condition, literal.expression);
+                    return;
                 }
-                ma = new IR::OF_MatchAndAction(match, action);
-            } else {
-                // if condition is false
-                match->push_back(
-                    new IR::OF_PriorityMatch(new IR::OF_Constant(1)));
-                ma = new IR::OF_MatchAndAction(match, action);
             }
-            auto rule = makeFlowRule(ma, node->statement->toString());
-            declarations->push_back(rule);
+            for (auto exception : exceptions) {
+                auto excepted = matches;
+                excepted.push_back(exception);
+                addFlow(excepted, 200, onFalse);
+            }
+            addFlow(matches, 100, onTrue);
+        }
+        addFlow({}, 1, onFalse);
+    }
+
+    /// Counts the DDlog rules in declarations 'firstDecl' onward that
+    /// produce flows from table entries ('rules') and that are constant
+    /// flows ('constantFlows'), adding the static flows from index
+    /// 'firstStatic' onward.
+    void countRules(size_t firstDecl, size_t firstStatic, size_t& rules, size_t& constantFlows) {
+        rules = 0;
+        constantFlows = 0;
+        for (size_t i = firstDecl; i < declarations->size(); i++) {
+            auto rule = declarations->at(i)->to<IR::DDlogRule>();
+            if (!rule)
+                continue;
+            if (rule->rhs.empty())
+                constantFlows++;
+            else
+                rules++;
+        }
+        for (size_t i = firstStatic; i < model->staticFlows.size(); i++)
+            if (!model->staticFlows.at(i).startsWith("#"))
+                constantFlows++;
+    }
+
+    /// Returns an estimate for 'node' with no flows, and with the most
+    /// entries that its table, if any, can have.  Nodes other than
+    /// tables are named by their stable key, e.g. "PEgress exit".
+    FlowEstimate entryBound(const CFG::Node* node) const {
+        FlowEstimate estimate;
+        estimate.name = node->is<CFG::TableNode>() ? node->name
+                : stableNodeKey(*cfg, ifKeys, node);
+        estimate.id = node->id;
+        auto tn = node->to<CFG::TableNode>();
+        if (!tn || !tn->table->getKey())
+            return estimate;
+        auto entries = tn->table->properties->getProperty(
+            IR::TableProperties::entriesPropertyName);
+        if (entries && entries->isConstant) {
+            estimate.entries = tn->table->getEntries()->entries.size();
+            estimate.entriesFrom = "const entries";
+        } else if (auto size = tn->table->getSizeProperty()) {
+            estimate.entries = size->asUint64();
+            estimate.entriesFrom = "size";
+        } else {
+            estimate.entries = OFP4Program::defaultTableSize;
+            estimate.entriesFrom = "default size";
+        }
+        return estimate;
+    }
+
+    /// The most flows that a rule for one entry of 'table' produces:
+    /// a range of w bits is covered by at most 2w - 2 prefixes.
+    size_t flowsPerRule(const IR::P4Table* table) const {
+        size_t result = 1;
+        if (auto key = table->getKey()) {
+            for (auto ke : key->keyElements) {
+                if (ke->matchType->path->name.name != "range")
+                    continue;
+                size_t width = keyWidth(model->typeMap, ke);
+                result *= width > 1 ? 2 * width - 2 : 1;
+            }
         }
+        return result;
+    }
+
+    /// Estimates the flows of 'node' from the DDlog rules and static
+    /// flows that generating it added, from declaration 'firstDecl' and
+    /// static flow 'firstStatic' onward.  The rules that join the
+    /// node's table produce flows for each entry; a default action
+    /// relation holds a single row.
+    FlowEstimate estimateFlows(const CFG::Node* node, size_t firstDecl, size_t firstStatic) {
+        auto estimate = entryBound(node);
+        std::map<cstring, size_t> joins;
+        countFlows(model, declarations, firstDecl, firstStatic, estimate.fixed, joins);
+        auto tn = node->to<CFG::TableNode>();
+        for (auto& join : joins) {
+            if (tn && join.first == genTableName(tn->table) + "DefaultAction")
+                estimate.fixed += join.second;
+            else if (tn)
+                estimate.perEntry += join.second * flowsPerRule(tn->table);
+            else
+                BUG("%1%: unexpected flow rule joining %2%", node, join.first);
+        }
+        return estimate;
+    }
+
+    void generateNode(CFG::Node* node) {
+        size_t firstDecl = declarations->size();
+        size_t firstStatic = model->staticFlows.size();
+        if (auto tn = node->to<CFG::TableNode>()) {
+            convertTable(tn);
+            if (model->stats) {
+                size_t rules, constantFlows;
+                countRules(firstDecl, firstStatic, rules, constantFlows);
+                model->stats->addTable(tn->name, tn->id, rules, constantFlows);
+            }
+        } else if (auto in = node->to<CFG::IfNode>()) {
+            convertIf(in);
+        } else if (auto d = node->to<CFG::DummyNode>()) {
+            convertDummy(d);
+        } else {
+            BUG("Unexpected CFG node %1%", node);
+        }
+        model->flowEstimates.push_back(estimateFlows(node, firstDecl, firstStatic));
+    }
+
+    /// Hands the declarations generated since the last call to
+    /// 'sharing', for finish().
+    void flush() {
+        sharing->add(declarations, actionCache->takeUses());
+        declarations = new IR::Vector<IR::Node>();
+        actionCache->setDeclarations(declarations);
+    }
+
+    /// Appends the declarations of all the nodes generated to the DDlog
+    /// program, once the action texts that they share are known.
+    void finish() {
+        sharing->finish();
     }
 
     void generate(CFG &cfg, size_t exitId) {
         exitBlockId = exitId;
-        for (auto node : cfg.allNodes) {
+        this->cfg = &cfg;
+        ifKeys.keys.clear();
+        cfg.container->body->apply(ifKeys);
+        applications.clear();
+        for (auto node : cfg.allNodes)
             if (auto tn = node->to<CFG::TableNode>())
-                convertTable(tn);
-            else if (auto in = node->to<CFG::IfNode>())
-                convertIf(in);
-            else if (auto d = node->to<CFG::DummyNode>())
-                convertDummy(d);
-            else
-                BUG("Unexpected CFG node %1%", node);
-        }
+                applications[tn->table]++;
+        for (auto node : cfg.allNodes)
+            generateNode(node);
+        flush();
     }
 };
 
-/// Allocates a register and inserts a declaration for a function
-/// returning the register in the DDlog program
-const IR::OF_Register* allocateRegister(
-    const IR::Declaration* decl,
-    OFResources& resources,
-    IR::Vector<IR::Node>* ddlog) {
-    auto reg = resources.allocateRegister(decl);
+/// Inserts in the DDlog program a declaration for a function
+/// returning the register 'reg'.
+static void declareRegister(const IR::OF_Register* reg, IR::Vector<IR::Node>* ddlog) {
     if (reg && !reg->friendlyName.isNullOrEmpty()) {
         auto ddfunc = new IR::DDlogFunction(
             IR::ID("r_" + reg->friendlyName),
@@ -941,20 +2142,41 @@ const IR::OF_Register* allocateRegister(
                 new IR::DDlogStringLiteral(reg->asDDlogString(false))));
         ddlog->push_back(ddfunc);
     }
+}
+
+/// Allocates a register and inserts a declaration for a function
+/// returning the register in the DDlog program
+const IR::OF_Register* allocateRegister(
+    const IR::Declaration* decl,
+    OFResources& resources,
+    IR::Vector<IR::Node>* ddlog) {
+    auto reg = resources.allocateRegister(decl);
+    declareRegister(reg, ddlog);
     return reg;
 }
 
-class ResourceAllocator : public Inspector {
-    OFResources& resources;
-    IR::Vector<IR::Node>* ddlog;
- public:
-    ResourceAllocator(OFResources& resources, IR::Vector<IR::Node>* ddlog):
-            resources(resources), ddlog(ddlog) { visitDagOnce = false; }
-    bool preorder(const IR::Declaration_Variable* decl) {
-        (void)allocateRegister(decl, resources, ddlog);
-        return false;
-    }
-};
+// OpenFlow table ids are 0-254; table 255 is reserved.
+const size_t OFP4Program::maxTables = 255;
+// P4Runtime servers commonly give tables without a size this many entries.
+const size_t OFP4Program::defaultTableSize = 1024;
+// The flows of the entries of a table have higher priorities.
+const unsigned OFP4Program::defaultActionPriority = 1;
+
+cstring FlowEstimate::formula() const {
+    if (perEntry == 0)
+        return Util::toString(fixed);
+    cstring result = (perEntry == 1 ? cstring("") : Util::toString(perEntry) + " * ") + "entries";
+    if (fixed)
+        result += " + " + Util::toString(fixed);
+    return result;
+}
+
+size_t OFP4Program::worstCaseFlows() const {
+    size_t result = fixedFlows;
+    for (auto& estimate : flowEstimates)
+        result += estimate.worstCase();
+    return result;
+}
 
 OFP4Program::OFP4Program(const IR::P4Program* program, const IR::ToplevelBlock* top,
                 P4::ReferenceMap* refMap, P4::TypeMap* typeMap):
@@ -971,19 +2193,13 @@ void OFP4Program::addFixedRules(IR::Vector<IR::Node> *declarations) {
                          new IR::OF_Constant(0)));
     match->push_back(new IR::OF_PriorityMatch(new IR::OF_Constant(100)));
     auto flowRule = new IR::OF_MatchAndAction(match, new IR::OF_DropAction());
-    declarations->push_back(makeFlowRule(flowRule, "drop if output port is 0"));
+    addFlowRule(this, declarations, flowRule, "drop if output port is 0");
 
     // send to output port from dedicated register
     flowRule = new IR::OF_MatchAndAction(
         new IR::OF_TableMatch(egressExitId),
         new IR::OF_OutputAction(outputPortRegister));
-    declarations->push_back(makeFlowRule(flowRule, "send to chosen port"));
-
-    // jump to multicast table
-    flowRule = new IR::OF_MatchAndAction(
-        new IR::OF_TableMatch(ingressExitId),
-        new IR::OF_ResubmitAction(multicastId));
-    declarations->push_back(makeFlowRule(flowRule, "jump to multicast table"));
+    addFlowRule(this, declarations, flowRule, "send to chosen port");
 
     // Fixed implementation of multicast table:
     // - multicast group is 0 - just forward to egress
@@ -993,41 +2209,59 @@ void OFP4Program::addFixedRules(IR::Vector<IR::Node> *declarations) {
     flowRule = new IR::OF_MatchAndAction(
         match,
         new IR::OF_ResubmitAction(egressStartId));
-    declarations->push_back(makeFlowRule(flowRule, "if multicast group is 0 just forward"));
+    addFlowRule(this, declarations, flowRule, "if multicast group is 0 just forward");
     // - multicast group non-zero: clone packet for each row from the MuticastGroup table
+    auto replica = new IR::OF_SeqAction(
+        new IR::OF_LoadAction(
+            new IR::OF_InterpolatedVarExpression("port", 16),
+            outputPortRegister),
+        new IR::OF_ResubmitAction(egressStartId));
+    auto lookupGroup = new IR::DDlogAtom(
+        "MulticastGroup", new IR::DDlogTupleExpression(
+            {new IR::DDlogVarName("mcast_id"), new IR::DDlogVarName("port")}));
     match = new IR::OF_SeqMatch();
     match->push_back(new IR::OF_TableMatch(multicastId));
     match->push_back(new IR::OF_EqualsMatch(multicastRegister,
                                             new IR::OF_InterpolatedVarExpression("mcast_id", multicastRegister->size)));
+    if (multicastGroups) {
+        // The group id is the multicast group id.  The runtime numbers
+        // the groups of action selectors above the multicast ids.
+        flowRule = new IR::OF_MatchAndAction(
+            match,
+            new IR::OF_GroupAction(new IR::OF_InterpolatedVarExpression("mcast_id", 32)));
+        declarations->push_back(new IR::DDlogRule(
+            makeFlowAtom(this, flowRule), { lookupGroup }, "multicast"));
+        // Each bucket is one replica, so a change in a group is a
+        // change in its buckets rather than in the flow.
+        auto bucket = new IR::DDlogAtom(
+            "MulticastBucket", new IR::DDlogTupleExpression({
+                new IR::DDlogVarName("mcast_id"),
+                new IR::DDlogVarName("port"),
+                makeActions(this, replica)}));
+        declarations->push_back(new IR::DDlogRule(bucket, { lookupGroup }, "multicast replicas"));
+        return;
+    }
     flowRule = new IR::OF_MatchAndAction(
         match,
         new IR::OF_InterpolatedVariableAction("outputs"));
-    auto lhs = makeFlowAtom(flowRule);
-
-    auto lookupGroup = new IR::DDlogAtom(
-        "MulticastGroup", new IR::DDlogTupleExpression(
-            {new IR::DDlogVarName("mcast_id"), new IR::DDlogVarName("port")}));
+    auto lhs = makeFlowAtom(this, flowRule);
 
-    auto clone = new IR::OF_CloneAction(
-        new IR::OF_SeqAction(
-            new IR::OF_LoadAction(
-                new IR::OF_InterpolatedVarExpression("port", 16),
-                outputPortRegister),
-            new IR::OF_ResubmitAction(egressStartId)));
+    auto clone = new IR::OF_CloneAction(replica);
     // TODO: This is not an accurate representation of the DDlog IR tree,
     // but it generates the same textual representation.
-    auto outputs = new IR::DDlogSetExpression(
-        "outputs",
+    auto groups = new IR::DDlogApply(
+        "to_vec",
         new IR::DDlogApply(
-            "join",
-            new IR::DDlogApply(
-                "to_vec",
-                new IR::DDlogApply(
-                    "group_by",
-                    new IR::DDlogStringLiteral(OpenFlowPrint::toString(clone)),
-                    { new IR::DDlogVarName("mcast_id") }),
-                {}),
-            { new IR::DDlogStringLiteral(", ") }));
+            "group_by",
+            makeActions(this, clone),
+            { new IR::DDlogVarName("mcast_id") }),
+        {});
+    const IR::DDlogExpression* joined;
+    if (structuredFlows)
+        joined = new IR::DDlogApply("flatten_actions", groups, {});
+    else
+        joined = new IR::DDlogApply("join", groups, { new IR::DDlogStringLiteral(", ") });
+    auto outputs = new IR::DDlogSetExpression("outputs", joined);
     auto rule = new IR::DDlogRule(lhs, { lookupGroup, new IR::DDlogExpressionTerm(outputs) },
                                   "multicast");
     declarations->push_back(rule);
@@ -1099,6 +2333,190 @@ void OFP4Program::build() {
     egress_meta_out = *it;
 }
 
+bool OFP4Program::assignStableTableIds(const std::vector<CFG::Node*>& order,
+                                       const CFG::Node* multicastNode) {
+    // The ingress pipeline must start at table 0, where OVS starts.
+    auto start = CFG::skipPassThrough(ingress_cfg.entryPoint);
+    IfKeys ingressIfs, egressIfs;
+    ingress_cfg.container->body->apply(ingressIfs);
+    egress_cfg.container->body->apply(egressIfs);
+    std::map<cstring, size_t> occurrences;
+    std::vector<cstring> keys;
+    for (auto n : order) {
+        cstring key;
+        if (n == multicastNode)
+            key = "multicast";
+        else if (ingress_cfg.allNodes.find(n) != ingress_cfg.allNodes.end())
+            key = stableNodeKey(ingress_cfg, ingressIfs, n);
+        else
+            key = stableNodeKey(egress_cfg, egressIfs, n);
+        // A table applied more than once, or the same condition tested
+        // in several places, is numbered by position.
+        size_t count = occurrences[key]++;
+        if (count)
+            key += " #" + Util::toString(count);
+        keys.push_back(key);
+    }
+
+    std::vector<bool> used(maxTables, false);
+    std::vector<bool> assigned(order.size(), false);
+    used[0] = true;
+    for (size_t i = 0; i < order.size(); i++) {
+        if (order.at(i) == start) {
+            order.at(i)->id = 0;
+            assigned[i] = true;
+            continue;
+        }
+        auto it = tableIds.find(keys.at(i));
+        if (it != tableIds.end() && it->second < maxTables && !used[it->second]) {
+            order.at(i)->id = it->second;
+            used[it->second] = true;
+            assigned[i] = true;
+        }
+    }
+    // New nodes take the lowest free ids.
+    size_t next = 0;
+    for (size_t i = 0; i < order.size(); i++) {
+        if (assigned[i])
+            continue;
+        while (next < maxTables && used[next])
+            next++;
+        if (next == maxTables) {
+            ::error(ErrorType::ERR_OVERLIMIT,
+                    "No OpenFlow table id is left for %1%; at most %2% tables are available",
+                    keys.at(i), maxTables);
+            return false;
+        }
+        order.at(i)->id = next;
+        used[next] = true;
+        LOG1("New table id " << next << " for " << keys.at(i));
+    }
+
+    tableIds.clear();
+    for (size_t i = 0; i < order.size(); i++)
+        tableIds.emplace(keys.at(i), order.at(i)->id);
+    return true;
+}
+
+void OFP4Program::analyzeRegisterWrites() {
+    // Every assignment of the program is in an action.  Translating the
+    // actions without their arguments treats each parameter as a value
+    // that may have any bit set.
+    auto writes = new RegisterWrites();
+    ActionTranslator translator(this);
+    auto analyze = [&](const IR::P4Action* action) {
+        if (auto body = translator.translate(action->body, false, 0))
+            body->checkedTo<IR::OF_Action>()->apply(*writes);
+    };
+    for (auto control : { ingress, egress })
+        for (auto decl : control->controlLocals)
+            if (auto action = decl->to<IR::P4Action>())
+                analyze(action);
+    for (auto decl : program->objects)
+        if (auto action = decl->to<IR::P4Action>())
+            analyze(action);
+
+    // The multicast stage loads the port of each replica.
+    auto replica = new IR::OF_LoadAction(new IR::OF_InterpolatedVarExpression("port", 16),
+                                         outputPortRegister);
+    replica->apply(*writes);
+    registerWrites = writes;
+}
+
+void OFP4Program::writeMegaflowReport(std::ostream& out) const {
+    CHECK_NULL(megaflow);
+    // Enumerate the paths from the first ingress table, through the
+    // multicast stage, to the end of egress.
+    std::vector<std::vector<const CFG::Node*>> paths;
+    std::vector<const CFG::Node*> path;
+    bool truncated = false;
+    std::function<void(const CFG::Node*)> walk = [&](const CFG::Node* node) {
+        if (paths.size() >= MegaflowAnalysis::maxPaths) {
+            truncated = true;
+            return;
+        }
+        path.push_back(node);
+        std::vector<const CFG::Node*> next;
+        if (node == multicastNode) {
+            next.push_back(CFG::skipPassThrough(egress_cfg.entryPoint));
+        } else {
+            for (auto e : node->successors.edges)
+                next.push_back(CFG::skipPassThrough(e->endpoint));
+        }
+        if (next.empty())
+            paths.push_back(path);
+        for (auto n : next)
+            walk(n);
+        path.pop_back();
+    };
+    walk(CFG::skipPassThrough(ingress_cfg.entryPoint));
+    megaflow->write(out, nodes, paths, truncated);
+}
+
+void OFP4Program::writeTableManifest(std::ostream& out) {
+    // The fields that the OVS classifier can track prefixes of, and
+    // the most that one OpenFlow table can track.
+    static const std::set<cstring> prefixFields = {
+        "nw_src", "nw_dst", "ipv6_src", "ipv6_dst",
+        "tun_src", "tun_dst", "tun_ipv6_src", "tun_ipv6_dst",
+    };
+    static const size_t maxPrefixes = 3;
+
+    ActionTranslator translator(this);
+    std::map<size_t, Util::JsonObject*> tables;
+    for (auto cfg : { &ingress_cfg, &egress_cfg }) {
+        for (auto node : cfg->allNodes) {
+            auto tn = node->to<CFG::TableNode>();
+            if (!tn)
+                continue;
+            auto keys = new Util::JsonArray();
+            auto prefixes = new Util::JsonArray();
+            std::set<cstring> tracked;
+            if (auto key = tn->table->getKey()) {
+                for (auto ke : key->keyElements) {
+                    cstring matchKind = ke->matchType->path->name.name;
+                    auto translated = translator.translate(ke->expression, false, 0);
+                    auto reg = translated ? translated->to<IR::OF_Register>() : nullptr;
+                    auto json = new Util::JsonObject();
+                    json->emplace("name", keyName(ke));
+                    json->emplace("match_kind", matchKind);
+                    json->emplace("bits", keyWidth(typeMap, ke));
+                    if (reg)
+                        json->emplace("field", reg->name);
+                    keys->append(json);
+
+                    // Prefix tracking pays off for keys whose masks
+                    // the control plane chooses.
+                    if (reg && (matchKind == "lpm" || matchKind == "ternary") &&
+                        prefixFields.count(reg->name) && tracked.size() < maxPrefixes &&
+                        tracked.insert(reg->name).second)
+                        prefixes->append(reg->name);
+                }
+            }
+            auto size = tn->table->getSizeProperty();
+            auto table = new Util::JsonObject();
+            table->emplace("id", static_cast<size_t>(tn->id));
+            table->emplace("name", cfg->container->externalName() + "." +
+                           tn->table->controlPlaneName());
+            if (size)
+                table->emplace("size", static_cast<size_t>(size->asUint64()));
+            else
+                table->emplace("size", Util::JsonValue::null);
+            table->emplace("keys", keys);
+            table->emplace("prefixes", prefixes);
+            tables.emplace(tn->id, table);
+        }
+    }
+
+    auto tablesJson = new Util::JsonArray();
+    for (auto& it : tables)
+        tablesJson->append(it.second);
+    auto result = new Util::JsonObject();
+    result->emplace("tables", tablesJson);
+    result->serialize(out);
+    out << std::endl;
+}
+
 IR::DDlogProgram* OFP4Program::convert() {
     // Collect here the DDlog program
     auto decls = new IR::Vector<IR::Node>();
@@ -1122,53 +2540,284 @@ IR::DDlogProgram* OFP4Program::convert() {
     CHECK_NULL(outputPortRegister);
     CHECK_NULL(multicastRegister);
 
-    ResourceAllocator allocator(resources, decls);
-    ingress->apply(allocator);
-    egress->apply(allocator);
-
     ingress_cfg.build(ingress, refMap, typeMap);
-    auto multicastNode = new CFG::DummyNode("multicast");
+    auto multicast = new CFG::DummyNode("multicast");
+    multicastNode = multicast;
     egress_cfg.build(egress, refMap, typeMap);
 
-    // Here we take advantage of the fact that node ids are not reused
-    // when building a new control flow graph.
-    startIngressId = ingress_cfg.entryPoint->id;
-    ingressExitId = ingress_cfg.exitPoint->id;
+    // Ingress continues with the multicast stage.  Nodes that only
+    // jump to another node would cost an extra lookup per packet;
+    // remove them.
+    ingress_cfg.exitPoint->successors.emplace(new CFG::Edge(multicast));
+    ingress_cfg.removePassThrough();
+    egress_cfg.removePassThrough();
+
+    // Local variables share registers when their live ranges do not
+    // overlap, in the graphs without the pass-through nodes.
+    RegisterAllocator allocator(refMap, typeMap, resources);
+    allocator.analyze(ingress_cfg);
+    allocator.analyze(egress_cfg);
+    for (auto decl : allocator.allocate())
+        declareRegister(resources.getRegister(decl), decls);
+
+    // Number the tables so that every edge goes to a larger table id;
+    // this lets flows use goto_table instead of resubmit.
+    std::vector<CFG::Node*> order = ingress_cfg.topologicalOrder();
+    order.push_back(multicast);
+    for (auto n : egress_cfg.topologicalOrder())
+        order.push_back(n);
+    if (order.size() > maxTables) {
+        ::error(ErrorType::ERR_OVERLIMIT,
+                "Program needs %1% OpenFlow tables, but at most %2% are available",
+                order.size(), maxTables);
+        return nullptr;
+    }
+    if (stableTableIds) {
+        if (!assignStableTableIds(order, multicast))
+            return nullptr;
+    } else {
+        unsigned tableId = 0;
+        for (auto n : order)
+            n->id = tableId++;
+    }
+    tableCount = order.size();
+    nodes.assign(order.begin(), order.end());
+    std::sort(nodes.begin(), nodes.end(),
+              [](const CFG::Node* a, const CFG::Node* b) { return a->id < b->id; });
+
+    startIngressId = CFG::skipPassThrough(ingress_cfg.entryPoint)->id;
+    // OVS starts each packet in table 0.
+    BUG_CHECK(startIngressId == 0, "ingress starts at table %1%", startIngressId);
+    ingressExitId = CFG::skipPassThrough(ingress_cfg.exitPoint)->id;
     multicastId = multicastNode->id;
-    egressStartId = egress_cfg.entryPoint->id;
+    egressStartId = CFG::skipPassThrough(egress_cfg.entryPoint)->id;
     egressExitId = egress_cfg.exitPoint->id;
 
+    // Stable ids may number a stage before one that jumps to it, and
+    // such a jump is a resubmit instead of a goto_table.
+    backwardJumps = 0;
+    for (auto n : order)
+        for (auto e : n->successors.edges)
+            if (e->endpoint->id < n->id)
+                backwardJumps++;
+    if (multicastId < ingressExitId)
+        backwardJumps++;
+    if (egressStartId < multicastId)
+        backwardJumps++;
+    if (backwardJumps)
+        ::warning(ErrorType::WARN_ORDERING,
+                  "%1% jumps between pipeline stages go to a lower OpenFlow table id, "
+                  "because of the ids kept from %2%, and take a resubmit instead of "
+                  "goto_table; remove the file to renumber all stages",
+                  backwardJumps, tableIdMapFile);
+
+    // The longest chain of tables, counting multicast as the
+    // link between ingress and egress.
+    std::map<const CFG::Node*, size_t> depth;
+    for (auto it = order.rbegin(); it != order.rend(); ++it) {
+        auto n = *it;
+        size_t longest = 0;
+        for (auto e : n->successors.edges)
+            longest = std::max(longest, depth[e->endpoint]);
+        if (n == multicastNode)
+            longest = depth[CFG::skipPassThrough(egress_cfg.entryPoint)];
+        depth[n] = longest + 1;
+    }
+    longestPath = depth[CFG::skipPassThrough(ingress_cfg.entryPoint)];
+
     DeclarationGenerator dgen(this, decls);
     program->apply(dgen);
+    if (narrowMatches) {
+        analyzeRegisterWrites();
+        if (::errorCount() > 0)
+            return nullptr;
+    }
 
     FlowGenerator rgen(this, decls);
     rgen.generate(ingress_cfg, ingressExitId);
     rgen.generate(egress_cfg, egressExitId);
+    rgen.finish();
+    size_t firstDecl = decls->size();
+    size_t firstStatic = staticFlows.size();
     addFixedRules(decls);
+    std::map<cstring, size_t> joins;
+    countFlows(this, decls, firstDecl, firstStatic, fixedFlows, joins);
+    flowsPerMulticastGroup = joins["MulticastGroup"];
+
+    // Records that the static flows are in a file of their own, so that
+    // the runtime refuses to run the program without them.
+    if (separateStaticFlows) {
+        size_t count = std::count_if(staticFlows.begin(), staticFlows.end(),
+                                     [](cstring flow) { return !flow.startsWith("#"); });
+        decls->push_back(new IR::DDlogRelationSugared(
+            IR::ID("StaticFlows"), IR::Direction::Out,
+            IR::IndexedVector<IR::Parameter>({
+                new IR::Parameter("count", IR::Direction::None, IR::Type_Bits::get(32))})));
+        decls->push_back(new IR::DDlogRule(
+            new IR::DDlogAtom("StaticFlows", new IR::DDlogTupleExpression(
+                IR::Vector<IR::DDlogExpression>({
+                    new IR::DDlogLiteral(Util::toString(count))}))),
+            {}, "number of flows written with --static-flows"));
+    }
+    if (stats)
+        stats->add("action_cache_hits", rgen.actionCacheHits());
 
     auto result = new IR::DDlogProgram(decls);
     return result;
 }
 
-void BackEnd::run(OFP4Options& options, const IR::P4Program* program) {
+/// Reads the table ids written by a previous compilation from 'file'
+/// into 'ids'.  A missing file means that there is no previous compilation.
+static bool readTableIdMap(cstring file, std::map<cstring, size_t>& ids) {
+    std::ifstream in(file);
+    if (!in)
+        return true;
+    std::string line;
+    size_t lineno = 0;
+    while (std::getline(in, line)) {
+        lineno++;
+        if (line.empty() || line[0] == '#')
+            continue;
+        size_t space = line.find(' ');
+        char* end;
+        size_t id = strtoul(line.c_str(), &end, 10);
+        if (space == std::string::npos || end != line.c_str() + space) {
+            ::error(ErrorType::ERR_INVALID, "%1%:%2%: expected table id and key", file, lineno);
+            return false;
+        }
+        ids.emplace(line.substr(space + 1), id);
+    }
+    return true;
+}
+
+/// Writes 'ids' to 'file', ordered by id, to be read back by the next compilation.
+static bool writeTableIdMap(cstring file, const std::map<cstring, size_t>& ids) {
+    auto out = openFile(file, false);
+    if (out == nullptr)
+        return false;
+    std::vector<std::pair<size_t, cstring>> byId;
+    for (auto& it : ids)
+        byId.emplace_back(it.second, it.first);
+    std::sort(byId.begin(), byId.end());
+    *out << "# OpenFlow table ids assigned by p4c-of; read back by the next compilation" << std::endl;
+    for (auto& it : byId)
+        *out << it.first << " " << it.second << std::endl;
+    return true;
+}
+
+bool BackEnd::generate(OFP4Options& options, const IR::P4Program* program,
+                       BackEndOutput& output) {
     P4::EvaluatorPass evaluator(refMap, typeMap);
     program = program->apply(evaluator);
+    if (stats)
+        stats->endPass("backend/EvaluatorPass");
     if (::errorCount() > 0)
-        return;
+        return false;
     auto top = evaluator.getToplevelBlock();
     auto main = top->getMain();
     if (main == nullptr) {
         ::warning(ErrorType::WARN_MISSING,
                   "Could not locate top-level block; is there a '%1%' package?",
                   IR::P4Program::main);
-        return;
+        return false;
     }
     OFP4Program ofp(program, top, refMap, typeMap);
+    ofp.resources.setPackBits(options.packBits);
+    ofp.structuredFlows = options.structuredFlows;
+    ofp.separateStaticFlows = !options.staticFlowsFile.isNullOrEmpty();
+    ofp.stats = stats;
+    ofp.multicastGroups = options.multicastGroups;
+    ofp.narrowMatches = options.narrowMatches;
+    ofp.perTableFlows = options.perTableFlows;
+    if (!options.megaflowReportFile.isNullOrEmpty())
+        ofp.megaflow = new MegaflowAnalysis();
+    if (options.multicastGroups && options.structuredFlows) {
+        ::error(ErrorType::ERR_UNSUPPORTED,
+                "--multicast-groups is not supported with --structured-flows");
+        return false;
+    }
+    if (!options.tableIdMapFile.isNullOrEmpty()) {
+        ofp.stableTableIds = true;
+        ofp.tableIdMapFile = options.tableIdMapFile;
+        if (!readTableIdMap(options.tableIdMapFile, ofp.tableIds))
+            return false;
+    }
     ofp.build();
+    if (stats)
+        stats->endPass("backend/build");
     if (::errorCount() > 0)
-        return;
+        return false;
     auto ddlogProgram = ofp.convert();
+    if (stats)
+        stats->endPass("backend/convert");
     if (!ddlogProgram)
+        return false;
+    if (stats) {
+        stats->add("openflow_tables", ofp.tableCount);
+        stats->add("longest_path_tables", ofp.longestPath);
+        stats->add("longest_path_resubmits", ofp.longestPath ? ofp.longestPath - 1 : 0);
+        stats->add("backward_jumps", ofp.backwardJumps);
+        stats->add("register_bits", ofp.resources.usedBits());
+        stats->add("register_bytes", (ofp.resources.usedBits() + 7) / 8);
+        stats->add("peak_register_pressure_bits", ofp.resources.peakPressure);
+        stats->add("ddlog_declarations", ddlogProgram->declarations.size());
+        auto estimates = ofp.flowEstimates;
+        std::sort(estimates.begin(), estimates.end(),
+                  [](const FlowEstimate& a, const FlowEstimate& b) { return a.id < b.id; });
+        for (auto& estimate : estimates)
+            stats->addFlows(estimate.name, estimate.id, estimate.formula(), estimate.entries,
+                            estimate.entriesFrom, estimate.worstCase());
+        stats->add("fixed_flows", ofp.fixedFlows);
+        stats->add("flows_per_multicast_group", ofp.flowsPerMulticastGroup);
+        stats->add("worst_case_flows", ofp.worstCaseFlows());
+    }
+
+    if (options.maxFlows && ofp.worstCaseFlows() > options.maxFlows) {
+        // Name the tables that take the most flows, since they are the
+        // ones to shrink.
+        auto estimates = ofp.flowEstimates;
+        std::stable_sort(estimates.begin(), estimates.end(),
+                         [](const FlowEstimate& a, const FlowEstimate& b) {
+                             return a.worstCase() > b.worstCase(); });
+        std::stringstream largest;
+        for (size_t i = 0; i < estimates.size() && i < 3; i++) {
+            auto& estimate = estimates.at(i);
+            largest << (i ? ", " : "") << estimate.name << ": " << estimate.formula()
+                    << " = " << estimate.worstCase() << " with " << estimate.entries
+                    << " entries (" << estimate.entriesFrom << ")";
+        }
+        ::error(ErrorType::ERR_OVERLIMIT,
+                "the program can take %1% OpenFlow flows, more than --max-flows %2%; "
+                "the largest tables are %3%",
+                ofp.worstCaseFlows(), options.maxFlows, cstring(largest.str()));
+        return false;
+    }
+
+    if (ofp.stableTableIds && !writeTableIdMap(options.tableIdMapFile, ofp.tableIds))
+        return false;
+
+    if (ofp.megaflow) {
+        auto reportStream = openFile(options.megaflowReportFile, false);
+        if (reportStream == nullptr)
+            return false;
+        ofp.writeMegaflowReport(*reportStream);
+    }
+
+    if (!options.tableManifestFile.isNullOrEmpty()) {
+        auto manifestStream = openFile(options.tableManifestFile, false);
+        if (manifestStream == nullptr)
+            return false;
+        ofp.writeTableManifest(*manifestStream);
+    }
+
+    output.ddlog = ddlogProgram;
+    output.staticFlows = ofp.staticFlows;
+    return true;
+}
+
+void BackEnd::run(OFP4Options& options, const IR::P4Program* program) {
+    BackEndOutput output;
+    if (!generate(options, program, output))
         return;
 
     if (options.outputFile.isNullOrEmpty())
@@ -1176,7 +2825,20 @@ void BackEnd::run(OFP4Options& options, const IR::P4Program* program) {
     auto dlStream = openFile(options.outputFile, false);
     if (dlStream == nullptr)
         return;
-    ddlogProgram->emit(*dlStream);
+    output.ddlog->emit(*dlStream);
+    if (stats) {
+        dlStream->flush();
+        stats->endPass("backend/emit");
+        stats->add("output_bytes", static_cast<size_t>(dlStream->tellp()));
+    }
+
+    if (options.staticFlowsFile.isNullOrEmpty())
+        return;
+    auto flowsStream = openFile(options.staticFlowsFile, false);
+    if (flowsStream == nullptr)
+        return;
+    for (auto flow : output.staticFlows)
+        *flowsStream << flow << std::endl;
 }
 
 }  // namespace OFP4
@@ -26,16 +26,52 @@ limitations under the License.
 #include "options.h"
 #include "resources.h"
 #include "controlFlowGraph.h"
+#include "megaflow.h"
+#include "stats.h"
 
 namespace OFP4 {
 
+/// What the back end generates for a program.
+struct BackEndOutput {
+    const IR::DDlogProgram* ddlog = nullptr;
+    /// With --static-flows, the flows that do not depend on DDlog
+    /// relations, and comments, in ovs-ofctl syntax.
+    std::vector<cstring> staticFlows;
+};
+
+/// A bound on the number of flows of a CFG node as a function of the
+/// number of entries of its P4 table: 'perEntry' flows for each of at
+/// most 'entries' entries, plus 'fixed' flows.
+struct FlowEstimate {
+    cstring name;
+    size_t id = 0;
+    size_t perEntry = 0;
+    size_t fixed = 0;
+    size_t entries = 0;
+    // Where 'entries' comes from: "size", "const entries", "no key",
+    // or "default size" for a table without a size.
+    cstring entriesFrom = "no key";
+
+    size_t worstCase() const { return perEntry * entries + fixed; }
+    /// E.g. "3 * entries + 1".
+    cstring formula() const;
+};
+
 /// P4 compiler backend for OpenFlow targets.
 class BackEnd {
     P4::ReferenceMap* refMap;
     P4::TypeMap*      typeMap;
+    CompileStats*     stats;  // may be nullptr
  public:
-    BackEnd(P4::ReferenceMap* refMap, P4::TypeMap* typeMap):
-            refMap(refMap), typeMap(typeMap) {}
+    BackEnd(P4::ReferenceMap* refMap, P4::TypeMap* typeMap, CompileStats* stats = nullptr):
+            refMap(refMap), typeMap(typeMap), stats(stats) {}
+    /// Generates the outputs for 'program' into 'output', and writes the
+    /// table id map, megaflow report and table manifest that 'options'
+    /// asks for.
+    /// Returns false on error.
+    bool generate(OFP4Options& options, const IR::P4Program* program, BackEndOutput& output);
+    /// Like generate(), but also writes the DDlog program and the static
+    /// flows to the files that 'options' names.
     void run(OFP4Options& options, const IR::P4Program* program);
 };
 
@@ -69,24 +105,91 @@ class OFP4Program {
     const IR::Type_Struct* ingress_to_arch_t = nullptr;  // type of ingress_itoa
     const IR::Type_Struct* output_metadata_t = nullptr;  // type of ingress_meta_out,egress_meta_out
 
+    static const size_t maxTables;  // number of usable OpenFlow tables
+    static const size_t defaultTableSize;  // entries of a table without a size
+    static const unsigned defaultActionPriority;  // OpenFlow priority of a default action
+
     // These will be used as OF table=ID nodes in the generated code.
-    size_t startIngressId;  // CFG node id of the entry point to ingress
-    size_t ingressExitId;   // CFG node id of the ingress exit point
+    // Pass-through nodes are removed from the CFGs, so some of these
+    // are the ids of the nodes that replace them.  Ids are assigned
+    // in topological order, ingress first, then multicast, then egress.
+    size_t startIngressId;  // CFG node id of the first ingress node
+    size_t ingressExitId;   // CFG node id where ingress continues on exit
     size_t multicastId;     // CFG node id of the built-in multicast stage
-    size_t egressStartId;   // CFG node id of the entry point to egress
+    size_t egressStartId;   // CFG node id of the first egress node
     size_t egressExitId;    // CFG node id of the exit point of egress
     OFResources resources;
+    // Generate StructuredFlow records instead of Flow strings.
+    bool structuredFlows = false;
+    // Collect the flows that do not depend on DDlog relations in
+    // 'staticFlows' instead of generating DDlog rules for them.
+    bool separateStaticFlows = false;
+    // Constant flows and comments, in ovs-ofctl syntax.
+    std::vector<cstring> staticFlows;
+    // Send multicast packets to a group of type all, whose buckets the
+    // runtime builds from the 'MulticastBucket' relation.
+    bool multicastGroups = false;
+    // Narrow matches on registers using 'registerWrites'.
+    bool narrowMatches = false;
+    // Put the flows of each OpenFlow table in their own relation, such
+    // as 'Flow_3', instead of in 'Flow'.
+    bool perTableFlows = false;
+    // Keep table ids stable across compilations, using 'tableIds', read
+    // from 'tableIdMapFile'.
+    bool stableTableIds = false;
+    cstring tableIdMapFile = nullptr;
+    // Stable key of each CFG node to its table id; read from the
+    // previous compilation and updated by convert().
+    std::map<cstring, size_t> tableIds;
+    // Number of OpenFlow tables used.
+    size_t tableCount = 0;
+    // Maximum number of OpenFlow tables that a packet traverses.
+    size_t longestPath = 0;
+    // Jumps from a stage to one with a lower table id, which need a
+    // resubmit; only stable table ids make any.
+    size_t backwardJumps = 0;
+    // The flows of each CFG node, as a function of its table's entries.
+    std::vector<FlowEstimate> flowEstimates;
+    // Flows of the built-in stages, and flows for each multicast group.
+    size_t fixedFlows = 0;
+    size_t flowsPerMulticastGroup = 0;
+    CompileStats* stats = nullptr;  // if set, collects per-table statistics
+    // If set, matches on registers are narrowed to the bits these writes may set.
+    const RegisterWrites* registerWrites = nullptr;
+    // If set, collects the bits that the flows of each table un-wildcard.
+    MegaflowAnalysis* megaflow = nullptr;
     const IR::OF_Register* outputPortRegister = nullptr;
     const IR::OF_Register* multicastRegister = nullptr;
 
     CFG ingress_cfg;
     CFG egress_cfg;
+    const CFG::Node* multicastNode = nullptr;
+    // All CFG nodes, in table id order.
+    std::vector<const CFG::Node*> nodes;
 
     OFP4Program(const IR::P4Program* program, const IR::ToplevelBlock* top,
                 P4::ReferenceMap* refMap, P4::TypeMap* typeMap);
     void build();
     void addFixedRules(IR::Vector<IR::Node> *declarations);
     IR::DDlogProgram* convert();
+    /// Writes the report of 'megaflow' for the converted program.
+    void writeMegaflowReport(std::ostream& out) const;
+    /// Writes, as JSON, the OpenFlow id, P4 name, size and key fields
+    /// of each table of the converted program, and the fields whose
+    /// prefixes the OVS classifier should track for it.
+    void writeTableManifest(std::ostream& out);
+    /// The number of flows of the converted program with every table
+    /// full, not counting those for multicast groups.
+    size_t worstCaseFlows() const;
+
+ private:
+    /// Numbers the nodes in 'order' so that the nodes in 'tableIds' keep
+    /// their ids, and updates 'tableIds' to the new numbering.  Reports
+    /// an error and returns false if the ids run out.
+    bool assignStableTableIds(const std::vector<CFG::Node*>& order,
+                              const CFG::Node* multicastNode);
+    /// Computes 'registerWrites' from the actions of the program.
+    void analyzeRegisterWrites();
 };
 
 }  // namespace OFP4
@@ -0,0 +1,253 @@
+#!/usr/bin/env python3
+# Copyright 2022 Vmware, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#    http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Benchmarks p4c-of on synthetic programs.  This script is invoked
+   by 'make bench-of' from the p4c build directory.  It generates
+   of_model.p4 programs of increasing size, compiles each one with
+   p4c-of, and reports the compile time, the peak memory, the size of
+   the DDlog output and the number of rules generated.
+
+   Every size parameter takes a comma-separated list of values; one
+   program is generated for each combination.
+"""
+
+import argparse
+import itertools
+import json
+import os
+import subprocess
+import sys
+import time
+
+SUCCESS = 0
+FAILURE = 1
+
+HEADER = """/* Synthetic benchmark program for p4c-of, generated by bench-of.py:
+ * {tables} tables, {keys} keys per table ({optional} optional),
+ * {actions} actions per table, if-nesting depth {depth}.
+ */
+
+#include <of_model.p4>
+
+"""
+
+FOOTER = """
+control PEgress(inout Headers hdr,
+                inout metadata_t meta,
+                in input_metadata_t meta_in,
+                inout output_metadata_t from_ingress) {
+    apply {
+        // Nothing to do.
+    }
+}
+
+OfSwitch (
+    PIngress(),
+    PEgress()
+) main;
+"""
+
+
+class Shape(object):
+    """Size parameters of one synthetic program"""
+    def __init__(self, tables, keys, optional, actions, depth):
+        self.tables = tables
+        self.keys = keys
+        self.optional = optional
+        self.actions = actions
+        self.depth = depth
+
+    def name(self):
+        return "bench_t{}_k{}_o{}_a{}_d{}".format(
+            self.tables, self.keys, self.optional, self.actions, self.depth)
+
+    def valid(self):
+        return (self.tables > 0 and self.keys > 0 and self.actions > 0 and
+                0 <= self.optional <= self.keys and self.depth >= 0)
+
+
+def generate(shape):
+    """Returns the text of a P4 program with the given shape.  Tables
+       match on metadata fields and their actions write metadata fields,
+       so every table depends on the ones before it.  The tables are
+       spread over 'depth' levels of nested if statements."""
+    fields = max(shape.keys, shape.actions)
+    out = [HEADER.format(**vars(shape))]
+
+    out.append("struct metadata_t {\n")
+    for f in range(fields):
+        out.append("    bit<16> f{};\n".format(f))
+    out.append("}\n\n")
+
+    out.append("""control PIngress(inout Headers hdr,
+                 out metadata_t meta,
+                 in input_metadata_t meta_in,
+                 inout ingress_to_arch_t itoa,
+                 inout output_metadata_t meta_out) {
+""")
+    for a in range(shape.actions):
+        out.append("    action Set{}(bit<16> v) {{ meta.f{} = v; }}\n".format(a, a))
+    out.append("    action Output(PortID port) { meta_out.out_port = port; }\n\n")
+
+    actions = " ".join("Set{};".format(a) for a in range(shape.actions))
+    for t in range(shape.tables):
+        out.append("    table T{} {{\n        key = {{\n".format(t))
+        for k in range(shape.keys):
+            # Rotate the keys so that the tables do not all look alike.
+            field = (t + k) % fields
+            kind = "optional" if k < shape.optional else "exact"
+            out.append("            meta.f{}: {} @name(\"k{}\");\n".format(field, kind, k))
+        out.append("        }\n")
+        out.append("        actions = {{ {} NoAction; }}\n".format(actions))
+        out.append("        default_action = NoAction();\n    }\n\n")
+
+    out.append("""    table Forward {
+        key = { meta.f0: exact @name("f0"); }
+        actions = { Output; }
+    }
+
+""")
+
+    # Table t goes at nesting level t % (depth + 1).
+    levels = [[] for _ in range(shape.depth + 1)]
+    for t in range(shape.tables):
+        levels[t % (shape.depth + 1)].append(t)
+
+    out.append("    apply {\n")
+    indent = "        "
+    for level, tables in enumerate(levels):
+        if level > 0:
+            out.append("{}if (meta.f{} == {}) {{\n".format(indent, level % fields, level))
+            indent += "    "
+        for t in tables:
+            out.append("{}T{}.apply();\n".format(indent, t))
+    for level in range(shape.depth, 0, -1):
+        indent = indent[:-4]
+        out.append("{}}}\n".format(indent))
+    out.append("        Forward.apply();\n")
+    out.append("    }\n}\n")
+    out.append(FOOTER)
+    return "".join(out)
+
+
+def compile_program(options, shape):
+    """Compiles the program for 'shape' and returns a dictionary of
+       measurements, or None if compilation failed"""
+    base = os.path.join(options.outputDir, shape.name())
+    p4file = base + ".p4"
+    dlfile = base + ".dl"
+    statsfile = base + ".json"
+    with open(p4file, "w") as f:
+        f.write(generate(shape))
+
+    args = [options.compiler, "-o", dlfile, "--stats", statsfile] + options.compilerOptions
+    args.append(p4file)
+    if options.verbose:
+        print(" ".join(args))
+
+    best = None
+    for _ in range(options.repeat):
+        start = time.monotonic()
+        pid = subprocess.Popen(args).pid
+        # wait4 reports the resources used by this child only.
+        _, status, usage = os.wait4(pid, 0)
+        seconds = time.monotonic() - start
+        if os.waitstatus_to_exitcode(status) != SUCCESS:
+            print("Error compiling", p4file, file=sys.stderr)
+            return None
+        if best is None or seconds < best["seconds"]:
+            best = {"seconds": seconds, "peak_rss_kb": usage.ru_maxrss}
+
+    with open(statsfile) as f:
+        stats = json.load(f)
+    tables = stats.get("tables", [])
+    best.update(vars(shape))
+    best["dl_bytes"] = os.path.getsize(dlfile)
+    best["rules"] = sum(t["rules"] for t in tables)
+    best["constant_flows"] = sum(t["constant_flows"] for t in tables)
+    best["openflow_tables"] = stats.get("program", {}).get("openflow_tables", 0)
+    # The slowest passes say where the time goes.
+    passes = sorted(stats.get("passes", []), key=lambda p: p["seconds"], reverse=True)
+    best["slowest_passes"] = [(p["name"], p["seconds"]) for p in passes[:3]]
+    return best
+
+
+COLUMNS = ["tables", "keys", "optional", "actions", "depth",
+           "seconds", "peak_rss_kb", "dl_bytes", "rules", "constant_flows",
+           "openflow_tables"]
+
+
+def print_results(results):
+    print(" ".join("{:>14}".format(c) for c in COLUMNS))
+    for r in results:
+        row = []
+        for c in COLUMNS:
+            value = r[c]
+            row.append("{:>14.3f}".format(value) if isinstance(value, float)
+                       else "{:>14}".format(value))
+        print(" ".join(row))
+
+
+def int_list(text):
+    return [int(v) for v in text.split(",")]
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--compiler", default="./p4c-of",
+                        help="p4c-of binary to benchmark")
+    parser.add_argument("--output-dir", dest="outputDir", default="bench-of",
+                        help="directory for the generated programs and outputs")
+    parser.add_argument("--tables", type=int_list, default=[1, 10, 100])
+    parser.add_argument("--keys", type=int_list, default=[1, 4])
+    parser.add_argument("--optional-keys", dest="optional", type=int_list, default=[0, 2])
+    parser.add_argument("--actions", type=int_list, default=[1, 8])
+    parser.add_argument("--depth", type=int_list, default=[0, 4])
+    parser.add_argument("--repeat", type=int, default=1,
+                        help="compile each program this many times and keep the fastest run")
+    parser.add_argument("-a", dest="compilerOptions", default="",
+                        help="extra arguments to pass to the compiler")
+    parser.add_argument("--json", help="also write the results to this file")
+    parser.add_argument("-v", dest="verbose", action="store_true",
+                        help="verbose operation")
+    options = parser.parse_args(argv[1:])
+    options.compilerOptions = options.compilerOptions.split()
+
+    os.makedirs(options.outputDir, exist_ok=True)
+    results = []
+    failed = False
+    for params in itertools.product(options.tables, options.keys, options.optional,
+                                    options.actions, options.depth):
+        shape = Shape(*params)
+        if not shape.valid():
+            continue
+        result = compile_program(options, shape)
+        if result is None:
+            failed = True
+            continue
+        results.append(result)
+        if options.verbose:
+            print(shape.name(), "slowest passes:", result["slowest_passes"])
+
+    print_results(results)
+    if options.json:
+        with open(options.json, "w") as f:
+            json.dump(results, f, indent=2)
+    sys.exit(FAILURE if failed else SUCCESS)
+
+
+if __name__ == "__main__":
+    main(sys.argv)
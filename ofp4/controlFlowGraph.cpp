@@ -15,6 +15,8 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 
+#include <algorithm>
+
 #include "controlFlowGraph.h"
 
 #include "ir/ir.h"
@@ -84,6 +86,78 @@ void CFG::Node::computeSuccessors() {
         e->getNode()->successors.emplace(e->clone(this));
 }
 
+bool CFG::Node::isPassThrough() const {
+    if (successors.size() == 0)
+        return false;
+    if (is<DummyNode>())
+        return successors.size() == 1 && (*successors.edges.begin())->isUnconditional();
+    if (is<IfNode>()) {
+        // Both branches lead to the same place: the condition does not matter.
+        auto first = (*successors.edges.begin())->endpoint;
+        for (auto e : successors.edges)
+            if (e->endpoint != first)
+                return false;
+        return true;
+    }
+    return false;
+}
+
+CFG::Node* CFG::skipPassThrough(CFG::Node* node) {
+    // The graph is acyclic, so this terminates.
+    while (node->isPassThrough())
+        node = (*node->successors.edges.begin())->endpoint;
+    return node;
+}
+
+void CFG::removePassThrough() {
+    // Redirecting edges may make more 'if' nodes pass-through,
+    // so repeat until nothing changes.
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto n : allNodes)
+            for (auto e : n->successors.edges)
+                e->endpoint = skipPassThrough(e->endpoint);
+        std::vector<Node*> removed;
+        for (auto n : allNodes)
+            if (n->isPassThrough())
+                removed.push_back(n);
+        for (auto n : removed) {
+            LOG2("Removing pass-through node " << n);
+            allNodes.erase(n);
+            changed = true;
+        }
+    }
+}
+
+namespace {
+void postorder(CFG::Node* node, const ordered_set<CFG::Node*>& nodes,
+               std::set<CFG::Node*>& visited, std::vector<CFG::Node*>& result) {
+    if (nodes.find(node) == nodes.end() || visited.count(node))
+        return;
+    visited.emplace(node);
+    for (auto e : node->successors.edges)
+        postorder(e->endpoint, nodes, visited, result);
+    result.push_back(node);
+}
+}  // namespace
+
+std::vector<CFG::Node*> CFG::topologicalOrder() const {
+    // Reverse postorder of a depth-first traversal; edges that leave
+    // the graph, e.g., to the multicast stage, are ignored.
+    std::set<Node*> visited;
+    std::vector<Node*> result;
+    postorder(skipPassThrough(entryPoint), allNodes, visited, result);
+    std::reverse(result.begin(), result.end());
+    for (auto n : allNodes) {
+        if (!visited.count(n)) {
+            visited.emplace(n);
+            result.push_back(n);
+        }
+    }
+    return result;
+}
+
 bool CFG::EdgeSet::isDestination(const CFG::Node* node) const {
     for (auto e : edges) {
         auto dest = e->endpoint;
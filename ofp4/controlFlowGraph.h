@@ -64,7 +64,9 @@ class CFG final : public IHasDbPrint {
         virtual ~Node() {}
 
      public:
-        const unsigned id;
+        /// Unique at creation; the backend renumbers the nodes that
+        /// survive simplification so they fit in the OpenFlow table range.
+        unsigned       id;
         const cstring  name;
         EdgeSet        successors;
 
@@ -74,6 +76,9 @@ class CFG final : public IHasDbPrint {
         template<typename T> T* to() { return dynamic_cast<T*>(this); }
         template<typename T> const T* to() const { return dynamic_cast<const T*>(this); }
         void computeSuccessors();
+        /// True if executing this node has no effect other than
+        /// continuing with its single successor.
+        bool isPassThrough() const;
         cstring toString() const { return name; }
     };
 
@@ -175,6 +180,17 @@ class CFG final : public IHasDbPrint {
     void dbprint(std::ostream& out) const;
     void computeSuccessors()
     { for (auto n : allNodes) n->computeSuccessors(); }
+    /// Follows the chain of pass-through nodes that starts at 'node' and
+    /// returns the first node that does some work.
+    static Node* skipPassThrough(Node* node);
+    /// Removes the pass-through nodes from the graph, redirecting the
+    /// edges that lead to them.  'entryPoint' and 'exitPoint' are left
+    /// unchanged even if they are removed; use skipPassThrough() to find
+    /// the nodes that replace them.
+    void removePassThrough();
+    /// Returns the nodes of the graph such that every node precedes
+    /// all its successors.  Nodes unreachable from the entry point come last.
+    std::vector<Node*> topologicalOrder() const;
 };
 
 }  // namespace OFP4
@@ -14,200 +14,338 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 
+#include <sstream>
+
 #include "ir/ir.h"
+#include "ir/visitor.h"
 
 // Implementation of methods for the DDlog* IR classes
 
 namespace IR {
 
-void DDlogProgram::emit(std::ostream &o) const {
-    for (auto d : *declarations) {
-        o << d->toString() << std::endl;
-    }
-    o.flush();
-}
+namespace {
 
-cstring DDlogTypeAlt::toString() const {
-    cstring result = "";
-    bool first = true;
-    for (auto alt : alternatives) {
-        if (!first)
-            result += " | ";
-        first = false;
-        result += alt->toString();
-    }
-    return result;
-}
+/// Writes DDlog IR nodes as text directly to a stream.  Building the
+/// text with cstring concatenation would intern every intermediate
+/// string, which is quadratic in the size of the output; this is
+/// linear and does not allocate.
+class DDlogEmitter : public Inspector {
+    std::ostream& out;
+    /// Spaces added after each newline, for function bodies.
+    unsigned indentation = 0;
 
-static cstring direction_to_string(const IR::Declaration* type, Direction direction) {
-    switch (direction) {
-        case IR::Direction::None:
-            return "";
-        case IR::Direction::In:
-            return "input ";
-        case IR::Direction::Out:
-            return "output ";
-        default:
-            BUG("%1% direction 'inout' unexpected", type);
+    void newline() {
+        out << '\n';
+        for (unsigned i = 0; i < indentation; i++)
+            out << ' ';
+    }
+    /// Writes 'text', indenting the lines after the first one.
+    void text(cstring text) {
+        if (indentation == 0) {
+            out << text;
+            return;
+        }
+        for (const char* c = text.c_str(); *c; c++) {
+            if (*c == '\n')
+                newline();
+            else
+                out << *c;
+        }
+    }
+    /// Writes 'elements' separated by 'separator'.
+    template<typename T>
+    void list(const T& elements, const char* separator) {
+        bool first = true;
+        for (auto e : elements) {
+            if (!first)
+                out << separator;
+            first = false;
+            visit(e);
+        }
+    }
+    void parameters(const IndexedVector<Parameter>& parameters) {
+        out << "(";
+        bool first = true;
+        for (auto p : parameters) {
+            if (!first)
+                out << ", ";
+            first = false;
+            out << p->name.toString() << ": ";
+            visit(p->type);
+        }
+        out << ")";
+    }
+    void direction(const Declaration* decl, Direction direction) {
+        switch (direction) {
+            case Direction::None:
+                return;
+            case Direction::In:
+                out << "input ";
+                return;
+            case Direction::Out:
+                out << "output ";
+                return;
+            default:
+                BUG("%1% direction 'inout' unexpected", decl);
+        }
     }
-}
-
-cstring DDlogRelationDirect::toString() const {
-    return direction_to_string(this, direction) + "relation " + externalName() + "[" + recordType->toString() + "]";
-}
-
-cstring parametersToString(IR::IndexedVector<Parameter> const& parameters) {
-    cstring result = "(";
-    for (auto p : parameters) {
-        if (result != "(")
-            result += ", ";
-        result += p->name.toString();
-        result += ": ";
-        result += p->type->toString();
-    }
-    result += ")";
-    return result;
-}
-
-cstring DDlogIndex::toString() const {
-    cstring result = "index " + externalName() + parametersToString(parameters) + " on " + relation + "(";
-    bool first = true;
-    for (auto f : formals) {
-        if (!first)
-            result += ", ";
-        first = false;
-        result += f;
-    }
-    result += ")";
-    return result;
-}
-
-cstring DDlogRelationSugared::toString() const {
-    return (direction_to_string(this, direction)
-            + "relation " + externalName() + parametersToString(parameters));
-}
 
-cstring DDlogTypeStruct::toString() const {
-    cstring result = externalName();
-    result += "{";
-    bool first = true;
-    for (auto f : fields) {
-        if (!first)
-            result += ", ";
-        first = false;
-        result += f->name.toString();
-        result += ": ";
-        result += f->type->toString();
-    }
-    result += "}";
-    return result;
-}
+ public:
+    explicit DDlogEmitter(std::ostream& out): out(out)
+    { setName("DDlogEmitter"); visitDagOnce = false; }
 
-cstring DDlogAtom::toString() const {
-    cstring result = relation.toString();
-    result += expression->toString();
-    return result;
-}
+    /// Nodes that are not specific to DDlog, such as P4 types, are small.
+    bool preorder(const Node* node) override {
+        text(node->toString());
+        return false;
+    }
 
-cstring DDlogRule::toString() const {
-    cstring result = "";
-    if (!comment.isNullOrEmpty())
-        result = cstring("// ") + comment + "\n";
-    result += lhs->toString();
-    if (rhs.size()) {
-        result += " :- ";
+    bool preorder(const DDlogImport* import) override {
+        out << "import " << import->module;
+        return false;
+    }
+    bool preorder(const DDlogTypeString*) override {
+        out << "string";
+        return false;
+    }
+    bool preorder(const DDlogTypedef* type) override {
+        out << "typedef " << type->name.toString() << " = ";
+        visit(type->type);
+        return false;
+    }
+    bool preorder(const DDlogTypeAlt* type) override {
+        list(type->alternatives, " | ");
+        return false;
+    }
+    bool preorder(const DDlogTypeStruct* type) override {
+        out << type->externalName() << "{";
         bool first = true;
-        for (auto term : rhs) {
+        for (auto f : type->fields) {
             if (!first)
-                result += ",\n   ";
+                out << ", ";
             first = false;
-            result += term->toString();
+            out << f->name.toString() << ": ";
+            visit(f->type);
         }
+        out << "}";
+        return false;
+    }
+    bool preorder(const DDlogTypeTuple* type) override {
+        out << "(";
+        list(type->components, ", ");
+        out << ")";
+        return false;
+    }
+    bool preorder(const DDlogTypeOption* type) override {
+        out << "Option<";
+        visit(type->type);
+        out << ">";
+        return false;
+    }
+    bool preorder(const DDlogFunction* function) override {
+        out << "function " << function->name.name << "(";
+        bool first = true;
+        for (auto p : function->parameters->parameters) {
+            if (!first)
+                out << ", ";
+            first = false;
+            out << p->name.name << ": ";
+            visit(p->type);
+        }
+        out << "): ";
+        visit(function->returnType);
+        out << " {";
+        indentation += 4;
+        newline();
+        visit(function->body);
+        indentation -= 4;
+        out << "\n}";
+        return false;
+    }
+    bool preorder(const DDlogRelationSugared* relation) override {
+        direction(relation, relation->direction);
+        out << "relation " << relation->externalName();
+        parameters(relation->parameters);
+        return false;
+    }
+    bool preorder(const DDlogRelationDirect* relation) override {
+        direction(relation, relation->direction);
+        out << "relation " << relation->externalName() << "[";
+        visit(relation->recordType);
+        out << "]";
+        return false;
+    }
+    bool preorder(const DDlogIndex* index) override {
+        out << "index " << index->externalName();
+        parameters(index->parameters);
+        out << " on " << index->relation << "(";
+        bool first = true;
+        for (auto f : index->formals) {
+            if (!first)
+                out << ", ";
+            first = false;
+            out << f.name;
+        }
+        out << ")";
+        return false;
     }
-    result += ".\n";
-    return result;
-}
 
-cstring DDlogIfExpression::toString() const {
-    cstring result = cstring("if (");
-    result += condition->toString();
-    result += ") ";
-    result += left->toString();
-    result += " else ";
-    result += right->toString();
-    return result;
-}
+    bool preorder(const DDlogStringLiteral* literal) override {
+        // Same escapes as cstring::escapeJson.
+        out << '"';
+        for (const char* c = literal->contents.c_str(); *c; c++) {
+            switch (*c) {
+                case '\n': out << "\\n"; break;
+                case '\r': out << "\\r"; break;
+                case '\t': out << "\\t"; break;
+                case '\\': out << "\\\\"; break;
+                case '"': out << "\\\""; break;
+                default: out << *c;
+            }
+        }
+        out << '"';
+        return false;
+    }
+    bool preorder(const DDlogLiteral* literal) override {
+        text(literal->contents);
+        return false;
+    }
+    bool preorder(const DDlogSetExpression* expression) override {
+        out << "var " << expression->variable << " = ";
+        visit(expression->rhs);
+        return false;
+    }
+    bool preorder(const DDlogMatchCase* matchCase) override {
+        visit(matchCase->label);
+        out << " -> ";
+        visit(matchCase->result);
+        return false;
+    }
+    bool preorder(const DDlogIfExpression* expression) override {
+        out << "if (";
+        visit(expression->condition);
+        out << ") ";
+        visit(expression->left);
+        out << " else ";
+        visit(expression->right);
+        return false;
+    }
+    bool preorder(const DDlogMatchExpression* expression) override {
+        out << "match(";
+        visit(expression->matched);
+        out << ") {";
+        bool first = true;
+        for (auto c : expression->cases) {
+            if (!first)
+                out << ",";
+            first = false;
+            newline();
+            out << "    ";
+            visit(c);
+        }
+        if (expression->cases.empty())
+            newline();
+        newline();
+        out << "}";
+        return false;
+    }
+    bool preorder(const DDlogVarName* var) override {
+        out << var->id.toString();
+        return false;
+    }
+    bool preorder(const DDlogTupleExpression* expression) override {
+        out << "(";
+        list(expression->components, ", ");
+        out << ")";
+        return false;
+    }
+    bool preorder(const DDlogApply* apply) override {
+        visit(apply->left);
+        out << "." << apply->function << "(";
+        list(apply->arguments, ", ");
+        out << ")";
+        return false;
+    }
+    bool preorder(const DDlogConstructorExpression* expression) override {
+        out << expression->constructor << "{";
+        bool first = true;
+        for (auto a : expression->arguments) {
+            if (!first)
+                out << ", ";
+            first = false;
+            text(a);
+        }
+        out << "}";
+        return false;
+    }
 
-cstring DDlogFunction::toString() const {
-    cstring result = cstring("function ") + name.name;
-    result += "(";
-    bool first = true;
-    for (auto p : parameters->parameters) {
-        if (!first)
-            result += ", ";
-        first = false;
-        result += p->name;
-        result += ": ";
-        result += p->type->toString();
-    }
-    result += "): ";
-    result += returnType->toString() + " {\n";
-    result += body->toString().indent(4);
-    result += "\n}";
-    return result;
-}
+    bool preorder(const DDlogAtom* atom) override {
+        out << atom->relation.toString();
+        visit(atom->expression);
+        return false;
+    }
+    bool preorder(const DDlogExpressionTerm* term) override {
+        visit(term->expression);
+        return false;
+    }
+    bool preorder(const DDlogRule* rule) override {
+        if (!rule->comment.isNullOrEmpty()) {
+            out << "// ";
+            text(rule->comment);
+            newline();
+        }
+        visit(rule->lhs);
+        if (rule->rhs.size()) {
+            out << " :- ";
+            bool first = true;
+            for (auto term : rule->rhs) {
+                if (!first) {
+                    out << ",";
+                    newline();
+                    out << "   ";
+                }
+                first = false;
+                visit(term);
+            }
+        }
+        out << ".";
+        newline();
+        return false;
+    }
+};
 
-cstring DDlogMatchExpression::toString() const {
-    cstring result = "match(" + matched->toString() + ") {\n";
-    bool first = true;
-    for (auto c : cases) {
-        if (!first)
-            result += ",\n";
-        first = false;
-        result += "    " + c->toString();
-    }
-    result += "\n}";
-    return result;
+/// The text of 'node'; used by toString(), which is meant for small
+/// nodes and debugging, while emit() streams whole programs.
+cstring emitToString(const Node* node) {
+    std::stringstream result;
+    node->apply(DDlogEmitter(result));
+    return result.str();
 }
 
-cstring DDlogTupleExpression::toString() const {
-    cstring result = "(";
-    bool first = true;
-    for (auto c : components) {
-        if (!first)
-            result += ", ";
-        first = false;
-        result += c->toString();
-    }
-    result += ")";
-    return result;
-}
+}  // namespace
 
-cstring DDlogApply::toString() const {
-    cstring result = left->toString();
-    result += "." + function + "(";
-    bool first = true;
-    for (auto c : arguments) {
-        if (!first)
-            result += ", ";
-        first = false;
-        result += c->toString();
-    }
-    result += ")";
-    return result;
+void DDlogProgram::emit(std::ostream &o) const {
+    DDlogEmitter emitter(o);
+    for (auto d : *declarations) {
+        d->apply(emitter);
+        o << std::endl;
+    }
+    o.flush();
 }
 
-cstring DDlogConstructorExpression::toString() const {
-    cstring result = constructor + "{";
-    bool first = true;
-    for (auto c : arguments) {
-        if (!first)
-            result += ", ";
-        first = false;
-        result += c;
-    }
-    result += "}";
-    return result;
-}
+cstring DDlogTypeAlt::toString() const { return emitToString(this); }
+cstring DDlogTypeTuple::toString() const { return emitToString(this); }
+cstring DDlogRelationDirect::toString() const { return emitToString(this); }
+cstring DDlogIndex::toString() const { return emitToString(this); }
+cstring DDlogRelationSugared::toString() const { return emitToString(this); }
+cstring DDlogTypeStruct::toString() const { return emitToString(this); }
+cstring DDlogAtom::toString() const { return emitToString(this); }
+cstring DDlogRule::toString() const { return emitToString(this); }
+cstring DDlogIfExpression::toString() const { return emitToString(this); }
+cstring DDlogFunction::toString() const { return emitToString(this); }
+cstring DDlogMatchExpression::toString() const { return emitToString(this); }
+cstring DDlogTupleExpression::toString() const { return emitToString(this); }
+cstring DDlogApply::toString() const { return emitToString(this); }
+cstring DDlogConstructorExpression::toString() const { return emitToString(this); }
 
 }  // namespace IR
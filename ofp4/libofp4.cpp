@@ -0,0 +1,241 @@
+/*
+Copyright 2022 VMware, Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+#include "libofp4.h"
+#include "backend.h"
+#include "control-plane/p4RuntimeSerializer.h"
+#include "frontends/common/applyOptionsPragmas.h"
+#include "frontends/common/parseInput.h"
+#include "frontends/p4/frontend.h"
+#include "lib/error.h"
+
+namespace OFP4 {
+
+using OFP4Context = P4CContextWithOptions<OFP4Options>;
+
+static bool done(const IR::P4Program* program) {
+    return program == nullptr || ::errorCount() > 0;
+}
+
+const IR::P4Program* runFrontMidEnd(OFP4Options& options, const IR::P4Program* program,
+                                    bool frontEnd, MidEnd& midend, CompileStats* stats) {
+    auto hook = options.getDebugHook();
+    if (frontEnd) {
+        P4::P4COptionPragmaParser optionsPragmaParser;
+        program->apply(P4::ApplyOptionsPragmas(optionsPragmaParser));
+
+        P4::FrontEnd fe;
+        fe.addDebugHook(hook);
+        if (stats)
+            fe.addDebugHook(stats->passHook());
+        program = fe.run(options, program);
+        if (done(program))
+            return nullptr;
+    }
+
+    P4::serializeP4RuntimeIfRequired(program, options);
+    if (stats)
+        stats->endPass("p4runtime");
+    midend.addDebugHook(hook);
+    if (stats)
+        midend.addDebugHook(stats->passHook());
+    program = program->apply(midend);
+    if (done(program))
+        return nullptr;
+    return program;
+}
+
+/// A file in the temporary directory, removed when this goes out of
+/// scope.  The preprocessor only reads files.
+class TemporaryFile {
+    std::string path;
+
+ public:
+    explicit TemporaryFile(const std::string& text) {
+        const char* dir = getenv("TMPDIR");
+        path = std::string(dir && *dir ? dir : "/tmp") + "/libofp4-XXXXXX.p4";
+        int fd = mkstemps(&path[0], 3);
+        if (fd < 0) {
+            ::error(ErrorType::ERR_IO, "cannot create a temporary file");
+            path.clear();
+            return;
+        }
+        close(fd);
+        std::ofstream out(path);
+        out << text;
+    }
+    ~TemporaryFile() { if (!path.empty()) unlink(path.c_str()); }
+    bool valid() const { return !path.empty(); }
+    cstring name() const { return path; }
+};
+
+/// Returns a line marker that makes the preprocessor and the parser
+/// refer to the lines after it as the lines of 'name', from line 1.
+static std::string lineMarker(cstring name) {
+    std::string marker = "# 1 \"";
+    for (const char* p = name.c_str(); *p; p++) {
+        if (*p == '"' || *p == '\\')
+            marker += '\\';
+        marker += *p;
+    }
+    return marker + "\"\n";
+}
+
+/// Returns 'arg' quoted for the shell that runs the preprocessor.
+static std::string shellQuote(const std::string& arg) {
+    std::string quoted = "'";
+    for (char c : arg) {
+        if (c == '\'')
+            quoted += "'\\''";
+        else
+            quoted += c;
+    }
+    return quoted + "'";
+}
+
+/// If the only preprocessor directives in 'source' are includes of
+/// core.p4 and of_model.p4, returns true and sets 'body' to 'source'
+/// with those lines blanked, so that line numbers do not change.
+static bool onlyIncludesArchitecture(const std::string& source, std::string& body) {
+    std::istringstream in(source);
+    std::ostringstream out;
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t start = line.find_first_not_of(" \t");
+        if (start != std::string::npos && line[start] == '#') {
+            std::istringstream directive(line.substr(start + 1));
+            std::string keyword, file, rest;
+            directive >> keyword >> file >> rest;
+            if (keyword != "include" || !rest.empty() ||
+                (file != "<core.p4>" && file != "<of_model.p4>"))
+                return false;
+            line.clear();
+        }
+        out << line << "\n";
+    }
+    body = out.str();
+    return true;
+}
+
+bool Compiler::readArchitecture(OFP4Options& options) {
+    if (haveArchitecture)
+        return true;
+    TemporaryFile file("#include <core.p4>\n#include <of_model.p4>\n");
+    if (!file.valid())
+        return false;
+    options.file = file.name();
+    FILE* in = options.preprocess();
+    preprocessorRuns++;
+    if (in == nullptr || ::errorCount() > 0)
+        return false;
+    char buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0)
+        architecture.append(buffer, n);
+    options.closePreprocessedInput(in);
+    haveArchitecture = ::errorCount() == 0;
+    return haveArchitecture;
+}
+
+CompileResult Compiler::compile(const std::string& source, cstring name,
+                                const std::string& includeDir,
+                                const IR::P4Program* frontended) {
+    CompileResult result;
+    std::stringstream diagnostics;
+    AutoCompileContext context(new OFP4Context);
+    auto& options = OFP4Context::get().options();
+    options.langVersion = CompilerOptions::FrontendVersion::P4_16;
+    options.compilerVersion = "0.1";
+    OFP4Context::get().errorReporter().setOutputStream(&diagnostics);
+
+    std::vector<std::string> argStrings = { "p4c-of" };
+    argStrings.insert(argStrings.end(), args.begin(), args.end());
+    argStrings.push_back(name.c_str());
+    std::vector<char*> argv;
+    for (auto& arg : argStrings)
+        argv.push_back(&arg[0]);
+    argv.push_back(nullptr);
+    if (options.process(static_cast<int>(argStrings.size()), argv.data()) != nullptr)
+        options.setInputFile();
+
+    const IR::P4Program* program = frontended;
+    std::string body;
+    if (::errorCount() > 0) {
+        program = nullptr;
+    } else if (frontended) {
+        // Nothing to parse.
+    } else if (onlyIncludesArchitecture(source, body)) {
+        // The line marker makes diagnostics refer to 'name'.
+        if (readArchitecture(options))
+            program = P4::parseP4String(architecture + lineMarker(name) + body,
+                                        options.langVersion);
+    } else {
+        // The preprocessor looks for quoted includes next to the file it
+        // reads, which is in the temporary directory, so also look in
+        // 'includeDir'.  The line marker makes diagnostics refer to 'name'.
+        options.preprocessor_options += " -iquote " + shellQuote(includeDir);
+        TemporaryFile file(lineMarker(name) + source);
+        if (file.valid()) {
+            options.file = file.name();
+            program = P4::parseP4File(options);
+            preprocessorRuns++;
+        }
+    }
+
+    if (!done(program)) {
+        MidEnd midend(options);
+        program = runFrontMidEnd(options, program, frontended == nullptr, midend, nullptr);
+        BackEndOutput output;
+        if (program) {
+            BackEnd backend(&midend.refMap, &midend.typeMap);
+            if (backend.generate(options, program, output)) {
+                std::stringstream ddlog;
+                output.ddlog->emit(ddlog);
+                result.ddlog = ddlog.str();
+                for (auto flow : output.staticFlows)
+                    result.staticFlows.push_back(flow.c_str());
+            }
+        }
+    }
+
+    result.success = ::errorCount() == 0 && !result.ddlog.empty();
+    result.diagnostics = diagnostics.str();
+    return result;
+}
+
+CompileResult Compiler::compileSource(const std::string& source, const std::string& name,
+                                      const std::string& includeDir) {
+    std::string dir = includeDir;
+    if (dir.empty()) {
+        size_t slash = name.rfind('/');
+        dir = slash == std::string::npos ? "." : name.substr(0, slash == 0 ? 1 : slash);
+    }
+    return compile(source, name, dir, nullptr);
+}
+
+CompileResult Compiler::compileProgram(const IR::P4Program* program) {
+    CHECK_NULL(program);
+    return compile("", "program.p4", ".", program);
+}
+
+}  // namespace OFP4
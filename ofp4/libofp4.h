@@ -0,0 +1,102 @@
+/*
+Copyright 2022 VMware, Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _EXTENSIONS_OFP4_LIBOFP4_H_
+#define _EXTENSIONS_OFP4_LIBOFP4_H_
+
+#include <string>
+#include <vector>
+
+#include "ir/ir.h"
+#include "midend.h"
+#include "options.h"
+#include "stats.h"
+
+/// In-process interface to the compiler, for programs that compile many
+/// P4 sources, such as the controller tests, without starting p4c-of and
+/// the C preprocessor for each one.
+
+namespace OFP4 {
+
+/// Runs the front end on 'program', unless 'frontEnd' is false because
+/// it already went through it, serializes the P4Runtime files that
+/// 'options' asks for, and runs 'midend'.  Returns the program for the
+/// back end, or nullptr on error.
+const IR::P4Program* runFrontMidEnd(OFP4Options& options, const IR::P4Program* program,
+                                    bool frontEnd, MidEnd& midend, CompileStats* stats);
+
+/// The outcome of compiling a program in memory.
+struct CompileResult {
+    /// True if the program compiled without errors.
+    bool success = false;
+    /// The DDlog program.
+    std::string ddlog;
+    /// With --static-flows, the flows that do not depend on DDlog
+    /// relations, one per element.
+    std::vector<std::string> staticFlows;
+    /// The errors and warnings, as p4c-of would print them.
+    std::string diagnostics;
+};
+
+/// Compiles P4 programs for of_model.p4 to DDlog in memory.  Each
+/// compilation has a compile context of its own, so a Compiler may be
+/// used for any number of programs, one at a time.
+class Compiler {
+    std::vector<std::string> args;
+    /// core.p4 and of_model.p4 after preprocessing, read on first use.
+    std::string architecture;
+    bool haveArchitecture = false;
+    unsigned preprocessorRuns = 0;
+
+    bool readArchitecture(OFP4Options& options);
+    CompileResult compile(const std::string& source, cstring name,
+                          const std::string& includeDir, const IR::P4Program* frontended);
+
+ public:
+    /// 'args' are p4c-of options, such as "--pack-bits" or "-I<dir>".
+    /// The DDlog program and the static flows are returned instead of
+    /// written, so -o and --static-flows only matter for their side
+    /// effects on code generation; the other output files are written
+    /// as usual.
+    explicit Compiler(std::vector<std::string> args = {}): args(std::move(args)) {}
+
+    /// Compiles P4 'source'; 'name' names it in diagnostics.  A source
+    /// whose only preprocessor directives are #include <core.p4> and
+    /// #include <of_model.p4> is parsed without running the preprocessor,
+    /// after the architecture text preprocessed by the first such call.
+    /// Only the preprocessed text is reused: the p4c parser cannot start
+    /// from parsed declarations, so every source is parsed and goes
+    /// through the front end together with the architecture.
+    /// #include "file" looks for 'file' in 'includeDir', by default the
+    /// directory of 'name', as if 'source' were in file 'name'.
+    CompileResult compileSource(const std::string& source,
+                                const std::string& name = "program.p4",
+                                const std::string& includeDir = "");
+
+    /// Compiles 'program', which already went through the front end,
+    /// e.g. in an earlier call to P4::FrontEnd::run().  This skips
+    /// parsing and the front end, for callers that compile the same
+    /// program with different options.
+    CompileResult compileProgram(const IR::P4Program* program);
+
+    /// Returns the number of times this Compiler ran the preprocessor:
+    /// once for the architecture, and once for each source that needs it.
+    unsigned preprocessed() const { return preprocessorRuns; }
+};
+
+}  // namespace OFP4
+
+#endif  /* _EXTENSIONS_OFP4_LIBOFP4_H_ */
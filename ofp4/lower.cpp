@@ -18,6 +18,88 @@ limitations under the License.
 
 namespace OFP4 {
 
+NormalCondition::Literal
+NormalCondition::literal(const IR::Expression* expression, bool negated) const {
+    bool invertible = false;
+    if (auto rel = expression->to<IR::Operation_Relation>()) {
+        auto isConstant = [](const IR::Expression* e) {
+            return e->is<IR::Constant>() || e->is<IR::BoolLiteral>();
+        };
+        auto variable = isConstant(rel->right) ? rel->left : rel->right;
+        invertible = (isConstant(rel->left) || isConstant(rel->right)) &&
+                typeMap->getType(variable, true)->width_bits() == 1;
+    } else if (!expression->is<IR::MethodCallExpression>()) {
+        // A Boolean value is matched against 1.
+        invertible = true;
+    }
+    return Literal{expression, negated, invertible};
+}
+
+bool NormalCondition::expand(const IR::Expression* expression, bool negated,
+                             std::vector<Term>& result) {
+    if (auto lnot = expression->to<IR::LNot>())
+        return expand(lnot->expr, !negated, result);
+    if (expression->is<IR::LAnd>() || expression->is<IR::LOr>()) {
+        auto binary = expression->to<IR::Operation_Binary>();
+        std::vector<Term> left, right;
+        if (!expand(binary->left, negated, left) || !expand(binary->right, negated, right))
+            return false;
+        // By De Morgan, a negated conjunction is a disjunction of negations.
+        if (expression->is<IR::LOr>() != negated) {
+            result = left;
+            result.insert(result.end(), right.begin(), right.end());
+        } else {
+            for (auto& l : left) {
+                for (auto& r : right) {
+                    Term term = l;
+                    term.insert(term.end(), r.begin(), r.end());
+                    result.push_back(term);
+                }
+            }
+        }
+        return result.size() <= maxTerms;
+    }
+    if (auto bl = expression->to<IR::BoolLiteral>()) {
+        // True is an empty term; false has no terms.
+        if (bl->value != negated)
+            result.push_back(Term());
+        return true;
+    }
+    if (expression->is<IR::Equ>() || expression->is<IR::Neq>()) {
+        result.push_back(Term{literal(expression, negated != expression->is<IR::Neq>())});
+        return true;
+    }
+    if (auto mce = expression->to<IR::MethodCallExpression>()) {
+        auto member = mce->method->to<IR::Member>();
+        if (!member || member->member != "isValid")
+            return false;
+        result.push_back(Term{literal(expression, negated)});
+        return true;
+    }
+    if ((expression->is<IR::Member>() || expression->is<IR::PathExpression>()) &&
+        typeMap->getType(expression, true)->is<IR::Type_Boolean>()) {
+        result.push_back(Term{literal(expression, negated)});
+        return true;
+    }
+    return false;
+}
+
+bool NormalCondition::normalize(const IR::Expression* condition, const P4::TypeMap* typeMap) {
+    this->typeMap = typeMap;
+    terms.clear();
+    return expand(condition, false, terms);
+}
+
+bool NormalCondition::matchable() const {
+    if (terms.size() <= 1)
+        return true;
+    for (auto& term : terms)
+        for (auto& literal : term)
+            if (literal.negated && !literal.invertible)
+                return false;
+    return true;
+}
+
 const IR::Node* RemoveBooleanValues::postorder(IR::AssignmentStatement* statement) {
     auto type = typeMap->getType(statement->right, true);
     if (!type->is<IR::Type_Boolean>())
@@ -47,6 +129,14 @@ LowerExpressions::createTemporary(const IR::Expression* expression) {
     return new IR::PathExpression(expression->srcInfo, new IR::Path(name));
 }
 
+// True if the expression being visited is part of the condition of an
+// if statement that the backend can match without temporaries.
+bool LowerExpressions::inMatchableCondition() const {
+    auto statement = findContext<IR::Statement>();
+    auto ifs = statement ? statement->to<IR::IfStatement>() : nullptr;
+    return ifs && NormalCondition::isMatchable(ifs->condition, typeMap);
+}
+
 const IR::Node* LowerExpressions::postorder(IR::Expression* expression) {
     // Just update the typeMap incrementally.
     auto type = typeMap->getType(getOriginal(), true);
@@ -66,7 +156,8 @@ const IR::Node* LowerExpressions::postorder(IR::P4Control* control) {
 
 const IR::Node* LowerExpressions::postorder(IR::Operation_Relation* expression) {
     if (findContext<IR::AssignmentStatement>() ||  // Do not simplify if inside an if condition...
-        (expression->is<IR::Neq>() && findContext<IR::Expression>())) {
+        (expression->is<IR::Neq>() && findContext<IR::Expression>() &&
+         !inMatchableCondition())) {
         // ... except if the condition is complex.
         auto type = typeMap->getType(getOriginal(), true);
         auto name = refMap->newName("tmp");
@@ -94,6 +185,11 @@ const IR::Node* LowerExpressions::postorder(IR::Operation_Relation* expression)
 }
 
 const IR::Node* LowerExpressions::postorder(IR::LNot* expression) {
+    if (inMatchableCondition()) {
+        auto type = typeMap->getType(getOriginal(), true);
+        typeMap->setType(expression, type);
+        return expression;
+    }
     auto name = refMap->newName("tmp");
     auto type = typeMap->getType(getOriginal(), true);
     auto decl = new IR::Declaration_Variable(IR::ID(name), type->getP4Type());
@@ -111,6 +207,32 @@ const IR::Node* LowerExpressions::postorder(IR::LNot* expression) {
     return result;
 }
 
+const IR::Node* LowerExpressions::lowerLogical(IR::Operation_Binary* expression) {
+    auto type = typeMap->getType(getOriginal(), true);
+    typeMap->setType(expression, type);
+    // Only the conditions of if statements that are too large to match
+    // directly need this; the operands of 'expression' were lowered
+    // first, so unless one of them is not supported at all, the if
+    // statement that computes it is matchable.
+    auto statement = findContext<IR::Statement>();
+    if (!statement || !statement->is<IR::IfStatement>() || inMatchableCondition() ||
+        !NormalCondition::isMatchable(expression, typeMap))
+        return expression;
+    auto name = refMap->newName("tmp");
+    auto decl = new IR::Declaration_Variable(IR::ID(name), type->getP4Type());
+    newDecls.push_back(decl);
+    typeMap->setType(decl, type);
+    auto t = new IR::AssignmentStatement(
+        expression->srcInfo, new IR::PathExpression(name), new IR::BoolLiteral(true));
+    auto f = new IR::AssignmentStatement(
+        expression->srcInfo, new IR::PathExpression(name), new IR::BoolLiteral(false));
+    auto ifs = new IR::IfStatement(expression->srcInfo, expression, t, f);
+    assignments.push_back(ifs);
+    auto result = new IR::PathExpression(expression->srcInfo, new IR::Path(name));
+    typeMap->setType(result, type->getP4Type());
+    return result;
+}
+
 const IR::Node* LowerExpressions::postorder(IR::Statement* statement) {
     // Insert before a statement whatever temporary assignments were generated
     if (assignments.empty())
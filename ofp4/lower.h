@@ -23,13 +23,66 @@ limitations under the License.
 
 namespace OFP4 {
 
+/**
+  The condition of an if statement in disjunctive normal form: it holds
+  if all the literals of one of its terms hold.  A literal is an
+  equality test, a header validity test or a Boolean value, possibly
+  negated.  The backend matches each term with a single flow, so a
+  condition in this form needs no temporaries and no extra tables.
+*/
+class NormalCondition {
+ public:
+    struct Literal {
+        /// An Equ, a Neq (an Equ with 'negated' inverted), an isValid()
+        /// call, or a Boolean value.
+        const IR::Expression* expression;
+        bool negated;
+        /// True if the literal compares a single bit with a constant,
+        /// so that its negation is also an equality test.
+        bool invertible;
+    };
+    typedef std::vector<Literal> Term;
+
+    /// Each term costs a flow, so beyond this temporaries are cheaper:
+    /// LowerExpressions computes each && and || of a larger condition
+    /// into a temporary.
+    static const size_t maxTerms = 8;
+
+    std::vector<Term> terms;
+
+    /// Puts 'condition' in normal form.  Returns false if it contains
+    /// an expression that is not a literal or if it has too many terms.
+    bool normalize(const IR::Expression* condition, const P4::TypeMap* typeMap);
+    /// True if the backend can match the condition with flows: either
+    /// it has a single term, whose negated literals become flows with a
+    /// higher priority, or all its negated literals are invertible.
+    bool matchable() const;
+
+    /// True if 'condition' normalizes to a matchable form.
+    static bool isMatchable(const IR::Expression* condition, const P4::TypeMap* typeMap) {
+        NormalCondition normal;
+        return normal.normalize(condition, typeMap) && normal.matchable();
+    }
+
+ private:
+    const P4::TypeMap* typeMap = nullptr;
+    bool expand(const IR::Expression* expression, bool negated, std::vector<Term>& result);
+    Literal literal(const IR::Expression* expression, bool negated) const;
+};
+
 /**
   This pass rewrites expressions which are not supported natively on OFP4.
+  Negations in the condition of an if statement are kept if the
+  condition is matchable as a NormalCondition.  If it is not, each &&
+  and || in it whose operands are matchable is computed into a
+  temporary, so that the if statement tests the temporary.
 */
 class LowerExpressions : public Transform {
     P4::ReferenceMap* refMap;
     P4::TypeMap* typeMap;
     const IR::PathExpression* createTemporary(const IR::Expression* expression);
+    bool inMatchableCondition() const;
+    const IR::Node* lowerLogical(IR::Operation_Binary* expression);
     IR::IndexedVector<IR::Declaration> newDecls;
     IR::IndexedVector<IR::StatOrDecl>  assignments;
 
@@ -41,6 +94,8 @@ class LowerExpressions : public Transform {
     const IR::Node* postorder(IR::Expression* expression) override;
     const IR::Node* postorder(IR::Operation_Relation* expression) override;
     const IR::Node* postorder(IR::LNot* expression) override;
+    const IR::Node* postorder(IR::LAnd* expression) override { return lowerLogical(expression); }
+    const IR::Node* postorder(IR::LOr* expression) override { return lowerLogical(expression); }
     const IR::Node* postorder(IR::Statement* statement) override;
     const IR::Node* postorder(IR::P4Control* control) override;
 };
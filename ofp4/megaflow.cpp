@@ -0,0 +1,274 @@
+/*
+Copyright 2022 VMware, Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <algorithm>
+#include <functional>
+#include <sstream>
+
+#include "megaflow.h"
+#include "ofvisitors.h"
+#include "lib/json.h"
+
+namespace OFP4 {
+
+const size_t MegaflowAnalysis::maxPaths = 1000;
+
+/// Parses the name of a pipeline register: 'x's, "reg", and the number
+/// of the register bundle.
+static bool parseRegisterName(cstring name, size_t& bundle) {
+    std::string s = name.c_str();
+    size_t x = s.find_first_not_of('x');
+    if (x == std::string::npos || s.compare(x, 3, "reg") != 0 || x + 3 == s.size())
+        return false;
+    std::string digits = s.substr(x + 3);
+    if (digits.find_first_not_of("0123456789") != std::string::npos)
+        return false;
+    bundle = std::stoul(digits);
+    return true;
+}
+
+bool isPipelineRegister(const IR::OF_Register* reg) {
+    size_t bundle;
+    return parseRegisterName(reg->name, bundle);
+}
+
+/// Calls 'f' for each bit 'i' of 'reg', counting from its low bit, with
+/// the field that holds it and the bit number within that field.  Bits
+/// of pipeline registers are given as bits of reg0, reg1, and so on.
+static void forEachBit(const IR::OF_Register* reg,
+                       std::function<void(size_t i, cstring field, size_t bit)> f) {
+    size_t bundle;
+    bool pipeline = parseRegisterName(reg->name, bundle);
+    size_t registers = reg->size / IR::OF_Register::registerSize;
+    for (size_t i = 0; i < reg->width(); i++) {
+        size_t bit = reg->low + i;
+        if (!pipeline || registers <= 1) {
+            f(i, pipeline ? cstring("reg" + Util::toString(bundle)) : reg->name, bit);
+            continue;
+        }
+        // In a bundle the register with the lowest number holds the
+        // most significant bits.
+        size_t number = bundle * registers + registers - 1 - bit / IR::OF_Register::registerSize;
+        f(i, "reg" + Util::toString(number), bit % IR::OF_Register::registerSize);
+    }
+}
+
+FieldBits registerBits(const IR::OF_Register* reg) {
+    FieldBits result;
+    forEachBit(reg, [&](size_t, cstring field, size_t bit) {
+        result[field] |= big_int(1) << bit;
+    });
+    return result;
+}
+
+static size_t countBits(big_int bits) {
+    size_t result = 0;
+    for (; bits != 0; bits >>= 1)
+        if ((bits & 1) != 0)
+            result++;
+    return result;
+}
+
+static cstring hex(const big_int& bits) {
+    return Util::toString(bits, 0, false, 16);
+}
+
+void RegisterWrites::write(const IR::OF_Expression* dest, const IR::OF_Expression* src) {
+    auto reg = dest->to<IR::OF_Register>();
+    if (auto slice = dest->to<IR::OF_Slice>()) {
+        if (auto base = slice->base->to<IR::OF_Register>())
+            reg = new IR::OF_Register(base->name, base->size, base->low + slice->low,
+                                      base->low + slice->high, base->is_boolean);
+    }
+    if (!reg || !isPipelineRegister(reg))
+        return;
+    // A constant only sets its 1 bits; anything else may set any bit.
+    big_int value = IR::Constant::GetMask(reg->width()).value;
+    if (auto constant = src ? src->to<IR::OF_Constant>() : nullptr)
+        value &= constant->value->value;
+    forEachBit(reg, [&](size_t i, cstring field, size_t bit) {
+        if (((value >> i) & 1) != 0)
+            written[field] |= big_int(1) << bit;
+    });
+}
+
+big_int RegisterWrites::mayBeSet(const IR::OF_Register* reg) const {
+    big_int result = 0;
+    forEachBit(reg, [&](size_t i, cstring field, size_t bit) {
+        auto it = written.find(field);
+        if (it != written.end() && ((it->second >> bit) & 1) != 0)
+            result |= big_int(1) << i;
+    });
+    return result;
+}
+
+const IR::Node* NarrowRegisterMatches::postorder(IR::OF_EqualsMatch* match) {
+    auto reg = match->left->to<IR::OF_Register>();
+    auto value = match->right->to<IR::OF_Constant>();
+    if (!reg || !value || !isPipelineRegister(reg))
+        return match;
+    big_int all = IR::Constant::GetMask(reg->width()).value;
+    big_int mask = all;
+    if (match->mask) {
+        auto constant = match->mask->to<IR::OF_Constant>();
+        if (!constant)
+            return match;
+        mask &= constant->value->value;
+    }
+
+    // If the match needs a 1 in a bit that is always 0, the flow never
+    // matches; that is not for this pass to fix.
+    big_int live = writes.mayBeSet(reg);
+    if ((value->value->value & mask & (all ^ live)) != 0)
+        return match;
+    big_int narrowed = mask & live;
+    if (narrowed == mask)
+        return match;
+    if (narrowed == 0 && getParent<IR::OF_SeqMatch>())
+        return nullptr;
+    auto type = IR::Type_Bits::get(reg->width());
+    return new IR::OF_EqualsMatch(match->left, match->right,
+                                  new IR::OF_Constant(new IR::Constant(type, narrowed)));
+}
+
+void MegaflowAnalysis::add(size_t table, cstring field, const big_int& bits) {
+    if (bits != 0)
+        tables[table][field] |= bits;
+}
+
+void MegaflowAnalysis::addPrerequisites(size_t table, cstring prereqs) {
+    // The width of the fields that prerequisites usually match.
+    static const std::map<cstring, size_t> widths = {
+        { "eth_type", 16 }, { "dl_type", 16 }, { "nw_proto", 8 }, { "ip_proto", 8 },
+        { "vlan_tci", 16 },
+    };
+    auto width = [](cstring field) {
+        auto it = widths.find(field);
+        return it == widths.end() ? 64 : it->second;
+    };
+
+    std::stringstream stream(prereqs.c_str());
+    std::string clause;
+    while (std::getline(stream, clause, ',')) {
+        clause.erase(0, clause.find_first_not_of(" "));
+        clause.erase(clause.find_last_not_of(" ") + 1);
+        if (clause.empty())
+            continue;
+        auto equals = clause.find('=');
+        if (equals != std::string::npos) {
+            cstring field = clause.substr(0, equals);
+            add(table, field, IR::Constant::GetMask(width(field)).value);
+        } else if (clause == "vlan") {
+            add(table, "vlan_tci", 0x1000);
+        } else if (auto fields = protocolPrerequisites(clause)) {
+            for (auto f : *fields)
+                add(table, f.first, IR::Constant::GetMask(width(f.first)).value);
+        }
+    }
+}
+
+void MegaflowAnalysis::addMatch(size_t table, const IR::OF_Match* match) {
+    if (auto seq = match->to<IR::OF_SeqMatch>()) {
+        for (auto m : seq->matches)
+            addMatch(table, m);
+    } else if (auto prereq = match->to<IR::OF_PrereqMatch>()) {
+        addPrerequisites(table, prereq->prereq);
+    } else if (auto proto = match->to<IR::OF_ProtocolMatch>()) {
+        addPrerequisites(table, proto->proto);
+    } else if (auto equals = match->to<IR::OF_EqualsMatch>()) {
+        auto reg = equals->left->to<IR::OF_Register>();
+        if (!reg)
+            return;
+        big_int mask = IR::Constant::GetMask(reg->width()).value;
+        if (equals->mask) {
+            if (auto constant = equals->mask->to<IR::OF_Constant>())
+                mask &= constant->value->value;
+        }
+        forEachBit(reg, [&](size_t i, cstring field, size_t bit) {
+            if (((mask >> i) & 1) != 0)
+                add(table, field, big_int(1) << bit);
+        });
+    }
+}
+
+/// Returns a JSON object with the bits of each field in 'fields'.
+static Util::JsonObject* fieldsToJson(const FieldBits& fields) {
+    auto result = new Util::JsonObject();
+    for (auto& field : fields)
+        result->emplace(field.first, hex(field.second));
+    return result;
+}
+
+static size_t countBits(const FieldBits& fields) {
+    size_t result = 0;
+    for (auto& field : fields)
+        result += countBits(field.second);
+    return result;
+}
+
+void MegaflowAnalysis::write(std::ostream& out, const std::vector<const CFG::Node*>& nodes,
+                             const std::vector<std::vector<const CFG::Node*>>& paths,
+                             bool truncated) const {
+    static const FieldBits none;
+    auto bitsOf = [this](const CFG::Node* node) -> const FieldBits& {
+        auto it = tables.find(node->id);
+        return it == tables.end() ? none : it->second;
+    };
+
+    auto tablesJson = new Util::JsonArray();
+    for (auto node : nodes) {
+        auto& fields = bitsOf(node);
+        auto table = new Util::JsonObject();
+        table->emplace("name", node->name);
+        table->emplace("id", static_cast<size_t>(node->id));
+        table->emplace("bits", countBits(fields));
+        table->emplace("fields", fieldsToJson(fields));
+        tablesJson->append(table);
+    }
+
+    // The paths that un-wildcard the most bits come first.
+    std::vector<std::pair<size_t, FieldBits>> unions;
+    for (auto& path : paths) {
+        FieldBits fields;
+        for (auto node : path)
+            for (auto& field : bitsOf(node))
+                fields[field.first] |= field.second;
+        unions.emplace_back(unions.size(), fields);
+    }
+    std::stable_sort(unions.begin(), unions.end(), [](const auto& a, const auto& b) {
+        return countBits(a.second) > countBits(b.second);
+    });
+    auto pathsJson = new Util::JsonArray();
+    for (auto& u : unions) {
+        auto names = new Util::JsonArray();
+        for (auto node : paths.at(u.first))
+            names->append(node->name);
+        auto path = new Util::JsonObject();
+        path->emplace("tables", names);
+        path->emplace("bits", countBits(u.second));
+        path->emplace("fields", fieldsToJson(u.second));
+        pathsJson->append(path);
+    }
+
+    auto result = new Util::JsonObject();
+    result->emplace("tables", tablesJson);
+    result->emplace("paths", pathsJson);
+    result->emplace("paths_truncated", new Util::JsonValue(truncated));
+    result->serialize(out);
+    out << std::endl;
+}
+
+}  // namespace OFP4
@@ -0,0 +1,103 @@
+/*
+Copyright 2022 VMware, Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _EXTENSIONS_OFP4_MEGAFLOW_H_
+#define _EXTENSIONS_OFP4_MEGAFLOW_H_
+
+#include "ir/ir.h"
+#include "controlFlowGraph.h"
+
+/// Models how the generated flows un-wildcard fields in the megaflows
+/// that the OVS datapath caches.  A packet that visits an OpenFlow
+/// table un-wildcards, at most, every bit that some flow of the table
+/// matches, so the megaflow of a path through the pipeline is the union
+/// of the bits of the tables on the path.
+
+namespace OFP4 {
+
+/// Bits of each field, by name.  Pipeline registers are split into the
+/// 32-bit registers that hold them, so xreg0 is reg0 and reg1.
+typedef std::map<cstring, big_int> FieldBits;
+
+/// True if 'reg' is a pipeline register, such as reg3 or xxreg0, as
+/// opposed to a packet field.  Pipeline registers are zero when a packet
+/// enters the pipeline and only the flows of the program write them.
+bool isPipelineRegister(const IR::OF_Register* reg);
+
+/// The bits of the fields that 'reg' occupies.  Registers that alias,
+/// such as xreg0 and reg1, have bits in common.
+FieldBits registerBits(const IR::OF_Register* reg);
+
+/// The bits of the pipeline registers that the actions of the program
+/// may set to 1.  The other bits are always 0.
+class RegisterWrites : public Inspector {
+    FieldBits written;
+
+    void write(const IR::OF_Expression* dest, const IR::OF_Expression* src);
+
+ public:
+    RegisterWrites() { setName("RegisterWrites"); visitDagOnce = false; }
+
+    bool preorder(const IR::OF_LoadAction* action) override
+    { write(action->dest, action->src); return false; }
+    bool preorder(const IR::OF_MoveAction* action) override
+    { write(action->dest, nullptr); return false; }
+
+    /// Bits of 'reg' that may be 1, aligned like a value of 'reg'.
+    big_int mayBeSet(const IR::OF_Register* reg) const;
+};
+
+/// Narrows the matches of pipeline registers against constants to the
+/// bits that the program may set: the other bits are always 0, so a
+/// match on them only un-wildcards them in the megaflow.
+class NarrowRegisterMatches : public Transform {
+    const RegisterWrites& writes;
+
+ public:
+    explicit NarrowRegisterMatches(const RegisterWrites& writes): writes(writes)
+    { setName("NarrowRegisterMatches"); visitDagOnce = false; }
+
+    const IR::Node* postorder(IR::OF_EqualsMatch* match) override;
+};
+
+/// Collects, for each OpenFlow table, the bits that its flows can
+/// un-wildcard, and reports them for the tables and for the paths
+/// through the pipeline.
+class MegaflowAnalysis {
+    std::map<size_t, FieldBits> tables;
+
+    void add(size_t table, cstring field, const big_int& bits);
+    void addPrerequisites(size_t table, cstring prereqs);
+
+ public:
+    /// Paths beyond this number are not reported.
+    static const size_t maxPaths;
+
+    /// Records the bits that 'match', a flow of 'table', matches.  A
+    /// mask computed at runtime may be anything, so it counts as the
+    /// whole field.
+    void addMatch(size_t table, const IR::OF_Match* match);
+
+    /// Writes a JSON report of the tables in 'nodes' and of 'paths',
+    /// each of which is a sequence of nodes from the start of the
+    /// pipeline to its end.  'truncated' says that there are more paths.
+    void write(std::ostream& out, const std::vector<const CFG::Node*>& nodes,
+               const std::vector<std::vector<const CFG::Node*>>& paths, bool truncated) const;
+};
+
+}  // namespace OFP4
+
+#endif  /* _EXTENSIONS_OFP4_MEGAFLOW_H_ */
@@ -63,6 +63,7 @@ class ParseAnnotations : public P4::ParseAnnotations {
     ParseAnnotations() : P4::ParseAnnotations("ofp4", false, {
                 PARSE("of_prereq", StringLiteral),
                 PARSE_CONSTANT_LIST("of_slice"),
+                PARSE_EMPTY("of_conjunction"),
             }) { }
 };
 
@@ -88,7 +89,7 @@ MidEnd::MidEnd(OFP4Options& options) {
         new P4::FlattenInterfaceStructs(&refMap, &typeMap),
         new P4::Predication(&refMap),
         new P4::MoveDeclarations(),
-        new P4::ValidateTableProperties({}),
+        new P4::ValidateTableProperties({"counters", "implementation"}),
         new P4::ConstantFolding(&refMap, &typeMap),
         new P4::GlobalCopyPropagation(&refMap, &typeMap),
         new PassRepeated({
@@ -85,6 +85,10 @@ cstring OF_ResubmitAction::toString() const {
     return cstring("resubmit(,") + Util::toString(nextTable) + ")";
 }
 
+cstring OF_GotoTableAction::toString() const {
+    return cstring("goto_table:") + Util::toString(nextTable);
+}
+
 cstring OF_Constant::toString() const {
     bool isSigned = false;
     if (auto tb = value->type->to<IR::Type_Bits>())
@@ -101,13 +105,20 @@ cstring OF_ProtocolMatch::toString() const {
 }
 
 cstring OF_EqualsMatch::toString() const {
-    return left->toString() + "=" + right->toString();
+    cstring result = left->toString() + "=" + right->toString();
+    if (mask)
+        result += "/" + mask->toString();
+    return result;
 }
 
 cstring OF_PriorityMatch::toString() const {
     return "priority=" + priority->toString();
 }
 
+cstring OF_CookieMatch::toString() const {
+    return "cookie=" + cookie->toString();
+}
+
 cstring OF_Slice::toString() const {
     return base->toString() + "[" + Util::toString(low) + ".." + Util::toString(high) + "]";
 }
@@ -0,0 +1,55 @@
+/*
+Copyright (c) 2022 VMware, Inc.
+SPDX-License-Identifier: MIT
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+ */
+
+//! Rust implementations of the extern functions declared in `ofp4lib.dl`.  DDlog builds them
+//! into the generated crate.  They format the values that flows interpolate, which happens every
+//! time DDlog recomputes a flow, so they avoid intermediate strings.
+
+const HEX_DIGITS: &[u8; 16] = b"0123456789abcdef";
+
+/// Formats the 48-bit `a` as an Ethernet address, such as `01:23:45:67:89:ab`.
+pub fn to_eth(a: &u64) -> String {
+    let mut s = String::with_capacity(17);
+    for i in (0..6).rev() {
+        let byte = (a >> (8 * i)) as u8;
+        s.push(HEX_DIGITS[usize::from(byte >> 4)] as char);
+        s.push(HEX_DIGITS[usize::from(byte & 0xf)] as char);
+        if i > 0 {
+            s.push(':');
+        }
+    }
+    s
+}
+
+/// Formats `a` in hexadecimal with a `0x` prefix, which `ovs-ofctl` syntax accepts for any field.
+pub fn to_hex128(a: &u128) -> String {
+    format!("{a:#x}")
+}
+
+/// Returns the (value, mask) pairs of a `width`-bit field that together match `lo` through
+/// `hi`.  The algorithm is in `p4ext`, where it is tested.
+pub fn range_to_prefixes(lo: &u128, hi: &u128, width: &u32)
+                         -> ddlog_std::Vec<ddlog_std::tuple2<u128, u128>> {
+    let prefixes: std::vec::Vec<ddlog_std::tuple2<u128, u128>> =
+        p4ext::range_to_prefixes(*lo, *hi, *width).into_iter()
+        .map(|(value, mask)| ddlog_std::tuple2(value, mask))
+        .collect();
+    ddlog_std::Vec::from(prefixes)
+}
@@ -14,9 +14,13 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 
+#include <algorithm>
 #include <map>
+#include <sstream>
+#include <vector>
 
 #include "ofvisitors.h"
+#include "megaflow.h"
 #include "ir/ir.h"
 
 namespace OFP4 {
@@ -33,7 +37,7 @@ bool OpenFlowPrint::preorder(const IR::OF_Constant* e) {
 
 bool OpenFlowPrint::preorder(const IR::OF_Register* e) {
     bool inMatch = findContext<const IR::OF_Match>();
-    if (!e->friendlyName.isNullOrEmpty()) {
+    if (!e->friendlyName.isNullOrEmpty() && interpolate) {
         buffer += "${r_" + e->friendlyName + "(" + Util::toString(inMatch) + ")}";
     } else {
         buffer += e->asDDlogString(inMatch);
@@ -41,8 +45,25 @@ bool OpenFlowPrint::preorder(const IR::OF_Register* e) {
     return false;
 }
 
+/// Returns the DDlog code to put before and after an expression of
+/// 'width' bits, interpolated into a flow, to format it.  DDlog formats
+/// values in decimal, which OVS does not accept for Ethernet addresses
+/// and which takes 128-bit divisions for wider values, so these get
+/// formatters from ofp4lib.
+static std::pair<cstring, cstring> formatter(size_t width, bool asEthernet) {
+    if (asEthernet)
+        return { "to_eth(", ")" };
+    if (width > 64 && width < 128)
+        return { "to_hex128((", ") as bit<128>)" };
+    if (width == 128)
+        return { "to_hex128(", ")" };
+    return { "", "" };
+}
+
 bool OpenFlowPrint::preorder(const IR::OF_InterpolatedVarExpression* e) {
-    buffer += e->toString();
+    BUG_CHECK(interpolate, "%1%: DDlog variable in a static flow", e);
+    auto format = formatter(e->width(), false);
+    buffer += "${" + format.first + e->varname + format.second + "}";
     return false;
 }
 
@@ -51,6 +72,11 @@ bool OpenFlowPrint::preorder(const IR::OF_PriorityMatch* e)  {
     return false;
 }
 
+bool OpenFlowPrint::preorder(const IR::OF_CookieMatch* e)  {
+    buffer += e->toString();
+    return false;
+}
+
 bool OpenFlowPrint::preorder(const IR::OF_PrereqMatch* e)  {
     buffer += e->toString();
     return false;
@@ -81,6 +107,22 @@ static cstring ethToString(uint64_t a) {
     return cstring(s);
 }
 
+// Returns a DDlog expression for 'e' converted to the size of 'reg' and
+// shifted to its position, or just 'e' if 'shift' is false.
+static cstring shiftedVariable(const IR::OF_InterpolatedVarExpression* e,
+                               const IR::OF_Register* reg, bool shift) {
+    if (reg->is_boolean)
+        return "(if (" + e->varname + ") " +
+                Util::toString(big_int(1) << reg->low) + " else 0)";
+    cstring result = e->varname;
+    if (shift) {
+        result = "(" + result + " as bit<" + Util::toString(reg->size) + ">)";
+        if (reg->low > 0)
+            result += " << " + Util::toString(reg->low);
+    }
+    return result;
+}
+
 // 'erms' must have at least one element.  All its elements must have 'left'
 // that are disjoint slices of the same OF_Register.
 static void printRegisterMatch(std::vector<const IR::OF_EqualsMatch*>& erms,
@@ -90,26 +132,61 @@ static void printRegisterMatch(std::vector<const IR::OF_EqualsMatch*>& erms,
     bool asEthernet = (reg0->name == "dl_src" || reg0->name == "dl_dst"
                        || reg0->name == "eth_src" || reg0->name == "eth_dst");
 
+    // The bits to match are the union of the constant masks and of
+    // 'maskTerms', which are computed at runtime.
+    IR::Constant matchMask = 0;
+    std::vector<cstring> maskTerms;
+    for (auto erm : erms) {
+        auto reg = erm->left->checkedTo<IR::OF_Register>();
+        if (!erm->mask) {
+            matchMask = matchMask | reg->mask();
+        } else if (auto constant = erm->mask->to<IR::OF_Constant>()) {
+            matchMask = matchMask | (IR::Constant(constant->value->value << reg->low) & reg->mask());
+        } else if (auto var = erm->mask->to<IR::OF_InterpolatedVarExpression>()) {
+            BUG_CHECK(ofp.interpolating(), "%1%: DDlog variable in a static flow", var);
+            maskTerms.push_back(shiftedVariable(var, reg, erms.size() > 1 || reg->low > 0));
+        } else {
+            BUG("%1%: unexpected mask", erm->mask);
+        }
+    }
+
     /* field=value/mask */
-    if (erms.size() > 1 || reg0->friendlyName.isNullOrEmpty()) {
+    if (erms.size() > 1 || reg0->friendlyName.isNullOrEmpty() || !ofp.interpolating()) {
         buffer += reg0->name;
     } else {
         buffer += "${r_" + reg0->friendlyName + "(true)}";
     }
     buffer += "=";
-    IR::Constant mask = 0;
-    if (erms.size() == 1 && !reg0->low) {
+    IR::Constant mask = 0;  // bits matched so far, to detect overlaps
+    if (!ofp.interpolating()) {
+        // All values are constants: compute the value of the whole field.
+        big_int value = 0;
+        for (auto erm : erms) {
+            auto reg = erm->left->checkedTo<IR::OF_Register>();
+            auto constant = erm->right->to<IR::OF_Constant>();
+            BUG_CHECK(constant, "%1%: expected a constant in a static flow", erm->right);
+            if ((mask & reg->mask()).value != 0)
+                ::error(ErrorType::ERR_UNSUPPORTED_ON_TARGET,
+                        "%1%: overlapping bitwise matches on register not yet implemented", reg);
+            mask = mask | reg->mask();
+            value |= constant->value->value << reg->low;
+        }
+        if (asEthernet)
+            buffer += ethToString(static_cast<uint64_t>(value));
+        else
+            buffer += Util::toString(value, 0, false, 16);
+    } else if (erms.size() == 1 && !reg0->low) {
         auto constant = erms[0]->right->to<IR::OF_Constant>();
+        auto var = erms[0]->right->to<IR::OF_InterpolatedVarExpression>();
         if (constant && asEthernet)
             buffer += ethToString(constant->value->asUint64());
+        else if (var && asEthernet)
+            buffer += "${to_eth(" + var->varname + ")}";
         else
             ofp.visit(erms[0]->right);
-        mask = reg0->mask();
     } else {
-        buffer += "${";
-
-        if (asEthernet)
-            buffer += "to_eth(";
+        auto format = formatter(reg0->size, asEthernet);
+        buffer += "${" + format.first;
 
         size_t n = 0;
         for (auto erm : erms) {
@@ -170,17 +247,28 @@ static void printRegisterMatch(std::vector<const IR::OF_EqualsMatch*>& erms,
             if (needsParens)
                 buffer += ")";
         }
-        if (asEthernet)
-            buffer += ")";
-        buffer += "}";
+        buffer += format.second + "}";
     }
 
-    if (mask.value != IR::Constant::GetMask(reg0->size).value) {
+    if (!maskTerms.empty()) {
+        if (matchMask.value != 0)
+            maskTerms.push_back(Util::toString(matchMask.value));
+        // A single mask of the low bits keeps the width of its variable.
+        bool shifted = erms.size() > 1 || reg0->low > 0;
+        auto format = formatter(shifted ? reg0->size : erms[0]->mask->width(), asEthernet);
+        buffer += "/${" + format.first;
+        for (size_t i = 0; i < maskTerms.size(); i++) {
+            if (i > 0)
+                buffer += " | ";
+            buffer += maskTerms[i];
+        }
+        buffer += format.second + "}";
+    } else if (matchMask.value != IR::Constant::GetMask(reg0->size).value) {
         buffer += "/";
         if (asEthernet)
-            buffer += ethToString(mask.asUint64());
+            buffer += ethToString(matchMask.asUint64());
         else
-            buffer += Util::toString(mask.value, 0, false, 16);
+            buffer += Util::toString(matchMask.value, 0, false, 16);
     }
 }
 
@@ -191,10 +279,14 @@ bool OpenFlowPrint::preorder(const IR::OF_EqualsMatch* e)  {
         erms.push_back(e);
         printRegisterMatch(erms, *this, buffer);
     } else {
-        /* field=value */
+        /* field=value or field=value/mask */
         visit(e->left);
         buffer += "=";
         visit(e->right);
+        if (e->mask) {
+            buffer += "/";
+            visit(e->mask);
+        }
     }
     return false;
 }
@@ -273,7 +365,13 @@ bool OpenFlowPrint::preorder(const IR::OF_ResubmitAction* e)  {
     return false;
 }
 
+bool OpenFlowPrint::preorder(const IR::OF_GotoTableAction* e)  {
+    buffer += e->toString();
+    return false;
+}
+
 bool OpenFlowPrint::preorder(const IR::OF_InterpolatedVariableAction* e)  {
+    BUG_CHECK(interpolate, "%1%: DDlog variable in a static flow", e);
     buffer += e->toString();
     return false;
 }
@@ -304,4 +402,469 @@ bool OpenFlowPrint::preorder(const IR::OF_OutputAction* e)  {
     return false;
 }
 
+bool OpenFlowPrint::preorder(const IR::OF_GroupAction* e)  {
+    buffer += "group:";
+    visit(e->group);
+    return false;
+}
+
+/// A 128-bit DDlog constant.
+static cstring bit128(big_int value) {
+    std::string hex = Util::toString(value, 0, false, 16).c_str();
+    if (hex.compare(0, 2, "0x") == 0)
+        hex = hex.substr(2);
+    return cstring("128'h") + hex;
+}
+
+static cstring join(const std::vector<cstring>& items, cstring separator) {
+    cstring result = "";
+    bool first = true;
+    for (auto i : items) {
+        if (!first)
+            result += separator;
+        first = false;
+        result += i;
+    }
+    return result;
+}
+
+static void addUnique(std::vector<cstring>& items, cstring item) {
+    if (std::find(items.begin(), items.end(), item) == items.end())
+        items.push_back(item);
+}
+
+void OpenFlowStructuredPrint::addField(cstring field, cstring value, cstring mask) {
+    auto& entry = fields[field];
+    addUnique(entry.first, value);
+    addUnique(entry.second, mask);
+}
+
+// Fields matched by the OVS protocol keywords, e.g. "tcp".
+static const std::map<cstring, std::vector<std::pair<cstring, unsigned>>> protocolFields = {
+    { "eth", {} },
+    { "ip", { { "eth_type", 0x0800 } } },
+    { "ipv4", { { "eth_type", 0x0800 } } },
+    { "ipv6", { { "eth_type", 0x86dd } } },
+    { "arp", { { "eth_type", 0x0806 } } },
+    { "rarp", { { "eth_type", 0x8035 } } },
+    { "mpls", { { "eth_type", 0x8847 } } },
+    { "mplsm", { { "eth_type", 0x8848 } } },
+    { "nsh", { { "eth_type", 0x894f } } },
+    { "icmp", { { "eth_type", 0x0800 }, { "nw_proto", 1 } } },
+    { "icmpv4", { { "eth_type", 0x0800 }, { "nw_proto", 1 } } },
+    { "icmp6", { { "eth_type", 0x86dd }, { "nw_proto", 58 } } },
+    { "icmpv6", { { "eth_type", 0x86dd }, { "nw_proto", 58 } } },
+    { "tcp", { { "eth_type", 0x0800 }, { "nw_proto", 6 } } },
+    { "tcp6", { { "eth_type", 0x86dd }, { "nw_proto", 6 } } },
+    { "udp", { { "eth_type", 0x0800 }, { "nw_proto", 17 } } },
+    { "udp6", { { "eth_type", 0x86dd }, { "nw_proto", 17 } } },
+    { "sctp", { { "eth_type", 0x0800 }, { "nw_proto", 132 } } },
+    { "sctp6", { { "eth_type", 0x86dd }, { "nw_proto", 132 } } },
+};
+
+const std::vector<std::pair<cstring, unsigned>>* protocolPrerequisites(cstring proto) {
+    auto it = protocolFields.find(proto);
+    return it == protocolFields.end() ? nullptr : &it->second;
+}
+
+// 'prereqs' is a comma-separated list of protocol keywords and
+// field=value clauses, as in an @of_prereq annotation.
+void OpenFlowStructuredPrint::addPrerequisites(cstring prereqs, const IR::Node* node) {
+    // The runtime truncates masks to the size of each field.
+    cstring exact = bit128(IR::Constant::GetMask(128).value);
+    std::stringstream stream(prereqs.c_str());
+    std::string clause;
+    while (std::getline(stream, clause, ',')) {
+        clause.erase(0, clause.find_first_not_of(" "));
+        clause.erase(clause.find_last_not_of(" ") + 1);
+        if (clause.empty())
+            continue;
+        auto equals = clause.find('=');
+        if (equals != std::string::npos) {
+            cstring field = clause.substr(0, equals);
+            auto value = std::stoull(clause.substr(equals + 1), nullptr, 0);
+            addField(field, bit128(value), exact);
+        } else if (clause == "vlan") {
+            addField("vlan_tci", bit128(0x1000), bit128(0x1000));
+        } else {
+            auto fields = protocolPrerequisites(clause);
+            if (!fields) {
+                ::error(ErrorType::ERR_UNSUPPORTED_ON_TARGET,
+                        "%1%: unknown protocol '%2%' in structured flows", node, clause);
+                continue;
+            }
+            for (auto f : *fields)
+                addField(f.first, bit128(f.second), exact);
+        }
+    }
+}
+
+// Returns a 128-bit DDlog expression for 'e' shifted into the position of 'dest'.
+cstring OpenFlowStructuredPrint::value(const IR::OF_Expression* e,
+                                       const IR::OF_Register* dest) const {
+    if (auto constant = e->to<IR::OF_Constant>())
+        return bit128(constant->value->value << dest->low);
+    if (auto var = e->to<IR::OF_InterpolatedVarExpression>()) {
+        if (dest->is_boolean)
+            return "(if (" + var->varname + ") " + bit128(big_int(1) << dest->low) + " else 128'h0)";
+        cstring result = "(" + var->varname + " as bit<128>";
+        if (dest->low > 0)
+            result += " << " + Util::toString(dest->low);
+        return result + ")";
+    }
+    ::error(ErrorType::ERR_UNSUPPORTED_ON_TARGET,
+            "%1%: value not supported in structured flows", e);
+    return "128'h0";
+}
+
+cstring OpenFlowStructuredPrint::subfield(const IR::OF_Expression* e) const {
+    auto reg = e->to<IR::OF_Register>();
+    if (!reg) {
+        ::error(ErrorType::ERR_UNSUPPORTED_ON_TARGET,
+                "%1%: expected a field or register in structured flows", e);
+        return "OfSubfield{\"\", 0, 0}";
+    }
+    return "OfSubfield{\"" + reg->name + "\", " + Util::toString(reg->low) + ", " +
+            Util::toString(reg->width()) + "}";
+}
+
+cstring OpenFlowStructuredPrint::getMatches() const {
+    std::vector<cstring> result;
+    for (auto f : fields)
+        result.push_back("OfField{\"" + f.first + "\", " + join(f.second.first, " | ") +
+                         ", " + join(f.second.second, " | ") + "}");
+    return "[" + join(result, ", ") + "]";
+}
+
+cstring OpenFlowStructuredPrint::getActions() const {
+    if (!actionsVariable.isNullOrEmpty()) {
+        BUG_CHECK(actions.empty(), "%1%: cannot combine actions with a variable", actionsVariable);
+        return actionsVariable;
+    }
+    return "[" + join(actions, ", ") + "]";
+}
+
+bool OpenFlowStructuredPrint::preorder(const IR::OF_TableMatch* e) {
+    table = Util::toString(e->id);
+    return false;
+}
+
+bool OpenFlowStructuredPrint::preorder(const IR::OF_PriorityMatch* e) {
+    if (auto var = e->priority->to<IR::OF_InterpolatedVarExpression>())
+        priority = "(" + var->varname + " as bit<16>)";
+    else
+        priority = e->priority->toString();
+    return false;
+}
+
+bool OpenFlowStructuredPrint::preorder(const IR::OF_CookieMatch* e) {
+    if (auto var = e->cookie->to<IR::OF_InterpolatedVarExpression>())
+        cookie = "(" + var->varname + " as bit<64>)";
+    else
+        cookie = e->cookie->toString();
+    return false;
+}
+
+bool OpenFlowStructuredPrint::preorder(const IR::OF_PrereqMatch* e) {
+    addPrerequisites(e->prereq, e);
+    return false;
+}
+
+bool OpenFlowStructuredPrint::preorder(const IR::OF_ProtocolMatch* e) {
+    addPrerequisites(e->proto, e);
+    return false;
+}
+
+bool OpenFlowStructuredPrint::preorder(const IR::OF_EqualsMatch* e) {
+    auto reg = e->left->to<IR::OF_Register>();
+    if (!reg) {
+        ::error(ErrorType::ERR_UNSUPPORTED_ON_TARGET,
+                "%1%: expected a field or register in structured flows", e->left);
+        return false;
+    }
+    cstring mask = e->mask ? value(e->mask, reg) : bit128(reg->mask().value);
+    addField(reg->name, value(e->right, reg), mask);
+    return false;
+}
+
+bool OpenFlowStructuredPrint::preorder(const IR::OF_SeqMatch* e) {
+    for (auto m : e->matches)
+        visit(m);
+    return false;
+}
+
+bool OpenFlowStructuredPrint::preorder(const IR::OF_EmptyAction*) {
+    return false;
+}
+
+bool OpenFlowStructuredPrint::preorder(const IR::OF_ExplicitAction* e) {
+    if (e->action == "strip_vlan")
+        actions.push_back("OfStripVlan{}");
+    else
+        ::error(ErrorType::ERR_UNSUPPORTED_ON_TARGET,
+                "%1%: action not supported in structured flows", e->action);
+    return false;
+}
+
+bool OpenFlowStructuredPrint::preorder(const IR::OF_MatchAndAction* e) {
+    visit(e->match);
+    visit(e->action);
+    return false;
+}
+
+bool OpenFlowStructuredPrint::preorder(const IR::OF_MoveAction* e) {
+    actions.push_back("OfMove{" + subfield(e->src) + ", " + subfield(e->dest) + "}");
+    return false;
+}
+
+bool OpenFlowStructuredPrint::preorder(const IR::OF_LoadAction* e) {
+    auto reg = e->dest->to<IR::OF_Register>();
+    if (!reg) {
+        ::error(ErrorType::ERR_UNSUPPORTED_ON_TARGET,
+                "%1%: expected a field or register in structured flows", e->dest);
+        return false;
+    }
+    actions.push_back("OfSetField{OfField{\"" + reg->name + "\", " + value(e->src, reg) +
+                      ", " + bit128(reg->mask().value) + "}}");
+    return false;
+}
+
+bool OpenFlowStructuredPrint::preorder(const IR::OF_ResubmitAction* e) {
+    actions.push_back("OfResubmit{" + Util::toString(e->nextTable) + "}");
+    return false;
+}
+
+bool OpenFlowStructuredPrint::preorder(const IR::OF_GotoTableAction* e) {
+    actions.push_back("OfGotoTable{" + Util::toString(e->nextTable) + "}");
+    return false;
+}
+
+bool OpenFlowStructuredPrint::preorder(const IR::OF_InterpolatedVariableAction* e) {
+    actionsVariable = e->varname;
+    return false;
+}
+
+bool OpenFlowStructuredPrint::preorder(const IR::OF_SeqAction* e) {
+    visit(e->left);
+    visit(e->right);
+    return false;
+}
+
+bool OpenFlowStructuredPrint::preorder(const IR::OF_DropAction*) {
+    // An empty action list drops the packet.
+    return false;
+}
+
+bool OpenFlowStructuredPrint::preorder(const IR::OF_CloneAction* e) {
+    actions.push_back("OfCloneBegin{}");
+    visit(e->action);
+    actions.push_back("OfCloneEnd{}");
+    return false;
+}
+
+bool OpenFlowStructuredPrint::preorder(const IR::OF_OutputAction* e) {
+    if (auto constant = e->dest->to<IR::OF_Constant>())
+        actions.push_back("OfOutput{" + constant->toString() + "}");
+    else
+        actions.push_back("OfOutputField{" + subfield(e->dest) + "}");
+    return false;
+}
+
+bool OpenFlowStructuredPrint::preorder(const IR::OF_GroupAction* e) {
+    // The backend rejects action selectors with structured flows.
+    BUG("%1%: groups are not supported in structured flows", e);
+}
+
+/// Appends to 'out' the actions of the sequence 'action'.
+static void flattenActions(const IR::OF_Action* action, std::vector<const IR::OF_Action*>& out) {
+    if (auto seq = action->to<IR::OF_SeqAction>()) {
+        flattenActions(seq->left, out);
+        flattenActions(seq->right, out);
+    } else if (!action->is<IR::OF_EmptyAction>()) {
+        out.push_back(action);
+    }
+}
+
+static bool overlaps(const FieldBits& a, const FieldBits& b) {
+    for (auto& field : a) {
+        auto it = b.find(field.first);
+        if (it != b.end() && (field.second & it->second) != 0)
+            return true;
+    }
+    return false;
+}
+
+static void subtract(FieldBits& a, const FieldBits& b) {
+    for (auto& field : b) {
+        auto it = a.find(field.first);
+        if (it == a.end())
+            continue;
+        it->second &= ~field.second;
+        if (it->second == 0)
+            a.erase(it);
+    }
+}
+
+/// A load or a move between registers, which the peephole optimizer
+/// can reason about.
+struct RegisterStore {
+    const IR::OF_Register* dest = nullptr;
+    /// The register that a move reads.
+    const IR::OF_Register* src = nullptr;
+    /// The value that a load writes, if it is a constant.
+    const IR::OF_Constant* value = nullptr;
+    FieldBits writes, reads;
+
+    explicit RegisterStore(const IR::OF_Action* action) {
+        if (auto load = action->to<IR::OF_LoadAction>()) {
+            if (load->src->is<IR::OF_Constant>() ||
+                load->src->is<IR::OF_InterpolatedVarExpression>()) {
+                dest = load->dest->to<IR::OF_Register>();
+                value = load->src->to<IR::OF_Constant>();
+                // Negative constants do not split into bits.
+                if (value && value->value->value < 0)
+                    value = nullptr;
+            }
+        } else if (auto move = action->to<IR::OF_MoveAction>()) {
+            src = move->src->to<IR::OF_Register>();
+            if (src)
+                dest = move->dest->to<IR::OF_Register>();
+        }
+        if (dest)
+            writes = registerBits(dest);
+        if (dest && src)
+            reads = registerBits(src);
+    }
+
+    /// False if the action is not a load or move that this understands.
+    bool known() const { return dest != nullptr; }
+};
+
+/// Returns a load of 'value', of the width of 'dest', to 'dest'.
+static const IR::OF_LoadAction* loadConstant(const big_int& value, const IR::OF_Register* dest) {
+    auto type = IR::Type_Bits::get(dest->width());
+    return new IR::OF_LoadAction(new IR::OF_Constant(new IR::Constant(type, value)), dest);
+}
+
+/// Replaces moves from registers loaded with a constant earlier in the
+/// same run by loads of the constant.
+static void foldConstantMoves(std::vector<const IR::OF_Action*>& actions) {
+    std::vector<std::pair<const IR::OF_Register*, big_int>> constants;
+    for (auto& action : actions) {
+        RegisterStore store(action);
+        if (!store.known()) {
+            constants.clear();
+            continue;
+        }
+        if (store.src) {
+            for (auto& c : constants) {
+                auto reg = c.first;
+                if (reg->name != store.src->name || store.src->low < reg->low ||
+                    store.src->high > reg->high)
+                    continue;
+                big_int value = (c.second >> (store.src->low - reg->low)) &
+                        IR::Constant::GetMask(store.src->width()).value;
+                action = loadConstant(value, store.dest);
+                store = RegisterStore(action);
+                break;
+            }
+        }
+        constants.erase(std::remove_if(constants.begin(), constants.end(), [&](const auto& c) {
+            return overlaps(registerBits(c.first), store.writes);
+        }), constants.end());
+        if (store.value)
+            constants.emplace_back(store.dest, store.value->value->value);
+    }
+}
+
+/// Removes the stores whose bits are all overwritten, later in the same
+/// run, before any of them is read.
+static void removeDeadStores(std::vector<const IR::OF_Action*>& actions) {
+    std::vector<const IR::OF_Action*> result;
+    for (size_t i = 0; i < actions.size(); i++) {
+        RegisterStore store(actions.at(i));
+        bool dead = false;
+        if (store.known()) {
+            FieldBits live = store.writes;
+            for (size_t j = i + 1; j < actions.size(); j++) {
+                RegisterStore later(actions.at(j));
+                if (!later.known() || overlaps(later.reads, live))
+                    break;
+                subtract(live, later.writes);
+                if (live.empty()) {
+                    dead = true;
+                    break;
+                }
+            }
+        }
+        if (!dead)
+            result.push_back(actions.at(i));
+    }
+    actions = result;
+}
+
+/// Merges each load of a constant with an earlier load of a constant to
+/// the adjacent bits of the same register, if the actions between them
+/// do not touch the bits of the later load.
+static bool mergeLoads(std::vector<const IR::OF_Action*>& actions) {
+    // OpenFlow "load" takes values of at most 64 bits.
+    static const size_t maxWidth = 64;
+    bool changed = false;
+    for (size_t i = 1; i < actions.size(); i++) {
+        RegisterStore store(actions.at(i));
+        if (!store.value || !store.dest)
+            continue;
+        for (size_t k = i; k-- > 0; ) {
+            RegisterStore earlier(actions.at(k));
+            if (!earlier.known())
+                break;
+            auto a = earlier.dest, b = store.dest;
+            if (earlier.value && a->name == b->name && a->size == b->size &&
+                a->width() + b->width() <= maxWidth &&
+                (a->high + 1 == b->low || b->high + 1 == a->low)) {
+                auto low = a->low < b->low ? earlier : store;
+                auto high = a->low < b->low ? store : earlier;
+                big_int lowBits = low.value->value->value &
+                        IR::Constant::GetMask(low.dest->width()).value;
+                big_int highBits = high.value->value->value &
+                        IR::Constant::GetMask(high.dest->width()).value;
+                big_int value = (highBits << low.dest->width()) | lowBits;
+                auto merged = new IR::OF_Register(a->name, a->size, low.dest->low,
+                                                  high.dest->high, false);
+                actions.at(k) = loadConstant(value, merged);
+                actions.erase(actions.begin() + i);
+                i--;
+                changed = true;
+                break;
+            }
+            if (overlaps(earlier.reads, store.writes) || overlaps(earlier.writes, store.writes))
+                break;
+        }
+    }
+    return changed;
+}
+
+const IR::Node* OpenFlowPeephole::preorder(IR::OF_SeqAction* sequence) {
+    std::vector<const IR::OF_Action*> actions;
+    flattenActions(sequence, actions);
+    for (auto& action : actions) {
+        // A clone runs its actions on a copy of the packet, so they are
+        // a separate list.
+        if (auto clone = action->to<IR::OF_CloneAction>())
+            action = clone->apply(OpenFlowPeephole())->checkedTo<IR::OF_Action>();
+    }
+
+    foldConstantMoves(actions);
+    removeDeadStores(actions);
+    while (mergeLoads(actions)) {}
+
+    prune();
+    if (actions.empty())
+        return new IR::OF_EmptyAction();
+    const IR::OF_Action* result = actions.front();
+    for (size_t i = 1; i < actions.size(); i++)
+        result = new IR::OF_SeqAction(result, actions.at(i));
+    return result;
+}
+
 }  // namespace OFP4
@@ -18,6 +18,7 @@ limitations under the License.
 #define _EXTENSIONS_OFP4_OFVISITORS_H_
 
 #include "ir/ir.h"
+#include "lib/ordered_map.h"
 
 namespace OFP4 {
 
@@ -60,20 +61,69 @@ class OpenFlowSimplify : public Transform {
         prune();
         return action;
     }
+
+    const IR::Node* preorder(IR::OF_GotoTableAction* action) override {
+        foundResubmit = true;
+        prune();
+        return action;
+    }
+};
+
+/// Peephole optimization of action lists, for flows that went through
+/// OpenFlowSimplify.  Within each run of loads and moves it turns moves
+/// from registers that hold a known constant into loads, removes stores
+/// that are overwritten before they are read, and merges loads of
+/// constants into adjacent bits of a register.  Any other action ends
+/// the run, since it may read or write anything.
+class OpenFlowPeephole : public Transform {
+ public:
+    OpenFlowPeephole() { setName("OpenFlowPeephole"); visitDagOnce = false; }
+
+    const IR::Node* preorder(IR::OF_SeqAction* sequence) override;
+};
+
+/// Replace the resubmits that jump forward from table 'table' with
+/// goto_table, which avoids a recursive lookup in OVS.  goto_table is
+/// not allowed within clone, so resubmits there are left unchanged.
+class UseGotoTable : public Transform {
+    size_t table;
+
+ public:
+    explicit UseGotoTable(size_t table): table(table)
+    { setName("UseGotoTable"); visitDagOnce = false; }
+
+    const IR::Node* preorder(IR::OF_CloneAction* action) override {
+        prune();
+        return action;
+    }
+
+    const IR::Node* preorder(IR::OF_ResubmitAction* action) override {
+        if (action->nextTable > table)
+            return new IR::OF_GotoTableAction(action->nextTable);
+        return action;
+    }
 };
 
 /// Convert an OpenFlow program to a string.
 class OpenFlowPrint : public Inspector {
     std::string buffer;
+    // If false, the output is a plain OpenFlow flow: registers are
+    // named directly and values are computed at compile time, so the
+    // program must not refer to DDlog variables.
+    bool interpolate;
 
  public:
-    OpenFlowPrint() { setName("OpenFlowPrint"); visitDagOnce = false; }
+    explicit OpenFlowPrint(bool interpolate = true): interpolate(interpolate)
+    { setName("OpenFlowPrint"); visitDagOnce = false; }
+
+    bool interpolating() const { return interpolate; }
 
     bool preorder(const IR::OF_TableMatch* e) override;
     bool preorder(const IR::OF_Constant* e) override;
     bool preorder(const IR::OF_Register* e) override;
     bool preorder(const IR::OF_InterpolatedVarExpression* e) override;
     bool preorder(const IR::OF_PriorityMatch* e) override;
+    bool preorder(const IR::OF_CookieMatch* e) override;
     bool preorder(const IR::OF_PrereqMatch* e) override;
     bool preorder(const IR::OF_Slice* e) override;
     bool preorder(const IR::OF_EqualsMatch* e) override;
@@ -85,11 +135,13 @@ class OpenFlowPrint : public Inspector {
     bool preorder(const IR::OF_MoveAction* e) override;
     bool preorder(const IR::OF_LoadAction* e) override;
     bool preorder(const IR::OF_ResubmitAction* e) override;
+    bool preorder(const IR::OF_GotoTableAction* e) override;
     bool preorder(const IR::OF_InterpolatedVariableAction* e) override;
     bool preorder(const IR::OF_SeqAction* e) override;
     bool preorder(const IR::OF_DropAction* e) override;
     bool preorder(const IR::OF_CloneAction* e) override;
     bool preorder(const IR::OF_OutputAction* e) override;
+    bool preorder(const IR::OF_GroupAction* e) override;
 
     cstring getString() { return cstring(buffer); }
 
@@ -99,6 +151,97 @@ class OpenFlowPrint : public Inspector {
         node->apply(ofp);
         return ofp.getString();
     }
+
+    /// Prints 'node', which must not depend on DDlog variables, in the
+    /// syntax of ovs-ofctl.
+    static cstring toStaticString(const IR::Node* node) {
+        OpenFlowPrint ofp(false);
+        BUG_CHECK(node->is<IR::IOF_Node>(), "%1%: expected an OF node", node);
+        node->apply(ofp);
+        return ofp.getString();
+    }
+};
+
+/// Checks whether an OpenFlow program depends on DDlog variables.
+class IsStaticFlow : public Inspector {
+ public:
+    bool result = true;
+
+    IsStaticFlow() { setName("IsStaticFlow"); }
+    bool preorder(const IR::OF_InterpolatedVarExpression*) override
+    { result = false; return false; }
+    bool preorder(const IR::OF_InterpolatedVariableAction*) override
+    { result = false; return false; }
+
+    static bool check(const IR::Node* node) {
+        IsStaticFlow isf;
+        node->apply(isf);
+        return isf.result;
+    }
+};
+
+/// Returns the fields and values that protocol keyword 'proto', such as
+/// "tcp", stands for in a match, or nullptr if 'proto' is unknown.
+const std::vector<std::pair<cstring, unsigned>>* protocolPrerequisites(cstring proto);
+
+/// Convert an OpenFlow program to the components of a DDlog
+/// 'structured_flow_t' (see ofp4lib.dl).  Register fields are named
+/// directly, since their positions are known at compile time, and
+/// protocol prerequisites are expanded into the fields they match.
+class OpenFlowStructuredPrint : public Inspector {
+    cstring table = "0";
+    cstring priority = "32768";  // default OpenFlow priority
+    cstring cookie = "0";
+    // Values and masks for each matched field, as 128-bit DDlog
+    // expressions to OR together; all the slices of a register are
+    // combined into a single match.
+    ordered_map<cstring, std::pair<std::vector<cstring>, std::vector<cstring>>> fields;
+    std::vector<cstring> actions;
+    // Set if the actions come from a DDlog variable.
+    cstring actionsVariable = nullptr;
+
+    void addField(cstring field, cstring value, cstring mask);
+    void addPrerequisites(cstring prereqs, const IR::Node* node);
+    cstring value(const IR::OF_Expression* e, const IR::OF_Register* dest) const;
+    cstring subfield(const IR::OF_Expression* e) const;
+
+ public:
+    OpenFlowStructuredPrint() { setName("OpenFlowStructuredPrint"); visitDagOnce = false; }
+
+    bool preorder(const IR::OF_TableMatch* e) override;
+    bool preorder(const IR::OF_PriorityMatch* e) override;
+    bool preorder(const IR::OF_CookieMatch* e) override;
+    bool preorder(const IR::OF_PrereqMatch* e) override;
+    bool preorder(const IR::OF_EqualsMatch* e) override;
+    bool preorder(const IR::OF_ProtocolMatch* e) override;
+    bool preorder(const IR::OF_SeqMatch* e) override;
+    bool preorder(const IR::OF_EmptyAction* e) override;
+    bool preorder(const IR::OF_ExplicitAction* e) override;
+    bool preorder(const IR::OF_MatchAndAction* e) override;
+    bool preorder(const IR::OF_MoveAction* e) override;
+    bool preorder(const IR::OF_LoadAction* e) override;
+    bool preorder(const IR::OF_ResubmitAction* e) override;
+    bool preorder(const IR::OF_GotoTableAction* e) override;
+    bool preorder(const IR::OF_InterpolatedVariableAction* e) override;
+    bool preorder(const IR::OF_SeqAction* e) override;
+    bool preorder(const IR::OF_DropAction* e) override;
+    bool preorder(const IR::OF_CloneAction* e) override;
+    bool preorder(const IR::OF_OutputAction* e) override;
+    bool preorder(const IR::OF_GroupAction* e) override;
+
+    cstring getTable() const { return table; }
+    cstring getPriority() const { return priority; }
+    cstring getCookie() const { return cookie; }
+    /// A DDlog expression of type Vec<of_field_t>.
+    cstring getMatches() const;
+    /// A DDlog expression of type Vec<of_action_t>.
+    cstring getActions() const;
+
+    static cstring actionsToString(const IR::OF_Action* action) {
+        OpenFlowStructuredPrint ofp;
+        action->apply(ofp);
+        return ofp.getActions();
+    }
 };
 
 }  // namespace OFP4
@@ -25,11 +25,84 @@ class OFP4Options : public CompilerOptions {
  public:
     // file to output to
     cstring outputFile = nullptr;
+    // pack booleans and other sub-byte values at bit granularity
+    bool packBits = false;
+    // generate typed StructuredFlow records instead of flow strings
+    bool structuredFlows = false;
+    // file to output the constant flows to, in ovs-ofctl syntax
+    cstring staticFlowsFile = nullptr;
+    // file to write compilation statistics to, as JSON
+    cstring statsFile = nullptr;
+    // number of threads that generate flows
+    // file with the table ids of the previous compilation, updated in place
+    cstring tableIdMapFile = nullptr;
+    // replicate multicast packets with OpenFlow groups of type all
+    bool multicastGroups = false;
+    // match registers only on the bits that the program may set
+    bool narrowMatches = false;
+    // file to write the bits that each table and path un-wildcard to, as JSON
+    cstring megaflowReportFile = nullptr;
+    // generate one flow relation per OpenFlow table
+    bool perTableFlows = false;
+    // file to write the OpenFlow tables' names, keys and prefix fields to, as JSON
+    cstring tableManifestFile = nullptr;
+    // fail if the worst-case number of flows exceeds this; 0 for no limit
+    unsigned long maxFlows = 0;
 
     OFP4Options() {
         registerOption("-o", "outfile",
                 [this](const char* arg) { outputFile = arg; return true; },
                 "Write output to outfile");
+        registerOption("--pack-bits", nullptr,
+                [this](const char*) { packBits = true; return true; },
+                "Pack booleans and values narrower than a byte into shared register bytes");
+        registerOption("--structured-flows", nullptr,
+                [this](const char*) { structuredFlows = true; return true; },
+                "Generate a typed StructuredFlow relation instead of Flow strings");
+        registerOption("--static-flows", "file",
+                [this](const char* arg) { staticFlowsFile = arg; return true; },
+                "Write the flows that do not depend on DDlog relations to file "
+                "instead of the DDlog program");
+        registerOption("--stats", "file",
+                [this](const char* arg) { statsFile = arg; return true; },
+                "Write the time and memory used by each pass and the size of "
+                "the output to file, as JSON");
+        registerOption("--table-id-map", "file",
+                [this](const char* arg) { tableIdMapFile = arg; return true; },
+                "Keep the OpenFlow table ids of the tables recorded in file, "
+                "and record the ids of this compilation in it");
+        registerOption("--multicast-groups", nullptr,
+                [this](const char*) { multicastGroups = true; return true; },
+                "Replicate multicast packets with an OpenFlow group of type all "
+                "per multicast group, instead of one flow that clones each packet");
+        registerOption("--narrow-matches", nullptr,
+                [this](const char*) { narrowMatches = true; return true; },
+                "Match registers against constants only on the bits that some "
+                "action may set, so that flows un-wildcard fewer bits");
+        registerOption("--megaflow-report", "file",
+                [this](const char* arg) { megaflowReportFile = arg; return true; },
+                "Write the fields and bits that the flows of each table, and of "
+                "each path through the pipeline, can un-wildcard to file, as JSON");
+        registerOption("--per-table-flows", nullptr,
+                [this](const char*) { perTableFlows = true; return true; },
+                "Generate a flow relation for each OpenFlow table, named with "
+                "the table id, instead of a single relation for all the flows");
+        registerOption("--table-manifest", "file",
+                [this](const char* arg) { tableManifestFile = arg; return true; },
+                "Write the id, name, size and key fields of each OpenFlow table, "
+                "and the fields that OVS should track prefixes of, to file, as JSON");
+        registerOption("--max-flows", "N",
+                [this](const char* arg) {
+                    char* end;
+                    maxFlows = strtoul(arg, &end, 10);
+                    if (*end != '\0' || maxFlows == 0) {
+                        ::error(ErrorType::ERR_INVALID,
+                                "--max-flows: expected a positive number, not %1%", arg);
+                        return false;
+                    }
+                    return true; },
+                "Fail if the tables, filled to their size, would take more than "
+                "N OpenFlow flows");
     }
 };
 
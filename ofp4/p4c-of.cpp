@@ -19,7 +19,6 @@ limitations under the License.
 #include <fstream>
 #include <iostream>
 
-#include "control-plane/p4RuntimeSerializer.h"
 #include "ir/ir.h"
 #include "ir/json_loader.h"
 #include "lib/log.h"
@@ -28,14 +27,14 @@ limitations under the License.
 #include "lib/gc.h"
 #include "lib/crash.h"
 #include "lib/nullstream.h"
-#include "frontends/common/applyOptionsPragmas.h"
 #include "frontends/common/parseInput.h"
 #include "frontends/p4/evaluator/evaluator.h"
-#include "frontends/p4/frontend.h"
 #include "frontends/p4/toP4/toP4.h"
+#include "libofp4.h"
 #include "midend.h"
 #include "backend.h"
 #include "options.h"
+#include "stats.h"
 
 using OFP4Context = P4CContextWithOptions<OFP4::OFP4Options>;
 
@@ -43,29 +42,21 @@ bool done(const IR::P4Program* program) {
     return program == nullptr || ::errorCount() > 0;
 }
 
-void compile(OFP4::OFP4Options& options) {
-    auto hook = options.getDebugHook();
+void compile(OFP4::OFP4Options& options, OFP4::CompileStats* stats) {
+    if (stats)
+        stats->start();
     const IR::P4Program * program = P4::parseP4File(options);
+    if (stats)
+        stats->endPass("parse");
     if (done(program))
         return;
 
-    P4::P4COptionPragmaParser optionsPragmaParser;
-    program->apply(P4::ApplyOptionsPragmas(optionsPragmaParser));
-
-    P4::FrontEnd fe;
-    fe.addDebugHook(hook);
-    program = fe.run(options, program);
-    if (done(program))
-        return;
-
-    P4::serializeP4RuntimeIfRequired(program, options);
     OFP4::MidEnd midend(options);
-    midend.addDebugHook(hook);
-    program = program->apply(midend);
+    program = OFP4::runFrontMidEnd(options, program, true, midend, stats);
     if (done(program))
         return;
 
-    OFP4::BackEnd backend(&midend.refMap, &midend.typeMap);
+    OFP4::BackEnd backend(&midend.refMap, &midend.typeMap, stats);
     backend.run(options, program);
 }
 
@@ -83,7 +74,15 @@ int main(int argc, char *const argv[]) {
     if (::errorCount() > 0)
         return 1;
 
-    compile(options);
+    OFP4::CompileStats* stats = nullptr;
+    if (!options.statsFile.isNullOrEmpty())
+        stats = new OFP4::CompileStats();
+    compile(options, stats);
+    if (stats) {
+        // Written even if compilation failed, to show how far it got.
+        if (auto statsStream = openFile(options.statsFile, false))
+            stats->write(*statsStream);
+    }
     if (Log::verbose())
         std::cerr << "Done." << std::endl;
     return ::errorCount() > 0;
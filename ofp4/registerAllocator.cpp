@@ -0,0 +1,287 @@
+/*
+Copyright 2022 VMware, Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <algorithm>
+
+#include "registerAllocator.h"
+#include "frontends/p4/methodInstance.h"
+
+namespace OFP4 {
+
+namespace {
+
+/// Collects the variables declared in a control, including the
+/// variables declared in its actions.
+class CollectVariables : public Inspector {
+    VariableSet& variables;
+
+ public:
+    explicit CollectVariables(VariableSet& variables): variables(variables)
+    { setName("CollectVariables"); }
+    bool preorder(const IR::Declaration_Variable* decl) override {
+        variables.emplace(decl);
+        return false;
+    }
+};
+
+/// Summarizes how a sequence of statements or an expression accesses
+/// the candidate variables.  Action bodies are straight-line code at
+/// this point, so a variable written completely by an assignment before
+/// it is read does not need to be live before the sequence.
+class VariableAccesses : public Inspector {
+    P4::ReferenceMap* refMap;
+    const VariableSet& candidates;
+
+    const IR::IDeclaration* getCandidate(const IR::PathExpression* path) const {
+        auto decl = refMap->getDeclaration(path->path, true);
+        if (candidates.find(decl) == candidates.end())
+            return nullptr;
+        return decl;
+    }
+
+ public:
+    VariableSet accessed;
+    VariableSet used;
+    VariableSet killed;
+
+    VariableAccesses(P4::ReferenceMap* refMap, const VariableSet& candidates):
+            refMap(refMap), candidates(candidates) {
+        setName("VariableAccesses"); visitDagOnce = false;
+    }
+
+    bool preorder(const IR::PathExpression* path) override {
+        auto decl = getCandidate(path);
+        if (!decl)
+            return false;
+        // A partial write, e.g., to a slice, preserves the other bits
+        // of the variable, so it behaves as a read too.
+        accessed.emplace(decl);
+        if (killed.find(decl) == killed.end())
+            used.emplace(decl);
+        return false;
+    }
+
+    bool preorder(const IR::AssignmentStatement* statement) override {
+        visit(statement->right);
+        if (auto path = statement->left->to<IR::PathExpression>()) {
+            if (auto decl = getCandidate(path)) {
+                accessed.emplace(decl);
+                killed.emplace(decl);
+                return false;
+            }
+        }
+        visit(statement->left);
+        return false;
+    }
+};
+
+}  // namespace
+
+void Liveness::summarize(const CFG::Node* node) {
+    VariableSet& nodeAccessed = accessed[node];
+    VariableSet& nodeUsed = used[node];
+    VariableSet& nodeKilled = killed[node];
+
+    if (auto tn = node->to<CFG::TableNode>()) {
+        // The key is read first, then exactly one action runs.
+        if (auto key = tn->table->getKey()) {
+            VariableAccesses keyAccesses(refMap, candidates);
+            for (auto ke : key->keyElements)
+                ke->expression->apply(keyAccesses);
+            nodeAccessed.insert(keyAccesses.accessed.begin(), keyAccesses.accessed.end());
+            nodeUsed.insert(keyAccesses.used.begin(), keyAccesses.used.end());
+        }
+
+        bool first = true;
+        for (auto ale : tn->table->getActionList()->actionList) {
+            auto mce = ale->expression->to<IR::MethodCallExpression>();
+            BUG_CHECK(mce, "%1%: expected a method call", ale->expression);
+            auto mi = P4::MethodInstance::resolve(mce, refMap, typeMap);
+            auto ac = mi->to<P4::ActionCall>();
+            CHECK_NULL(ac);
+
+            VariableAccesses actionAccesses(refMap, candidates);
+            ac->action->body->apply(actionAccesses);
+            nodeAccessed.insert(actionAccesses.accessed.begin(), actionAccesses.accessed.end());
+            nodeUsed.insert(actionAccesses.used.begin(), actionAccesses.used.end());
+            // Only the variables written by all actions are surely killed.
+            if (first) {
+                nodeKilled = actionAccesses.killed;
+                first = false;
+            } else {
+                VariableSet both;
+                for (auto v : nodeKilled)
+                    if (actionAccesses.killed.find(v) != actionAccesses.killed.end())
+                        both.emplace(v);
+                nodeKilled = both;
+            }
+        }
+    } else if (auto in = node->to<CFG::IfNode>()) {
+        VariableAccesses conditionAccesses(refMap, candidates);
+        in->statement->condition->apply(conditionAccesses);
+        nodeAccessed = conditionAccesses.accessed;
+        nodeUsed = conditionAccesses.used;
+    }
+}
+
+void Liveness::compute() {
+    for (auto node : cfg.allNodes) {
+        summarize(node);
+        liveIn[node];
+        liveOut[node];
+    }
+
+    // Standard backwards data-flow analysis.  The sets only grow, so
+    // comparing sizes is enough to detect a fixed point.  The graph is
+    // acyclic, so visiting nodes in reverse creation order converges quickly.
+    std::vector<const CFG::Node*> order(cfg.allNodes.begin(), cfg.allNodes.end());
+    std::reverse(order.begin(), order.end());
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto node : order) {
+            VariableSet out;
+            for (auto e : node->successors.edges) {
+                auto it = liveIn.find(e->endpoint);
+                if (it != liveIn.end())
+                    out.insert(it->second.begin(), it->second.end());
+            }
+            VariableSet in = used[node];
+            auto& nodeKilled = killed[node];
+            for (auto v : out)
+                if (nodeKilled.find(v) == nodeKilled.end())
+                    in.emplace(v);
+            if (in.size() != liveIn[node].size() || out.size() != liveOut[node].size())
+                changed = true;
+            liveIn[node] = in;
+            liveOut[node] = out;
+        }
+    }
+    LOG2("Liveness for " << cfg.container->name << this);
+}
+
+VariableSet Liveness::liveAt(const CFG::Node* node) const {
+    VariableSet result;
+    for (auto map : { &accessed, &liveIn, &liveOut }) {
+        auto it = map->find(node);
+        if (it != map->end())
+            result.insert(it->second.begin(), it->second.end());
+    }
+    return result;
+}
+
+void Liveness::dbprint(std::ostream& out) const {
+    for (auto node : cfg.allNodes) {
+        out << std::endl << node->id << " " << node->name << ": live";
+        for (auto v : liveAt(node))
+            out << " " << v->externalName();
+    }
+}
+
+void RegisterAllocator::interfere(const VariableSet& live) {
+    for (auto v : live) {
+        auto& neighbors = interference[v];
+        for (auto w : live)
+            if (v != w)
+                neighbors.emplace(w);
+    }
+}
+
+void RegisterAllocator::analyze(const CFG& cfg) {
+    CHECK_NULL(cfg.container);
+    auto candidates = new VariableSet();
+    CollectVariables collect(*candidates);
+    cfg.container->apply(collect);
+    variables.insert(candidates->begin(), candidates->end());
+
+    auto liveness = new Liveness(refMap, typeMap, cfg, *candidates);
+    liveness->compute();
+    analyses.push_back(liveness);
+
+    for (auto node : cfg.allNodes)
+        interfere(liveness->liveAt(node));
+    // Variables that may be read uninitialized rely on the register
+    // being 0.  The entry point may have been removed as a pass-through
+    // node; the variables live into the control are then those live
+    // into the node that replaces it, which is outside the graph if
+    // the control does nothing.
+    auto it = liveness->liveIn.find(CFG::skipPassThrough(cfg.entryPoint));
+    if (it == liveness->liveIn.end())
+        return;
+    for (auto v : it->second) {
+        LOG2(v->externalName() << " may be read before being written");
+        exclusive.emplace(v);
+    }
+}
+
+std::vector<const IR::Declaration_Variable*> RegisterAllocator::allocate() {
+    std::vector<const IR::IDeclaration*> order(variables.begin(), variables.end());
+    std::map<const IR::IDeclaration*, size_t> width;
+    for (auto v : order) {
+        auto type = typeMap->getType(v->getNode(), true);
+        width[v] = typeMap->widthBits(type, v->getNode(), true);
+    }
+    // Color the widest and most constrained variables first; this
+    // keeps fragmentation low.  The sort is stable, so ties keep the
+    // declaration order and the result is deterministic.
+    std::stable_sort(order.begin(), order.end(),
+                     [&](const IR::IDeclaration* a, const IR::IDeclaration* b) {
+                         if (width[a] != width[b])
+                             return width[a] > width[b];
+                         return interference[a].size() > interference[b].size();
+                     });
+
+    for (auto v : exclusive)
+        resources.allocateRegister(v);
+    for (auto v : order) {
+        if (exclusive.find(v) != exclusive.end())
+            continue;
+        std::vector<bool> busy(resources.totalBits(), false);
+        for (auto w : interference[v])
+            resources.markBits(w, busy);
+        resources.allocateRegister(v, busy);
+    }
+    computePressure();
+
+    std::vector<const IR::Declaration_Variable*> result;
+    for (auto v : variables)
+        result.push_back(v->getNode()->checkedTo<IR::Declaration_Variable>());
+    return result;
+}
+
+void RegisterAllocator::computePressure() {
+    auto& reserved = resources.reservedBits();
+    size_t peak = 0;
+    const CFG::Node* peakNode = nullptr;
+    for (auto liveness : analyses) {
+        for (auto node : liveness->liveIn) {
+            std::vector<bool> bits(reserved);
+            for (auto v : liveness->liveAt(node.first))
+                resources.markBits(v, bits);
+            size_t count = std::count(bits.begin(), bits.end(), true);
+            if (count > peak) {
+                peak = count;
+                peakNode = node.first;
+            }
+        }
+    }
+    resources.peakPressure = peak;
+    LOG1("Peak register pressure: " << peak << " of " << resources.totalBits() <<
+         " bits at " << (peakNode ? peakNode->name : cstring("<none>")) <<
+         "; " << resources.usedBits() << " bits allocated" << std::endl << &resources);
+}
+
+}  // namespace OFP4
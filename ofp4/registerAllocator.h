@@ -0,0 +1,107 @@
+/*
+Copyright 2022 VMware, Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _EXTENSIONS_OFP4_REGISTERALLOCATOR_H_
+#define _EXTENSIONS_OFP4_REGISTERALLOCATOR_H_
+
+#include "ir/ir.h"
+#include "lib/ordered_map.h"
+#include "lib/ordered_set.h"
+#include "frontends/common/resolveReferences/referenceMap.h"
+#include "frontends/p4/typeMap.h"
+#include "controlFlowGraph.h"
+#include "resources.h"
+
+/// Register allocation for the local variables of the ingress and egress
+/// controls.
+
+namespace OFP4 {
+
+typedef ordered_set<const IR::IDeclaration*> VariableSet;
+
+/// Computes the variables that are live before and after each node of a
+/// control-flow graph.  Every node is either a table, whose key is read
+/// and then exactly one of its actions runs, or a condition, which only
+/// reads values.
+class Liveness : public IHasDbPrint {
+    P4::ReferenceMap* refMap;
+    P4::TypeMap* typeMap;
+    const CFG& cfg;
+    const VariableSet& candidates;
+
+ public:
+    /// Variables read or written by each node.
+    std::map<const CFG::Node*, VariableSet> accessed;
+    /// Variables that a node may read before writing them.
+    std::map<const CFG::Node*, VariableSet> used;
+    /// Variables that a node always overwrites completely.
+    std::map<const CFG::Node*, VariableSet> killed;
+    std::map<const CFG::Node*, VariableSet> liveIn;
+    std::map<const CFG::Node*, VariableSet> liveOut;
+
+    Liveness(P4::ReferenceMap* refMap, P4::TypeMap* typeMap,
+             const CFG& cfg, const VariableSet& candidates):
+            refMap(refMap), typeMap(typeMap), cfg(cfg), candidates(candidates) {
+        CHECK_NULL(refMap); CHECK_NULL(typeMap);
+    }
+
+    void compute();
+    /// Variables holding a value while 'node' executes.
+    VariableSet liveAt(const CFG::Node* node) const;
+    void dbprint(std::ostream& out) const;
+
+ private:
+    void summarize(const CFG::Node* node);
+};
+
+/// Allocates registers to local variables using liveness information.
+/// Two variables interfere if they are live during the same CFG node;
+/// the interference graph is colored greedily, so variables that do not
+/// interfere can share register bits.  Variables that are read before
+/// being written on some path get private bits, so they keep the zero
+/// value that OpenFlow registers have when a packet enters the pipeline.
+class RegisterAllocator {
+    P4::ReferenceMap* refMap;
+    P4::TypeMap* typeMap;
+    OFResources& resources;
+
+    /// All candidate variables in declaration order.
+    VariableSet variables;
+    ordered_map<const IR::IDeclaration*, VariableSet> interference;
+    /// Variables that must not share register bits.
+    VariableSet exclusive;
+    std::vector<Liveness*> analyses;
+
+    void interfere(const VariableSet& live);
+    void computePressure();
+
+ public:
+    RegisterAllocator(P4::ReferenceMap* refMap, P4::TypeMap* typeMap,
+                      OFResources& resources):
+            refMap(refMap), typeMap(typeMap), resources(resources) {
+        CHECK_NULL(refMap); CHECK_NULL(typeMap);
+    }
+
+    /// Analyzes the variables declared in the control of 'cfg'.
+    void analyze(const CFG& cfg);
+    /// Allocates registers for all analyzed variables and returns them
+    /// in declaration order.
+    std::vector<const IR::Declaration_Variable*> allocate();
+};
+
+}  // namespace OFP4
+
+#endif  /* _EXTENSIONS_OFP4_REGISTERALLOCATOR_H_ */
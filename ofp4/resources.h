@@ -30,23 +30,28 @@ namespace OFP4 {
 class OFResources : public IHasDbPrint {
     P4::TypeMap* typeMap;
     std::map<const IR::IDeclaration*, const IR::OF_Register*> map;
-    // One bit for each register byte; if 'true' the byte is allocated.
-    std::vector<bool> byteMask;
-    size_t bytesPerRegister;
-
- public:
-    explicit OFResources(P4::TypeMap* typeMap): typeMap(typeMap) {
-        CHECK_NULL(typeMap);
-        bytesPerRegister = IR::OF_Register::registerSize / 8;
-        for (size_t i = 0; i < IR::OF_Register::maxRegister * bytesPerRegister; i++)
-            byteMask.push_back(false);
+    // Bits of the register file occupied by each allocated object.
+    std::map<const IR::IDeclaration*, std::vector<size_t>> placement;
+    // One bit for each register bit; if 'true' the bit is reserved
+    // for a single object for the whole pipeline.
+    std::vector<bool> bitMask;
+    // One bit for each register bit; if 'true' the bit holds at least one
+    // object that shares it with other objects whose live ranges do not overlap.
+    std::vector<bool> sharedMask;
+    // If true objects narrower than a byte are packed at bit granularity.
+    bool packBits = false;
+
+    // Index in the register file of bit 'bit' of register bundle number
+    // 'bundle' of 'size' bits.  In a bundle the register with the lowest
+    // number holds the most significant bits, e.g., xreg0 is reg0:reg1.
+    static size_t fileBit(size_t bundle, size_t size, size_t bit) {
+        size_t registers = size / IR::OF_Register::registerSize;
+        size_t reg = bundle * registers + registers - 1 - bit / IR::OF_Register::registerSize;
+        return reg * IR::OF_Register::registerSize + bit % IR::OF_Register::registerSize;
     }
 
-    static cstring makeId(cstring name) {
-        return name.replace(".", "_");
-    }
-
-    const IR::OF_Register* allocateRegister(const IR::IDeclaration* decl) {
+    const IR::OF_Register* allocate(const IR::IDeclaration* decl,
+                                    const std::vector<bool>& busy, bool reserve) {
         auto node = decl->getNode();
         auto type = typeMap->getType(node, true);
         size_t width = typeMap->widthBits(type, node, true);
@@ -67,28 +72,29 @@ class OFResources : public IHasDbPrint {
             name += "x";
         }
 
+        // Objects are byte-aligned and occupy whole bytes unless they are
+        // narrower than a byte and bit packing is enabled.
+        size_t granularity = packBits && width < 8 ? 1 : 8;
+        size_t bitsNeeded = ROUNDUP(width, granularity) * granularity;
+        auto isBusy = [&](size_t i) { return bitMask.at(i) || busy.at(i); };
         bool found = false;
-        size_t index;
-        size_t bytesNeeded = ROUNDUP(width, 8);
-        // Find a gap of bytesNeeded bytes
-        for (size_t i = 0; i < byteMask.size() - bytesNeeded + 1; i++) {
-            // The data must fit in the current register bundle.
-            if ((i * 8) / size != (i * 8 + width - 1) / size)
-                // start and end in different registers.
-                continue;
-
-            if (!byteMask.at(i)) {
-                found = true;
-                for (size_t j = i + 1; j < i + bytesNeeded; j++) {
-                    if (byteMask.at(j)) {
-                        found = false;
-                        i = j;
+        size_t bundle = 0, low = 0;
+        // Find a gap of bitsNeeded bits; the data must fit in a single
+        // register bundle.
+        size_t bundles = bitMask.size() / size;
+        for (size_t b = 0; b < bundles && !found; b++) {
+            for (size_t l = 0; l + bitsNeeded <= size; l += granularity) {
+                bool available = true;
+                for (size_t j = l; j < l + bitsNeeded; j++) {
+                    if (isBusy(fileBit(b, size, j))) {
+                        available = false;
                         break;
                     }
                 }
-                if (found) {
-                    LOG3("Allocating " << bytesNeeded << " bytes at offset " << i);
-                    index = i;
+                if (available) {
+                    found = true;
+                    bundle = b;
+                    low = l;
                     break;
                 }
             }
@@ -97,15 +103,23 @@ class OFResources : public IHasDbPrint {
             ::error(ErrorType::ERR_OVERLIMIT, "Exhausted register space");
             return nullptr;
         }
-        for (size_t i = index; i < index + bytesNeeded; i++) {
-            assert(!byteMask[i]);
-            byteMask[i] = true;
+        LOG3("Allocating " << bitsNeeded << " bits at bit " << low << " of bundle " << bundle);
+
+        auto& bits = placement[decl];
+        for (size_t j = low; j < low + bitsNeeded; j++) {
+            size_t i = fileBit(bundle, size, j);
+            assert(!bitMask[i]);
+            if (reserve)
+                bitMask[i] = true;
+            else
+                sharedMask[i] = true;
+            bits.push_back(i);
         }
-        name += "reg" + Util::toString(index / bytesPerRegister);
+        name += "reg" + Util::toString(bundle);
         auto result = new IR::OF_Register(name,
                                           size,
-                                          (index % bytesPerRegister) * 8,
-                                          (index % bytesPerRegister) * 8 + width-1,
+                                          low,
+                                          low + width - 1,
                                           type->is<IR::Type_Boolean>(),
                                           makeId(decl->externalName()));
         map.emplace(decl, result);
@@ -114,17 +128,87 @@ class OFResources : public IHasDbPrint {
         return result;
     }
 
+ public:
+    /// Largest number of register bits holding live values at any
+    /// point in the pipeline; computed by the register allocator.
+    size_t peakPressure = 0;
+
+    explicit OFResources(P4::TypeMap* typeMap): typeMap(typeMap) {
+        CHECK_NULL(typeMap);
+        for (size_t i = 0;
+             i < IR::OF_Register::maxRegister * IR::OF_Register::registerSize; i++) {
+            bitMask.push_back(false);
+            sharedMask.push_back(false);
+        }
+    }
+
+    static cstring makeId(cstring name) {
+        return name.replace(".", "_");
+    }
+
+    /// Pack objects narrower than a byte, such as booleans, at bit
+    /// granularity instead of giving each one a whole byte.
+    void setPackBits(bool pack) { packBits = pack; }
+
+    /// Size of the register file in bits.
+    size_t totalBits() const { return bitMask.size(); }
+
+    /// Allocates register space to 'decl' for the whole pipeline.
+    const IR::OF_Register* allocateRegister(const IR::IDeclaration* decl) {
+        return allocate(decl, bitMask, true);
+    }
+
+    /// Allocates register space to 'decl' avoiding the bits that are set
+    /// in 'busy'.  The allocated bits are not reserved: they are given to
+    /// other objects too when their live ranges do not overlap.
+    const IR::OF_Register* allocateRegister(const IR::IDeclaration* decl,
+                                            const std::vector<bool>& busy) {
+        BUG_CHECK(busy.size() == bitMask.size(), "Mask size mismatch");
+        return allocate(decl, busy, false);
+    }
+
+    /// Sets in 'mask' the bits allocated to 'decl', if any.
+    void markBits(const IR::IDeclaration* decl, std::vector<bool>& mask) const {
+        auto it = placement.find(decl);
+        if (it == placement.end())
+            return;
+        for (auto i : it->second)
+            mask.at(i) = true;
+    }
+
+    /// Returns a mask of the bits reserved for the whole pipeline.
+    const std::vector<bool>& reservedBits() const { return bitMask; }
+
+    /// Number of bits in the register file that are allocated to some object.
+    size_t usedBits() const {
+        size_t result = 0;
+        for (size_t i = 0; i < bitMask.size(); i++)
+            if (bitMask[i] || sharedMask[i])
+                result++;
+        return result;
+    }
+
     const IR::OF_Register* getRegister(const IR::IDeclaration* decl) const {
         auto result = ::get(map, decl);
         return result;
     }
 
     void dbprint(std::ostream& out) const {
-        size_t index = 0;
-        for (bool b: byteMask) {
-            out << (b ? "X" : "_");
-            index++;
-            if (!(index % 4))
+        // One character per byte; X: reserved, S: shared by objects with
+        // disjoint lifetimes, x and s: partially used bytes.
+        for (size_t byte = 0; byte < bitMask.size() / 8; byte++) {
+            size_t reserved = 0, shared = 0;
+            for (size_t i = byte * 8; i < byte * 8 + 8; i++) {
+                reserved += bitMask[i];
+                shared += sharedMask[i] && !bitMask[i];
+            }
+            if (reserved + shared == 0)
+                out << "_";
+            else if (reserved >= shared)
+                out << (reserved + shared == 8 ? "X" : "x");
+            else
+                out << (reserved + shared == 8 ? "S" : "s");
+            if (!((byte + 1) % 4))
                 out << " ";
         }
         out << std::endl;
@@ -22,6 +22,7 @@
 
 from subprocess import Popen
 from threading import Thread
+import re
 import sys
 import tempfile
 import shutil
@@ -40,6 +41,7 @@ class Options(object):
         self.compilerSrcDir = ""        # path to compiler source tree
         self.verbose = False
         self.compilerOptions = []
+        self.staticFlows = False        # if true write static flows to a separate file
 
 def usage(options):
     """Print program usage"""
@@ -51,6 +53,7 @@ def usage(options):
     print("options:")
     print("          -v: verbose operation")
     print("          -a \"args\": pass args to the compiler")
+    print("          -s: write the static flows to a separate file")
 
 
 class Local(object):
@@ -91,6 +94,19 @@ def run_timeout(options, args, timeout, stderr):
     return local.process.returncode
 
 
+def check_shared_actions(outputFile):
+    """Checks that the match cases of the DDlog program in outputFile call
+    the function for each shared action text instead of repeating it"""
+    with open(outputFile) as f:
+        program = f.read()
+    shared = re.findall(r'^function (actions_\w+)\(.*\): string \{\n *(".*")\n\}$', program, re.M)
+    for name, text in shared:
+        if re.search(" -> " + re.escape(text) + "(,|$)", program, re.M):
+            print("The text of", name, "is also used as a literal")
+            return FAILURE
+    return SUCCESS
+
+
 def process_file(options, argv):
     assert isinstance(options, Options)
     tmpdir = tempfile.mkdtemp(dir=".")
@@ -106,12 +122,24 @@ def process_file(options, argv):
     if not os.path.isfile(options.p4filename):
         raise Exception("No such file " + options.p4filename)
     args = ["./p4c-of", "-o", outputFile, "--p4runtime-files", p4runtimeFile] + options.compilerOptions
+    if options.staticFlows:
+        args += ["--static-flows", tmpdir + "/" + base + ".flows"]
     args.extend(argv)
 
     result = run_timeout(options, args, TIMEOUT, stderr)
     if result != SUCCESS:
         print("Error compiling")
 
+    if options.staticFlows and result == SUCCESS:
+        # The runtime relies on this to insist on the static flows.
+        with open(outputFile) as f:
+            if "output relation StaticFlows(" not in f.read():
+                print("No StaticFlows relation in", outputFile)
+                result = FAILURE
+
+    if result == SUCCESS:
+        result = check_shared_actions(outputFile)
+
     args = ["ddlog", "-i", outputFile]
     result = run_timeout(options, args, TIMEOUT, None)
     if result != SUCCESS:
@@ -145,6 +173,8 @@ def main(argv):
             options.cleanupTmp = False
         elif argv[0] == "-v":
             options.verbose = True
+        elif argv[0] == "-s":
+            options.staticFlows = True
         elif argv[0] == "-a":
             if len(argv) == 0:
                 print("Missing argument for -a option")
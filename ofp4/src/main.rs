@@ -30,7 +30,7 @@ use daemon::{Daemonize, Daemonizing};
 use differential_datalog::api::HDDlog;
 use differential_datalog::ddval::{DDValConvert, DDValue};
 use differential_datalog::program::{IdxId, RelId, Update};
-use differential_datalog::record::{Record, RelIdentifier, UpdCmd};
+use differential_datalog::record::{FromRecord, IntoRecord, Name, Record, RelIdentifier, UpdCmd};
 use differential_datalog::{DeltaMap, DDlog, DDlogDynamic, DDlogInventory};
 
 use futures_util::{FutureExt, SinkExt, TryFutureExt, TryStreamExt};
@@ -52,8 +52,9 @@ use ovs::{
     latch::Latch,
     ofpbuf::Ofpbuf,
     ofp_bundle::*,
-    ofp_flow::{FlowMod, FlowModCommand},
-    ofp_msgs::OfpType,
+    ofp_flow::{FieldValue, FlowAction, FlowMod, FlowModCommand, FlowStats, FlowStatsRequest, Subfield},
+    ofp_group::{GroupDescRequest, GroupMod, GroupModCommand},
+    ofp_msgs::{OfpType, ofpmp_more, xid},
     rconn::Rconn
 };
 
@@ -61,8 +62,13 @@ use p4ext::*;
 
 use proto::p4info::P4Info;
 use proto::p4runtime::{
+    ActionProfileGroup,
+    ActionProfileGroup_Member,
+    ActionProfileMember,
     CapabilitiesRequest,
     CapabilitiesResponse,
+    CounterData,
+    DirectCounterEntry,
     Entity,
     Entity_oneof_entity,
     ForwardingPipelineConfig,
@@ -77,6 +83,7 @@ use proto::p4runtime::{
     SetForwardingPipelineConfigResponse,
     StreamMessageRequest,
     StreamMessageResponse,
+    TableAction_oneof_type,
     Update_Type,
     WriteRequest,
     WriteResponse,
@@ -85,32 +92,119 @@ use proto::p4runtime_grpc::{P4Runtime, create_p4_runtime};
 
 use protobuf::{Message, well_known_types::Any};
 
-use ofp4dl_ddlog::typedefs::ofp4lib::{flow_t, multicast_group_t};
-use std::collections::{BTreeSet, HashMap};
+use serde::Deserialize;
+
+use ofp4dl_ddlog::typedefs::ofp4lib::{
+    action_profile_bucket_t,
+    flow_t,
+    multicast_bucket_t,
+    multicast_group_t,
+    of_action_t,
+    of_subfield_t,
+    structured_flow_t,
+};
+use std::borrow::Cow;
+use std::collections::{BTreeMap, BTreeSet, HashMap, HashSet};
+use std::collections::hash_map::DefaultHasher;
 use std::default::Default;
 use std::convert::TryInto;
-use std::fs::{File, OpenOptions};
-use std::io::stderr;
-use std::path::PathBuf;
-use std::sync::{Arc, Mutex};
+use std::fs::{File, OpenOptions, read_to_string};
+use std::hash::{Hash, Hasher};
+use std::io::{ErrorKind, stderr};
+use std::path::{Path, PathBuf};
+use std::process::Command;
+use std::sync::{mpsc, Arc, Mutex};
+use std::thread;
+use std::time::Duration;
 
 use tracing::{event, error, info, instrument, Level, span, warn};
 
 const OFP_PROTOCOL: ovs::ofp_protocol::Protocol = ovs::ofp_protocol::Protocol::OF15_OXM;
 const OFP_VERSION: ovs::ofp_protocol::Version = ovs::ofp_protocol::Version::OFP15;
 
+/// How long a P4Runtime read waits for the switch to report the counters that it asked for.
+const COUNTER_READ_TIMEOUT: Duration = Duration::from_secs(10);
+
+/// A counter read for more entries than this dumps the flows for all entries in one request,
+/// instead of sending one request per entry.
+const COUNTER_DUMP_THRESHOLD: usize = 64;
+
+/// How long `ovs-vsctl` may take to configure the OpenFlow tables in OVSDB, in seconds.
+const OVS_VSCTL_TIMEOUT: u32 = 10;
+
+/// The form of the flows that a P4 program generates.
+#[derive(Clone, Copy, Debug, PartialEq)]
+enum FlowFormat {
+    /// `Flow` relation of strings in `ovs-ofctl` syntax.
+    Text,
+    /// `StructuredFlow` relation, from `p4c-of --structured-flows`.
+    Structured,
+}
+
 struct Config {
     p4info: P4Info,
     module: String,
     cookie: u64,
     table_schemas: HashMap<u32, Table>,
-    flow_idxid: IdxId,
-    flow_relid: RelId,
+    /// Maps from the ID of a table to the ID of its direct counter, for tables that have one.
+    direct_counters: HashMap<u32, u32>,
+    /// The IDs of the tables with `@of_conjunction`.
+    conjunction_tables: HashSet<u32>,
+    flow_format: FlowFormat,
+    /// The relations that hold the flows, in OpenFlow table order.
+    flow_relations: Vec<FlowRelation>,
+    /// Flows that do not depend on DDlog relations, from `p4c-of --static-flows`.
+    static_flows: Vec<FlowMod>,
+    /// The OpenFlow tables of the program, from `p4c-of --table-manifest`.
+    table_manifest: Option<TableManifest>,
     multicast_group_relid: RelId,
+    /// Action selectors, by the ID of their P4Info action profile.
+    selectors: HashMap<u32, Selector>,
+    /// DDlog's `ActionProfileBucket` relation, which programs compiled before `p4c-of` supported
+    /// action selectors do not have.  Then the program has no selectors either.
+    bucket_relid: Option<RelId>,
+    /// DDlog's `MulticastBucket` relation, which exists if `p4c-of --multicast-groups` compiled the
+    /// program.  Then each multicast group is an OpenFlow group of type all with the same ID.
+    multicast_bucket_relid: Option<RelId>,
+}
+
+/// A DDlog output relation of flows.  There is a single `Flow` or `StructuredFlow` relation,
+/// unless `p4c-of --per-table-flows` compiled the program.  Then the flows of each OpenFlow table
+/// are in a separate relation, with the table ID as suffix, e.g. `Flow_3`.
+struct FlowRelation {
+    relid: RelId,
+    idxid: IdxId,
+}
+
+/// The OpenFlow tables of a P4 program, as written by `p4c-of --table-manifest`.  The manifest
+/// also describes the keys of each table, which the runtime does not need.
+#[derive(Clone, Deserialize)]
+struct TableManifest {
+    tables: Vec<ManifestTable>,
+}
+
+#[derive(Clone, Deserialize)]
+struct ManifestTable {
+    id: u8,
+    name: String,
+    /// Fields whose prefixes the OVS classifier should track in this table.
+    #[serde(default)]
+    prefixes: Vec<String>,
+}
+
+/// An action selector.  `p4c-of` only allows a selector to be used by a single table.
+struct Selector {
+    /// Name of the action profile, which DDlog's `ActionProfileBucket` relation uses.
+    name: String,
+    table_id: u32,
+    /// Name of the DDlog relation for the selector's members.
+    member_relname: String,
+    member_relid: RelId,
 }
 
 impl Config {
-    fn new(fpc: &ForwardingPipelineConfig, hddlog: &HDDlog) -> Result<Self> {
+    fn new(fpc: &ForwardingPipelineConfig, hddlog: &HDDlog, static_flows_dir: Option<&Path>,
+           table_manifest_dir: Option<&Path>) -> Result<Self> {
         let p4info = fpc.get_p4info();
         let module = p4info.get_pkg_info().name.clone();
         info!("Configuring for P4 module '{module}'");
@@ -121,27 +215,193 @@ impl Config {
             .iter()
             .map(|a| (a.get_preamble().id, a.into()))
             .collect();
-        let table_schemas = p4info.get_tables().iter()
+        let table_schemas: HashMap<u32, Table> = p4info.get_tables().iter()
             .map(|table| p4ext::Table::new_from_proto(table, &action_by_id))
             .map(|table| (table.preamble.id, table))
             .collect();
+        let direct_counters = p4info.get_direct_counters().iter()
+            .map(|dc| (dc.direct_table_id, dc.get_preamble().id))
+            .collect();
+        let conjunction_tables = table_schemas.values()
+            .filter(|table| table.preamble.annotations.0.contains_key("of_conjunction"))
+            .map(|table| table.preamble.id)
+            .collect();
 
-        let flow_relname = format!("{module}::Flow");
-        let flow_relid = hddlog.inventory.get_table_id(&flow_relname).ddlog_map_error()?;
-        let flow_idxid = hddlog.inventory.get_index_id(&flow_relname).ddlog_map_error()?;
+        let (flow_format, flow_relations) = find_flow_relations(hddlog, &module)?;
         let multicast_group_relname = format!("{module}::MulticastGroup");
         let multicast_group_relid = hddlog.inventory.get_table_id(&multicast_group_relname).ddlog_map_error()?;
+        let bucket_relid = hddlog.inventory.get_table_id(&format!("{module}::ActionProfileBucket")).ok();
+        let multicast_bucket_relid = hddlog.inventory.get_table_id(&format!("{module}::MulticastBucket")).ok();
+
+        let mut selectors = HashMap::new();
+        for profile in p4info.get_action_profiles().iter().filter(|profile| profile.with_selector) {
+            let name = profile.get_preamble().name.clone();
+            if bucket_relid.is_none() {
+                return Err(anyhow!("action selector {name} needs DDlog relation {module}::ActionProfileBucket; recompile the program with p4c-of"));
+            }
+            let table = match profile.table_ids.as_slice() {
+                [table_id] => table_schemas.get(table_id),
+                _ => None
+            }.ok_or_else(|| anyhow!("action selector {name} must be used by exactly one table"))?;
+            let member_relname = format!("{}::{}Member", module, table.preamble.name.replace('.', "_"));
+            let member_relid = hddlog.inventory.get_table_id(&member_relname).ddlog_map_error()?;
+            selectors.insert(profile.get_preamble().id, Selector {
+                name, table_id: table.preamble.id, member_relname, member_relid
+            });
+        }
+
+        // A program compiled with `p4c-of --static-flows` declares `StaticFlows`, and it does not
+        // work without the flows in the file.
+        let needs_static_flows = hddlog.inventory.get_table_id(&format!("{module}::StaticFlows")).is_ok();
+        let static_flows = match static_flows_dir {
+            Some(dir) => read_static_flows(&dir.join(format!("{module}.flows")), needs_static_flows)?,
+            None if needs_static_flows => {
+                return Err(anyhow!("P4 module '{module}' was compiled with `p4c-of --static-flows`, so its static flows must be passed with --static-flows-dir"));
+            },
+            None => Vec::new()
+        };
+        let table_manifest = match table_manifest_dir {
+            Some(dir) => read_table_manifest(&dir.join(format!("{module}.tables.json")))?,
+            None => None
+        };
 
         Ok(Config {
             p4info: p4info.clone(),
             module,
             cookie: fpc.get_cookie().get_cookie(),
             table_schemas,
-            flow_idxid,
-            flow_relid,
+            direct_counters,
+            conjunction_tables,
+            flow_format,
+            flow_relations,
+            static_flows,
+            table_manifest,
             multicast_group_relid,
+            selectors,
+            bucket_relid,
+            multicast_bucket_relid,
         })
     }
+
+    /// Returns the ID of the action selector of table `table_id`, if it has one.
+    fn table_selector(&self, table_id: u32) -> Option<u32> {
+        self.selectors.iter()
+            .find(|(_, selector)| selector.table_id == table_id)
+            .map(|(&id, _)| id)
+    }
+}
+
+/// Finds the relations that hold the flows of P4 module `module`, and the form of their flows.
+fn find_flow_relations(hddlog: &HDDlog, module: &str) -> Result<(FlowFormat, Vec<FlowRelation>)> {
+    let relation = |relname: &str| -> Option<FlowRelation> {
+        let relid = hddlog.inventory.get_table_id(relname).ok()?;
+        let idxid = hddlog.inventory.get_index_id(relname).ok()?;
+        Some(FlowRelation { relid, idxid })
+    };
+    for (flow_format, base) in [(FlowFormat::Text, "Flow"), (FlowFormat::Structured, "StructuredFlow")] {
+        if let Some(flow_relation) = relation(&format!("{module}::{base}")) {
+            return Ok((flow_format, vec![flow_relation]));
+        }
+        let flow_relations: Vec<FlowRelation> = (0..=u8::MAX)
+            .filter_map(|table_id| relation(&format!("{module}::{base}_{table_id}")))
+            .collect();
+        if !flow_relations.is_empty() {
+            info!("{} flow relations, one per OpenFlow table", flow_relations.len());
+            return Ok((flow_format, flow_relations));
+        }
+    }
+    Err(anyhow!("DDlog program has no flow relations for P4 module '{module}'"))
+}
+
+/// Parses the flows in `path`, one per line in `ovs-ofctl` syntax, ignoring blank lines and
+/// comments.  A missing file means the program has no static flows, unless `required`.
+fn read_static_flows(path: &Path, required: bool) -> Result<Vec<FlowMod>> {
+    let text = match read_to_string(path) {
+        Ok(text) => text,
+        Err(err) if err.kind() == ErrorKind::NotFound && !required => return Ok(Vec::new()),
+        Err(err) => return Err(err).with_context(|| format!("{}: read failed", path.display()))
+    };
+    let mut flows = Vec::new();
+    for line in text.lines().map(str::trim).filter(|line| !line.is_empty() && !line.starts_with('#')) {
+        match FlowMod::parse(line, Some(FlowModCommand::Add)) {
+            Ok((mut flow, _)) => {
+                flow.set_cookie(flow_cookie(flow.table_id(), 0, line));
+                flows.push(flow)
+            },
+            Err(s) => {
+                let err = anyhow!("{}: {line}: {s}", path.display());
+                error!("{err}");
+                return Err(err);
+            }
+        }
+    }
+    info!("Read {} static flows from {}", flows.len(), path.display());
+    Ok(flows)
+}
+
+/// Reads the table manifest in `path`.  A missing file means that the program has no manifest.
+fn read_table_manifest(path: &Path) -> Result<Option<TableManifest>> {
+    let text = match read_to_string(path) {
+        Ok(text) => text,
+        Err(err) if err.kind() == ErrorKind::NotFound => return Ok(None),
+        Err(err) => return Err(err).with_context(|| format!("{}: read failed", path.display()))
+    };
+    let manifest: TableManifest = serde_json::from_str(&text)
+        .with_context(|| format!("{}: bad table manifest", path.display()))?;
+    info!("Read {} tables from {}", manifest.tables.len(), path.display());
+    Ok(Some(manifest))
+}
+
+/// Where and how to configure the OpenFlow tables of the bridge in OVSDB.
+struct Ovsdb {
+    remote: String,
+    bridge: String,
+}
+
+/// Replaces the Flow_Table configuration of the bridge in `ovsdb` by one that names each table of
+/// `manifest` and enables prefix tracking for the fields that the manifest lists, so that the
+/// classifier un-wildcards only the prefix bits that lookups need.  Tables without prefix fields
+/// keep the default prefix tracking of OVS.
+fn configure_flow_tables(ovsdb: &Ovsdb, manifest: &TableManifest) -> Result<()> {
+    let mut command = Command::new("ovs-vsctl");
+    command.arg(format!("--db={}", ovsdb.remote)).arg("--no-wait")
+        .arg(format!("--timeout={OVS_VSCTL_TIMEOUT}"))
+        .args(["--", "clear", "Bridge", &ovsdb.bridge, "flow_tables"]);
+    for table in &manifest.tables {
+        let id = format!("@t{}", table.id);
+        command.args(["--", &format!("--id={id}"), "create", "Flow_Table"])
+            .arg(format!("name={}", serde_json::to_string(&table.name)?));
+        if !table.prefixes.is_empty() {
+            command.arg(format!("prefixes={}", table.prefixes.join(",")));
+        }
+        command.args(["--", "set", "Bridge", &ovsdb.bridge,
+                      &format!("flow_tables:{}={id}", table.id)]);
+    }
+    let output = command.output().context("ovs-vsctl failed to start")?;
+    if !output.status.success() {
+        return Err(anyhow!("ovs-vsctl failed ({}): {}", output.status,
+                           String::from_utf8_lossy(&output.stderr).trim()));
+    }
+    info!("Configured {} OpenFlow tables in OVSDB", manifest.tables.len());
+    Ok(())
+}
+
+impl Ovsdb {
+    /// Starts a thread that configures the OpenFlow tables in this database from each manifest
+    /// sent to the returned channel, so that the server does not wait for `ovs-vsctl`.  If
+    /// manifests arrive while `ovs-vsctl` runs, only the latest one is configured next.
+    fn start_configurator(self) -> mpsc::Sender<TableManifest> {
+        let (sender, receiver) = mpsc::channel::<TableManifest>();
+        thread::spawn(move || {
+            while let Ok(manifest) = receiver.recv() {
+                let manifest = receiver.try_iter().last().unwrap_or(manifest);
+                if let Err(err) = configure_flow_tables(&self, &manifest) {
+                    warn!("{err}");
+                }
+            }
+        });
+        sender
+    }
 }
 
 struct State {
@@ -151,23 +411,441 @@ struct State {
 
     // Configuration state.
     device_id: u64,
+    static_flows_dir: Option<PathBuf>,
+    table_manifest_dir: Option<PathBuf>,
     config: Option<Config>,
     config_seqno: u64,
 
     // Table state.
     multicast_groups: HashMap<MulticastGroupId, BTreeSet<Replica>>,
-    table_entries: HashMap<TableKey, TableValue>
+    /// The OpenFlow actions of the buckets of each multicast group, by port, from DDlog's
+    /// `MulticastBucket` relation.
+    multicast_buckets: HashMap<u16, BTreeMap<u16, String>>,
+    table_entries: HashMap<TableKey, TableValue>,
+
+    // Direct counter state.  Each entry in a table with a direct counter has a nonzero id, which
+    // is part of the cookies of its flows.  The id of a deleted entry is free for another one.
+    counter_ids: HashMap<TableKey, u32>,
+    counter_id_allocator: IdAllocator,
+    /// Counter reads waiting to be sent to the switch.
+    counter_queries: Vec<CounterQuery>,
+
+    // Conjunction state, for the tables with `@of_conjunction`.
+    conjunctions: Conjunctions,
+
+    // Action selector state.  Members and groups are keyed by action profile ID and member or
+    // group ID.  Each group is an OpenFlow select group; P4Runtime group IDs are only unique
+    // within an action profile, so the OpenFlow group IDs are allocated here, above the 16-bit
+    // IDs that multicast groups use.
+    profile_members: HashMap<(u32, u32), TableAction>,
+    profile_groups: HashMap<(u32, u32), ProfileGroup>,
+    /// The OpenFlow actions of each member, by action profile name and member ID, from DDlog's
+    /// `ActionProfileBucket` relation.
+    buckets: HashMap<(String, u32), String>,
+    /// The group of each entry in a table with an action selector.
+    entry_groups: HashMap<TableKey, (u32, u32)>,
+    next_of_group: u32,
+}
+
+/// The first OpenFlow group ID for action profile groups.  Lower IDs are for multicast groups.
+const FIRST_PROFILE_GROUP: u32 = 0x10000;
+
+/// A P4Runtime action profile group.
+struct ProfileGroup {
+    of_group: u32,
+    /// Member IDs and weights.
+    members: Vec<(u32, i32)>,
+}
+
+/// Allocates nonzero `u32` ids, reusing the ids that are freed.
+#[derive(Default)]
+struct IdAllocator {
+    free: Vec<u32>,
+    /// The largest id allocated so far, or 0.
+    last: u32,
+}
+
+impl IdAllocator {
+    /// Returns an id that is not in use, or `None` if all of them are.
+    fn allocate(&mut self) -> Option<u32> {
+        if let Some(id) = self.free.pop() {
+            return Some(id);
+        }
+        self.last = self.last.checked_add(1)?;
+        Some(self.last)
+    }
+
+    /// Whether `n` more ids can be allocated.
+    fn can_allocate(&self, n: usize) -> bool {
+        self.free.len() as u64 + (u32::MAX - self.last) as u64 >= n as u64
+    }
+
+    /// Returns the ids that `n` calls of `allocate` would return, without allocating them, or
+    /// fewer if there are not as many.
+    fn peek(&self, n: usize) -> Vec<u32> {
+        let new = (self.last as u64 + 1..=u32::MAX as u64).map(|id| id as u32);
+        self.free.iter().rev().copied().chain(new).take(n).collect()
+    }
+
+    /// Allocates `id`, the next id that `peek` returns.
+    fn claim(&mut self, id: u32) {
+        assert_eq!(self.allocate(), Some(id));
+    }
+
+    /// Makes `id`, which was allocated, available again.
+    fn release(&mut self, id: u32) {
+        self.free.push(id);
+    }
+}
+
+/// Identifies the entries of a table with `@of_conjunction` that may share an OVS conjunction:
+/// their table ID, action and priority.
+type ConjunctionKey = (u32, Option<TableAction>, i32);
+
+/// The value of an entry in each dimension of a conjunction, that is, its match for each key field
+/// of its table, in order, or `None` for a field that it omits.
+type ConjunctionPoint = Vec<Option<FieldMatch>>;
+
+/// An OVS conjunction.  OVS runs its action for a packet that matches one of its values in every
+/// dimension, so its entries must be all the combinations of their values, the cross product of
+/// their values in each dimension.
+#[derive(Clone)]
+struct Conjunction {
+    key: ConjunctionKey,
+    entries: HashMap<TableKey, ConjunctionPoint>,
+    /// The number of entries with each value, for each dimension.
+    values: Vec<HashMap<Option<FieldMatch>, usize>>,
+}
+
+impl Conjunction {
+    fn new(key: ConjunctionKey, dimensions: usize) -> Conjunction {
+        Conjunction { key, entries: HashMap::new(), values: vec![HashMap::new(); dimensions] }
+    }
+
+    fn insert(&mut self, entry: TableKey, point: ConjunctionPoint) {
+        for (values, value) in self.values.iter_mut().zip(&point) {
+            *values.entry(value.clone()).or_default() += 1;
+        }
+        self.entries.insert(entry, point);
+    }
+
+    fn remove(&mut self, entry: &TableKey) -> ConjunctionPoint {
+        let point = self.entries.remove(entry).unwrap();
+        for (values, value) in self.values.iter_mut().zip(&point) {
+            let count = values.get_mut(value).unwrap();
+            *count -= 1;
+            if *count == 0 {
+                values.remove(value);
+            }
+        }
+        point
+    }
+
+    /// Whether the entries are the cross product of their values.
+    fn is_cross_product(&self) -> bool {
+        self.values.iter()
+            .try_fold(1usize, |product, values| product.checked_mul(values.len()))
+            == Some(self.entries.len())
+    }
+
+    /// Whether the entries, a cross product, remain one with an entry at `point`: `point` has a
+    /// new value in one dimension, and in every other one it has the single value of the entries.
+    fn extends_with(&self, point: &ConjunctionPoint) -> bool {
+        let mut new_values = 0;
+        for (values, value) in self.values.iter().zip(point) {
+            if !values.contains_key(value) {
+                new_values += 1;
+            } else if values.len() != 1 {
+                return false;
+            }
+        }
+        new_values == 1
+    }
+
+    /// Whether the union of the entries and those of `other`, both cross products, is a cross
+    /// product: they have the same values in every dimension but one.
+    fn merges_with(&self, other: &Conjunction) -> bool {
+        let differing = self.values.iter().zip(&other.values)
+            .filter(|(a, b)| a.len() != b.len() || a.keys().any(|value| !b.contains_key(value)))
+            .count();
+        differing == 1
+    }
+}
+
+/// The OVS conjunctions of the entries of the tables with `@of_conjunction`.
+///
+/// Entries with the same action and priority share conjunctions, each of which must stay a cross
+/// product.  An entry joins a conjunction that it extends, or a new one, which then merges with
+/// any other whose union with it is a cross product.  When an entry leaves a conjunction, the rest
+/// is split into cross products if it is no longer one.  Every move of an entry from one
+/// conjunction to another replaces its flows, so the larger conjunction keeps its id in a merge or
+/// a split.  An id is free for another conjunction once its conjunction has no entries.
+#[derive(Default)]
+struct Conjunctions {
+    by_id: HashMap<u32, Conjunction>,
+    by_key: HashMap<ConjunctionKey, BTreeSet<u32>>,
+    /// The conjunction of each entry.
+    ids: HashMap<TableKey, u32>,
+    allocator: IdAllocator,
+}
+
+/// How a write changes the conjunctions of table entries.  `Conjunctions::plan` computes it and
+/// `Conjunctions::apply` makes it.
+struct ConjunctionChange {
+    /// The id of the entry written before and after the write, if any.
+    old_id: Option<u32>,
+    new_id: Option<u32>,
+    /// The old and new ids of the other entries whose conjunction changed.
+    moves: HashMap<TableKey, (u32, u32)>,
+    /// The new contents of the conjunctions that change, or `None` for those that go away.
+    conjunctions: HashMap<u32, Option<Conjunction>>,
+    /// The ids of the new conjunctions, in the order of allocation, and the ids freed.
+    allocated: Vec<u32>,
+    released: Vec<u32>,
+}
+
+/// The conjunctions as a write would change them, on top of `base`, which stays unchanged.
+struct ConjunctionPlan<'a> {
+    base: &'a Conjunctions,
+    /// The conjunctions changed so far, by id, or `None` for those that went away.
+    changed: HashMap<u32, Option<Conjunction>>,
+    /// The conjunction of each entry that moved, or `None` for one that left.
+    ids: HashMap<TableKey, Option<u32>>,
+    moves: HashMap<TableKey, (u32, u32)>,
+    /// The ids that new conjunctions can take, in the order that `base.allocator` gives them.
+    available: std::vec::IntoIter<u32>,
+    allocated: Vec<u32>,
+    released: Vec<u32>,
+}
+
+impl ConjunctionPlan<'_> {
+    fn get(&self, id: u32) -> &Conjunction {
+        match self.changed.get(&id) {
+            Some(conjunction) => conjunction.as_ref().unwrap(),
+            None => &self.base.by_id[&id]
+        }
+    }
+
+    fn get_mut(&mut self, id: u32) -> &mut Conjunction {
+        let base = self.base;
+        self.changed.entry(id).or_insert_with(|| Some(base.by_id[&id].clone())).as_mut().unwrap()
+    }
+
+    fn id_of(&self, entry: &TableKey) -> Option<u32> {
+        match self.ids.get(entry) {
+            Some(&id) => id,
+            None => self.base.ids.get(entry).copied()
+        }
+    }
+
+    /// The ids of the conjunctions for `key`.
+    fn ids_for(&self, key: &ConjunctionKey) -> BTreeSet<u32> {
+        let mut ids: BTreeSet<u32> = self.base.by_key.get(key).cloned().unwrap_or_default();
+        for (&id, conjunction) in &self.changed {
+            match conjunction {
+                Some(conjunction) if conjunction.key == *key => { ids.insert(id); },
+                Some(_) => (),
+                None => { ids.remove(&id); }
+            }
+        }
+        ids
+    }
+
+    /// Adds an empty conjunction for `key`, and returns its id.
+    fn add(&mut self, key: ConjunctionKey, dimensions: usize) -> u32 {
+        let id = self.available.next().unwrap();
+        self.allocated.push(id);
+        self.changed.insert(id, Some(Conjunction::new(key, dimensions)));
+        id
+    }
+
+    /// Removes conjunction `id`, and returns it.  Its id is free once the write is made.
+    fn remove(&mut self, id: u32) -> Conjunction {
+        let conjunction = match self.changed.insert(id, None) {
+            Some(conjunction) => conjunction.unwrap(),
+            None => self.base.by_id[&id].clone()
+        };
+        self.released.push(id);
+        conjunction
+    }
+
+    /// Records that `entry` moved from conjunction `from` to `to`.
+    fn record_move(&mut self, entry: &TableKey, from: u32, to: u32) {
+        self.ids.insert(entry.clone(), Some(to));
+        self.moves.entry(entry.clone()).or_insert((from, to)).1 = to;
+    }
+
+    /// Removes `entry` from conjunction `id`, and splits the other entries into cross products.
+    fn leave(&mut self, entry: &TableKey, id: u32) {
+        self.ids.insert(entry.clone(), None);
+        let conjunction = self.get_mut(id);
+        let point = conjunction.remove(entry);
+        if conjunction.entries.is_empty() {
+            self.remove(id);
+            return;
+        }
+        if conjunction.is_cross_product() {
+            return;
+        }
+
+        // The entries that differ from the one that left in the first dimension are a cross
+        // product, and so are the rest of those that do not in the second dimension, and so on.
+        let mut parts: Vec<Vec<TableKey>> = Vec::new();
+        let mut rest: Vec<(&TableKey, &ConjunctionPoint)> = conjunction.entries.iter().collect();
+        for (dimension, value) in point.iter().enumerate() {
+            let (differ, same): (Vec<_>, Vec<_>) =
+                rest.into_iter().partition(|(_, p)| p[dimension] != *value);
+            if !differ.is_empty() {
+                parts.push(differ.into_iter().map(|(key, _)| key.clone()).collect());
+            }
+            rest = same;
+        }
+        let largest = (0..parts.len()).max_by_key(|&i| parts[i].len()).unwrap();
+        parts.swap_remove(largest);
+
+        let key = conjunction.key.clone();
+        let dimensions = conjunction.values.len();
+        for part in parts {
+            let new_id = self.add(key.clone(), dimensions);
+            for entry in part {
+                let point = self.get_mut(id).remove(&entry);
+                self.record_move(&entry, id, new_id);
+                self.get_mut(new_id).insert(entry, point);
+            }
+        }
+    }
+
+    /// Adds `entry` at `point` to a conjunction for `key`, merging conjunctions whose union is a
+    /// cross product, and returns the id of its conjunction.
+    fn join(&mut self, entry: &TableKey, key: ConjunctionKey, point: ConjunctionPoint) -> u32 {
+        let extended = self.ids_for(&key).into_iter().find(|&id| self.get(id).extends_with(&point));
+        let mut id = match extended {
+            Some(id) => id,
+            None => self.add(key.clone(), point.len())
+        };
+        self.get_mut(id).insert(entry.clone(), point);
+        self.ids.insert(entry.clone(), Some(id));
+
+        loop {
+            let other = self.ids_for(&key).into_iter()
+                .find(|&other| other != id && self.get(id).merges_with(self.get(other)));
+            let other = match other {
+                Some(other) => other,
+                None => break
+            };
+            let (keep, gone) = if self.get(id).entries.len() >= self.get(other).entries.len() {
+                (id, other)
+            } else {
+                (other, id)
+            };
+            for (entry, point) in self.remove(gone).entries {
+                self.record_move(&entry, gone, keep);
+                self.get_mut(keep).insert(entry, point);
+            }
+            id = keep;
+        }
+        id
+    }
+}
+
+impl Conjunctions {
+    /// Computes how moving `entry` to the conjunction for `new`, its key and point, or out of the
+    /// conjunctions if it is `None`, changes them, without changing them.  Fails if that would
+    /// take more ids than are free.
+    fn plan(&self, entry: &TableKey, new: Option<(ConjunctionKey, ConjunctionPoint)>)
+            -> Result<ConjunctionChange> {
+        let old_id = self.ids.get(entry).copied();
+        if let (Some(id), Some((key, _))) = (old_id, &new) {
+            if self.by_id[&id].key == *key {
+                return Ok(ConjunctionChange { old_id, new_id: old_id, moves: HashMap::new(),
+                                              conjunctions: HashMap::new(),
+                                              allocated: Vec::new(), released: Vec::new() });
+            }
+        }
+
+        // A split makes at most one new conjunction per dimension, and a join at most one more.
+        // The ids freed here become available only after the write, so that no id names two
+        // conjunctions in one transaction.
+        let dimensions = new.as_ref().map(|(_, point)| point.len())
+            .or_else(|| old_id.map(|id| self.by_id[&id].values.len()))
+            .unwrap_or(0);
+        if !self.allocator.can_allocate(dimensions + 1) {
+            Err(Error(RpcStatusCode::RESOURCE_EXHAUSTED)).context("out of conjunction ids")?;
+        }
+        let mut plan = ConjunctionPlan {
+            base: self, changed: HashMap::new(), ids: HashMap::new(), moves: HashMap::new(),
+            available: self.allocator.peek(dimensions + 1).into_iter(),
+            allocated: Vec::new(), released: Vec::new()
+        };
+
+        if let Some(id) = old_id {
+            plan.leave(entry, id);
+        }
+        let new_id = new.map(|(key, point)| plan.join(entry, key, point));
+        debug_assert_eq!(plan.id_of(entry), new_id);
+        let mut moves = plan.moves;
+        moves.remove(entry);
+        moves.retain(|_, (from, to)| from != to);
+        Ok(ConjunctionChange { old_id, new_id, moves, conjunctions: plan.changed,
+                               allocated: plan.allocated, released: plan.released })
+    }
+
+    /// Makes `change`, which `plan` computed for `entry` with the conjunctions as they are.
+    fn apply(&mut self, entry: &TableKey, change: ConjunctionChange) {
+        for id in change.allocated {
+            self.allocator.claim(id);
+        }
+        for (id, conjunction) in change.conjunctions {
+            match conjunction {
+                Some(conjunction) => {
+                    self.by_key.entry(conjunction.key.clone()).or_default().insert(id);
+                    self.by_id.insert(id, conjunction);
+                },
+                None => if let Some(conjunction) = self.by_id.remove(&id) {
+                    let ids = self.by_key.get_mut(&conjunction.key).unwrap();
+                    ids.remove(&id);
+                    if ids.is_empty() {
+                        self.by_key.remove(&conjunction.key);
+                    }
+                }
+            }
+        }
+        for (other, (_, new_id)) in change.moves {
+            self.ids.insert(other, new_id);
+        }
+        match change.new_id {
+            Some(id) => self.ids.insert(entry.clone(), id),
+            None => self.ids.remove(entry)
+        };
+        for id in change.released {
+            self.allocator.release(id);
+        }
+    }
+}
+
+/// Packet and byte counts, by entry id.
+type CounterCounts = HashMap<u32, (u64, u64)>;
+
+/// A request to read the counters for some table entries, which `run_server` answers on `reply`.
+struct CounterQuery {
+    entry_ids: HashSet<u32>,
+    reply: mpsc::Sender<Result<CounterCounts, String>>,
 }
 
 impl State {
-    fn new(hddlog: HDDlog, device_id: u64)
-           -> State {
+    fn new(hddlog: HDDlog, device_id: u64, static_flows_dir: Option<PathBuf>,
+           table_manifest_dir: Option<PathBuf>) -> State {
         let (pending_flow_mods, config, config_seqno,
-             multicast_groups, table_entries) = Default::default();
+             multicast_groups, table_entries, counter_ids, counter_id_allocator, counter_queries) = Default::default();
+        let (profile_members, profile_groups, buckets, entry_groups, multicast_buckets) = Default::default();
+        let conjunctions = Default::default();
         State {
             latch: Latch::new(),
-            hddlog, device_id,
-            pending_flow_mods, config, config_seqno, multicast_groups, table_entries,
+            hddlog, device_id, static_flows_dir, table_manifest_dir,
+            pending_flow_mods, config, config_seqno, multicast_groups, multicast_buckets, table_entries,
+            counter_ids, counter_id_allocator, counter_queries,
+            conjunctions,
+            profile_members, profile_groups, buckets, entry_groups, next_of_group: FIRST_PROFILE_GROUP,
         }
     }
 
@@ -200,46 +878,106 @@ impl State {
     /// `target`.  As P4Runtime specifies, any field in `target` that is zero or missing acts as a
     /// wildcard.  Returns the entities to send back to the P4Runtime client.
     fn read_table_entries(&self, target: &proto::p4runtime::TableEntry) -> Vec<Entity> {
-        let target: TableEntry = match target.try_into() {
-            Ok(target) => target,
-            Err(error) => {
-                warn!("bad TableEntry {target:?} for read operation ({error:?})");
-                return Vec::new();
-            }
-        };
-            
         let mut entities = Vec::new();
-        for (key, value) in &self.table_entries {
-            if target.key.table_id != 0 && target.key.table_id != key.table_id {
-                continue;
-            }
-            if !target.key.matches.is_empty() && target.key.matches != key.matches {
-                continue;
-            }
-            if target.key.priority != 0 && target.key.priority != key.priority {
-                continue;
-            }
-            if target.key.is_default_action && !key.is_default_action {
-                continue;
-            }
-            if target.value.controller_metadata != 0 && target.value.controller_metadata != value.controller_metadata {
-                continue;
-            }
-            if !target.value.metadata.is_empty() && target.value.metadata != value.metadata {
-                continue;
-            }
+        for (key, value) in self.select_table_entries(target) {
             // XXX meter_config
             // XXX counter_data
             // XXX idle_timeout_ns?
             // XXX time_since_last_hit?
             let (unknown_fields, cached_size) = Default::default();
             let te = TableEntry { key: key.clone(), value: value.clone() }; 
+            let mut p_te: proto::p4runtime::TableEntry = (&te).into();
+            if let Some(&(_, group_id)) = self.entry_groups.get(key) {
+                p_te.action = Some(proto::p4runtime::TableAction {
+                    field_type: Some(TableAction_oneof_type::action_profile_group_id(group_id)),
+                    ..Default::default()}).into();
+            }
             entities.push(Entity {
-                entity: Some(Entity_oneof_entity::table_entry((&te).into())),
+                entity: Some(Entity_oneof_entity::table_entry(p_te)),
                 unknown_fields, cached_size });
         }
         entities
     }
+
+    /// Implements the P4Runtime `read` operation for action profile members.  A zero
+    /// `action_profile_id` or `member_id` acts as a wildcard.
+    fn read_profile_members(&self, target: &ActionProfileMember) -> Vec<Entity> {
+        self.profile_members.iter()
+            .filter(|(&(profile_id, member_id), _)| {
+                (target.action_profile_id == 0 || target.action_profile_id == profile_id) &&
+                    (target.member_id == 0 || target.member_id == member_id)
+            })
+            .map(|(&(action_profile_id, member_id), action)| Entity {
+                entity: Some(Entity_oneof_entity::action_profile_member(ActionProfileMember {
+                    action_profile_id, member_id,
+                    action: Some(action.into()).into(),
+                    ..Default::default()})),
+                ..Default::default()})
+            .collect()
+    }
+
+    /// Implements the P4Runtime `read` operation for action profile groups.  A zero
+    /// `action_profile_id` or `group_id` acts as a wildcard.
+    fn read_profile_groups(&self, target: &ActionProfileGroup) -> Vec<Entity> {
+        self.profile_groups.iter()
+            .filter(|(&(profile_id, group_id), _)| {
+                (target.action_profile_id == 0 || target.action_profile_id == profile_id) &&
+                    (target.group_id == 0 || target.group_id == group_id)
+            })
+            .map(|(&(action_profile_id, group_id), group)| Entity {
+                entity: Some(Entity_oneof_entity::action_profile_group(ActionProfileGroup {
+                    action_profile_id, group_id,
+                    members: group.members.iter().map(|&(member_id, weight)| ActionProfileGroup_Member {
+                        member_id, weight, ..Default::default()}).collect(),
+                    ..Default::default()})),
+                ..Default::default()})
+            .collect()
+    }
+
+    /// Returns the table entries that match all of the fields in `target`, with the P4Runtime
+    /// wildcard rules described for [`State::read_table_entries`].
+    fn select_table_entries(&self, target: &proto::p4runtime::TableEntry) -> Vec<(&TableKey, &TableValue)> {
+        let target: TableEntry = match target.try_into() {
+            Ok(target) => target,
+            Err(error) => {
+                warn!("bad TableEntry {target:?} for read operation ({error:?})");
+                return Vec::new();
+            }
+        };
+
+        self.table_entries.iter().filter(|(key, value)| {
+            (target.key.table_id == 0 || target.key.table_id == key.table_id) &&
+                (target.key.matches.is_empty() || target.key.matches == key.matches) &&
+                (target.key.priority == 0 || target.key.priority == key.priority) &&
+                (!target.key.is_default_action || key.is_default_action) &&
+                (target.value.controller_metadata == 0 || target.value.controller_metadata == value.controller_metadata) &&
+                (target.value.metadata.is_empty() || target.value.metadata == value.metadata)
+        }).collect()
+    }
+
+    /// Starts the P4Runtime `read` operation for the direct counters of the table entries that
+    /// match `target`, which is the `table_entry` in a `DirectCounterEntry`.  Returns the entries
+    /// and their ids, with a receiver for their counts, which [`run_server`] obtains from the
+    /// switch.
+    fn read_direct_counters(&mut self, target: &proto::p4runtime::TableEntry)
+                            -> (Vec<(TableEntry, u32)>, mpsc::Receiver<Result<CounterCounts, String>>) {
+        let entries: Vec<(TableEntry, u32)> = self.select_table_entries(target).into_iter()
+            .filter_map(|(key, value)| self.counter_ids.get(key).map(|&id| {
+                (TableEntry { key: key.clone(), value: value.clone() }, id)
+            }))
+            .collect();
+        let (reply, receiver) = mpsc::channel();
+        if entries.is_empty() {
+            reply.send(Ok(HashMap::new())).unwrap();
+        } else {
+            self.counter_queries.push(CounterQuery {
+                entry_ids: entries.iter().map(|&(_, id)| id).collect(),
+                reply
+            });
+            self.latch.set();
+        }
+        (entries, receiver)
+    }
 }
 
 #[derive(Clone)]
@@ -344,7 +1082,7 @@ impl P4RuntimeService {
                 };
 
                 // Commit the operation to DDlog.
-                let mut commands = Vec::with_capacity(2);
+                let mut commands = Vec::with_capacity(2 + conjunction_change.as_ref().map_or(0, |change| 2 * change.moves.len()));
                 for insertion in new_value.difference(old_value) {
                     commands.push(Update::Insert {
                         relid: config.multicast_group_relid,
@@ -370,7 +1108,10 @@ impl P4RuntimeService {
                     hddlog.apply_updates(&mut commands.into_iter()).ddlog_map_error()?;
                     hddlog.transaction_commit_dump_changes().ddlog_map_error()?
                 };
-                delta_to_flow_mods(&delta, config.flow_relid, &mut state.pending_flow_mods);
+                // Groups go before the flows that refer to them.
+                delta_to_multicast_group_mods(&delta, config, &mut state.multicast_buckets,
+                                              &mut state.pending_flow_mods);
+                delta_to_flow_mods(&delta, config, &mut state.pending_flow_mods);
                 state.latch.set();
 
                 // Commit the operation to our internal representation.
@@ -381,8 +1122,122 @@ impl P4RuntimeService {
                 }
                 Ok(())
             },
+            Some(Entity { entity: Some(Entity_oneof_entity::action_profile_member(apm)), .. }) => {
+                let selector = match config.selectors.get(&apm.action_profile_id) {
+                    Some(selector) => selector,
+                    None => Err(Error(RpcStatusCode::NOT_FOUND)).context(format!("unknown action selector {}", apm.action_profile_id))?
+                };
+                let table = &config.table_schemas[&selector.table_id];
+                let table_name = format!("{}::{}", config.module, table.preamble.name.replace('.', "_"));
+
+                // Validate the operation.  A member can't be deleted while a group has it.
+                let key = (apm.action_profile_id, apm.member_id);
+                let old_action = state.profile_members.get(&key);
+                Self::validate_write(op, old_action.is_some())?;
+                if op == Update_Type::DELETE && state.profile_groups.iter().any(|(&(profile_id, _), group)| {
+                    profile_id == key.0 && group.members.iter().any(|&(member_id, _)| member_id == key.1)
+                }) {
+                    Err(Error(RpcStatusCode::FAILED_PRECONDITION)).context(format!("member {} is in a group", apm.member_id))?;
+                }
+                let new_action: Option<TableAction> = match op {
+                    Update_Type::DELETE => None,
+                    _ => Some(apm.get_action().try_into()?)
+                };
+
+                // Commit the operation to DDlog.
+                let member_record = |action: &TableAction| -> Result<Record> {
+                    let mut fields = vec![(Name::from("member_id"), apm.member_id.into_record())];
+                    if let Some(record) = action.to_record(table, &table_name)? {
+                        fields.push((Name::from("action"), record));
+                    }
+                    Ok(Record::NamedStruct(Name::Owned(selector.member_relname.clone()), fields))
+                };
+                let relid = selector.member_relid;
+                let mut commands = Vec::with_capacity(2 + conjunction_change.as_ref().map_or(0, |change| 2 * change.moves.len()));
+                if let Some(old_action) = old_action {
+                    commands.push(UpdCmd::Delete(RelIdentifier::RelId(relid), member_record(old_action)?));
+                }
+                if let Some(ref new_action) = new_action {
+                    commands.push(UpdCmd::Insert(RelIdentifier::RelId(relid), member_record(new_action)?));
+                }
+                let delta = {
+                    let hddlog = &state.hddlog;
+
+                    hddlog.transaction_start().ddlog_map_error()?;
+                    hddlog.apply_updates_dynamic(&mut commands.into_iter()).ddlog_map_error()?;
+                    hddlog.transaction_commit_dump_changes().ddlog_map_error()?
+                };
+                delta_to_group_mods(&delta, config, &mut state.buckets, &state.profile_groups,
+                                    &mut state.pending_flow_mods);
+                state.latch.set();
+
+                // Commit the operation to our internal representation.
+                match new_action {
+                    Some(new_action) => state.profile_members.insert(key, new_action),
+                    None => state.profile_members.remove(&key)
+                };
+                Ok(())
+            },
+            Some(Entity { entity: Some(Entity_oneof_entity::action_profile_group(apg)), .. }) => {
+                if !config.selectors.contains_key(&apg.action_profile_id) {
+                    Err(Error(RpcStatusCode::NOT_FOUND)).context(format!("unknown action selector {}", apg.action_profile_id))?;
+                }
+
+                // Validate the operation.  A group can't be deleted while a table entry uses it.
+                let key = (apg.action_profile_id, apg.group_id);
+                let old_group = state.profile_groups.get(&key);
+                Self::validate_write(op, old_group.is_some())?;
+                if op == Update_Type::DELETE {
+                    if state.entry_groups.values().any(|&group| group == key) {
+                        Err(Error(RpcStatusCode::FAILED_PRECONDITION)).context(format!("group {} is in use", apg.group_id))?;
+                    }
+                    let of_group = old_group.unwrap().of_group;
+                    state.pending_flow_mods.extend(parse_group_mod(&format!("group_id={of_group}"),
+                                                                   GroupModCommand::Delete));
+                    state.profile_groups.remove(&key);
+                    state.latch.set();
+                    return Ok(());
+                }
+
+                let members: Vec<(u32, i32)> = apg.members.iter().map(|m| (m.member_id, m.weight)).collect();
+                if let Some(&(member_id, _)) = members.iter().find(|&&(member_id, _)| {
+                    !state.profile_members.contains_key(&(key.0, member_id))
+                }) {
+                    Err(Error(RpcStatusCode::NOT_FOUND)).context(format!("unknown member {member_id}"))?;
+                }
+                let of_group = match old_group {
+                    Some(old_group) => old_group.of_group,
+                    None => {
+                        let id = state.next_of_group;
+                        state.next_of_group += 1;
+                        id
+                    }
+                };
+
+                // A change in the membership of a group is a single group_mod.
+                let group = ProfileGroup { of_group, members };
+                if let Some(msg) = group_mod(config, &state.buckets, key.0, &group) {
+                    state.pending_flow_mods.push(msg);
+                }
+                state.profile_groups.insert(key, group);
+                state.latch.set();
+                Ok(())
+            },
             Some(Entity { entity: Some(Entity_oneof_entity::table_entry(te)), .. }) => {
-                let te: TableEntry = te.try_into()?;
+                // An entry in a table with an action selector names a group instead of an action.
+                let selector_id = config.table_selector(te.table_id);
+                let (te, group_key): (TableEntry, Option<(u32, u32)>) = match selector_id {
+                    Some(profile_id) => {
+                        let mut te = te.clone();
+                        let group_id = match te.action.take().and_then(|ta| ta.field_type) {
+                            Some(TableAction_oneof_type::action_profile_group_id(group_id)) => Some(group_id),
+                            Some(_) => Err(Error(RpcStatusCode::UNIMPLEMENTED)).context(format!("entries in table {} must name an action profile group", te.table_id))?,
+                            None => None
+                        };
+                        ((&te).try_into()?, group_id.map(|group_id| (profile_id, group_id)))
+                    },
+                    None => (te.try_into()?, None)
+                };
 
                 // Look up the table schema and get its DDlog relation ID.
                 let table = match config.table_schemas.get(&te.key.table_id) {
@@ -395,18 +1250,70 @@ impl P4RuntimeService {
                 // Validate the operation.
                 let old_value = state.table_entries.get(&te.key);
                 Self::validate_write(op, old_value.is_some())?;
+                let old_of_group = state.entry_groups.get(&te.key).map(|key| state.profile_groups[key].of_group);
+                let new_of_group = match (selector_id, op) {
+                    (Some(_), Update_Type::INSERT | Update_Type::MODIFY) => Some(match group_key.and_then(|key| state.profile_groups.get(&key)) {
+                        Some(group) => group.of_group,
+                        None => Err(Error(RpcStatusCode::NOT_FOUND)).context(format!("unknown group {group_key:?}"))?
+                    }),
+                    _ => None
+                };
+
+                // An entry in a table with a direct counter keeps its id when it is modified.  A new
+                // entry fails if every id belongs to an entry, because two entries with the same
+                // id would share their counters.  A new id is only claimed once DDlog has the entry.
+                let counter_id = if config.direct_counters.contains_key(&te.key.table_id) {
+                    Some(match state.counter_ids.get(&te.key) {
+                        Some(&id) => id,
+                        None => match state.counter_id_allocator.peek(1).first() {
+                            Some(&id) => id,
+                            None => Err(Error(RpcStatusCode::RESOURCE_EXHAUSTED)).context("out of counter ids")?
+                        }
+                    })
+                } else {
+                    None
+                };
+
+                // An entry in a table with @of_conjunction gets the id of a conjunction for its
+                // action and priority, which it shares with other entries.  Joining or leaving
+                // one can move other entries to another conjunction, which replaces their flows.
+                // The conjunctions only change once DDlog has the new ids.
+                let conjunction_change = if config.conjunction_tables.contains(&te.key.table_id) {
+                    let new_conj = (op != Update_Type::DELETE).then(|| {
+                        let key = (te.key.table_id, te.value.action.clone(), te.key.priority);
+                        let point: ConjunctionPoint = table.match_fields.iter()
+                            .map(|field| te.key.matches.iter().find(|m| m.field_id == field.preamble.id).cloned())
+                            .collect();
+                        (key, point)
+                    });
+                    Some(state.conjunctions.plan(&te.key, new_conj)?)
+                } else {
+                    None
+                };
+                let old_conj_id = conjunction_change.as_ref().and_then(|change| change.old_id);
+                let new_conj_id = conjunction_change.as_ref().and_then(|change| change.new_id);
 
                 // Commit the operation to DDlog.
-                let mut commands = Vec::with_capacity(2);
+                let mut commands = Vec::with_capacity(2 + conjunction_change.as_ref().map_or(0, |change| 2 * change.moves.len()));
                 if let Some(old_value) = old_value {
                     let old_te = TableEntry { key: te.key.clone(), value: old_value.clone() };
                     let old_record = old_te.to_record(table, &table_name).unwrap();
+                    let old_record = with_field(with_field(old_record, "of_group", old_of_group), "counter_id", counter_id);
+                    let old_record = with_field(old_record, "conj_id", old_conj_id);
                     commands.push(UpdCmd::Delete(RelIdentifier::RelId(relid), old_record));
                 }
                 if op != Update_Type::DELETE {
                     let new_record = te.to_record(table, &table_name).unwrap();
+                    let new_record = with_field(with_field(new_record, "of_group", new_of_group), "counter_id", counter_id);
+                    let new_record = with_field(new_record, "conj_id", new_conj_id);
                     commands.push(UpdCmd::Insert(RelIdentifier::RelId(relid), new_record));
                 }
+                for (key, &(old_id, new_id)) in conjunction_change.iter().flat_map(|change| &change.moves) {
+                    let entry = TableEntry { key: key.clone(), value: state.table_entries[key].clone() };
+                    let record = entry.to_record(table, &table_name).unwrap();
+                    commands.push(UpdCmd::Delete(RelIdentifier::RelId(relid), with_field(record.clone(), "conj_id", Some(old_id))));
+                    commands.push(UpdCmd::Insert(RelIdentifier::RelId(relid), with_field(record, "conj_id", Some(new_id))));
+                }
                 let delta = {
                     let hddlog = &state.hddlog;
 
@@ -414,13 +1321,28 @@ impl P4RuntimeService {
                     hddlog.apply_updates_dynamic(&mut commands.into_iter()).ddlog_map_error()?;
                     hddlog.transaction_commit_dump_changes().ddlog_map_error()?
                 };
-                delta_to_flow_mods(&delta, config.flow_relid, &mut state.pending_flow_mods);
+                delta_to_flow_mods(&delta, config, &mut state.pending_flow_mods);
                 state.latch.set();
 
                 // Commit the operation to our internal representation.
+                if let Some(change) = conjunction_change {
+                    state.conjunctions.apply(&te.key, change);
+                }
                 if op == Update_Type::DELETE {
+                    if let Some(counter_id) = state.counter_ids.remove(&te.key) {
+                        state.counter_id_allocator.release(counter_id);
+                    }
+                    state.entry_groups.remove(&te.key);
                     state.table_entries.remove(&te.key);
                 } else {
+                    if let Some(counter_id) = counter_id {
+                        if state.counter_ids.insert(te.key.clone(), counter_id).is_none() {
+                            state.counter_id_allocator.claim(counter_id);
+                        }
+                    }
+                    if let Some(group_key) = group_key {
+                        state.entry_groups.insert(te.key.clone(), group_key);
+                    }
                     state.table_entries.insert(te.key, te.value);
                 }
 
@@ -433,12 +1355,13 @@ impl P4RuntimeService {
     #[instrument(name = "Read", err, skip(self))]
     fn do_read(&mut self, req: ReadRequest) -> Result<Vec<ReadResponse>, grpcio::RpcStatus> {
         let _span = span!(Level::INFO, "read").entered();
-        let state = self.state.lock().unwrap();
+        let mut state = self.state.lock().unwrap();
         if req.device_id != state.device_id {
             return Err(grpcio::RpcStatus::new(RpcStatusCode::NOT_FOUND));
         }
 
         let mut responses = Vec::new();
+        let mut counter_reads = Vec::new();
         for rq_entity in req.entities {
             let rpy_entities = match rq_entity {
                 Entity {
@@ -449,10 +1372,52 @@ impl P4RuntimeService {
                 Entity { entity: Some(Entity_oneof_entity::table_entry(te)), .. }
                 => state.read_table_entries(&te),
 
+                Entity { entity: Some(Entity_oneof_entity::action_profile_member(apm)), .. }
+                => state.read_profile_members(&apm),
+
+                Entity { entity: Some(Entity_oneof_entity::action_profile_group(apg)), .. }
+                => state.read_profile_groups(&apg),
+
+                Entity { entity: Some(Entity_oneof_entity::direct_counter_entry(dce)), .. } => {
+                    // The counts come from the switch, so fill them in below, after all the
+                    // queries have been started.
+                    counter_reads.push((responses.len(), state.read_direct_counters(dce.get_table_entry())));
+                    Vec::new()
+                },
+
                 _ => Vec::new(),
             };
             responses.push(ReadResponse { entities: rpy_entities.into(), ..Default::default() });
         }
+
+        // Wait for the counts without holding the lock, since `run_server` needs it to send the
+        // queries.
+        drop(state);
+        for (index, (entries, receiver)) in counter_reads {
+            let counts = match receiver.recv_timeout(COUNTER_READ_TIMEOUT) {
+                Ok(Ok(counts)) => counts,
+                Ok(Err(error)) => {
+                    warn!("reading direct counters failed ({error})");
+                    return Err(grpcio::RpcStatus::new(RpcStatusCode::UNAVAILABLE));
+                },
+                Err(_) => return Err(grpcio::RpcStatus::new(RpcStatusCode::DEADLINE_EXCEEDED))
+            };
+            let entities: Vec<Entity> = entries.into_iter().map(|(te, id)| {
+                let (packet_count, byte_count) = counts.get(&id).copied().unwrap_or_default();
+                let data = CounterData {
+                    packet_count: packet_count as i64,
+                    byte_count: byte_count as i64,
+                    ..Default::default()
+                };
+                Entity {
+                    entity: Some(Entity_oneof_entity::direct_counter_entry(DirectCounterEntry {
+                        table_entry: Some((&te).into()).into(),
+                        data: Some(data).into(),
+                        ..Default::default()})),
+                    ..Default::default()}
+            }).collect();
+            responses[index].entities = entities.into();
+        }
         Ok(responses)
     }
 
@@ -533,7 +1498,8 @@ impl P4RuntimeService {
         // XXX check action, device_id, role, election_id
 
         let mut state = self.state.lock().unwrap();
-        match Config::new(req.get_config(), &state.hddlog) {
+        match Config::new(req.get_config(), &state.hddlog, state.static_flows_dir.as_deref(),
+                          state.table_manifest_dir.as_deref()) {
             Ok(config) => {
                 state.config = Some(config);
                 state.config_seqno += 1;
@@ -627,14 +1593,253 @@ fn flow_record_to_string(record: &Record) -> Option<&String> {
     record_as_string(record.get_struct_field("flow")?)
 }
 
-fn flow_record_to_flow_mod(record: &Record) -> Result<FlowMod> {
+fn flow_record_to_flow_mod(record: &Record, flow_format: FlowFormat) -> Result<FlowMod> {
+    if flow_format == FlowFormat::Structured {
+        let flow = structured_flow_t::from_record(record).map_err(|s| anyhow!("{record}: {s}"))?;
+        return structured_flow_to_flow_mod(&flow, FlowModCommand::Add);
+    }
     let flow = flow_record_to_string(&record).ok_or(anyhow!("Flow record {record} lacks 'flow' field"))?;
-    match FlowMod::parse(flow, Some(FlowModCommand::Add)) {
-        Ok((flow, _)) => Ok(flow),
-        Err(s) => Err(anyhow!("{flow}: {s}"))
+    parse_flow(flow, FlowModCommand::Add).map_err(|s| anyhow!("{flow}: {s}"))
+}
+
+/// Parses `flow`, in `ovs-ofctl` syntax, and gives it its cookie.  For a table with direct
+/// counters, `p4c-of` writes the id of the P4Runtime entry as `cookie=<id>`, which OVS only accepts
+/// in flow additions; deletions do not match on the cookie, so it is dropped for them.
+fn parse_flow(flow: &str, command: FlowModCommand) -> Result<FlowMod> {
+    let (mut flow_mod, _) = match command {
+        FlowModCommand::Add => FlowMod::parse(flow, Some(command))?,
+        _ => FlowMod::parse(&strip_cookie(flow), Some(command))?
+    };
+    let entry_id = match command {
+        FlowModCommand::Add => flow_mod.cookie() as u32,
+        _ => 0
+    };
+    flow_mod.set_cookie(flow_cookie(flow_mod.table_id(), entry_id, flow));
+    Ok(flow_mod)
+}
+
+/// Returns `flow` without its `cookie=<value>`, if any.
+fn strip_cookie(flow: &str) -> Cow<'_, str> {
+    let start = match flow.find("cookie=") {
+        Some(start) => start,
+        None => return Cow::Borrowed(flow)
+    };
+    let tail = &flow[start..];
+    let end = tail.find(|c| c == ',' || c == ' ').unwrap_or(tail.len());
+    let rest = tail[end..].trim_start_matches(|c| c == ',' || c == ' ');
+    Cow::Owned(format!("{}{rest}", &flow[..start]))
+}
+
+/// Cookie bit that marks a flow that implements a P4Runtime entry of a table with direct counters.
+const COOKIE_ENTRY_FLAG: u64 = 1 << 55;
+/// Position of the entry id in a cookie with [`COOKIE_ENTRY_FLAG`].
+const COOKIE_ENTRY_SHIFT: u32 = 23;
+
+/// Returns the cookie and cookie mask that select the flows for P4Runtime entry `entry_id`, in any
+/// table.
+fn entry_cookie(entry_id: u32) -> (u64, u64) {
+    (COOKIE_ENTRY_FLAG | ((entry_id as u64) << COOKIE_ENTRY_SHIFT),
+     COOKIE_ENTRY_FLAG | ((u32::MAX as u64) << COOKIE_ENTRY_SHIFT))
+}
+
+/// Returns the entry id in `cookie`, if it has one.
+fn cookie_entry_id(cookie: u64) -> Option<u32> {
+    if cookie & COOKIE_ENTRY_FLAG != 0 {
+        Some((cookie >> COOKIE_ENTRY_SHIFT) as u32)
+    } else {
+        None
+    }
+}
+
+/// Returns the cookie for a flow in OpenFlow table `table_id` whose content, as text or as a
+/// structured record, is `content`, and that implements P4Runtime entry `entry_id` (0 for none).
+/// The table is in the high 8 bits, so that the flows of a table can be selected with a cookie
+/// mask.  For an entry, the flag bit and the entry id follow, so that its flows can be selected
+/// to read its counters (see [`entry_cookie`]).  A hash of the content is in the remaining bits,
+/// 55 of them for a flow without an entry but only 23 for the flows of an entry, so different
+/// flows can have the same cookie; a resync therefore also compares the flows themselves (see
+/// [`resync_difference`]).  The hash only has to be consistent within a single `ofp4` binary:
+/// after an upgrade, the first resync replaces all the flows.
+fn flow_cookie<T: Hash + ?Sized>(table_id: u8, entry_id: u32, content: &T) -> u64 {
+    let mut hasher = DefaultHasher::new();
+    content.hash(&mut hasher);
+    let hash = hasher.finish();
+    let table = (table_id as u64) << 56;
+    if entry_id == 0 {
+        table | (hash & (COOKIE_ENTRY_FLAG - 1))
+    } else {
+        table | entry_cookie(entry_id).0 | (hash & ((1 << COOKIE_ENTRY_SHIFT) - 1))
+    }
+}
+
+/// Adds field `name` with `value`, if any, to `record`, the DDlog record for a table entry.
+/// `p4c-of` adds a `counter_id` field to the relations for tables with a direct counter, an
+/// `of_group` field, instead of the action, to those for tables with an action selector, and a
+/// `conj_id` field to those for tables with `@of_conjunction`.
+fn with_field(record: Record, name: &'static str, value: Option<u32>) -> Record {
+    match (record, value) {
+        (Record::NamedStruct(relation, mut fields), Some(value)) => {
+            fields.push((Name::from(name), value.into_record()));
+            Record::NamedStruct(relation, fields)
+        },
+        (record, _) => record
+    }
+}
+
+/// Returns the group_mod that adds or replaces the OpenFlow select group for `group`, a group of
+/// action selector `profile_id`, whose buckets are the actions of its members in `buckets`.
+fn group_mod(config: &Config, buckets: &HashMap<(String, u32), String>,
+             profile_id: u32, group: &ProfileGroup) -> Option<Ofpbuf> {
+    let name = &config.selectors.get(&profile_id)?.name;
+    let mut text = format!("group_id={},type=select", group.of_group);
+    for &(member_id, weight) in &group.members {
+        match buckets.get(&(name.clone(), member_id)) {
+            Some(actions) => {
+                // P4Runtime weights are at least 1, but a zero weight means the default.
+                let weight = weight.clamp(1, u16::MAX as i32);
+                text += &format!(",bucket=weight:{weight},actions={actions}");
+            },
+            None => warn!("{name}: no actions for member {member_id}")
+        }
+    }
+    parse_group_mod(&text, GroupModCommand::AddOrModify)
+}
+
+/// Returns the group_mod that adds or replaces the OpenFlow group of type all for multicast group
+/// `mcast_id`, with one bucket per port in `buckets`.
+fn multicast_group_mod(mcast_id: u16, buckets: &BTreeMap<u16, String>) -> Option<Ofpbuf> {
+    let mut text = format!("group_id={mcast_id},type=all");
+    for (port, actions) in buckets {
+        text += &format!(",bucket=bucket_id:{port},actions={actions}");
+    }
+    parse_group_mod(&text, GroupModCommand::AddOrModify)
+}
+
+fn parse_group_mod(text: &str, command: GroupModCommand) -> Option<Ofpbuf> {
+    match GroupMod::parse(text, command) {
+        Ok((gm, _)) => Some(gm.encode(OFP_VERSION)),
+        Err(err) => { warn!("{text}: {err}"); None }
+    }
+}
+
+/// Applies the changes to the `MulticastBucket` relation in `delta` to `multicast_buckets`, and
+/// appends to `msgs` the group_mods that update the multicast groups.  A group that gains its
+/// first bucket is added and one that loses its last is deleted; otherwise only the buckets that
+/// changed are inserted or removed.
+fn delta_to_multicast_group_mods(delta: &DeltaMap<DDValue>,
+                                 config: &Config,
+                                 multicast_buckets: &mut HashMap<u16, BTreeMap<u16, String>>,
+                                 msgs: &mut Vec<Ofpbuf>) {
+    let changes = match config.multicast_bucket_relid.and_then(|relid| delta.try_get_rel(relid)) {
+        Some(changes) => changes,
+        None => return
+    };
+    let mut removed: HashMap<u16, Vec<u16>> = HashMap::new();
+    let mut inserted: HashMap<u16, Vec<(u16, String)>> = HashMap::new();
+    for (val, &weight) in changes.iter() {
+        let bucket = multicast_bucket_t::from_ddvalue_ref(val);
+        if weight > 0 {
+            inserted.entry(bucket.mcast_id).or_default().push((bucket.port, bucket.actions.clone()));
+        } else {
+            removed.entry(bucket.mcast_id).or_default().push(bucket.port);
+        }
+    }
+    let mcast_ids: BTreeSet<u16> = removed.keys().chain(inserted.keys()).copied().collect();
+    for mcast_id in mcast_ids {
+        let existed = multicast_buckets.contains_key(&mcast_id);
+        let buckets = multicast_buckets.entry(mcast_id).or_default();
+        let removed = removed.remove(&mcast_id).unwrap_or_default();
+        let inserted = inserted.remove(&mcast_id).unwrap_or_default();
+        for port in &removed {
+            buckets.remove(port);
+        }
+        for (port, actions) in &inserted {
+            buckets.insert(*port, actions.clone());
+        }
+
+        if buckets.is_empty() {
+            multicast_buckets.remove(&mcast_id);
+            msgs.extend(parse_group_mod(&format!("group_id={mcast_id}"), GroupModCommand::Delete));
+        } else if !existed {
+            msgs.extend(multicast_group_mod(mcast_id, buckets));
+        } else {
+            // A port whose actions changed is removed and then inserted again.
+            for port in removed {
+                msgs.extend(parse_group_mod(&format!("group_id={mcast_id},command_bucket_id={port}"),
+                                            GroupModCommand::RemoveBucket));
+            }
+            for (port, actions) in inserted {
+                msgs.extend(parse_group_mod(&format!("group_id={mcast_id},command_bucket_id=last,bucket=bucket_id:{port},actions={actions}"),
+                                            GroupModCommand::InsertBucket));
+            }
+        }
+    }
+}
+
+/// Applies the changes to the `ActionProfileBucket` relation in `delta` to `buckets`, and appends
+/// to `msgs` the group_mods that update the groups of the members whose actions changed.
+fn delta_to_group_mods(delta: &DeltaMap<DDValue>,
+                       config: &Config,
+                       buckets: &mut HashMap<(String, u32), String>,
+                       groups: &HashMap<(u32, u32), ProfileGroup>,
+                       msgs: &mut Vec<Ofpbuf>) {
+    let changes = match config.bucket_relid.and_then(|relid| delta.try_get_rel(relid)) {
+        Some(changes) => changes,
+        None => return
+    };
+    let mut changed = HashSet::new();
+    // Insert after delete, since a member whose actions changed is in both.
+    for target in [-1, 1] {
+        for (val, &weight) in changes.iter().filter(|(_, &weight)| weight == target) {
+            let bucket = action_profile_bucket_t::from_ddvalue_ref(val);
+            let key = (bucket.profile.clone(), bucket.member_id);
+            if weight > 0 {
+                buckets.insert(key.clone(), bucket.actions.clone());
+            } else {
+                buckets.remove(&key);
+            }
+            changed.insert(key);
+        }
+    }
+    for (&(profile_id, _), group) in groups {
+        let name = match config.selectors.get(&profile_id) {
+            Some(selector) => &selector.name,
+            None => continue
+        };
+        if group.members.iter().any(|&(member_id, _)| changed.contains(&(name.clone(), member_id))) {
+            msgs.extend(group_mod(config, buckets, profile_id, group));
+        }
     }
 }
 
+fn to_subfield(sf: &of_subfield_t) -> Subfield {
+    Subfield { field: &sf.field, ofs: sf.ofs, n_bits: sf.n_bits }
+}
+
+/// Encodes `flow` directly, without formatting and parsing it as text.
+fn structured_flow_to_flow_mod(flow: &structured_flow_t, command: FlowModCommand) -> Result<FlowMod> {
+    let fields: Vec<FieldValue> = flow.matches.iter()
+        .map(|m| FieldValue { field: &m.field, value: m.value, mask: m.mask })
+        .collect();
+    let actions: Vec<FlowAction> = flow.actions.iter()
+        .map(|a| match a {
+            of_action_t::OfSetField { field } => FlowAction::SetField(
+                FieldValue { field: &field.field, value: field.value, mask: field.mask }),
+            of_action_t::OfMove { src, dst } => FlowAction::Move { src: to_subfield(src), dst: to_subfield(dst) },
+            of_action_t::OfResubmit { table } => FlowAction::Resubmit(*table),
+            of_action_t::OfGotoTable { table } => FlowAction::GotoTable(*table),
+            of_action_t::OfOutput { port } => FlowAction::Output(*port),
+            of_action_t::OfOutputField { src } => FlowAction::OutputField(to_subfield(src)),
+            of_action_t::OfStripVlan { .. } => FlowAction::StripVlan,
+            of_action_t::OfCloneBegin { .. } => FlowAction::CloneBegin,
+            of_action_t::OfCloneEnd { .. } => FlowAction::CloneEnd,
+        })
+        .collect();
+    let mut flow_mod = FlowMod::new(flow.table, flow.priority, command, &fields, &actions)?;
+    flow_mod.set_cookie(flow_cookie(flow.table, flow.cookie as u32, flow));
+    Ok(flow_mod)
+}
+
 #[derive(Parser, Debug)]
 #[clap(version, about)]
 struct Args {
@@ -662,19 +1867,270 @@ struct Args {
 
     /// File to write DDlog replay log to
     #[clap(long)]
-    ddlog_record: Option<PathBuf>
+    ddlog_record: Option<PathBuf>,
+
+    /// Directory with static flows written by `p4c-of --static-flows`, as `<module>.flows`
+    #[clap(long)]
+    static_flows_dir: Option<PathBuf>,
+
+    /// Directory with table manifests written by `p4c-of --table-manifest`, as
+    /// `<module>.tables.json`
+    #[clap(long)]
+    table_manifest_dir: Option<PathBuf>,
+
+    /// OVSDB remote for configuring the bridge's OpenFlow tables from the table manifest, e.g.
+    /// "unix:/path/to/ovs/tutorial/sandbox/db.sock"
+    #[clap(long)]
+    ovsdb: Option<String>,
+
+    /// Bridge whose OpenFlow tables to configure in OVSDB
+    #[clap(long, default_value = "br0")]
+    bridge: String,
+}
+
+/// The flows and groups in the switch, from its replies to a flow stats request and a group
+/// description request.
+#[derive(Default)]
+struct SwitchContents {
+    /// The bodies of the flows (see [`FlowMod::body`]), by table and cookie.
+    flows: HashMap<(u8, u64), BTreeSet<String>>,
+    groups: BTreeSet<u32>,
+}
+
+/// Progress of the resynchronization of the switch's flows and groups after connecting to it.
+enum Resync {
+    /// In sync, or disconnected.
+    Idle,
+    /// Waiting for the replies to flow stats request `flow_xid` and group description request
+    /// `group_xid`.  Each becomes `None` after its last reply.
+    Dumping { flow_xid: Option<u32>, group_xid: Option<u32>, existing: SwitchContents },
+    /// The switch's flows and groups are known.  `None` means that a dump failed, so they must all
+    /// be replaced.
+    Ready(Option<SwitchContents>),
+}
+
+impl Resync {
+    /// Asks the switch on `rconn` for its flows and groups, and returns the state that waits for
+    /// the replies.
+    fn start(rconn: &mut Rconn) -> Resync {
+        let request = FlowStatsRequest { table_id: FlowStatsRequest::ALL_TABLES, cookie: 0, cookie_mask: 0 };
+        let flow_msg = request.encode(OFP_PROTOCOL);
+        let group_msg = GroupDescRequest::encode(OFP_VERSION);
+        let resync = Resync::Dumping {
+            flow_xid: Some(xid(flow_msg.as_slice())),
+            group_xid: Some(xid(group_msg.as_slice())),
+            existing: SwitchContents::default()
+        };
+        rconn.send(flow_msg).unwrap();
+        rconn.send(group_msg).unwrap();
+        resync
+    }
+
+    /// Returns true if this is waiting for replies to transaction `msg_xid`.
+    fn is_dumping(&self, msg_xid: u32) -> bool {
+        matches!(*self, Resync::Dumping { flow_xid, group_xid, .. }
+                 if flow_xid == Some(msg_xid) || group_xid == Some(msg_xid))
+    }
+
+    /// Handles flow stats reply `msg`, whose transaction id is `msg_xid`.  While dumping for that
+    /// transaction, adds the reply's flows to the switch's flows, and becomes `Ready` after the
+    /// last reply of both dumps, or after a bad reply.
+    fn add_flow_stats_reply(&mut self, msg_xid: u32, msg: &[u8]) {
+        if let Resync::Dumping { ref mut flow_xid, ref mut existing, .. } = *self {
+            if *flow_xid != Some(msg_xid) {
+                return;
+            }
+            match FlowStats::decode_reply(msg) {
+                Ok(flows) => {
+                    for fs in flows {
+                        existing.flows.entry((fs.table_id, fs.cookie)).or_default().insert(fs.body);
+                    }
+                    if !ofpmp_more(msg) {
+                        *flow_xid = None;
+                    }
+                },
+                Err(err) => {
+                    warn!("bad flow stats reply ({err}), replacing all flows");
+                    *self = Resync::Ready(None);
+                    return;
+                }
+            }
+            self.finish_dump();
+        }
+    }
+
+    /// Like [`Resync::add_flow_stats_reply`], for group description reply `msg`.
+    fn add_group_desc_reply(&mut self, msg_xid: u32, msg: &[u8]) {
+        if let Resync::Dumping { ref mut group_xid, ref mut existing, .. } = *self {
+            if *group_xid != Some(msg_xid) {
+                return;
+            }
+            match GroupDescRequest::decode_reply_ids(msg) {
+                Ok(ids) => {
+                    existing.groups.extend(ids);
+                    if !ofpmp_more(msg) {
+                        *group_xid = None;
+                    }
+                },
+                Err(err) => {
+                    warn!("bad group description reply ({err}), replacing all flows");
+                    *self = Resync::Ready(None);
+                    return;
+                }
+            }
+            self.finish_dump();
+        }
+    }
+
+    /// Becomes `Ready` once both dumps are complete.
+    fn finish_dump(&mut self) {
+        if let Resync::Dumping { flow_xid: None, group_xid: None, ref mut existing } = *self {
+            let existing = std::mem::take(existing);
+            *self = Resync::Ready(Some(existing));
+        }
+    }
+}
+
+/// Returns the flows to delete from the switch, as (table, cookie) pairs in order, and the flows
+/// to add to it, to change the flows in the switch, `existing`, to `wanted`.  The flows with a
+/// given table and cookie are in sync if the switch has exactly the wanted flows with them,
+/// compared by body.  Otherwise, all of them are deleted and the wanted ones added, which also
+/// covers different flows whose cookies happen to be the same.
+fn resync_difference<'a>(existing: &HashMap<(u8, u64), BTreeSet<String>>, wanted: &[&'a FlowMod])
+                         -> (Vec<(u8, u64)>, Vec<&'a FlowMod>) {
+    let mut wanted_bodies: HashMap<(u8, u64), BTreeSet<String>> = HashMap::new();
+    for fm in wanted {
+        wanted_bodies.entry((fm.table_id(), fm.cookie())).or_default().insert(fm.body());
+    }
+    let mut deletions: Vec<(u8, u64)> = existing.iter()
+        .filter(|&(key, bodies)| wanted_bodies.get(key) != Some(bodies))
+        .map(|(&key, _)| key)
+        .collect();
+    deletions.sort_unstable();
+    let additions: Vec<&FlowMod> = wanted.iter().copied()
+        .filter(|fm| {
+            let key = (fm.table_id(), fm.cookie());
+            existing.get(&key) != wanted_bodies.get(&key)
+        })
+        .collect();
+    (deletions, additions)
+}
+
+/// Returns the flow_mods that change the flows in the switch, `existing`, to `wanted`: deleting
+/// the flows that are not wanted, then adding the wanted flows that the switch lacks.  If
+/// `existing` is `None`, deletes all the flows and adds all of `wanted`.
+fn resync_flow_mods(existing: Option<&HashMap<(u8, u64), BTreeSet<String>>>, wanted: &[&FlowMod])
+                    -> Vec<Ofpbuf> {
+    let existing = match existing {
+        Some(existing) => existing,
+        None => {
+            let delete_all = FlowMod::parse("", Some(FlowModCommand::Delete { strict: false })).unwrap().0;
+            return std::iter::once(&delete_all).chain(wanted.iter().copied())
+                .map(|fm| fm.encode(OFP_PROTOCOL))
+                .collect();
+        }
+    };
+
+    let (deletions, additions) = resync_difference(existing, wanted);
+    let deletions: Vec<FlowMod> = deletions.into_iter()
+        .filter_map(|(table, cookie)| {
+            match FlowMod::parse(&format!("table={table},cookie={cookie:#x}/-1"),
+                                 Some(FlowModCommand::Delete { strict: false })) {
+                Ok((fm, _)) => Some(fm),
+                Err(err) => { event!(Level::ERROR, "table {table} cookie {cookie:#x}: {err}"); None }
+            }
+        })
+        .collect();
+    info!("Resync: deleting flows with {} cookies, adding {} flows, keeping {}",
+          deletions.len(), additions.len(), wanted.len() - additions.len());
+    deletions.iter().chain(additions.into_iter())
+        .map(|fm| fm.encode(OFP_PROTOCOL))
+        .collect()
+}
+
+/// Returns the IDs of the groups in the switch, `existing`, that are not among the `wanted` ones.
+fn stale_groups(existing: &BTreeSet<u32>, wanted: &BTreeSet<u32>) -> Vec<u32> {
+    existing.difference(wanted).copied().collect()
+}
+
+/// A counter read that the switch has not finished answering.
+struct CounterRead {
+    query: CounterQuery,
+    /// Transaction IDs of the flow stats requests whose replies are not yet complete.
+    xids: HashSet<u32>,
+    counts: CounterCounts,
+}
+
+impl CounterRead {
+    /// Sends the flow stats requests for `query` on `rconn`.  The requests are sent together, so
+    /// they take a single round trip.  A large query asks for the flows of all the entries at
+    /// once, which is cheaper than a request per entry.
+    fn start(rconn: &mut Rconn, query: CounterQuery) -> CounterRead {
+        let cookies: Vec<(u64, u64)> = if query.entry_ids.len() > COUNTER_DUMP_THRESHOLD {
+            vec![(COOKIE_ENTRY_FLAG, COOKIE_ENTRY_FLAG)]
+        } else {
+            query.entry_ids.iter().map(|&id| entry_cookie(id)).collect()
+        };
+        let mut xids = HashSet::new();
+        for (cookie, cookie_mask) in cookies {
+            let request = FlowStatsRequest { table_id: FlowStatsRequest::ALL_TABLES, cookie, cookie_mask };
+            let msg = request.encode(OFP_PROTOCOL);
+            xids.insert(xid(msg.as_slice()));
+            rconn.send(msg).unwrap();
+        }
+        CounterRead { query, xids, counts: HashMap::new() }
+    }
+
+    /// Adds the flows in flow stats reply `msg` to the counts, aggregating the flows of each entry.
+    /// Returns true if this was the last reply.
+    fn add_reply(&mut self, msg: &[u8]) -> Result<bool> {
+        for fs in FlowStats::decode_reply(msg)? {
+            if let Some(id) = cookie_entry_id(fs.cookie).filter(|id| self.query.entry_ids.contains(id)) {
+                let (packets, bytes) = self.counts.entry(id).or_default();
+                *packets = packets.saturating_add(fs.packet_count);
+                *bytes = bytes.saturating_add(fs.byte_count);
+            }
+        }
+        if !ofpmp_more(msg) {
+            self.xids.remove(&xid(msg));
+        }
+        Ok(self.xids.is_empty())
+    }
+
+    fn finish(self, result: Result<(), String>) {
+        // The reader might have given up waiting, so ignore errors.
+        let CounterRead { query, counts, .. } = self;
+        let _ = query.reply.send(result.map(|()| counts));
+    }
+}
+
+/// Fails all of the counter reads in `reads` and `queries` with `error`.
+fn fail_counter_reads(reads: &mut Vec<CounterRead>, queries: &mut Vec<CounterQuery>, error: &str) {
+    for read in reads.drain(..) {
+        read.finish(Err(error.into()));
+    }
+    for query in queries.drain(..) {
+        let _ = query.reply.send(Err(error.into()));
+    }
 }
 
 // Runs the server main loop, servicing P4Runtime requests from `state` and applying them to OVS
 // via `rconn`.  After initialization completes, finishes daemonization using `daemonizing`, if it
-// is not `None`.
-fn run_server(state: Arc<Mutex<State>>, mut rconn: Rconn, mut daemonizing: Option<Daemonizing>) -> Result<()> {
+// is not `None`.  If `ovsdb` is not `None`, configures the OpenFlow tables there from the table
+// manifest of the program on every connection and configuration change, in the background.
+fn run_server(state: Arc<Mutex<State>>, mut rconn: Rconn, mut daemonizing: Option<Daemonizing>,
+              ovsdb: Option<Ovsdb>) -> Result<()> {
+    let configurator = ovsdb.map(Ovsdb::start_configurator);
     let mut last_connection_seqno = 0;
     let mut last_config_seqno = 0;
     let mut bundle_id = 0;
+    let mut resync = Resync::Idle;
+    let mut counter_reads: Vec<CounterRead> = Vec::new();
     loop {
         rconn.run();
         while let Some(msg) = rconn.recv() {
+            let msg_xid = xid(msg.as_slice());
+            let counter_read = counter_reads.iter().position(|read| read.xids.contains(&msg_xid));
             match OfpType::decode(msg.as_slice()) {
                 Ok(OfpType(ovs::sys::ofptype_OFPTYPE_BUNDLE_CONTROL)) => {
                     if let Ok(bcm) = BundleCtrlMsg::decode(msg.as_slice()) {
@@ -688,6 +2144,30 @@ fn run_server(state: Arc<Mutex<State>>, mut rconn: Rconn, mut daemonizing: Optio
                         }
                     }
                 },
+                Ok(OfpType(ovs::sys::ofptype_OFPTYPE_FLOW_STATS_REPLY)) if counter_read.is_some() => {
+                    let index = counter_read.unwrap();
+                    match counter_reads[index].add_reply(msg.as_slice()) {
+                        Ok(false) => (),
+                        Ok(true) => counter_reads.swap_remove(index).finish(Ok(())),
+                        Err(err) => counter_reads.swap_remove(index).finish(Err(format!("bad flow stats reply ({err})")))
+                    }
+                },
+                Ok(OfpType(ovs::sys::ofptype_OFPTYPE_ERROR)) if counter_read.is_some() => {
+                    let error = format!("{}", ovs::ofp_print::Printer(msg.as_slice()));
+                    counter_reads.swap_remove(counter_read.unwrap()).finish(Err(error));
+                },
+                Ok(OfpType(ovs::sys::ofptype_OFPTYPE_FLOW_STATS_REPLY)) => {
+                    resync.add_flow_stats_reply(msg_xid, msg.as_slice());
+                },
+                Ok(OfpType(ovs::sys::ofptype_OFPTYPE_GROUP_DESC_STATS_REPLY)) => {
+                    resync.add_group_desc_reply(msg_xid, msg.as_slice());
+                },
+                Ok(OfpType(ovs::sys::ofptype_OFPTYPE_ERROR)) if resync.is_dumping(msg_xid) => {
+                    // Most likely, the switch refused to dump its flows or groups.
+                    warn!("error while dumping flows or groups ({}), replacing all flows",
+                          ovs::ofp_print::Printer(msg.as_slice()));
+                    resync = Resync::Ready(None);
+                },
                 _ => println!("received message {}", ovs::ofp_print::Printer(msg.as_slice()))
             }
         }
@@ -697,53 +2177,118 @@ fn run_server(state: Arc<Mutex<State>>, mut rconn: Rconn, mut daemonizing: Optio
             let mut state = state.lock().unwrap();
 
             let flags = ovs::ofp_bundle::OFPBF_ATOMIC | ovs::ofp_bundle::OFPBF_ORDERED;
-            if rconn.connection_seqno() == last_connection_seqno &&
-                state.config_seqno == last_config_seqno
+            if rconn.connection_seqno() != last_connection_seqno ||
+                state.config_seqno != last_config_seqno
             {
-                // Send pending flow mods, if any.
-                if !state.pending_flow_mods.is_empty() {
-                    bundle_id += 1;
-                    let bundle = ovs::ofp_bundle::BundleSequence::new(bundle_id, flags, OFP_VERSION,
-                                                                      state.pending_flow_mods.drain(..));
-                    for msg in bundle {
-                        rconn.send(msg).unwrap();
-                    }
+                // We just reconnected, or the configuration changed.  Configure the tables again,
+                // in case the database was recreated along with the switch.  This is idempotent.
+                // It only changes how the classifier tracks prefixes, so the flows need not wait.
+                if let (Some(configurator), Some(manifest)) = (&configurator, state.config.as_ref().and_then(|c| c.table_manifest.as_ref())) {
+                    let _ = configurator.send(manifest.clone());
                 }
-            } else {
-                // We just reconnected.  Send all the flows.  Discard pending flow mods, if any,
-                // because the full collection of flows includes them.
+
+                // Ask the switch for the flows and groups it has, so that we only need to send
+                // the difference.
+                resync = Resync::start(&mut rconn);
+                if rconn.connection_seqno() != last_connection_seqno {
+                    // Replies to counter reads sent on the old connection will never arrive.
+                    fail_counter_reads(&mut counter_reads, &mut Vec::new(), "reconnected to switch");
+                }
+                last_connection_seqno = rconn.connection_seqno();
+                last_config_seqno = state.config_seqno;
+            } else if let Resync::Ready(ref existing) = resync {
+                // Discard pending flow mods, if any, because the full collection of flows
+                // includes them.
                 state.pending_flow_mods.clear();
 
-                // Compose a sequence of flow_mods starting with one to delete all the existing
-                // flows, then add in all the flows we do want.  We're going to put all of these
-                // together into an atomic bundle, so we shouldn't change the treatment of all the
-                // packets in the middle.
                 let mut flow_mods = Vec::new();
-                flow_mods.push(FlowMod::parse("", Some(FlowModCommand::Delete { strict: false })).unwrap().0);
                 if let Some(ref config) = state.config {
-                    flow_mods.extend(state.hddlog.dump_index_dynamic(config.flow_idxid).unwrap().into_iter()
-                                     .filter_map(|record| match flow_record_to_flow_mod(&record) {
-                                         Ok(fm) => Some(fm),
-                                         Err(err) => { event!(Level::ERROR, "flow failed to parse: {err}"); None }
-                                     }));
+                    // With a relation per table, the flows come in table order.
+                    for relation in &config.flow_relations {
+                        flow_mods.extend(state.hddlog.dump_index_dynamic(relation.idxid).unwrap().into_iter()
+                                         .filter_map(|record| match flow_record_to_flow_mod(&record, config.flow_format) {
+                                             Ok(fm) => Some(fm),
+                                             Err(err) => { event!(Level::ERROR, "flow failed to parse: {err}"); None }
+                                         }));
+                    }
                 };
 
-                // Encode the flow_mods into OpenFlow and send them.
-                let flow_mods = flow_mods.into_iter().map(|fm| fm.encode(OFP_PROTOCOL));
-                bundle_id += 1;
-                let bundle = ovs::ofp_bundle::BundleSequence::new(bundle_id, flags, OFP_VERSION, flow_mods);
-                for msg in bundle {
-                    rconn.send(msg).unwrap();
+                // The static flows were parsed once, when the configuration was set.  We're going
+                // to put all of the changes together into an atomic bundle, so we shouldn't
+                // change the treatment of all the packets in the middle.
+                let wanted: Vec<&FlowMod> = state.config.iter().flat_map(|config| config.static_flows.iter())
+                    .chain(flow_mods.iter())
+                    .collect();
+
+                // The flows for multicast and for tables with action selectors can refer to
+                // groups, so the groups go first.  They are few and re-adding one is cheap, so
+                // all the wanted groups are re-added.
+                let mut msgs = Vec::new();
+                if let Some(ref config) = state.config {
+                    if existing.is_none() {
+                        msgs.extend(parse_group_mod("group_id=all", GroupModCommand::Delete));
+                    }
+                    for (&(profile_id, _), group) in &state.profile_groups {
+                        msgs.extend(group_mod(config, &state.buckets, profile_id, group));
+                    }
+                    for (&mcast_id, buckets) in &state.multicast_buckets {
+                        msgs.extend(multicast_group_mod(mcast_id, buckets));
+                    }
                 }
+                msgs.extend(resync_flow_mods(existing.as_ref().map(|e| &e.flows), &wanted));
+
+                // Groups that are no longer wanted, e.g. because they were deleted while we were
+                // disconnected, go last, after the flows that referred to them.
+                if let Some(existing) = existing {
+                    let wanted_groups: BTreeSet<u32> = state.profile_groups.values()
+                        .map(|group| group.of_group)
+                        .chain(state.multicast_buckets.keys().map(|&mcast_id| mcast_id.into()))
+                        .collect();
+                    let stale = stale_groups(&existing.groups, &wanted_groups);
+                    if !stale.is_empty() {
+                        info!("Resync: deleting {} groups", stale.len());
+                    }
+                    for group_id in stale {
+                        msgs.extend(parse_group_mod(&format!("group_id={group_id}"), GroupModCommand::Delete));
+                    }
+                }
+                resync = Resync::Idle;
+                if msgs.is_empty() {
+                    // Already in sync, so there's no bundle whose commit ends startup.
+                    if let Some(daemonizing) = daemonizing.take() {
+                        daemonizing.finish();
+                    }
+                } else {
+                    bundle_id += 1;
+                    let bundle = ovs::ofp_bundle::BundleSequence::new(bundle_id, flags, OFP_VERSION, msgs);
+                    for msg in bundle {
+                        rconn.send(msg).unwrap();
+                    }
+                }
+            } else if let Resync::Idle = resync {
+                // Send pending flow mods, if any.  While a resync is in progress, they wait
+                // for it, which includes them.
+                if !state.pending_flow_mods.is_empty() {
+                    bundle_id += 1;
+                    let bundle = ovs::ofp_bundle::BundleSequence::new(bundle_id, flags, OFP_VERSION,
+                                                                      state.pending_flow_mods.drain(..));
+                    for msg in bundle {
+                        rconn.send(msg).unwrap();
+                    }
+                }
+            }
 
-                last_connection_seqno = rconn.connection_seqno();
-                last_config_seqno = state.config_seqno;
+            // Ask the switch for the counters that P4Runtime clients want to read.
+            for query in std::mem::take(&mut state.counter_queries) {
+                counter_reads.push(CounterRead::start(&mut rconn, query));
             }
         } else {
-            // We're disconnected.  We can't send pending flow mods.  When we reconnect, we'll send
-            // everything.
+            // We're disconnected.  We can't send pending flow mods.  When we reconnect, we'll
+            // resynchronize everything.
             let mut state = state.lock().unwrap();
             state.pending_flow_mods.clear();
+            resync = Resync::Idle;
+            fail_counter_reads(&mut counter_reads, &mut state.counter_queries, "not connected to switch");
         }
 
         state.lock().unwrap().latch.wait();
@@ -756,7 +2301,8 @@ fn run_server(state: Arc<Mutex<State>>, mut rconn: Rconn, mut daemonizing: Optio
 fn main() -> Result<()> {
     log_panics::init();
     let Args { ovs_remote, p4_port, p4_addr, device_id,
-               daemonize, log_file, ddlog_record } = Args::parse();
+               daemonize, log_file, ddlog_record, static_flows_dir,
+               table_manifest_dir, ovsdb, bridge } = Args::parse();
     if let Some(log_file) = log_file {
         let writer = OpenOptions::new().create(true).append(true).open(log_file)?;
         tracing_subscriber::fmt()
@@ -780,7 +2326,7 @@ fn main() -> Result<()> {
         hddlog.record_commands(&mut record);
     }
 
-    let state = Arc::new(Mutex::new(State::new(hddlog, device_id)));
+    let state = Arc::new(Mutex::new(State::new(hddlog, device_id, static_flows_dir, table_manifest_dir)));
     let service = create_p4_runtime(P4RuntimeService::new(state.clone()));
     let ch_builder = ChannelBuilder::new(env.clone());
     let mut server = ServerBuilder::new(env)
@@ -800,16 +2346,18 @@ fn main() -> Result<()> {
     let mut rconn = Rconn::new(0, 0, ovs::rconn::DSCP_DEFAULT, OFP_VERSION.into());
     rconn.connect(&ovs_remote, None);
 
-    run_server(state, rconn, daemonizing)
+    let ovsdb = ovsdb.map(|remote| Ovsdb { remote, bridge });
+    run_server(state, rconn, daemonizing, ovsdb)
 }
 
-/// Converts the `delta` of changes to DDlog output relations (particularly `Flow`) into OpenFlow
-/// [`FlowMod`] messages and appends those messages to `flow_mods`.
+/// Converts the `delta` of changes to DDlog output relations (particularly `Flow` or
+/// `StructuredFlow`) into OpenFlow [`FlowMod`] messages and appends those messages to `flow_mods`.
+/// With a relation per table, the messages for each table are together, in table order.
 fn delta_to_flow_mods(delta: &DeltaMap<DDValue>,
-                      flow_relid: RelId,
+                      config: &Config,
                       flow_mods: &mut Vec<Ofpbuf>) {
-    for (&rel, changes) in delta.iter() {
-        if rel == flow_relid {
+    for relation in &config.flow_relations {
+        if let Some(changes) = delta.try_get_rel(relation.relid) {
             for (val, weight) in changes.iter() {
                 let command = match weight {
                     1 => FlowModCommand::Add,
@@ -817,12 +2365,266 @@ fn delta_to_flow_mods(delta: &DeltaMap<DDValue>,
                     _ => unreachable!()
                 };
 
-                let flow = flow_t::from_ddvalue_ref(val);
-                match FlowMod::parse(&flow.flow, Some(command)) {
-                    Ok((flow_mod, _)) => flow_mods.push(flow_mod.encode(OFP_PROTOCOL)),
-                    Err(s) => warn!("{flow}: {s}")
-                };
+                match config.flow_format {
+                    FlowFormat::Text => {
+                        let flow = flow_t::from_ddvalue_ref(val);
+                        match parse_flow(&flow.flow, command) {
+                            Ok(flow_mod) => flow_mods.push(flow_mod.encode(OFP_PROTOCOL)),
+                            Err(s) => warn!("{flow}: {s}")
+                        };
+                    },
+                    FlowFormat::Structured => {
+                        let flow = structured_flow_t::from_ddvalue_ref(val);
+                        match structured_flow_to_flow_mod(flow, command) {
+                            Ok(flow_mod) => flow_mods.push(flow_mod.encode(OFP_PROTOCOL)),
+                            Err(s) => warn!("{flow:?}: {s}")
+                        };
+                    }
+                }
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// Returns an OpenFlow 1.3 flow stats reply with transaction id `xid` for flows with the
+    /// given tables and cookies, with the "more" flag if `more`.  Each flow has priority 100, an
+    /// empty match and no actions, like "priority=100,actions=drop".
+    fn flow_stats_reply(xid: u32, more: bool, flows: &[(u8, u64)]) -> Vec<u8> {
+        // Header, with the length filled in below, then the multipart header for OFPMP_FLOW.
+        let mut msg = vec![4, 19, 0, 0];
+        msg.extend_from_slice(&xid.to_be_bytes());
+        msg.extend_from_slice(&1u16.to_be_bytes());
+        msg.extend_from_slice(&(more as u16).to_be_bytes());
+        msg.extend_from_slice(&[0; 4]);
+        for &(table_id, cookie) in flows {
+            msg.extend_from_slice(&56u16.to_be_bytes());
+            msg.extend_from_slice(&[table_id, 0]);
+            msg.extend_from_slice(&[0; 8]);                     // duration
+            msg.extend_from_slice(&100u16.to_be_bytes());        // priority
+            msg.extend_from_slice(&[0; 10]);                    // timeouts, flags, padding
+            msg.extend_from_slice(&cookie.to_be_bytes());
+            msg.extend_from_slice(&[0; 16]);                    // packet and byte counts
+            msg.extend_from_slice(&[0, 1, 0, 4, 0, 0, 0, 0]);   // empty OXM match, padded
+        }
+        let length = msg.len() as u16;
+        msg[2..4].copy_from_slice(&length.to_be_bytes());
+        msg
+    }
+
+    #[test]
+    fn id_allocator_reuses_ids() {
+        let mut ids = IdAllocator::default();
+        assert_eq!(ids.allocate(), Some(1));
+        assert_eq!(ids.allocate(), Some(2));
+        ids.release(1);
+        // Peeking allocates nothing; claiming allocates what a peek returned.
+        assert_eq!(ids.peek(3), vec![1, 3, 4]);
+        assert_eq!(ids.peek(3), vec![1, 3, 4]);
+        ids.claim(1);
+        assert_eq!(ids.peek(1), vec![3]);
+        ids.release(1);
+        assert_eq!(ids.allocate(), Some(1));
+
+        // Once every id is in use, only a released one can be allocated again.
+        ids.last = u32::MAX - 1;
+        assert!(ids.can_allocate(1) && !ids.can_allocate(2));
+        assert_eq!(ids.peek(2), vec![u32::MAX]);
+        assert_eq!(ids.allocate(), Some(u32::MAX));
+        assert_eq!(ids.peek(1), vec![]);
+        assert_eq!(ids.allocate(), None);
+        ids.release(2);
+        assert_eq!(ids.allocate(), Some(2));
+        assert_eq!(ids.allocate(), None);
+    }
+
+    /// Returns the key of an entry in table 7 whose first two key fields are `a` and `b`, and the
+    /// point of that entry in a conjunction over those fields.
+    fn conjunction_entry(a: u128, b: u128) -> (TableKey, ConjunctionPoint) {
+        let matches: Vec<FieldMatch> = [a, b].iter().enumerate()
+            .map(|(i, &value)| FieldMatch { field_id: i as u32 + 1,
+                                            match_type: FieldMatchType::Exact(FieldValue(value)) })
+            .collect();
+        let point = matches.iter().cloned().map(Some).collect();
+        (TableKey { table_id: 7, matches, priority: 10, is_default_action: false }, point)
+    }
+
+    /// Checks that every conjunction in `conjunctions` is a cross product, and returns the number
+    /// of conjunctions.
+    fn check_conjunctions(conjunctions: &Conjunctions) -> usize {
+        for (id, conjunction) in &conjunctions.by_id {
+            assert!(conjunction.is_cross_product());
+            assert!(conjunction.entries.keys().all(|entry| conjunctions.ids[entry] == *id));
+        }
+        conjunctions.by_id.len()
+    }
+
+    #[test]
+    fn conjunctions_stay_cross_products() {
+        let key: ConjunctionKey = (7, None, 10);
+        let mut conjunctions = Conjunctions::default();
+        let mut ids = HashMap::new();
+        let mut write = |conjunctions: &mut Conjunctions, a: u128, b: u128, insert: bool| {
+            let (entry, point) = conjunction_entry(a, b);
+            let change = conjunctions.plan(&entry, insert.then(|| (key.clone(), point))).unwrap();
+            // Planning changes nothing, so a write that DDlog rejects leaves no trace.
+            assert_eq!(ids, conjunctions.ids);
+            for (other, &(old_id, new_id)) in &change.moves {
+                assert_eq!(ids.insert(other.clone(), new_id), Some(old_id));
             }
+            assert_eq!(ids.get(&entry).copied(), change.old_id);
+            match change.new_id {
+                Some(id) => ids.insert(entry.clone(), id),
+                None => ids.remove(&entry)
+            };
+            conjunctions.apply(&entry, change);
+            assert_eq!(ids, conjunctions.ids);
+        };
+
+        // (1,1) and (2,2) alone would also match (1,2) and (2,1), so they do not share a
+        // conjunction until those are there too.
+        write(&mut conjunctions, 1, 1, true);
+        write(&mut conjunctions, 2, 2, true);
+        assert_eq!(check_conjunctions(&conjunctions), 2);
+        write(&mut conjunctions, 1, 2, true);
+        write(&mut conjunctions, 2, 1, true);
+        assert_eq!(check_conjunctions(&conjunctions), 1);
+
+        // Removing a corner splits the rest.
+        write(&mut conjunctions, 1, 1, false);
+        assert_eq!(check_conjunctions(&conjunctions), 2);
+
+        // Every other write keeps them cross products too.
+        for i in 0..200u128 {
+            write(&mut conjunctions, i % 5, i * 7 % 3, i % 4 != 3);
+            check_conjunctions(&conjunctions);
+        }
+        for a in 0..5 {
+            for b in 0..3 {
+                write(&mut conjunctions, a, b, true);
+            }
+        }
+        assert_eq!(check_conjunctions(&conjunctions), 1);
+    }
+
+    #[test]
+    fn flow_cookie_layout() {
+        let cookie = flow_cookie(3, 0, "table=3 actions=drop");
+        assert_eq!(cookie >> 56, 3);
+        assert_eq!(cookie & COOKIE_ENTRY_FLAG, 0);
+        assert_eq!(cookie_entry_id(cookie), None);
+        assert_eq!(cookie, flow_cookie(3, 0, "table=3 actions=drop"));
+        assert_eq!(flow_cookie(4, 0, "table=3 actions=drop") >> 56, 4);
+
+        for &(table_id, entry_id) in &[(0u8, 1u32), (200, 12345), (254, u32::MAX)] {
+            let cookie = flow_cookie(table_id, entry_id, "actions=drop");
+            assert_eq!(cookie >> 56, table_id as u64);
+            assert_eq!(cookie_entry_id(cookie), Some(entry_id));
+            let (value, mask) = entry_cookie(entry_id);
+            assert_eq!(cookie & mask, value);
+            // The mask selects no other entry.
+            let (other, _) = entry_cookie(entry_id ^ 1);
+            assert_ne!(other & mask, value);
+        }
+    }
+
+    #[test]
+    fn parse_flow_cookies() {
+        assert_eq!(strip_cookie("table=2,cookie=0x7,priority=10,actions=drop"),
+                   "table=2,priority=10,actions=drop");
+        assert_eq!(strip_cookie("cookie=7 table=2 actions=drop"), "table=2 actions=drop");
+        assert_eq!(strip_cookie("table=2 actions=drop"), "table=2 actions=drop");
+
+        let flow = "table=2,cookie=0x7,priority=10,actions=drop";
+        let add = parse_flow(flow, FlowModCommand::Add).unwrap();
+        assert_eq!(add.table_id(), 2);
+        assert_eq!(cookie_entry_id(add.cookie()), Some(7));
+        assert_eq!(add.cookie(), flow_cookie(2, 7, flow));
+
+        // Only additions carry an entry id in their cookie.
+        let delete = parse_flow(flow, FlowModCommand::Delete { strict: true }).unwrap();
+        assert_eq!(delete.table_id(), 2);
+        assert_eq!(cookie_entry_id(delete.cookie()), None);
+
+        let plain = parse_flow("table=1,priority=5,actions=drop", FlowModCommand::Add).unwrap();
+        assert_eq!(cookie_entry_id(plain.cookie()), None);
+        assert_eq!(plain.cookie() >> 56, 1);
+    }
+
+    /// Returns an OpenFlow 1.3 group description reply with transaction id `xid` for "all" groups
+    /// with the given IDs and no buckets, with the "more" flag if `more`.
+    fn group_desc_reply(xid: u32, more: bool, groups: &[u32]) -> Vec<u8> {
+        // Header, with the length filled in below, then the multipart header for OFPMP_GROUP_DESC.
+        let mut msg = vec![4, 19, 0, 0];
+        msg.extend_from_slice(&xid.to_be_bytes());
+        msg.extend_from_slice(&7u16.to_be_bytes());
+        msg.extend_from_slice(&(more as u16).to_be_bytes());
+        msg.extend_from_slice(&[0; 4]);
+        for &group_id in groups {
+            msg.extend_from_slice(&8u16.to_be_bytes());
+            msg.extend_from_slice(&[0, 0]);                     // OFPGT_ALL, padding
+            msg.extend_from_slice(&group_id.to_be_bytes());
+        }
+        let length = msg.len() as u16;
+        msg[2..4].copy_from_slice(&length.to_be_bytes());
+        msg
+    }
+
+    #[test]
+    fn resync_from_flow_stats() {
+        let flows: Vec<FlowMod> = ["table=0,priority=100,actions=drop",
+                                   "table=1,cookie=0x5,priority=100,actions=drop",
+                                   "table=2,priority=100,actions=drop",
+                                   "table=3,priority=1,actions=drop"].iter()
+            .map(|flow| parse_flow(flow, FlowModCommand::Add).unwrap())
+            .collect();
+        let wanted: Vec<&FlowMod> = flows.iter().collect();
+        let stale = (1u8, flow_cookie(1, 0, "table=1,priority=2,actions=drop"));
+        // A different flow with the cookie of a wanted flow.
+        let collision = (3u8, wanted[3].cookie());
+
+        let mut resync = Resync::Dumping { flow_xid: Some(9), group_xid: Some(10),
+                                           existing: SwitchContents::default() };
+        assert!(resync.is_dumping(9) && resync.is_dumping(10) && !resync.is_dumping(8));
+        // Replies to other requests are not part of the dump.
+        resync.add_flow_stats_reply(8, &flow_stats_reply(8, false, &[(2, 1)]));
+        resync.add_group_desc_reply(9, &group_desc_reply(9, false, &[1]));
+        resync.add_flow_stats_reply(9, &flow_stats_reply(9, true, &[(0, wanted[0].cookie())]));
+        resync.add_flow_stats_reply(9, &flow_stats_reply(9, false, &[(1, wanted[1].cookie()), stale,
+                                                                     collision]));
+        // The dump takes both replies.
+        assert!(matches!(resync, Resync::Dumping { flow_xid: None, .. }));
+        resync.add_group_desc_reply(10, &group_desc_reply(10, false, &[1, 2]));
+        let existing = match resync {
+            Resync::Ready(Some(existing)) => existing,
+            _ => panic!("dump did not finish")
+        };
+        assert_eq!(existing.flows.len(), 4);
+        assert_eq!(existing.groups, BTreeSet::from([1, 2]));
+        assert_eq!(stale_groups(&existing.groups, &BTreeSet::from([2])), vec![1]);
+
+        let (deletions, additions) = resync_difference(&existing.flows, &wanted);
+        let mut expected_deletions = vec![stale, collision];
+        expected_deletions.sort_unstable();
+        assert_eq!(deletions, expected_deletions);
+        let added: Vec<u64> = additions.iter().map(|fm| fm.cookie()).collect();
+        assert_eq!(added, vec![wanted[2].cookie(), wanted[3].cookie()]);
+
+        // Nothing changes once the switch has the wanted flows.
+        let mut synced: HashMap<(u8, u64), BTreeSet<String>> = HashMap::new();
+        for fm in &wanted {
+            synced.entry((fm.table_id(), fm.cookie())).or_default().insert(fm.body());
         }
+        let (deletions, additions) = resync_difference(&synced, &wanted);
+        assert!(deletions.is_empty() && additions.is_empty());
+
+        // A bad reply replaces everything.
+        let mut resync = Resync::Dumping { flow_xid: Some(9), group_xid: Some(10),
+                                           existing: SwitchContents::default() };
+        resync.add_flow_stats_reply(9, &[4, 19, 0, 8, 0, 0, 0, 9]);
+        assert!(matches!(resync, Resync::Ready(None)));
     }
 }
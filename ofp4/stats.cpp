@@ -0,0 +1,88 @@
+/*
+Copyright 2022 VMware, Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <sys/resource.h>
+
+#include "stats.h"
+
+namespace OFP4 {
+
+/// Peak resident set size of this process so far, in kilobytes.
+static uint64_t peakRssKb() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+    return usage.ru_maxrss;
+}
+
+CompileStats::CompileStats() :
+        passes(new Util::JsonArray()), tables(new Util::JsonArray()),
+        flows(new Util::JsonArray()), program(new Util::JsonObject()), last(Clock::now()) {}
+
+void CompileStats::endPass(cstring name) {
+    auto now = Clock::now();
+    std::chrono::duration<double> seconds = now - last;
+    last = now;
+
+    auto pass = new Util::JsonObject();
+    pass->emplace("name", name);
+    pass->emplace("seconds", seconds.count());
+    pass->emplace("peak_rss_kb", peakRssKb());
+    passes->append(pass);
+}
+
+DebugHook CompileStats::passHook() {
+    return [this](const char* manager, unsigned, const char* pass, const IR::Node*) {
+        endPass(cstring(manager) + "/" + pass);
+    };
+}
+
+void CompileStats::addTable(cstring name, size_t id, size_t rules, size_t constantFlows) {
+    auto table = new Util::JsonObject();
+    table->emplace("name", name);
+    table->emplace("id", id);
+    table->emplace("rules", rules);
+    table->emplace("constant_flows", constantFlows);
+    tables->append(table);
+}
+
+void CompileStats::addFlows(cstring name, size_t id, cstring formula, size_t entries,
+                            cstring entriesFrom, size_t worstCase) {
+    auto node = new Util::JsonObject();
+    node->emplace("name", name);
+    node->emplace("id", id);
+    node->emplace("formula", formula);
+    node->emplace("entries", entries);
+    node->emplace("entries_from", entriesFrom);
+    node->emplace("worst_case", worstCase);
+    flows->append(node);
+}
+
+void CompileStats::add(cstring name, size_t value) {
+    program->emplace(name, value);
+}
+
+void CompileStats::write(std::ostream& out) const {
+    auto result = new Util::JsonObject();
+    result->emplace("passes", passes);
+    result->emplace("tables", tables);
+    result->emplace("flows", flows);
+    result->emplace("program", program);
+    result->serialize(out);
+    out << std::endl;
+}
+
+}  // namespace OFP4
@@ -0,0 +1,64 @@
+/*
+Copyright 2022 VMware, Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _EXTENSIONS_OFP4_STATS_H_
+#define _EXTENSIONS_OFP4_STATS_H_
+
+#include <chrono>
+
+#include "ir/ir.h"
+#include "ir/pass_manager.h"
+#include "lib/json.h"
+
+namespace OFP4 {
+
+/// Statistics about one compilation, written as JSON by --stats: the
+/// time and memory used by each pass, what each table expanded to, how
+/// many flows each stage can take, and the size of the output.
+class CompileStats {
+    typedef std::chrono::steady_clock Clock;
+
+    Util::JsonArray* passes;
+    Util::JsonArray* tables;
+    Util::JsonArray* flows;
+    Util::JsonObject* program;
+    Clock::time_point last;
+
+ public:
+    CompileStats();
+
+    /// Starts timing the first pass.
+    void start() { last = Clock::now(); }
+    /// Records the pass that just ended; the next pass starts now.
+    void endPass(cstring name);
+    /// A hook for a PassManager that records each of its passes.
+    DebugHook passHook();
+    /// Records the DDlog rules generated for a table; 'rules' produce
+    /// flows from table entries, 'constantFlows' are known at compile time.
+    void addTable(cstring name, size_t id, size_t rules, size_t constantFlows);
+    /// Records how many flows the OpenFlow table of a CFG node can take:
+    /// 'formula' in terms of the entries of its P4 table, at most
+    /// 'entries' of them as 'entriesFrom' says, and so 'worstCase'.
+    void addFlows(cstring name, size_t id, cstring formula, size_t entries,
+                  cstring entriesFrom, size_t worstCase);
+    /// Records a property of the whole program.
+    void add(cstring name, size_t value);
+    void write(std::ostream& out) const;
+};
+
+}  // namespace OFP4
+
+#endif  /* _EXTENSIONS_OFP4_STATS_H_ */
@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+# Copyright 2022 Vmware, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#    http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Checks the flows that --stats estimates for tests/range.p4, and the
+   tables that --max-flows names when the estimate is over budget.  The
+   16-bit ranges of PortAcl and SrcAcl take 30 flows per entry, and each
+   table's default action takes one more.  PortAcl has 3 constant
+   entries and SrcAcl has a size of 100.  Invoked with the compiler and
+   the P4 program.
+"""
+
+import json
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+
+# Flows of each table: (formula, entries, where they come from, worst case).
+EXPECTED = {
+    "PIngress.PortAcl": ("30 * entries + 1", 3, "const entries", 91),
+    "PIngress.SrcAcl": ("30 * entries + 1", 100, "size", 3001),
+}
+
+# Drop and output at the end of egress, and multicast group 0.
+FIXED_FLOWS = 3
+# One flow clones the packet to the ports of each multicast group.
+FLOWS_PER_MULTICAST_GROUP = 1
+
+
+def check(condition, message):
+    if not condition:
+        print("FAILED:", message, file=sys.stderr)
+        sys.exit(1)
+
+
+def main(argv):
+    if len(argv) != 3:
+        print("usage:", argv[0], "compiler file.p4", file=sys.stderr)
+        sys.exit(1)
+    compiler, p4file = argv[1], argv[2]
+    tmpdir = tempfile.mkdtemp(dir=".")
+    try:
+        output = os.path.join(tmpdir, "program.dl")
+        stats = os.path.join(tmpdir, "program.json")
+        args = [compiler, "-o", output, "--stats", stats, p4file]
+        print(" ".join(args))
+        subprocess.run(args, check=True)
+        with open(stats) as f:
+            result = json.load(f)
+
+        args = [compiler, "-o", output, "--max-flows", "1000", p4file]
+        print(" ".join(args))
+        over = subprocess.run(args, stderr=subprocess.PIPE, universal_newlines=True)
+    finally:
+        shutil.rmtree(tmpdir)
+
+    flows = result["flows"]
+    program = result["program"]
+    names = [node["name"] for node in flows]
+    check(all(names), "unnamed nodes in %s" % names)
+    check(len(set(names)) == len(names), "nodes with the same name in %s" % names)
+    for name, (formula, entries, entries_from, worst_case) in EXPECTED.items():
+        nodes = [node for node in flows if node["name"] == name]
+        check(len(nodes) == 1, "no single estimate for %s in %s" % (name, names))
+        node = nodes[0]
+        actual = (node["formula"], node["entries"], node["entries_from"], node["worst_case"])
+        check(actual == (formula, entries, entries_from, worst_case),
+              "%s: expected %s, got %s" % (name, (formula, entries, entries_from, worst_case),
+                                           actual))
+    for node in flows:
+        if node["name"] not in EXPECTED:
+            check(node["entries_from"] == "no key" and node["entries"] == 0,
+                  "%s: unexpected entries %d from %s" %
+                  (node["name"], node["entries"], node["entries_from"]))
+    check(any(name == "PEgress exit" for name in names),
+          "no estimate named after the end of egress in %s" % names)
+
+    check(program["fixed_flows"] == FIXED_FLOWS,
+          "fixed_flows is %d, expected %d" % (program["fixed_flows"], FIXED_FLOWS))
+    check(program["flows_per_multicast_group"] == FLOWS_PER_MULTICAST_GROUP,
+          "flows_per_multicast_group is %d, expected %d" %
+          (program["flows_per_multicast_group"], FLOWS_PER_MULTICAST_GROUP))
+    total = program["fixed_flows"] + sum(node["worst_case"] for node in flows)
+    check(program["worst_case_flows"] == total,
+          "worst_case_flows is %d, the estimates add up to %d" %
+          (program["worst_case_flows"], total))
+
+    # 3001 flows for SrcAcl alone are over the budget, and it comes first.
+    check(over.returncode != 0, "--max-flows 1000 did not fail")
+    check("more than --max-flows 1000" in over.stderr, "unexpected error: %s" % over.stderr)
+    largest = over.stderr.split("the largest tables are ", 1)[-1]
+    check(largest.startswith("PIngress.SrcAcl: 30 * entries + 1 = 3001 with 100 entries (size), "
+                             "PIngress.PortAcl: 30 * entries + 1 = 91 with 3 entries"),
+          "unexpected largest tables: %s" % largest)
+    print("PASSED")
+
+
+if __name__ == "__main__":
+    main(sys.argv)
@@ -0,0 +1,138 @@
+/*
+Copyright 2022 VMware, Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/// Tests OFP4::Compiler: compiles a program for of_model.p4 twice without
+/// the preprocessor and twice with it, through one Compiler, and checks
+/// that each compilation produces the same DDlog as p4c-of.
+///
+/// Usage: test-libofp4 P4C-OF PROGRAM.P4
+/// where PROGRAM.P4 includes only <core.p4> and <of_model.p4>.
+
+#include <unistd.h>
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "lib/crash.h"
+#include "lib/gc.h"
+#include "libofp4.h"
+
+static int failures = 0;
+
+static void check(bool ok, const std::string& what) {
+    if (!ok) {
+        std::cerr << "FAIL: " << what << std::endl;
+        failures++;
+    }
+}
+
+static bool readFile(const std::string& path, std::string& text) {
+    std::ifstream in(path);
+    if (!in)
+        return false;
+    std::stringstream buffer;
+    buffer << in.rdbuf();
+    text = buffer.str();
+    return true;
+}
+
+/// Compiles 'source', named 'name', with 'compiler', and checks that the
+/// result is 'expected'.  Quoted includes resolve against 'includeDir'.
+static void checkCompile(OFP4::Compiler& compiler, const std::string& source,
+                         const std::string& name, const std::string& expected,
+                         const std::string& what, const std::string& includeDir = "") {
+    auto result = compiler.compileSource(source, name, includeDir);
+    check(result.success, what + " succeeds");
+    if (!result.success)
+        std::cerr << result.diagnostics;
+    check(result.ddlog == expected, what + " produces the same DDlog as p4c-of");
+}
+
+int main(int argc, char* const argv[]) {
+    setup_gc_logging();
+    setup_signals();
+
+    if (argc != 3) {
+        std::cerr << "usage: " << argv[0] << " P4C-OF PROGRAM.P4" << std::endl;
+        return 2;
+    }
+    std::string compilerPath = argv[1];
+    std::string programPath = argv[2];
+
+    std::string source;
+    if (!readFile(programPath, source)) {
+        std::cerr << programPath << ": cannot read" << std::endl;
+        return 2;
+    }
+
+    // The shell that runs the preprocessor must see the name of this
+    // directory as one argument.
+    char dir[] = "/tmp/test-libofp4 it's-XXXXXX";
+    if (!mkdtemp(dir)) {
+        std::cerr << "cannot create a temporary directory" << std::endl;
+        return 2;
+    }
+    std::string expectedPath = std::string(dir) + "/expected.dl";
+    std::string command = compilerPath + " -o \"" + expectedPath + "\" " + programPath;
+    std::string expected;
+    if (std::system(command.c_str()) != 0 || !readFile(expectedPath, expected)) {
+        std::cerr << command << ": failed" << std::endl;
+        return 2;
+    }
+    unlink(expectedPath.c_str());
+
+    OFP4::Compiler compiler;
+
+    // The architecture is preprocessed once, for the first compilation.
+    checkCompile(compiler, source, programPath, expected, "first compilation");
+    checkCompile(compiler, source, programPath, expected, "second compilation");
+    check(compiler.preprocessed() == 1, "the architecture is preprocessed once");
+
+    // A #define needs the preprocessor.  The quoted include resolves
+    // against the directory of 'name', not the temporary directory.
+    size_t slash = programPath.rfind('/');
+    std::string base = slash == std::string::npos ? programPath : programPath.substr(slash + 1);
+    std::string wrapperName = programPath.substr(0, programPath.size() - base.size()) +
+                              "wrapper.p4";
+    std::string wrapper = "#define TEST_LIBOFP4 1\n#include \"" + base + "\"\n";
+    checkCompile(compiler, wrapper, wrapperName, expected, "first preprocessed compilation");
+    checkCompile(compiler, wrapper, wrapperName, expected, "second preprocessed compilation");
+    check(compiler.preprocessed() == 3, "each preprocessed source is preprocessed once");
+
+    // A quoted include in a directory that the shell would split.
+    std::string copyPath = std::string(dir) + "/" + base;
+    {
+        std::ofstream copy(copyPath);
+        copy << source;
+    }
+    checkCompile(compiler, wrapper, "wrapper.p4", expected, "compilation with includeDir",
+                 dir);
+    unlink(copyPath.c_str());
+    rmdir(dir);
+
+    // Diagnostics name the source, not the temporary file.
+    auto result = compiler.compileSource("#define X 1\nthis is not P4;\n", "broken.p4");
+    check(!result.success, "a syntax error fails");
+    check(result.diagnostics.find("broken.p4") != std::string::npos &&
+          result.diagnostics.find("libofp4-") == std::string::npos,
+          "diagnostics name the source");
+
+    if (failures)
+        std::cerr << failures << " checks failed" << std::endl;
+    return failures != 0;
+}
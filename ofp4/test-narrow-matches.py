@@ -0,0 +1,158 @@
+#!/usr/bin/env python3
+# Copyright 2022 Vmware, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#    http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Checks --narrow-matches and --megaflow-report on
+   tests/narrow_matches.p4, whose actions only set bits 0 and 2 of
+   meta.cls.  Compiles the program with and without --narrow-matches,
+   both times with a megaflow report.  The flows that match meta.cls
+   must match all of its bits without narrowing and only bits 0 and 2
+   with it, and the report must count those bits for the table of the
+   condition.  Invoked with the compiler and the P4 program.
+"""
+
+import json
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+
+REGISTER_SIZE = 32
+
+REGISTER_RE = re.compile(
+    r'function r_(\w+)\(ismatch: bool\): string \{\s*'
+    r'if \(ismatch\) "[^"]*" else "(x*)reg(\d+)(?:\[(\d+)(?:\.\.(\d+))?\])?"')
+
+# A match of an object, printed as ${r_name(true)}=value/mask.
+MATCH_RE = re.compile(r'\$\{r_(\w+)\(true\)\}=(?:\$\{[^}]*\}|[^/,\s"]+)(?:/([0-9a-fA-Fx]+))?')
+
+# The bits of meta.cls that the actions may set.
+WRITTEN = 0x05
+WIDTH = 8
+
+
+def compile_program(compiler, p4file, tmpdir, name, extra_args):
+    """Compiles 'p4file' and returns the DDlog output and the megaflow
+       report"""
+    output = os.path.join(tmpdir, name + ".dl")
+    report = os.path.join(tmpdir, name + ".json")
+    args = [compiler, "-o", output, "--megaflow-report", report] + extra_args + [p4file]
+    print(" ".join(args))
+    subprocess.run(args, check=True)
+    with open(output) as f:
+        ddlog = f.read()
+    with open(report) as f:
+        return ddlog, json.load(f)
+
+
+def find_register(ddlog, variable):
+    """Returns the name of the object named after 'variable', and its
+       register bundle, size and low bit"""
+    found = [m for m in REGISTER_RE.finditer(ddlog) if variable in m.group(1)]
+    check(len(found) == 1, "no single register for %s" % variable)
+    name, xs, bundle, low, _ = found[0].groups()
+    return name, int(bundle), REGISTER_SIZE << len(xs), int(low or 0)
+
+
+def match_masks(ddlog, name, size):
+    """Returns the masks of the matches of object 'name' in 'ddlog'"""
+    return [int(mask, 16) if mask else (1 << size) - 1
+            for n, mask in MATCH_RE.findall(ddlog) if n == name]
+
+
+def field_bits(bundle, size, low, value):
+    """Returns the bits of the 32-bit registers that the bits of 'value',
+       shifted to 'low' in register bundle 'bundle' of 'size' bits, are,
+       as the megaflow report names them"""
+    registers = size // REGISTER_SIZE
+    fields = {}
+    for bit in range(size):
+        if (value << low) >> bit & 1:
+            number = bundle * registers + registers - 1 - bit // REGISTER_SIZE
+            field = "reg%d" % number
+            fields[field] = fields.get(field, 0) | 1 << bit % REGISTER_SIZE
+    return fields
+
+
+def report_bits(table, fields):
+    """Returns the bits of 'fields' that 'table' of a report un-wildcards"""
+    bits = {}
+    for field, mask in fields.items():
+        value = int(table["fields"].get(field, "0"), 16) & mask
+        if value:
+            bits[field] = value
+    return bits
+
+
+def check_report(report, name, fields, expected):
+    """Checks that a table of 'report' un-wildcards the 'expected' bits of
+       'fields' and none other of them, and returns that table"""
+    for table in report["tables"]:
+        total = sum(bin(int(mask, 16)).count("1") for mask in table["fields"].values())
+        check(table["bits"] == total,
+              "table %s counts %d bits, its fields have %d" % (table["name"], table["bits"], total))
+    tables = [t for t in report["tables"] if report_bits(t, fields)]
+    check(len(tables) == 1, "%s: %d tables match %s" % (name, len(tables), fields))
+    bits = report_bits(tables[0], fields)
+    check(bits == expected, "%s: table %s un-wildcards %s, expected %s" %
+          (name, tables[0]["name"], bits, expected))
+    return tables[0]
+
+
+def check(condition, message):
+    if not condition:
+        print("FAILED:", message, file=sys.stderr)
+        sys.exit(1)
+
+
+def main(argv):
+    if len(argv) != 3:
+        print("usage:", argv[0], "compiler file.p4", file=sys.stderr)
+        sys.exit(1)
+    compiler, p4file = argv[1], argv[2]
+    tmpdir = tempfile.mkdtemp(dir=".")
+    try:
+        plain, plain_report = compile_program(compiler, p4file, tmpdir, "plain", [])
+        narrow, narrow_report = compile_program(compiler, p4file, tmpdir, "narrow",
+                                                ["--narrow-matches"])
+    finally:
+        shutil.rmtree(tmpdir)
+
+    name, bundle, size, low = find_register(narrow, "cls")
+    check(find_register(plain, "cls") == (name, bundle, size, low),
+          "--narrow-matches moved meta.cls")
+    full = ((1 << WIDTH) - 1) << low
+    masks = match_masks(plain, name, size)
+    check(masks and all(mask & full == full for mask in masks),
+          "without --narrow-matches, the masks of %s are %s" % (name, [hex(m) for m in masks]))
+    masks = match_masks(narrow, name, size)
+    check(masks and all(mask & full == WRITTEN << low for mask in masks),
+          "with --narrow-matches, the masks of %s are %s, expected %s" %
+          (name, [hex(m) for m in masks], hex(WRITTEN << low)))
+
+    fields = field_bits(bundle, size, low, (1 << WIDTH) - 1)
+    before = check_report(plain_report, "plain", fields, fields)
+    after = check_report(narrow_report, "narrow", fields,
+                         field_bits(bundle, size, low, WRITTEN))
+    check(after["name"] == before["name"], "the condition moved from table %s to %s" %
+          (before["name"], after["name"]))
+    check(before["bits"] - after["bits"] == WIDTH - bin(WRITTEN).count("1"),
+          "table %s goes from %d to %d bits" % (after["name"], before["bits"], after["bits"]))
+    print("PASSED")
+
+
+if __name__ == "__main__":
+    main(sys.argv)
@@ -0,0 +1,122 @@
+#!/usr/bin/env python3
+# Copyright 2022 Vmware, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#    http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Checks the registers that the register allocator gives to the local
+   variables of tests/register_sharing.p4.  Compiles the program with
+   --stats and reads the register of each object from the r_ functions
+   of the DDlog output: the variables with disjoint lifetimes must share
+   their bits, the variables that may be read before being written, in
+   ingress or egress, must not share theirs with anything, and the peak pressure must count the
+   shared bits once.  Invoked with the compiler and the P4 program.
+"""
+
+import json
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+
+REGISTER_SIZE = 32
+
+REGISTER_RE = re.compile(
+    r'function r_(\w+)\(ismatch: bool\): string \{\s*'
+    r'if \(ismatch\) "[^"]*" else "(x*)reg(\d+)(?:\[(\d+)(?:\.\.(\d+))?\])?"')
+
+
+def file_bit(bundle, size, bit):
+    """Returns the index in the register file of bit 'bit' of register
+       bundle 'bundle' of 'size' bits, as OFResources numbers them"""
+    registers = size // REGISTER_SIZE
+    reg = bundle * registers + registers - 1 - bit // REGISTER_SIZE
+    return reg * REGISTER_SIZE + bit % REGISTER_SIZE
+
+
+def read_registers(ddlog):
+    """Returns the register file bits of each object declared in 'ddlog',
+       rounded up to whole bytes like the allocator places them"""
+    registers = {}
+    for m in REGISTER_RE.finditer(ddlog):
+        name, xs, bundle, low, high = m.groups()
+        size = REGISTER_SIZE << len(xs)
+        if low is None:
+            low, high = 0, size - 1
+        else:
+            low = int(low)
+            high = int(high) if high is not None else low
+        width = (high - low + 1 + 7) // 8 * 8
+        registers[name] = frozenset(file_bit(int(bundle), size, bit)
+                                    for bit in range(low, low + width))
+    return registers
+
+
+def find(registers, variable):
+    """Returns the bits of the object named after 'variable'"""
+    names = [name for name in registers if variable in name]
+    check(len(names) == 1, "no single register for %s: %s" % (variable, sorted(registers)))
+    return registers[names[0]]
+
+
+def check(condition, message):
+    if not condition:
+        print("FAILED:", message, file=sys.stderr)
+        sys.exit(1)
+
+
+def main(argv):
+    if len(argv) != 3:
+        print("usage:", argv[0], "compiler file.p4", file=sys.stderr)
+        sys.exit(1)
+    compiler, p4file = argv[1], argv[2]
+    tmpdir = tempfile.mkdtemp(dir=".")
+    try:
+        output = os.path.join(tmpdir, "program.dl")
+        stats = os.path.join(tmpdir, "program.json")
+        args = [compiler, "-o", output, "--stats", stats, p4file]
+        print(" ".join(args))
+        subprocess.run(args, check=True)
+        with open(output) as f:
+            registers = read_registers(f.read())
+        with open(stats) as f:
+            program = json.load(f)["program"]
+    finally:
+        shutil.rmtree(tmpdir)
+
+    first = find(registers, "first_port")
+    second = find(registers, "second_port")
+    check(first == second, "first_port and second_port do not share their bits")
+    for variable in ["early_port", "maybe_class", "egress_early"]:
+        bits = find(registers, variable)
+        for name, other in registers.items():
+            check(variable in name or not bits & other,
+                  "%s shares its bits with %s" % (variable, name))
+
+    allocated = frozenset().union(*registers.values())
+    check(program["register_bits"] == len(allocated),
+          "register_bits is %d, the objects have %d bits" %
+          (program["register_bits"], len(allocated)))
+    check(sum(len(bits) for bits in registers.values()) == len(allocated) + len(first),
+          "only first_port and second_port should overlap")
+    # Reserved bits count as live everywhere, and first_port is live
+    # while Early runs, so the peak covers every allocated bit once.
+    check(program["peak_register_pressure_bits"] == len(allocated),
+          "peak register pressure is %d bits, expected %d" %
+          (program["peak_register_pressure_bits"], len(allocated)))
+    print("PASSED")
+
+
+if __name__ == "__main__":
+    main(sys.argv)
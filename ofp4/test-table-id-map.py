@@ -0,0 +1,110 @@
+#!/usr/bin/env python3
+# Copyright 2022 Vmware, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#    http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Checks that --table-id-map keeps OpenFlow table ids across
+   compilations.  Compiles tests/table_id_map.p4 twice with the same
+   map, which must not change the map or the output, and then with
+   -DEXTRA_TABLE, which adds a table: the other stages must keep their
+   ids, and the jump from the new table, whose id is after theirs, must
+   be reported.  Invoked with the compiler and the P4 program.
+"""
+
+import json
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+
+
+def read_map(path):
+    """Returns the table id of each stage key in the map at 'path'"""
+    ids = {}
+    with open(path) as f:
+        for line in f:
+            line = line.rstrip("\n")
+            if not line or line.startswith("#"):
+                continue
+            table_id, key = line.split(" ", 1)
+            ids[key] = int(table_id)
+    return ids
+
+
+def compile_program(compiler, p4file, tmpdir, name, extra_args):
+    """Compiles 'p4file' with the map in 'tmpdir' and returns the DDlog
+       output, the map that it leaves, and the statistics"""
+    output = os.path.join(tmpdir, name + ".dl")
+    stats = os.path.join(tmpdir, name + ".json")
+    args = [compiler, "-o", output, "--stats", stats,
+            "--table-id-map", os.path.join(tmpdir, "ids.map")] + extra_args + [p4file]
+    print(" ".join(args))
+    subprocess.run(args, check=True)
+    with open(output) as f:
+        ddlog = f.read()
+    with open(stats) as f:
+        program = json.load(f)["program"]
+    return ddlog, read_map(os.path.join(tmpdir, "ids.map")), program
+
+
+def check(condition, message):
+    if not condition:
+        print("FAILED:", message, file=sys.stderr)
+        sys.exit(1)
+
+
+def main(argv):
+    if len(argv) != 3:
+        print("usage:", argv[0], "compiler file.p4", file=sys.stderr)
+        sys.exit(1)
+    compiler, p4file = argv[1], argv[2]
+    tmpdir = tempfile.mkdtemp(dir=".")
+    try:
+        first, ids, stats = compile_program(compiler, p4file, tmpdir, "first", [])
+        check(len(set(ids.values())) == len(ids), "table ids are not distinct: %s" % ids)
+        check(stats["backward_jumps"] == 0, "fresh ids make backward jumps")
+        check(any(key.endswith(" if meta.class != 0") for key in ids),
+              "conditions are not keyed by their source: %s" % ids)
+
+        second, again, _ = compile_program(compiler, p4file, tmpdir, "second", [])
+        check(again == ids, "recompiling changed the map: %s, then %s" % (ids, again))
+        check(second == first, "recompiling with the map changed the output")
+
+        _, extended, stats = compile_program(compiler, p4file, tmpdir, "extra",
+                                             ["-DEXTRA_TABLE"])
+        # Conditions are keyed by their source, not by its line, which
+        # the new table moves.  Other stages are keyed by their CFG node
+        # names, which adding a table may change.
+        stable = [key for key in ids
+                  if " table " in key or " if " in key or key.endswith(" exit")
+                  or key == "multicast"]
+        check(len(stable) >= 4, "too few stages with stable keys: %s" % ids)
+        for key in stable:
+            check(extended.get(key) == ids[key],
+                  "%s moved from table %d to %s" % (key, ids[key], extended.get(key)))
+        for key in set(ids) & set(extended):
+            check(extended[key] == ids[key],
+                  "%s moved from table %d to %d" % (key, ids[key], extended[key]))
+        new = [key for key in extended if key not in ids]
+        check(any("table Extra" in key for key in new), "no id for the new table: %s" % new)
+        check(not set(extended[key] for key in new) & set(ids.values()),
+              "new stages reuse ids: %s" % new)
+        check(stats["backward_jumps"] > 0, "the jump back from the new table is not reported")
+    finally:
+        shutil.rmtree(tmpdir)
+    print("PASSED")
+
+
+if __name__ == "__main__":
+    main(sys.argv)
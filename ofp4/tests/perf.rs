@@ -0,0 +1,433 @@
+//! Dataplane performance harness.  For every P4 program compiled into `ofp4`, starts OVS in a
+//! sandbox, installs the program through P4Runtime, and measures:
+//!
+//!    - The rate at which bulk P4Runtime writes turn into OpenFlow flows in the switch.
+//!
+//!    - How long `ofp4` takes to resynchronize the switch after ovs-vswitchd restarts.
+//!
+//!    - The cost of a packet in the pipeline: the OpenFlow tables it visits and the resubmits on
+//!      the way, and the time of an `ofproto/trace`.
+//!
+//!    - What the userspace datapath does with a burst of packets injected into a port: how many
+//!      it looked up, how many hit a megaflow, how many the ports transmitted, and how fast it
+//!      looked them up, from the datapath and port statistics before and after the burst.
+//!
+//! These take a while and need OVS, so they are ignored by default.  Run them with `make perf`,
+//! or `cargo test --release --test perf -- --ignored --nocapture`.  Environment variables:
+//!
+//!    - `OFP4_PERF_ENTRIES`: table entries to write (default 1000), in `OFP4_PERF_BATCH` entries
+//!      per write request (default 100).
+//!
+//!    - `OFP4_PERF_PACKETS`: packets per injected burst (default 1000).
+//!
+//!    - `OFP4_PERF_P4INFO`: colon-separated P4Info files of more programs to measure, e.g. ones
+//!      generated by `bench-of.py` and compiled in.
+//!
+//!    - `OFP4_PERF_JSON`: also write the results to this file.
+//!
+//! A program that `ofp4` was not built with is reported as skipped: add it to `P4` in the
+//! Makefile and import it in `ofp4dl.dl` to measure it.
+
+mod common;
+
+use anyhow::{anyhow, Result};
+use common::*;
+use p4ext::{MatchType, Table};
+use proto::p4info::P4Info;
+use proto::p4runtime::{
+    Action,
+    Action_Param,
+    Entity,
+    Entity_oneof_entity,
+    FieldMatch,
+    FieldMatch_Exact,
+    FieldMatch_LPM,
+    FieldMatch_Optional,
+    FieldMatch_Range,
+    FieldMatch_Ternary,
+    FieldMatch_oneof_field_match_type,
+    TableAction,
+    TableAction_oneof_type,
+    TableEntry,
+    Update,
+    Update_Type,
+    WriteRequest,
+    WriteRequest_Atomicity,
+};
+use proto::p4runtime_grpc::P4RuntimeClient;
+use protobuf::{Message, RepeatedField};
+use serde::Serialize;
+use std::collections::HashMap;
+use std::default::Default;
+use std::path::{Path, PathBuf};
+use std::time::{Duration, Instant};
+use tracing::info;
+
+fn env_usize(name: &str, default: usize) -> usize {
+    std::env::var(name).ok().and_then(|s| s.parse().ok()).unwrap_or(default)
+}
+
+/// Returns the P4Info files to measure: those next to the `.p4` files in this directory and in
+/// `tests/`, then those in `OFP4_PERF_P4INFO`.
+fn p4info_files() -> Result<Vec<PathBuf>> {
+    let base = Path::new(env!("CARGO_MANIFEST_DIR"));
+    let mut files = Vec::new();
+    for dir in [base.to_path_buf(), base.join("tests")] {
+        let mut found: Vec<PathBuf> = std::fs::read_dir(&dir)?
+            .filter_map(|entry| entry.ok().map(|e| e.path()))
+            .filter(|path| path.extension().map_or(false, |e| e == "p4"))
+            .map(|path| path.with_extension("p4info.bin"))
+            .filter(|path| path.exists())
+            .collect();
+        found.sort();
+        files.extend(found);
+    }
+    if let Ok(extra) = std::env::var("OFP4_PERF_P4INFO") {
+        files.extend(extra.split(':').filter(|s| !s.is_empty()).map(PathBuf::from));
+    }
+    Ok(files)
+}
+
+/// Returns the number of flows in br0.
+fn flow_count<P: AsRef<Path>>(tmp_dir: P) -> Result<usize> {
+    let output = ovs_command("ovs-ofctl", &tmp_dir).arg("dump-aggregate").arg("br0").run()?;
+    output.stdout.split_whitespace()
+        .find_map(|word| word.strip_prefix("flow_count="))
+        .and_then(|count| count.parse().ok())
+        .ok_or_else(|| anyhow!("cannot parse flow count from: {}", output.stdout))
+}
+
+/// Waits until the number of flows in br0 has not changed for a while, or `timeout` passes, and
+/// returns the number and the time of the last change, measured from `start`.
+fn wait_for_flows<P: AsRef<Path>>(tmp_dir: P, start: Instant, timeout: Duration)
+                                  -> Result<(usize, Duration)> {
+    let quiet = Duration::from_millis(500);
+    let mut count = flow_count(&tmp_dir)?;
+    let mut changed = start.elapsed();
+    while start.elapsed() - changed < quiet && start.elapsed() < timeout {
+        std::thread::sleep(Duration::from_millis(10));
+        let n = flow_count(&tmp_dir)?;
+        if n != count {
+            count = n;
+            changed = start.elapsed();
+        }
+    }
+    Ok((count, changed))
+}
+
+/// Returns `value` as a P4Runtime bytestring for a `bits`-bit field.
+fn bytes(value: u64, bits: i32) -> Vec<u8> {
+    let n = ((bits + 7) / 8) as usize;
+    let value = if bits < 64 { value & ((1u64 << bits) - 1) } else { value };
+    let mut result = vec![0; n];
+    for (i, byte) in result.iter_mut().rev().enumerate().take(8) {
+        *byte = (value >> (8 * i)) as u8;
+    }
+    result
+}
+
+/// Returns the `index`th of a series of distinct entries for `table`, which match exactly on
+/// every field, or `None` if `table` has a kind of match field that this cannot fill in.
+fn synthetic_entry(table: &Table, action: &p4ext::Action, index: u64) -> Option<TableEntry> {
+    use FieldMatch_oneof_field_match_type as FM;
+    let mut rest = index;
+    let mut fms = Vec::new();
+    for mf in &table.match_fields {
+        let value = bytes(rest, mf.bit_width);
+        rest = if mf.bit_width < 64 { rest >> mf.bit_width } else { 0 };
+        let all = bytes(u64::MAX, mf.bit_width);
+        let fm = match mf.match_type {
+            MatchType::Exact => FM::exact(FieldMatch_Exact { value, ..Default::default() }),
+            MatchType::Ternary => FM::ternary(FieldMatch_Ternary {
+                value, mask: all, ..Default::default()
+            }),
+            MatchType::LPM => FM::lpm(FieldMatch_LPM {
+                value, prefix_len: mf.bit_width, ..Default::default()
+            }),
+            MatchType::Optional => FM::optional(FieldMatch_Optional {
+                value, ..Default::default()
+            }),
+            MatchType::Range => FM::range(FieldMatch_Range {
+                low: value.clone(), high: value, ..Default::default()
+            }),
+            _ => return None,
+        };
+        fms.push(FieldMatch {
+            field_id: mf.preamble.id,
+            field_match_type: Some(fm),
+            ..Default::default()
+        });
+    }
+    if rest != 0 {
+        // Not enough key bits for this many distinct entries.
+        return None;
+    }
+
+    let params = action.params.iter()
+        .map(|p| Action_Param { param_id: p.preamble.id, value: bytes(1, p.bit_width),
+                                ..Default::default() })
+        .collect();
+    let action = Action {
+        action_id: action.preamble.id,
+        params: RepeatedField::from_vec(params),
+        ..Default::default()
+    };
+    Some(TableEntry {
+        table_id: table.preamble.id,
+        field_match: RepeatedField::from_vec(fms),
+        action: Some(TableAction {
+            field_type: Some(TableAction_oneof_type::action(action)),
+            ..Default::default()
+        }).into(),
+        priority: if table.has_priority() { 1 } else { 0 },
+        ..Default::default()
+    })
+}
+
+fn write_entries(client: &P4RuntimeClient, entries: Vec<TableEntry>) -> Result<()> {
+    let updates = entries.into_iter()
+        .map(|te| Update {
+            field_type: Update_Type::INSERT,
+            entity: Some(Entity {
+                entity: Some(Entity_oneof_entity::table_entry(te)),
+                ..Default::default()
+            }).into(),
+            ..Default::default()
+        })
+        .collect();
+    client.write(&WriteRequest {
+        device_id: DEVICE_ID,
+        election_id: Some(election_id()).into(),
+        updates: RepeatedField::from_vec(updates),
+        atomicity: WriteRequest_Atomicity::CONTINUE_ON_ERROR,
+        ..Default::default()
+    })?;
+    Ok(())
+}
+
+#[derive(Default, Serialize)]
+struct Measurements {
+    program: String,
+    skipped: Option<String>,
+    table: Option<String>,
+    entries: usize,
+    flows_before: usize,
+    flows_after: usize,
+    install_seconds: f64,
+    entries_per_second: f64,
+    flows_per_second: f64,
+    resync_seconds: Option<f64>,
+    resynced_flows: usize,
+    tables_visited: f64,
+    resubmits: f64,
+    trace_ms: f64,
+    /// Packets in the burst that the datapath looked up, and those that hit a megaflow.
+    datapath_packets: u64,
+    megaflow_hits: u64,
+    /// Packets that the bridge's ports transmitted because of the burst.
+    tx_packets: u64,
+    /// Packets that the datapath looked up per second, from the start of the injection until it
+    /// looked up the last one.  This includes starting `ovs-appctl`, so it is a lower bound.
+    datapath_packets_per_second: f64,
+}
+
+/// Returns the packets that the datapath has looked up so far, as (hits, misses).
+fn datapath_lookups(tmp_dir: &Path) -> Result<(u64, u64)> {
+    // A line like "  lookups: hit:10 missed:2 lost:0".
+    let output = ovs_command("ovs-appctl", tmp_dir).arg("dpctl/show").run()?;
+    let counter = |name: &str| output.stdout.split_whitespace()
+        .find_map(|word| word.strip_prefix(name))
+        .and_then(|n| n.parse::<u64>().ok());
+    match (counter("hit:"), counter("missed:")) {
+        (Some(hit), Some(missed)) => Ok((hit, missed)),
+        _ => Err(anyhow!("cannot parse datapath lookups from: {}", output.stdout))
+    }
+}
+
+/// Returns the packets that the ports of br0 have transmitted so far.
+fn tx_packets(tmp_dir: &Path) -> Result<u64> {
+    // Each port has a line like "           tx pkts=3, bytes=180, drop=0, errs=0, coll=0".
+    let output = ovs_command("ovs-ofctl", tmp_dir).args(["dump-ports", "br0"]).run()?;
+    Ok(output.stdout.lines()
+       .filter_map(|line| line.trim_start().strip_prefix("tx pkts="))
+       .filter_map(|rest| rest.split(',').next()?.parse::<u64>().ok())
+       .sum())
+}
+
+/// Writes `entries` entries, in batches of `batch`, to the first table that accepts them.
+fn measure_install(p4info: &P4Info, client: &P4RuntimeClient, tmp_dir: &Path,
+                   entries: usize, batch: usize, m: &mut Measurements) -> Result<()> {
+    let actions: HashMap<u32, p4ext::Action> = p4info.get_actions().iter()
+        .map(|a| (a.get_preamble().id, a.into()))
+        .collect();
+    m.flows_before = flow_count(tmp_dir)?;
+    for t in p4info.get_tables().iter().filter(|t| !t.is_const_table) {
+        let table = Table::new_from_proto(t, &actions);
+        let action = match table.entry_actions().next() {
+            Some(ar) => ar.action.clone(),
+            None => continue,
+        };
+        let generated: Option<Vec<TableEntry>> = (0..entries as u64)
+            .map(|i| synthetic_entry(&table, &action, i))
+            .collect();
+        let generated = match generated {
+            Some(generated) => generated,
+            None => continue,
+        };
+
+        let start = Instant::now();
+        let mut ok = true;
+        for chunk in generated.chunks(batch.max(1)) {
+            if let Err(e) = write_entries(client, chunk.to_vec()) {
+                info!("{}: write failed ({e}), trying the next table", table.preamble.name);
+                ok = false;
+                break;
+            }
+        }
+        if !ok {
+            continue;
+        }
+        let (count, elapsed) = wait_for_flows(tmp_dir, start, Duration::from_secs(60))?;
+        let seconds = elapsed.as_secs_f64().max(1e-6);
+        m.table = Some(table.preamble.name.clone());
+        m.entries = entries;
+        m.flows_after = count;
+        m.install_seconds = seconds;
+        m.entries_per_second = entries as f64 / seconds;
+        m.flows_per_second = count.saturating_sub(m.flows_before) as f64 / seconds;
+        return Ok(());
+    }
+    m.flows_after = m.flows_before;
+    info!("no table accepted synthetic entries");
+    Ok(())
+}
+
+/// Restarts ovs-vswitchd, which loses its flows, and times how long `ofp4` takes to reconnect and
+/// put them back.
+fn measure_resync(tmp_dir: &Path, m: &mut Measurements) -> Result<()> {
+    let expected = flow_count(tmp_dir)?;
+    ovs_command("ovs-appctl", tmp_dir).args(["-t", "ovs-vswitchd", "exit"]).run()?;
+    std::thread::sleep(Duration::from_millis(100));
+    let start = Instant::now();
+    start_vswitchd(tmp_dir)?;
+    let timeout = Duration::from_secs(60);
+    while start.elapsed() < timeout {
+        if flow_count(tmp_dir).unwrap_or(0) >= expected {
+            m.resync_seconds = Some(start.elapsed().as_secs_f64());
+            break;
+        }
+        std::thread::sleep(Duration::from_millis(10));
+    }
+    m.resynced_flows = flow_count(tmp_dir)?;
+    Ok(())
+}
+
+/// Traces a packet from each port and injects a burst of packets into port 1.
+fn measure_packets(tmp_dir: &Path, packets: usize, m: &mut Measurements) -> Result<()> {
+    let mut traces = 0;
+    let mut elapsed = Duration::default();
+    for port in 1..=4 {
+        let start = Instant::now();
+        let (output, _) = trace_flow(tmp_dir, [format!("in_port=p{port}")])?;
+        elapsed += start.elapsed();
+        traces += 1;
+        // Each lookup is a line like " 3. reg0=0x1, priority 32768".
+        m.tables_visited += output.lines()
+            .filter(|line| {
+                let line = line.trim_start();
+                line.split_once(". ").map_or(false, |(n, _)| n.parse::<u32>().is_ok())
+            })
+            .count() as f64;
+        m.resubmits += output.matches("resubmit(").count() as f64;
+    }
+    m.tables_visited /= traces as f64;
+    m.resubmits /= traces as f64;
+    m.trace_ms = elapsed.as_secs_f64() * 1000.0 / traces as f64;
+
+    // The sandbox's ports are dummies, so an external traffic generator cannot reach them.
+    // Injecting a burst through netdev-dummy exercises the userspace datapath instead: the first
+    // packet goes through the OpenFlow pipeline and the others should hit its megaflow.  The
+    // datapath processes the packets after ovs-appctl queues them, so count what it did from its
+    // statistics instead of timing ovs-appctl.
+    let packet = format!("ffffffffffff0000000000011234{}", "00".repeat(46));
+    let mut command = ovs_command("ovs-appctl", tmp_dir);
+    command.args(["netdev-dummy/receive", "p1"]);
+    for _ in 0..packets {
+        command.arg(&packet);
+    }
+    let (hits_before, misses_before) = datapath_lookups(tmp_dir)?;
+    let tx_before = tx_packets(tmp_dir)?;
+    let start = Instant::now();
+    command.run()?;
+    let timeout = Duration::from_secs(10);
+    let mut elapsed = start.elapsed();
+    loop {
+        let (hits, misses) = datapath_lookups(tmp_dir)?;
+        let looked_up = (hits + misses).saturating_sub(hits_before + misses_before);
+        if looked_up > m.datapath_packets {
+            elapsed = start.elapsed();
+        }
+        m.datapath_packets = looked_up;
+        m.megaflow_hits = hits.saturating_sub(hits_before);
+        if looked_up >= packets as u64 || start.elapsed() > timeout {
+            break;
+        }
+        std::thread::sleep(Duration::from_millis(1));
+    }
+    m.tx_packets = tx_packets(tmp_dir)?.saturating_sub(tx_before);
+    m.datapath_packets_per_second = m.datapath_packets as f64 / elapsed.as_secs_f64().max(1e-6);
+    Ok(())
+}
+
+fn print_results(results: &[Measurements]) {
+    println!("{:<24} {:>8} {:>10} {:>12} {:>10} {:>8} {:>10} {:>10} {:>10} {:>10} {:>10} {:>12}",
+             "program", "entries", "flows", "entries/s", "resync_s", "tables", "resubmits",
+             "trace_ms", "dp_pkts", "dp_hits", "tx_pkts", "dp_pkts/s");
+    for m in results {
+        if let Some(reason) = &m.skipped {
+            println!("{:<24} skipped: {reason}", m.program);
+            continue;
+        }
+        let resync = m.resync_seconds.map_or("timeout".into(), |s| format!("{s:.3}"));
+        println!("{:<24} {:>8} {:>10} {:>12.0} {:>10} {:>8.1} {:>10.1} {:>10.2} {:>10} {:>10} {:>10} {:>12.0}",
+                 m.program, m.entries, m.flows_after, m.entries_per_second, resync,
+                 m.tables_visited, m.resubmits, m.trace_ms, m.datapath_packets, m.megaflow_hits,
+                 m.tx_packets, m.datapath_packets_per_second);
+    }
+}
+
+#[tokio::test]
+#[ignore]
+async fn perf() -> Result<()> {
+    let entries = env_usize("OFP4_PERF_ENTRIES", 1000);
+    let batch = env_usize("OFP4_PERF_BATCH", 100);
+    let packets = env_usize("OFP4_PERF_PACKETS", 1000);
+
+    let mut results = Vec::new();
+    for file in p4info_files()? {
+        let mut m = Measurements {
+            program: file.file_name().unwrap().to_string_lossy()
+                .trim_end_matches(".p4info.bin").into(),
+            ..Default::default()
+        };
+        let p4info: P4Info = Message::parse_from_bytes(&std::fs::read(&file)?)?;
+        let (_cleanup, tmp_dir, client) = match start_ofp4(p4info.clone()).await {
+            Ok(started) => started,
+            Err(e) => {
+                m.skipped = Some(format!("{e}"));
+                results.push(m);
+                continue;
+            }
+        };
+        measure_install(&p4info, &client, &tmp_dir, entries, batch, &mut m)?;
+        measure_packets(&tmp_dir, packets, &mut m)?;
+        measure_resync(&tmp_dir, &mut m)?;
+        results.push(m);
+    }
+
+    print_results(&results);
+    if let Ok(file) = std::env::var("OFP4_PERF_JSON") {
+        std::fs::write(file, serde_json::to_string_pretty(&results)?)?;
+    }
+    Ok(())
+}
@@ -74,6 +74,7 @@ pub mod ofpbuf;
 pub mod ofp_bundle;
 pub mod ofp_errors;
 pub mod ofp_flow;
+pub mod ofp_group;
 pub mod ofp_msgs;
 pub mod ofp_print;
 pub mod ofp_protocol;
@@ -27,8 +27,9 @@ use super::ds::Ds;
 use std::error;
 use std::ffi;
 use std::fmt;
+use std::mem;
 use std::os::raw;
-use std::ptr::{null, null_mut};
+use std::ptr::{self, null, null_mut};
 
 use anyhow::Result;
 
@@ -78,6 +79,196 @@ impl fmt::Display for FlowModParseError {
 
 impl error::Error for FlowModParseError {}
 
+#[derive(Debug)]
+pub struct FlowModBuildError(pub String);
+
+impl fmt::Display for FlowModBuildError {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        write!(f, "{}", self.0)
+    }
+}
+
+impl error::Error for FlowModBuildError {}
+
+/// A value and mask for an OVS field, e.g. "reg0" or "eth_src", for [`FlowMod::new`].  `value`
+/// and `mask` hold the field in their low-order bits.
+pub struct FieldValue<'a> {
+    pub field: &'a str,
+    pub value: u128,
+    pub mask: u128
+}
+
+/// Bits `ofs` through `ofs + n_bits - 1` of an OVS field.
+pub struct Subfield<'a> {
+    pub field: &'a str,
+    pub ofs: u16,
+    pub n_bits: u16
+}
+
+/// An action for [`FlowMod::new`].  The actions between `CloneBegin` and the matching `CloneEnd`
+/// are nested inside a `clone` action.
+pub enum FlowAction<'a> {
+    SetField(FieldValue<'a>),
+    Move { src: Subfield<'a>, dst: Subfield<'a> },
+    Resubmit(u8),
+    GotoTable(u8),
+    Output(u16),
+    OutputField(Subfield<'a>),
+    StripVlan,
+    CloneBegin,
+    CloneEnd
+}
+
+// These mirror the layout of the corresponding structs in OVS's ofp-actions.h.  OVS pads them
+// with anonymous unions, which bindgen makes awkward to use.
+#[repr(C)]
+struct OfpactHeader {
+    type_: u8,
+    raw: u8,
+    len: u16
+}
+
+#[repr(C)]
+struct OfpactResubmit {
+    ofpact: OfpactHeader,
+    in_port: u16,
+    table_id: u8,
+    with_ct_orig: bool
+}
+
+#[repr(C)]
+struct OfpactGotoTable {
+    ofpact: OfpactHeader,
+    table_id: u8
+}
+
+#[repr(C)]
+struct OfpactOutput {
+    ofpact: OfpactHeader,
+    port: u16,
+    max_len: u16
+}
+
+#[repr(C)]
+struct OfpactOutputReg {
+    ofpact: OfpactHeader,
+    max_len: u16,
+    src: sys::mf_subfield
+}
+
+#[repr(C)]
+struct OfpactRegMove {
+    ofpact: OfpactHeader,
+    src: sys::mf_subfield,
+    dst: sys::mf_subfield
+}
+
+const OFPACT_ALIGNTO: usize = 8;
+const OFPP_IN_PORT: u16 = 0xfff8;
+const OFPP_ANY: u16 = 0xffff;
+const OFPG_ANY: u32 = 0xffffffff;
+
+/// Appends an action of type `T` to `ofpacts` and returns it.  OVS initializes the header and
+/// zeros the rest.
+unsafe fn put_ofpact<T>(ofpacts: &mut sys::ofpbuf, type_: sys::ofpact_type) -> *mut T {
+    let len = (mem::size_of::<T>() + OFPACT_ALIGNTO - 1) / OFPACT_ALIGNTO * OFPACT_ALIGNTO;
+    sys::ofpact_put(ofpacts as *mut _, type_, len as _) as *mut T
+}
+
+fn field_from_name(name: &str) -> Result<*const sys::mf_field> {
+    let cname = match ffi::CString::new(name) {
+        Ok(cs) => cs,
+        Err(_) => Err(FlowModBuildError(format!("{name}: unexpected NUL in field name")))?
+    };
+    let mf = unsafe { sys::mf_from_name(cname.as_ptr()) };
+    if mf.is_null() {
+        Err(FlowModBuildError(format!("{name}: unknown field")))?
+    }
+    Ok(mf)
+}
+
+/// Converts the low-order bytes of `x` into a value for `mf`, in network byte order.
+unsafe fn field_value(mf: *const sys::mf_field, x: u128) -> Result<sys::mf_value> {
+    let n_bytes = (*mf).n_bytes as usize;
+    if n_bytes > mem::size_of::<u128>() {
+        let name = ffi::CStr::from_ptr((*mf).name).to_string_lossy();
+        Err(FlowModBuildError(format!("{name}: fields wider than 128 bits are not supported")))?
+    }
+    let mut value: sys::mf_value = mem::zeroed();
+    let bytes = x.to_be_bytes();
+    ptr::copy_nonoverlapping(bytes[bytes.len() - n_bytes..].as_ptr(),
+                             &mut value as *mut _ as *mut u8, n_bytes);
+    Ok(value)
+}
+
+fn subfield(sf: &Subfield) -> Result<sys::mf_subfield> {
+    Ok(sys::mf_subfield { field: field_from_name(sf.field)?, ofs: sf.ofs as _, n_bits: sf.n_bits as _ })
+}
+
+unsafe fn put_actions(actions: &[FlowAction], ofpacts: &mut sys::ofpbuf) -> Result<()> {
+    // Offsets of the enclosing clone actions; the buffer may move as it grows.
+    let mut clones = Vec::new();
+    for action in actions {
+        match action {
+            FlowAction::SetField(fv) => {
+                let mf = field_from_name(fv.field)?;
+                let value = field_value(mf, fv.value)?;
+                let mask = field_value(mf, fv.mask)?;
+                sys::ofpact_put_set_field(ofpacts as *mut _, mf,
+                                          &value as *const _ as *const raw::c_void,
+                                          &mask as *const _ as *const raw::c_void);
+            },
+            FlowAction::Move { src, dst } => {
+                let (src, dst) = (subfield(src)?, subfield(dst)?);
+                let a = put_ofpact::<OfpactRegMove>(ofpacts, sys::ofpact_type_OFPACT_REG_MOVE);
+                (*a).src = src;
+                (*a).dst = dst;
+            },
+            FlowAction::Resubmit(table_id) => {
+                let a = put_ofpact::<OfpactResubmit>(ofpacts, sys::ofpact_type_OFPACT_RESUBMIT);
+                (*a).in_port = OFPP_IN_PORT;
+                (*a).table_id = *table_id;
+            },
+            FlowAction::GotoTable(table_id) => {
+                let a = put_ofpact::<OfpactGotoTable>(ofpacts, sys::ofpact_type_OFPACT_GOTO_TABLE);
+                (*a).table_id = *table_id;
+            },
+            FlowAction::Output(port) => {
+                let a = put_ofpact::<OfpactOutput>(ofpacts, sys::ofpact_type_OFPACT_OUTPUT);
+                (*a).port = *port;
+            },
+            FlowAction::OutputField(src) => {
+                let src = subfield(src)?;
+                let a = put_ofpact::<OfpactOutputReg>(ofpacts, sys::ofpact_type_OFPACT_OUTPUT_REG);
+                (*a).max_len = u16::MAX;
+                (*a).src = src;
+            },
+            FlowAction::StripVlan => {
+                put_ofpact::<OfpactHeader>(ofpacts, sys::ofpact_type_OFPACT_STRIP_VLAN);
+            },
+            FlowAction::CloneBegin => {
+                let a = put_ofpact::<OfpactHeader>(ofpacts, sys::ofpact_type_OFPACT_CLONE);
+                clones.push(a as usize - ofpacts.data as usize);
+            },
+            FlowAction::CloneEnd => {
+                let offset = match clones.pop() {
+                    Some(offset) => offset,
+                    None => Err(FlowModBuildError("clone end without clone begin".into()))?
+                };
+                // ofpact_finish() sets the length of the clone to include everything
+                // appended since it began.
+                let clone = (ofpacts.data as *mut u8).add(offset) as *mut sys::ofpact;
+                ofpacts.header = clone as *mut raw::c_void;
+                sys::ofpact_finish(ofpacts as *mut _, clone);
+            }
+        }
+    }
+    if !clones.is_empty() {
+        Err(FlowModBuildError("clone begin without clone end".into()))?
+    }
+    Ok(())
+}
+
 unsafe impl Send for FlowMod {}
 unsafe impl Sync for FlowMod {}
 impl FlowMod {
@@ -106,6 +297,75 @@ impl FlowMod {
         }
     }
 
+    /// Constructs a flow_mod directly from its components, which avoids formatting and parsing
+    /// the flow as a string.  The caller must include the prerequisites of the matched fields in
+    /// `fields`.
+    pub fn new(table_id: u8, priority: u16, command: FlowModCommand,
+               fields: &[FieldValue], actions: &[FlowAction]) -> Result<FlowMod> {
+        unsafe {
+            let mut match_: sys::match_ = mem::zeroed();
+            sys::match_init_catchall(&mut match_ as *mut _);
+            for fv in fields {
+                let mf = field_from_name(fv.field)?;
+                let value = field_value(mf, fv.value)?;
+                let mask = field_value(mf, fv.mask)?;
+                let mut error: *mut raw::c_char = null_mut();
+                sys::mf_set(mf, &value as *const _, &mask as *const _, &mut match_ as *mut _,
+                            &mut error as *mut _);
+                if error != null_mut() {
+                    let s = ffi::CStr::from_ptr(error).to_string_lossy().into();
+                    libc::free(error as *mut ffi::c_void);
+                    Err(FlowModBuildError(s))?
+                }
+            }
+
+            let mut ofpacts: sys::ofpbuf = mem::zeroed();
+            sys::ofpbuf_init(&mut ofpacts as *mut _, 64);
+            if let Err(e) = put_actions(actions, &mut ofpacts) {
+                sys::ofpbuf_uninit(&mut ofpacts as *mut _);
+                return Err(e);
+            }
+
+            let mut fm: sys::ofputil_flow_mod = Default::default();
+            sys::minimatch_init(&mut fm.match_ as *mut _, &match_ as *const _);
+            fm.priority = priority;
+            fm.table_id = table_id;
+            fm.command = command.to_openflow() as _;
+            fm.buffer_id = u32::MAX;
+            fm.out_port = OFPP_ANY;
+            fm.out_group = OFPG_ANY;
+            fm.ofpacts_len = ofpacts.size as _;
+            fm.ofpacts = sys::ofpbuf_steal_data(&mut ofpacts as *mut _) as *mut _;
+            Ok(FlowMod(fm))
+        }
+    }
+
+    /// Sets the cookie that the flow gets when it is added, and that a strict delete or modify
+    /// must match.
+    pub fn set_cookie(&mut self, cookie: u64) {
+        self.0.cookie = cookie.to_be();
+        self.0.new_cookie = cookie.to_be();
+    }
+
+    /// Returns the cookie set by [`FlowMod::set_cookie`] or parsed from `cookie=`.
+    pub fn cookie(&self) -> u64 {
+        u64::from_be(self.0.new_cookie)
+    }
+
+    pub fn table_id(&self) -> u8 {
+        self.0.table_id
+    }
+
+    /// Returns the priority, match and actions of the flow that this adds, formatted the same way
+    /// as [`FlowStats::body`] formats a flow in the switch, so that the two can be compared.
+    pub fn body(&self) -> String {
+        unsafe {
+            let mut match_: sys::match_ = mem::zeroed();
+            sys::minimatch_expand(&self.0.match_ as *const _, &mut match_ as *mut _);
+            format_body(&match_, self.0.priority, self.0.ofpacts, self.0.ofpacts_len as usize)
+        }
+    }
+
     pub fn encode(&self, protocol: Protocol) -> Ofpbuf {
         unsafe {
             let b = sys::ofputil_encode_flow_mod(&self.0 as *const sys::ofputil_flow_mod,
@@ -123,6 +383,95 @@ impl FlowMod {
     }
 }
 
+/// Formats a flow's `match_` at `priority`, and its actions.
+unsafe fn format_body(match_: *const sys::match_, priority: u16, ofpacts: *const sys::ofpact,
+                      ofpacts_len: usize) -> String {
+    let mut ds = Ds::new();
+    sys::match_format(match_, null(), &mut ds.0 as *mut _, priority as raw::c_int);
+    sys::ds_put_cstr(&mut ds.0 as *mut _, b" actions=\0".as_ptr() as *const raw::c_char);
+    let params = sys::ofpact_format_params {
+        port_map: null(),
+        table_map: null(),
+        s: &mut ds.0 as *mut _
+    };
+    sys::ofpacts_format(ofpacts, ofpacts_len as _, &params as *const _);
+    ds.into()
+}
+
+/// A request for the flows whose cookie, masked by `cookie_mask`, is `cookie`, in table `table_id`
+/// or, if it is `ALL_TABLES`, in every table.
+pub struct FlowStatsRequest {
+    pub table_id: u8,
+    pub cookie: u64,
+    pub cookie_mask: u64
+}
+
+impl FlowStatsRequest {
+    pub const ALL_TABLES: u8 = 0xff;
+
+    pub fn encode(&self, protocol: Protocol) -> Ofpbuf {
+        unsafe {
+            let mut fsr: sys::ofputil_flow_stats_request = mem::zeroed();
+            fsr.aggregate = false;
+            sys::match_init_catchall(&mut fsr.match_ as *mut _);
+            fsr.cookie = self.cookie.to_be();
+            fsr.cookie_mask = self.cookie_mask.to_be();
+            fsr.out_port = OFPP_ANY;
+            fsr.out_group = OFPG_ANY;
+            fsr.table_id = self.table_id;
+            let b = sys::ofputil_encode_flow_stats_request(&fsr as *const _, protocol.into());
+            Ofpbuf::from_ptr(b)
+        }
+    }
+}
+
+/// A flow in a flow stats reply.
+#[derive(Clone, Debug)]
+pub struct FlowStats {
+    pub table_id: u8,
+    pub priority: u16,
+    pub cookie: u64,
+    pub packet_count: u64,
+    pub byte_count: u64,
+    /// The priority, match and actions, formatted like [`FlowMod::body`].
+    pub body: String
+}
+
+impl FlowStats {
+    /// Decodes all the flows in flow stats reply `msg`.  A reply to a large request is split
+    /// into several messages; see [`super::ofp_msgs::ofpmp_more`].
+    pub fn decode_reply(msg: &[u8]) -> Result<Vec<FlowStats>> {
+        let mut flows = Vec::new();
+        unsafe {
+            let mut b: sys::ofpbuf = mem::zeroed();
+            sys::ofpbuf_use_const(&mut b as *mut _, msg.as_ptr() as *const _, msg.len() as _);
+            let mut ofpacts: sys::ofpbuf = mem::zeroed();
+            sys::ofpbuf_init(&mut ofpacts as *mut _, 0);
+            let result = loop {
+                let mut fs: sys::ofputil_flow_stats = mem::zeroed();
+                let retval = sys::ofputil_decode_flow_stats_reply(&mut fs as *mut _, &mut b as *mut _,
+                                                                  false, &mut ofpacts as *mut _);
+                if retval == libc::EOF {
+                    break Ok(());
+                } else if retval != 0 {
+                    break ofp_errors::parse(retval as _);
+                }
+                flows.push(FlowStats {
+                    table_id: fs.table_id,
+                    priority: fs.priority,
+                    cookie: u64::from_be(fs.cookie),
+                    packet_count: fs.packet_count,
+                    byte_count: fs.byte_count,
+                    body: format_body(&fs.match_, fs.priority, fs.ofpacts, fs.ofpacts_len as usize)
+                });
+            };
+            sys::ofpbuf_uninit(&mut ofpacts as *mut _);
+            result?;
+        }
+        Ok(flows)
+    }
+}
+
 mod tests {
     #[test]
     fn it_works() {
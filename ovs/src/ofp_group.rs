@@ -0,0 +1,166 @@
+/*
+Copyright (c) 2022 VMware, Inc.
+SPDX-License-Identifier: MIT
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+ */
+
+//! OpenFlow group support.
+use super::sys;
+
+use super::ofpbuf::Ofpbuf;
+use super::ofp_errors;
+use super::ofp_protocol::{Protocols, Version};
+
+use std::error;
+use std::ffi;
+use std::fmt;
+use std::mem;
+use std::ptr::{null, null_mut};
+
+use anyhow::Result;
+
+pub struct GroupMod(sys::ofputil_group_mod);
+
+const OFPG_ALL: u32 = 0xfffffffc;
+
+pub enum GroupModCommand {
+    Add,
+    Modify,
+    /// Adds the group, or replaces it if it exists.  This is an Open vSwitch extension.
+    AddOrModify,
+    Delete,
+    /// Adds buckets to an existing group, at the position given by `command_bucket_id`.
+    /// This requires OpenFlow 1.5 or later.
+    InsertBucket,
+    /// Removes the bucket given by `command_bucket_id` from an existing group.  This requires
+    /// OpenFlow 1.5 or later.
+    RemoveBucket
+}
+
+#[derive(Debug)]
+pub struct GroupModParseError(pub String);
+
+impl fmt::Display for GroupModParseError {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        write!(f, "{}", self.0)
+    }
+}
+
+impl error::Error for GroupModParseError {}
+
+impl GroupModCommand {
+    fn to_openflow(&self) -> u16 {
+        (match self {
+            GroupModCommand::Add => sys::ofp11_group_mod_command_OFPGC11_ADD,
+            GroupModCommand::Modify => sys::ofp11_group_mod_command_OFPGC11_MODIFY,
+            GroupModCommand::AddOrModify => sys::ofp11_group_mod_command_OFPGC11_ADD_OR_MOD,
+            GroupModCommand::Delete => sys::ofp11_group_mod_command_OFPGC11_DELETE,
+            GroupModCommand::InsertBucket => sys::ofp15_group_mod_command_OFPGC15_INSERT_BUCKET,
+            GroupModCommand::RemoveBucket => sys::ofp15_group_mod_command_OFPGC15_REMOVE_BUCKET
+        }) as u16
+    }
+}
+
+impl Drop for GroupMod {
+    fn drop(&mut self) {
+        unsafe {
+            sys::ofputil_uninit_group_mod(&mut self.0 as *mut _);
+        }
+    }
+}
+
+unsafe impl Send for GroupMod {}
+unsafe impl Sync for GroupMod {}
+impl GroupMod {
+    /// Parses `s` in the syntax of `ovs-ofctl add-group`, e.g.
+    /// `group_id=1,type=select,bucket=actions=output:1,bucket=actions=output:2`.  A deletion only
+    /// needs `group_id=<id>` or `group_id=all`.  Inserting or removing buckets also takes
+    /// `command_bucket_id=<id>`, e.g. `group_id=1,command_bucket_id=last,bucket=bucket_id:3,actions=output:3`.
+    pub fn parse(s: &str, command: GroupModCommand) -> Result<(GroupMod, Protocols)> {
+        let s = match ffi::CString::new(s) {
+            Ok(cs) => cs,
+            Err(_) => Err(GroupModParseError("unexpected NUL in string".into()))?
+        };
+        let mut usable_protocols = Protocols::all().bits();
+        unsafe {
+            let mut gm: sys::ofputil_group_mod = mem::zeroed();
+            let error = sys::parse_ofp_group_mod_str(&mut gm as *mut _, command.to_openflow() as _,
+                                                     s.as_ptr(), null(), null(),
+                                                     &mut usable_protocols as *mut sys::ofputil_protocol);
+            if error == null_mut() {
+                Ok((GroupMod(gm), Protocols::from_bits_unchecked(usable_protocols)))
+            } else {
+                let cs = ffi::CStr::from_ptr(error).to_string_lossy().into();
+                libc::free(error as *mut ffi::c_void);
+                Err(GroupModParseError(cs))?
+            }
+        }
+    }
+
+    pub fn group_id(&self) -> u32 {
+        self.0.group_id
+    }
+
+    pub fn encode(&self, version: Version) -> Ofpbuf {
+        unsafe {
+            let b = sys::ofputil_encode_group_mod(version as sys::ofp_version,
+                                                  &self.0 as *const sys::ofputil_group_mod,
+                                                  null(), -1);
+            Ofpbuf::from_ptr(b)
+        }
+    }
+}
+
+/// A request for the descriptions of all the groups in the switch.
+pub struct GroupDescRequest;
+
+impl GroupDescRequest {
+    pub fn encode(version: Version) -> Ofpbuf {
+        unsafe {
+            let b = sys::ofputil_encode_group_desc_request(version as sys::ofp_version, OFPG_ALL);
+            Ofpbuf::from_ptr(b)
+        }
+    }
+
+    /// Decodes group description reply `msg` and returns the IDs of the groups that it describes.
+    /// A reply for many groups is split into several messages; see
+    /// [`super::ofp_msgs::ofpmp_more`].
+    pub fn decode_reply_ids(msg: &[u8]) -> Result<Vec<u32>> {
+        let mut ids = Vec::new();
+        if msg.is_empty() {
+            return Ok(ids);
+        }
+        let version = msg[0] as sys::ofp_version;
+        unsafe {
+            let mut b: sys::ofpbuf = mem::zeroed();
+            sys::ofpbuf_use_const(&mut b as *mut _, msg.as_ptr() as *const _, msg.len() as _);
+            loop {
+                let mut gd: sys::ofputil_group_desc = mem::zeroed();
+                let retval = sys::ofputil_decode_group_desc_reply(&mut gd as *mut _, &mut b as *mut _,
+                                                                  version);
+                if retval == libc::EOF {
+                    break;
+                } else if retval != 0 {
+                    ofp_errors::parse(retval as _)?;
+                }
+                ids.push(gd.group_id);
+                sys::ofputil_uninit_group_desc(&mut gd as *mut _);
+            }
+        }
+        Ok(ids)
+    }
+}
@@ -108,3 +108,13 @@ pub fn update_length(buf: &mut Ofpbuf) {
     }
 }
 
+/// Returns true if `oh` is a multipart reply that more replies follow.
+pub fn ofpmp_more(oh: &[u8]) -> bool {
+    unsafe { sys::ofpmp_more(oh.as_ptr() as *const sys::ofp_header) }
+}
+
+/// Returns the transaction ID of OpenFlow message `oh`.  A reply has the same transaction ID as its
+/// request.
+pub fn xid(oh: &[u8]) -> u32 {
+    u32::from_be_bytes([oh[4], oh[5], oh[6], oh[7]])
+}
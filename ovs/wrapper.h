@@ -1,8 +1,12 @@
 #include "ovs/include/openvswitch/hmap.h"
 #include "ovs/include/openvswitch/json.h"
+#include "ovs/include/openvswitch/match.h"
+#include "ovs/include/openvswitch/meta-flow.h"
+#include "ovs/include/openvswitch/ofp-actions.h"
 #include "ovs/include/openvswitch/ofp-bundle.h"
 #include "ovs/include/openvswitch/ofp-errors.h"
 #include "ovs/include/openvswitch/ofp-flow.h"
+#include "ovs/include/openvswitch/ofp-group.h"
 #include "ovs/include/openvswitch/ofp-msgs.h"
 #include "ovs/include/openvswitch/ofp-print.h"
 #include "ovs/include/openvswitch/ofpbuf.h"
@@ -837,11 +837,7 @@ impl TryFrom<&proto::p4runtime::TableAction> for TableAction {
 
     fn try_from(ta: &proto::p4runtime::TableAction) -> Result<Self> {
         match &ta.field_type {
-            Some(TableAction_oneof_type::action(a)) =>
-                Ok(TableAction {
-                    action_id: a.action_id,
-                    params: a.params.iter().map(|x| x.try_into()).collect::<Result<Vec<_>>>()?,
-                }),
+            Some(TableAction_oneof_type::action(a)) => a.try_into(),
             Some(_) => Err(Error(RpcStatusCode::UNIMPLEMENTED))
                 .context(format!("unsupported TableAction type {:?}", ta)),
             None => Err(Error(RpcStatusCode::INVALID_ARGUMENT))
@@ -849,18 +845,31 @@ impl TryFrom<&proto::p4runtime::TableAction> for TableAction {
         }
     }
 }
+impl TryFrom<&proto::p4runtime::Action> for TableAction {
+    type Error = anyhow::Error;
+
+    fn try_from(a: &proto::p4runtime::Action) -> Result<Self> {
+        Ok(TableAction {
+            action_id: a.action_id,
+            params: a.params.iter().map(|x| x.try_into()).collect::<Result<Vec<_>>>()?,
+        })
+    }
+}
+impl From<&TableAction> for proto::p4runtime::Action {
+    fn from(ta: &TableAction) -> proto::p4runtime::Action {
+        let (unknown_fields, cached_size) = Default::default();
+        proto::p4runtime::Action {
+            action_id: ta.action_id,
+            params: ta.params.iter().map(|param| param.into()).collect(),
+            unknown_fields, cached_size
+        }
+    }
+}
 impl From<&TableAction> for proto::p4runtime::TableAction {
     fn from(ta: &TableAction) -> proto::p4runtime::TableAction {
         let (unknown_fields, cached_size) = Default::default();
         proto::p4runtime::TableAction {
-            field_type: Some({
-                let (unknown_fields, cached_size) = Default::default();
-                TableAction_oneof_type::action(proto::p4runtime::Action {
-                    action_id: ta.action_id,
-                    params: ta.params.iter().map(|param| param.into()).collect(),
-                    unknown_fields, cached_size
-                })
-            }),
+            field_type: Some(TableAction_oneof_type::action(ta.into())),
             unknown_fields, cached_size
         }
     }
@@ -987,6 +996,44 @@ impl From<&TableEntry> for proto::p4runtime::TableEntry {
     }
 }
 
+/// Returns the `(low, high)` range that matches every value of a `bit_width`-bit field, which is
+/// the don't-care value of a range match.
+pub fn range_dont_care(bit_width: i32) -> (u128, u128) {
+    let high = if bit_width >= 128 { u128::MAX } else { (1u128 << bit_width) - 1 };
+    (0, high)
+}
+
+/// Returns the `(value, mask)` pairs of a `width`-bit field that together match the values from
+/// `lo` to `hi`, inclusive, so that a range match can become masked matches.  Each pair is the
+/// largest aligned block that starts at the lowest value not yet matched and ends at or before
+/// `hi`, so there are at most `2 * width - 2` of them (one for a 1-bit field).  An empty range, or
+/// one that does not fit in the field, has none.
+pub fn range_to_prefixes(lo: u128, hi: u128, width: u32) -> Vec<(u128, u128)> {
+    let (_, field) = range_dont_care(width as i32);
+    let mut result = Vec::new();
+    if lo > hi || hi > field {
+        return result;
+    }
+    let mut low = lo;
+    loop {
+        // The block of 2**bits values from `low`.
+        let mut bits = 0;
+        while bits < width {
+            let ones = field >> (width - (bits + 1));
+            if low & ones != 0 || hi - low < ones {
+                break;
+            }
+            bits += 1;
+        }
+        let ones = if bits == 0 { 0 } else { field >> (width - bits) };
+        result.push((low, field ^ ones));
+        if low | ones >= hi {
+            return result;
+        }
+        low = (low | ones) + 1;
+    }
+}
+
 #[cfg(feature = "ofp4")]
 use differential_datalog::record::{IntoRecord, Name, Record};
 
@@ -1025,7 +1072,10 @@ impl MatchField {
                         .context(format!("cannot use don't-care for exact-match")),
                     MatchType::LPM => Ok(Record::Tuple(vec![zero(), zero()])),
                     MatchType::Ternary => Ok(Record::Tuple(vec![zero(), zero()])),
-                    MatchType::Range => Ok(Record::Tuple(vec![zero(), self.bit_width.into_record()])),
+                    MatchType::Range => {
+                        let (low, high) = range_dont_care(self.bit_width);
+                        Ok(Record::Tuple(vec![low.into_record(), high.into_record()]))
+                    },
                     MatchType::Optional => Ok(Record::NamedStruct(Name::from("ddlog_std::None"), vec![])),
                     MatchType::Unspecified | MatchType::Other(_) => Ok(Record::Tuple(vec![])),
                 }
@@ -1050,39 +1100,48 @@ impl TableEntry {
         if table.has_priority() {
             values.push((Name::from("priority"), self.key.priority.into_record()));
         }
-        match &self.value.action {
-            Some(TableAction { action_id, params }) => {
-                // Find the ActionRef corresponding to 'action_id'.
-                let ar = match table.actions.iter().find(|ar| ar.action.preamble.id == *action_id) {
-                    Some(ar) => ar,
-                    None => return Err(Error(RpcStatusCode::NOT_FOUND)).context(format!("TableEntry {:?} references action not in table", self))
-                };
-
-                if ar.action.params.len() == 0 && table.entry_actions().count() == 1 {
-                    // This action doesn't have any parameters, and it's the only action.  Don't
-                    // include it in the output.
-                } else {
-                    let action_name = format!("{}Action{}", table_ddlog_name, ar.action.preamble.alias);
-                    let mut param_values: Vec<(Name, Record)> = Vec::new();
-                    for p in &ar.action.params {
-                        let arg = match params.iter().find(|arg| arg.param_id == p.preamble.id) {
-                            Some(arg) => arg,
-                            None => return Err(Error(RpcStatusCode::INVALID_ARGUMENT)).context(format!("table entry lacks argument for parameter {:?}", p))?
-                        };
-                        let record = Record::Int(arg.value.0.into());
-                        param_values.push((Name::Owned(p.preamble.name.clone()), record));
-                    }
-                    values.push((Name::from("action"),
-                                 Record::NamedStruct(Name::Owned(action_name), param_values)));
-                };
-            },
-            None => ()
+        if let Some(action) = &self.value.action {
+            if let Some(record) = action.to_record(table, table_ddlog_name)
+                .with_context(|| format!("TableEntry {:?}", self))? {
+                values.push((Name::from("action"), record));
+            }
         }
 
         Ok(Record::NamedStruct(Name::Owned(table_ddlog_name.into()), values))
     }
 }
 
+#[cfg(feature = "ofp4")]
+impl TableAction {
+    /// Converts this `TableAction`, for an entry in `table`, into a DDlog Record.  Returns `None`
+    /// if the table's only action has no parameters, because then the DDlog relation omits the
+    /// action.  `table_ddlog_name` is as for [`TableEntry::to_record`].
+    pub fn to_record(&self, table: &Table, table_ddlog_name: &str) -> Result<Option<Record>> {
+        // Find the ActionRef corresponding to 'action_id'.
+        let ar = match table.actions.iter().find(|ar| ar.action.preamble.id == self.action_id) {
+            Some(ar) => ar,
+            None => return Err(Error(RpcStatusCode::NOT_FOUND)).context(format!("action {} not in table", self.action_id))
+        };
+
+        if ar.action.params.len() == 0 && table.entry_actions().count() == 1 {
+            // This action doesn't have any parameters, and it's the only action.  Don't
+            // include it in the output.
+            return Ok(None);
+        }
+        let action_name = format!("{}Action{}", table_ddlog_name, ar.action.preamble.alias);
+        let mut param_values: Vec<(Name, Record)> = Vec::new();
+        for p in &ar.action.params {
+            let arg = match self.params.iter().find(|arg| arg.param_id == p.preamble.id) {
+                Some(arg) => arg,
+                None => return Err(Error(RpcStatusCode::INVALID_ARGUMENT)).context(format!("action lacks argument for parameter {:?}", p))?
+            };
+            let record = Record::Int(arg.value.0.into());
+            param_values.push((Name::Owned(p.preamble.name.clone()), record));
+        }
+        Ok(Some(Record::NamedStruct(Name::Owned(action_name), param_values)))
+    }
+}
+
 fn parse_type_name(pnto: Option<&p4types::P4NamedType>) -> Option<String> {
     pnto.map(|pnt| pnt.name.clone())
 }
@@ -106,3 +106,57 @@ async fn stream_channel() {
     );
     assert!(master_result.await.is_ok());
 }
+
+/// Returns true if `x` is in one of `prefixes`, checking that it is in at most one.
+fn in_prefixes(x: u128, prefixes: &[(u128, u128)]) -> bool {
+    let n = prefixes.iter().filter(|&&(value, mask)| x & mask == value).count();
+    assert!(n <= 1, "{} is in {} of {:?}", x, n, prefixes);
+    n == 1
+}
+
+#[test]
+fn range_to_prefixes_exhaustive() {
+    for width in 1..=8u32 {
+        let field = (1u128 << width) - 1;
+        let bound = if width == 1 { 1 } else { 2 * width as usize - 2 };
+        for lo in 0..=field {
+            for hi in 0..=field {
+                let prefixes = p4ext::range_to_prefixes(lo, hi, width);
+                assert!(prefixes.len() <= bound,
+                        "{lo}..{hi} in {width} bits: {} prefixes", prefixes.len());
+                for &(value, mask) in &prefixes {
+                    assert_eq!(value & !mask, 0, "{value:#x}/{mask:#x} has bits outside its mask");
+                    assert_eq!(mask & !field, 0, "{mask:#x} is wider than {width} bits");
+                    // A prefix mask: the ones are the most significant bits of the field.
+                    assert_eq!((field ^ mask) & ((field ^ mask) + 1), 0, "{mask:#x} is not a prefix");
+                }
+                for x in 0..=field {
+                    assert_eq!(in_prefixes(x, &prefixes), lo <= x && x <= hi,
+                               "{x} vs {lo}..{hi} in {width} bits: {prefixes:?}");
+                }
+            }
+        }
+    }
+}
+
+#[test]
+fn range_to_prefixes_wide() {
+    // Ranges that do not fit in the field, and empty ranges, match nothing.
+    assert!(p4ext::range_to_prefixes(0, 256, 8).is_empty());
+    assert!(p4ext::range_to_prefixes(5, 4, 8).is_empty());
+    assert_eq!(p4ext::range_to_prefixes(0, u128::MAX, 128), vec![(0, 0)]);
+    assert_eq!(p4ext::range_to_prefixes(u128::MAX, u128::MAX, 128), vec![(u128::MAX, u128::MAX)]);
+    assert_eq!(p4ext::range_to_prefixes(1, u128::MAX - 1, 128).len(), 2 * 128 - 2);
+}
+
+#[test]
+fn range_dont_care() {
+    for width in [1, 3, 8, 16, 32, 48, 64, 127, 128] {
+        let (low, high) = p4ext::range_dont_care(width);
+        assert_eq!(low, 0);
+        assert_eq!(high.count_ones(), width as u32);
+        assert_eq!(high.leading_zeros(), 128 - width as u32);
+        // The don't-care value becomes a single flow that matches any value.
+        assert_eq!(p4ext::range_to_prefixes(low, high, width as u32), vec![(0, 0)]);
+    }
+}